@@ -104,6 +104,7 @@ proc cr_bd_fractal_all_bd { srcset {parentCell ""} } {
   set aresetn [ create_bd_port -dir I -type rst aresetn ]
   set m_axis_tdata [ create_bd_port -dir O -from 23 -to 0 m_axis_tdata ]
   set m_axis_tlast [ create_bd_port -dir O m_axis_tlast ]
+  set m_axis_tready [ create_bd_port -dir I m_axis_tready ]
   set m_axis_tuser [ create_bd_port -dir O -from 0 -to 0 m_axis_tuser ]
   set m_axis_tvalid [ create_bd_port -dir O m_axis_tvalid ]
 
@@ -147,6 +148,7 @@ proc cr_bd_fractal_all_bd { srcset {parentCell ""} } {
   connect_bd_net -net Net1 [get_bd_ports aresetn] [get_bd_pins axi_vip_0/aresetn] [get_bd_pins fractal_0/aresetn]
   connect_bd_net -net fractal_0_m_axis_tdata [get_bd_pins fractal_0/m_axis_tdata] [get_bd_ports m_axis_tdata]
   connect_bd_net -net fractal_0_m_axis_tlast [get_bd_pins fractal_0/m_axis_tlast] [get_bd_ports m_axis_tlast]
+  connect_bd_net -net m_axis_tready_1 [get_bd_ports m_axis_tready] [get_bd_pins fractal_0/m_axis_tready]
   connect_bd_net -net fractal_0_m_axis_tuser [get_bd_pins fractal_0/m_axis_tuser] [get_bd_ports m_axis_tuser]
   connect_bd_net -net fractal_0_m_axis_tvalid [get_bd_pins fractal_0/m_axis_tvalid] [get_bd_ports m_axis_tvalid]
 
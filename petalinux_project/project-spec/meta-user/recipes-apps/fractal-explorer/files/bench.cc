@@ -0,0 +1,857 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cairo.h>
+
+extern "C" {
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#include <linux/videodev2.h>
+}
+
+#include "event_loop.h"
+#include "fractal.h"
+#include "fractal_engine.h"
+#include "itmap.h"
+#include "overlay.h"
+#include "snapshot.h"
+
+// Times the primitives the explorer spends its frames in, to catch regressions on the host and
+// on the board.
+//
+// A benchmark runs batches of operations, each batch long enough to be timed reliably, and the
+// time per operation is reported over a number of batches: median, mean, standard deviation and
+// range. Only the part of an operation that is the primitive is timed; a batch returns its time.
+
+using namespace std::chrono_literals;
+using namespace std::string_literals;
+
+// keeps results the compiler could otherwise drop
+static volatile std::uint64_t sink;
+
+struct benchmark {
+  std::string name;
+  const char* unit; // what one operation is
+  // runs `ops` operations and returns the time they took, or nothing if the benchmark cannot run
+  std::function<std::optional<std::chrono::nanoseconds>(std::uint64_t ops)> run;
+  std::uint64_t fixed_ops = 0; // a batch size to use instead of calibrating one
+};
+
+struct result {
+  std::string name;
+  const char* unit;
+  std::uint64_t ops; // in each batch
+  double median, mean, stddev, min, max; // ns per operation
+};
+
+template <typename F>
+static std::chrono::nanoseconds timed(F f) {
+  const auto start = std::chrono::steady_clock::now();
+  f();
+  return std::chrono::steady_clock::now() - start;
+}
+
+static std::optional<result> measure(const benchmark& b, std::size_t repetitions,
+                                     std::chrono::nanoseconds min_time) {
+  auto ops = b.fixed_ops;
+  if (ops == 0) {
+    // double the batch until it takes long enough, which also warms up
+    for (ops = 1;; ops *= 2) {
+      const auto t = b.run(ops);
+      if (!t) {
+        return std::nullopt;
+      }
+      if (*t >= min_time) {
+        break;
+      }
+    }
+  } else if (!b.run(ops)) {
+    return std::nullopt;
+  }
+
+  std::vector<double> samples;
+  for (std::size_t i = 0; i < repetitions; ++i) {
+    const auto t = b.run(ops);
+    if (!t) {
+      return std::nullopt;
+    }
+    samples.push_back(static_cast<double>(t->count()) / static_cast<double>(ops));
+  }
+
+  std::sort(samples.begin(), samples.end());
+  const auto n = samples.size();
+  const auto mean = std::accumulate(samples.begin(), samples.end(), 0.0) / n;
+  double var = 0.0;
+  for (const auto s : samples) {
+    var += (s - mean) * (s - mean);
+  }
+  return result{
+      b.name,
+      b.unit,
+      ops,
+      n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2.0,
+      mean,
+      n > 1 ? std::sqrt(var / (n - 1)) : 0.0,
+      samples.front(),
+      samples.back(),
+  };
+}
+
+static std::vector<benchmark> fix_benchmarks() {
+  // a spread of magnitudes and signs, as views and zoom steps have
+  static const auto values = [] {
+    std::vector<double> v(4096);
+    for (std::size_t i = 0; i < v.size(); ++i) {
+      v[i] = std::ldexp(static_cast<double>(i % 97) - 48.0, -static_cast<int>(i % 29)) / 7.0;
+    }
+    return v;
+  }();
+  static const auto fixed = [] {
+    std::vector<std::uint32_t> v(values.size());
+    std::transform(values.begin(), values.end(), v.begin(), fix<4>::double_to_fix);
+    return v;
+  }();
+
+  return {
+      {"fix/double_to_fix", "value",
+       [](std::uint64_t ops) -> std::optional<std::chrono::nanoseconds> {
+         std::uint32_t acc = 0;
+         const auto t = timed([&] {
+           for (std::uint64_t i = 0; i < ops; ++i) {
+             acc += fix<4>::double_to_fix(values[i % values.size()]);
+           }
+         });
+         sink = acc;
+         return t;
+       }},
+      {"fix/to_double", "value",
+       [](std::uint64_t ops) -> std::optional<std::chrono::nanoseconds> {
+         double acc = 0.0;
+         const auto t = timed([&] {
+           for (std::uint64_t i = 0; i < ops; ++i) {
+             acc += fix<4>{fixed[i % fixed.size()]}.to_double();
+           }
+         });
+         sink = static_cast<std::uint64_t>(acc);
+         return t;
+       }},
+  };
+}
+
+static std::vector<benchmark> kernel_benchmarks() {
+  constexpr std::uint32_t size = 128;
+
+  // Views of different iteration mixes: nearly every point escaping in a few iterations, the
+  // whole set of the default c with its mix of counts, and points that all reach the limit.
+  struct view {
+    const char* name;
+    double center_r, center_i, span, cr, ci;
+  };
+  static constexpr view views[] = {
+      {"escape", 0.0, 0.0, 14.0, -0.4, 0.6},
+      {"mixed", 0.0, 0.0, 3.0, -0.4, 0.6},
+      {"interior", 0.0, 0.0, 0.5, 0.0, 0.0},
+  };
+
+  std::vector<benchmark> benchmarks;
+  for (const auto& v : views) {
+    const auto step = v.span / size;
+    const auto p = make_fractal_params(
+        step * size / 2 - v.center_r, step * size / 2 + v.center_i, step, step, v.cr, v.ci);
+
+    benchmarks.push_back({
+        "kernel/scalar/"s + v.name,
+        "pixel",
+        [p](std::uint64_t ops) -> std::optional<std::chrono::nanoseconds> {
+          std::uint64_t acc = 0;
+          const auto t = timed([&] {
+            for (std::uint64_t i = 0; i < ops; ++i) {
+              const auto x = static_cast<std::uint32_t>(i % size);
+              const auto y = static_cast<std::uint32_t>(i / size % size);
+              acc += fractal_iterations(static_cast<std::int32_t>(-p.x0 + x * p.dx),
+                                        static_cast<std::int32_t>(-p.y0 + y * p.dy),
+                                        static_cast<std::int32_t>(p.cr),
+                                        static_cast<std::int32_t>(p.ci),
+                                        p.max_iterations);
+            }
+          });
+          sink = acc;
+          return t;
+        },
+    });
+
+    // whole blocks at a time, so the count is rounded up to one
+    benchmarks.push_back({
+        "kernel/vector/"s + v.name,
+        "pixel",
+        [p](std::uint64_t ops) -> std::optional<std::chrono::nanoseconds> {
+          std::vector<std::uint8_t> out(std::size_t{size} * size);
+          const auto blocks = std::max<std::uint64_t>(ops / out.size(), 1);
+          const auto t = timed([&] {
+            for (std::uint64_t i = 0; i < blocks; ++i) {
+              render_iterations(p, 0, 0, size, size, out.data(), size);
+            }
+          });
+          sink = out[out.size() / 2];
+          return t * ops / (blocks * out.size());
+        },
+    });
+  }
+  return benchmarks;
+}
+
+static std::vector<benchmark> itmap_benchmarks() {
+  constexpr std::uint32_t width = 1920;
+  constexpr std::uint32_t height = 1080;
+
+  // Maps as the recorder sees them, and the one that costs the encoder most: every third pixel
+  // far off its neighbours, so that the residual is a single literal between each pair that
+  // packs. Frames differ from the one before, for both predictors to be tried.
+  struct pattern {
+    const char* name;
+    std::function<std::uint8_t(std::uint32_t x, std::uint32_t y, std::uint64_t frame)> value;
+  };
+  static const pattern patterns[] = {
+      {"fractal",
+       [](std::uint32_t x, std::uint32_t y, std::uint64_t frame) {
+         static const auto counts = [] {
+           const auto step = 3.0 / width;
+           const auto p = make_fractal_params(1.5, step * height / 2, step, step, -0.4, 0.6);
+           std::vector<std::uint8_t> v(std::size_t{width} * height);
+           render_iterations(p, 0, 0, width, height, v.data(), width);
+           return v;
+         }();
+         return counts[std::size_t{y} * width + (x + frame) % width];
+       }},
+      {"worst",
+       [](std::uint32_t x, std::uint32_t y, std::uint64_t frame) {
+         static constexpr std::uint8_t scale[] = {100, 1, 1};
+         return static_cast<std::uint8_t>((y + frame) * scale[x % 3]);
+       }},
+  };
+
+  std::vector<benchmark> benchmarks;
+  for (const auto& p : patterns) {
+    // Only adding frames is timed; the stream is then decoded and compared with them.
+    benchmarks.push_back({
+        "itmap/encode/"s + p.name,
+        "frame",
+        [&p](std::uint64_t ops) -> std::optional<std::chrono::nanoseconds> {
+          const int fd = ::memfd_create("itmap-bench", MFD_CLOEXEC);
+          if (fd < 0) {
+            std::perror("memfd_create");
+            return std::nullopt;
+          }
+          const auto path = "/proc/self/fd/" + std::to_string(fd);
+
+          const auto frame = [&](std::uint64_t i) {
+            std::vector<std::uint8_t> v(std::size_t{width} * height);
+            for (std::uint32_t y = 0; y < height; ++y) {
+              for (std::uint32_t x = 0; x < width; ++x) {
+                v[std::size_t{y} * width + x] = p.value(x, y, i);
+              }
+            }
+            return v;
+          };
+
+          std::chrono::nanoseconds t{};
+          auto ok = true;
+          try {
+            {
+              itmap_encoder encoder{path.c_str(), width, height, 4};
+              for (std::uint64_t i = 0; i < ops; ++i) {
+                const auto v = frame(i);
+                itmap_frame_info info{};
+                info.sequence = i;
+                t += timed([&] { encoder.add_frame(v.data(), width, info); });
+              }
+            }
+
+            itmap_reader reader{path.c_str()};
+            std::vector<std::uint8_t> decoded(std::size_t{width} * height);
+            for (std::uint64_t i = 0; i < ops && ok; ++i) {
+              reader.decode(i, decoded.data(), width);
+              ok = decoded == frame(i);
+            }
+            if (!ok) {
+              std::cerr << "itmap/encode/" << p.name << ": frames decode differently"
+                        << std::endl;
+            }
+          } catch (const std::exception& e) {
+            std::cerr << "itmap/encode/" << p.name << ": " << e.what() << std::endl;
+            ok = false;
+          }
+          ::close(fd);
+          return ok ? std::optional{t} : std::nullopt;
+        },
+        8,
+    });
+  }
+  return benchmarks;
+}
+
+// A QOI decoder written from the specification, independently of the encoder, into RGBA. False
+// if the stream is cut short or not QOI.
+static bool decode_qoi(const std::vector<std::uint8_t>& in, std::uint32_t& width,
+                       std::uint32_t& height, std::vector<std::uint8_t>& rgba) {
+  const auto be32 = [&](std::size_t p) {
+    return std::uint32_t{in[p]} << 24 | std::uint32_t{in[p + 1]} << 16 |
+           std::uint32_t{in[p + 2]} << 8 | in[p + 3];
+  };
+  if (in.size() < 14 + 8 || std::memcmp(in.data(), "qoif", 4) != 0) {
+    return false;
+  }
+  width = be32(4);
+  height = be32(8);
+
+  struct pixel {
+    std::uint8_t r, g, b, a;
+  };
+  pixel index[64]{};
+  pixel px{0, 0, 0, 255};
+  const auto end = in.size() - 8;
+  std::size_t p = 14;
+  std::uint32_t run = 0;
+
+  rgba.resize(std::size_t{width} * height * 4);
+  for (std::size_t i = 0; i < rgba.size(); i += 4) {
+    if (run > 0) {
+      --run;
+    } else {
+      if (p >= end) {
+        return false;
+      }
+      const auto b = in[p++];
+      if (b == 0xfe || b == 0xff) {
+        if (p + (b == 0xfe ? 3 : 4) > end) {
+          return false;
+        }
+        px.r = in[p++];
+        px.g = in[p++];
+        px.b = in[p++];
+        if (b == 0xff) {
+          px.a = in[p++];
+        }
+      } else if (b >> 6 == 0) {
+        px = index[b];
+      } else if (b >> 6 == 1) {
+        px.r = static_cast<std::uint8_t>(px.r + ((b >> 4) & 3) - 2);
+        px.g = static_cast<std::uint8_t>(px.g + ((b >> 2) & 3) - 2);
+        px.b = static_cast<std::uint8_t>(px.b + (b & 3) - 2);
+      } else if (b >> 6 == 2) {
+        if (p >= end) {
+          return false;
+        }
+        const auto dg = (b & 0x3f) - 32;
+        const auto b2 = in[p++];
+        px.r = static_cast<std::uint8_t>(px.r + dg - 8 + (b2 >> 4));
+        px.g = static_cast<std::uint8_t>(px.g + dg);
+        px.b = static_cast<std::uint8_t>(px.b + dg - 8 + (b2 & 0x0f));
+      } else {
+        run = b & 0x3f;
+      }
+      index[(px.r * 3 + px.g * 5 + px.b * 7 + px.a * 11) % 64] = px;
+    }
+    rgba[i] = px.r;
+    rgba[i + 1] = px.g;
+    rgba[i + 2] = px.b;
+    rgba[i + 3] = px.a;
+  }
+  return p == end;
+}
+
+static std::vector<benchmark> snapshot_benchmarks() {
+  constexpr std::uint32_t width = 1920;
+  constexpr std::uint32_t height = 1080;
+
+  // A colored frame of the default view, black inside the set as color1 leaves it, so that black
+  // first comes after other colors. Only the encoding is timed; each still is then decoded and
+  // compared with the frame.
+  return {
+      {"snapshot/qoi", "frame",
+       [](std::uint64_t ops) -> std::optional<std::chrono::nanoseconds> {
+         static const auto pixels = [] {
+           const auto step = 3.0 / width;
+           const auto p = make_fractal_params(1.5, step * height / 2, step, step, -0.4, 0.6);
+           std::vector<std::uint8_t> counts(std::size_t{width} * height);
+           render_iterations(p, 0, 0, width, height, counts.data(), width);
+           std::vector<std::uint8_t> v(counts.size() * 4);
+           for (std::size_t i = 0; i < counts.size(); ++i) {
+             const auto n = counts[i] == fractal_max_iterations ? 0 : counts[i];
+             v[i * 4 + 0] = static_cast<std::uint8_t>(n * 3);
+             v[i * 4 + 1] = static_cast<std::uint8_t>(n * 5);
+             v[i * 4 + 2] = static_cast<std::uint8_t>(n * 7);
+           }
+           return v;
+         }();
+
+         char directory[] = "/tmp/fractal-bench-XXXXXX";
+         if (!::mkdtemp(directory)) {
+           std::perror("mkdtemp");
+           return std::nullopt;
+         }
+
+         std::chrono::nanoseconds t{};
+         auto ok = true;
+         {
+           snapshot_writer writer{directory, snapshot_writer::format::qoi};
+           for (std::uint64_t i = 0; i < ops && ok; ++i) {
+             const snapshot_writer::frame f{0, pixels.data(), -1, width, height, width * 4,
+                                            static_cast<std::uint32_t>(i)};
+             writer.submit(f);
+             std::vector<snapshot_writer::result> results;
+             while (results.empty()) {
+               ::pollfd pfd{writer.event_fd(), POLLIN, 0};
+               ::poll(&pfd, 1, -1);
+               results = writer.completed();
+             }
+             const auto& r = results.front();
+             t += r.encode_time;
+
+             std::ifstream in{r.path, std::ios::binary};
+             const std::vector<std::uint8_t> qoi{std::istreambuf_iterator<char>{in}, {}};
+             ::unlink(r.path.c_str());
+
+             std::uint32_t w;
+             std::uint32_t h;
+             std::vector<std::uint8_t> rgba;
+             ok = r.ok && decode_qoi(qoi, w, h, rgba) && w == width && h == height;
+             for (std::size_t j = 0; ok && j < pixels.size(); j += 4) {
+               ok = rgba[j] == pixels[j + 2] && rgba[j + 1] == pixels[j + 1] &&
+                    rgba[j + 2] == pixels[j] && rgba[j + 3] == 255;
+             }
+             if (!ok) {
+               std::cerr << "snapshot/qoi: the still does not decode to the frame" << std::endl;
+             }
+           }
+         }
+         ::rmdir(directory);
+         return ok ? std::optional{t} : std::nullopt;
+       },
+       4},
+  };
+}
+
+static std::vector<benchmark> overlay_benchmarks() {
+  // as many lines as the explorer shows with a recorder and the verifier running
+  static constexpr std::string_view text =
+      "c:  -0.40000000+0.60000000i,  max iter: 255\n"
+      "x:   0.00000000,  y:   0.00000000,  scale:   1.00000000\n"
+      "\n"
+      "fps (fpga / display): 60.0000 / 60.0000,  refresh: 60.00 Hz\n"
+      "compositor: 1.234 ms,  pacing jitter: 0.012 ms\n"
+      "rec: 1234 frames,  123.4 MB/s,  skipped: 0,  lost: 0\n"
+      "snapshot: 12.3 ms\n"
+      "verify: 123 frames,  31488 pixels,  0 wrong,  cpu: 0.52%\n";
+
+  return {
+      {"overlay/draw", "frame",
+       [](std::uint64_t ops) -> std::optional<std::chrono::nanoseconds> {
+         auto surface =
+             ::cairo_image_surface_create(CAIRO_FORMAT_ARGB32, overlay_width, overlay_height);
+         if (::cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+           return std::nullopt;
+         }
+         const auto t = timed([&] {
+           for (std::uint64_t i = 0; i < ops; ++i) {
+             draw_overlay(surface, text);
+           }
+         });
+         sink = ::cairo_image_surface_get_data(surface)[0];
+         ::cairo_surface_destroy(surface);
+         return t;
+       }},
+  };
+}
+
+static std::vector<benchmark> epoll_benchmarks() {
+  // what the explorer's loop does for each event: wait, then call the handler registered with it
+  struct loop {
+    int epoll_fd;
+    int event_fd;
+    std::uint64_t handled;
+  };
+  using handler_type = void (*)(loop*, std::uint32_t);
+  static const handler_type handle_event = [](loop* l, std::uint32_t events) {
+    if (events & EPOLLIN) {
+      std::uint64_t count;
+      [[maybe_unused]] const auto ret = ::read(l->event_fd, &count, sizeof count);
+      l->handled += count;
+    }
+  };
+
+  return {
+      {"epoll/dispatch", "event",
+       [](std::uint64_t ops) -> std::optional<std::chrono::nanoseconds> {
+         loop l{::epoll_create1(EPOLL_CLOEXEC), ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK), 0};
+         if (l.epoll_fd < 0 || l.event_fd < 0) {
+           std::perror("epoll");
+           return std::nullopt;
+         }
+         ::epoll_event ep{};
+         ep.events = EPOLLIN | EPOLLERR | EPOLLHUP;
+         ep.data.ptr = reinterpret_cast<void*>(handle_event);
+         ::epoll_ctl(l.epoll_fd, EPOLL_CTL_ADD, l.event_fd, &ep);
+
+         const std::uint64_t one = 1;
+         const auto t = timed([&] {
+           for (std::uint64_t i = 0; i < ops; ++i) {
+             [[maybe_unused]] const auto ret = ::write(l.event_fd, &one, sizeof one);
+             ::epoll_event events[16];
+             const int count = ::epoll_wait(l.epoll_fd, events, 16, -1);
+             for (int j = 0; j < count; ++j) {
+               reinterpret_cast<handler_type>(events[j].data.ptr)(&l, events[j].events);
+             }
+           }
+         });
+         sink = l.handled;
+         ::close(l.event_fd);
+         ::close(l.epoll_fd);
+         return t;
+       }},
+      // the same through the coroutine runtime the explorer runs on now
+      {"epoll/coroutine", "event",
+       [](std::uint64_t ops) -> std::optional<std::chrono::nanoseconds> {
+         const int event_fd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+         if (event_fd < 0) {
+           std::perror("eventfd");
+           return std::nullopt;
+         }
+
+         std::uint64_t handled = 0;
+         std::optional<event_loop> el;
+         try {
+           el.emplace();
+         } catch (const std::exception& e) {
+           std::cerr << e.what() << std::endl;
+           ::close(event_fd);
+           return std::nullopt;
+         }
+         const auto run = [](event_loop& el, int fd, std::uint64_t& handled) -> task {
+           fd_watch watch{el, fd};
+           for (;;) {
+             if ((co_await watch) & EPOLLIN) {
+               std::uint64_t count;
+               [[maybe_unused]] const auto ret = ::read(fd, &count, sizeof count);
+               handled += count;
+             }
+           }
+         };
+         auto reader = run(*el, event_fd, handled);
+
+         const std::uint64_t one = 1;
+         const auto t = timed([&] {
+           for (std::uint64_t i = 0; i < ops; ++i) {
+             [[maybe_unused]] const auto ret = ::write(event_fd, &one, sizeof one);
+             el->run_once();
+           }
+         });
+         sink = handled;
+         reader = {};
+         el.reset();
+         ::close(event_fd);
+         return t;
+       }},
+  };
+}
+
+// the first capture device of the vivid driver, if there is one
+static std::string find_vivid() {
+  for (int i = 0; i < 64; ++i) {
+    const auto path = "/dev/video" + std::to_string(i);
+    const int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+      continue;
+    }
+    ::v4l2_capability cap{};
+    const auto ok = ::ioctl(fd, VIDIOC_QUERYCAP, &cap) == 0 &&
+                    std::string_view{reinterpret_cast<const char*>(cap.driver)} == "vivid" &&
+                    cap.device_caps & (V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_VIDEO_CAPTURE_MPLANE) &&
+                    cap.device_caps & V4L2_CAP_STREAMING;
+    ::close(fd);
+    if (ok) {
+      return path;
+    }
+  }
+  return {};
+}
+
+static std::vector<benchmark> v4l2_benchmarks(std::string device) {
+  if (device.empty()) {
+    device = find_vivid();
+  }
+  if (device.empty()) {
+    std::cerr << "no vivid capture device; skipping the V4L2 benchmark" << std::endl;
+    return {};
+  }
+
+  // Frames come at the device's rate, so the batch is a fixed number of them, and only the
+  // ioctls are timed once a frame is ready.
+  return {
+      {"v4l2/dqbuf_qbuf", "frame",
+       [device](std::uint64_t ops) -> std::optional<std::chrono::nanoseconds> {
+         const int fd = ::open(device.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+         if (fd < 0) {
+           std::perror(device.c_str());
+           return std::nullopt;
+         }
+
+         ::v4l2_capability cap{};
+         ::ioctl(fd, VIDIOC_QUERYCAP, &cap);
+         const auto mplane = (cap.device_caps & V4L2_CAP_VIDEO_CAPTURE_MPLANE) != 0;
+         const auto type =
+             mplane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+         ::v4l2_requestbuffers req{};
+         req.count = 4;
+         req.type = type;
+         req.memory = V4L2_MEMORY_MMAP;
+         if (::ioctl(fd, VIDIOC_REQBUFS, &req) == -1 || req.count == 0) {
+           std::perror("VIDIOC_REQBUFS");
+           ::close(fd);
+           return std::nullopt;
+         }
+
+         ::v4l2_plane planes[VIDEO_MAX_PLANES];
+         const auto make_buffer = [&](std::uint32_t index) {
+           ::v4l2_buffer buf{};
+           buf.type = type;
+           buf.memory = V4L2_MEMORY_MMAP;
+           buf.index = index;
+           if (mplane) {
+             buf.length = VIDEO_MAX_PLANES;
+             buf.m.planes = planes;
+           }
+           return buf;
+         };
+
+         auto ok = true;
+         for (std::uint32_t i = 0; i < req.count && ok; ++i) {
+           auto buf = make_buffer(i);
+           ok = ::ioctl(fd, VIDIOC_QBUF, &buf) == 0;
+         }
+         int stream_type = type;
+         ok = ok && ::ioctl(fd, VIDIOC_STREAMON, &stream_type) == 0;
+
+         std::chrono::nanoseconds t{};
+         for (std::uint64_t i = 0; i < ops && ok; ++i) {
+           ::pollfd pfd{fd, POLLIN, 0};
+           if (::poll(&pfd, 1, 1000) != 1) {
+             std::cerr << device << ": no frame within a second" << std::endl;
+             ok = false;
+             break;
+           }
+           auto buf = make_buffer(0);
+           t += timed([&] {
+             ok = ::ioctl(fd, VIDIOC_DQBUF, &buf) == 0 && ::ioctl(fd, VIDIOC_QBUF, &buf) == 0;
+           });
+         }
+         if (!ok) {
+           std::perror("VIDIOC_DQBUF/QBUF");
+         }
+
+         ::ioctl(fd, VIDIOC_STREAMOFF, &stream_type);
+         req.count = 0;
+         ::ioctl(fd, VIDIOC_REQBUFS, &req);
+         ::close(fd);
+         return ok ? std::optional{t} : std::nullopt;
+       },
+       30},
+  };
+}
+
+static std::string json_string(std::string_view s) {
+  std::string out = "\"";
+  for (const auto c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+    }
+    if (static_cast<unsigned char>(c) < 0x20) {
+      char esc[8];
+      std::snprintf(esc, sizeof esc, "\\u%04x", c);
+      out += esc;
+    } else {
+      out += c;
+    }
+  }
+  return out + '"';
+}
+
+static bool write_json(const std::string& path, const std::vector<result>& results,
+                       std::size_t repetitions) {
+  ::utsname un{};
+  ::uname(&un);
+#if defined(__aarch64__) && defined(__ARM_NEON)
+  constexpr auto vector = "neon";
+#elif defined(__SSE4_1__)
+  constexpr auto vector = "sse4.1";
+#else
+  constexpr auto vector = "none";
+#endif
+
+  std::ofstream out{path};
+  out << "{\n"
+      << "  \"host\": {\n"
+      << "    \"machine\": " << json_string(un.machine) << ",\n"
+      << "    \"kernel\": " << json_string(un.release) << ",\n"
+      << "    \"compiler\": " << json_string(__VERSION__) << ",\n"
+      << "    \"vector\": " << json_string(vector) << "\n"
+      << "  },\n"
+      << "  \"repetitions\": " << repetitions << ",\n"
+      << "  \"benchmarks\": [";
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    const auto& r = results[i];
+    char stats[256];
+    std::snprintf(stats, sizeof stats,
+                  "\"median_ns\": %.3f, \"mean_ns\": %.3f, \"stddev_ns\": %.3f, "
+                  "\"min_ns\": %.3f, \"max_ns\": %.3f",
+                  r.median, r.mean, r.stddev, r.min, r.max);
+    out << (i ? ",\n" : "\n") << "    {\"name\": " << json_string(r.name)
+        << ", \"unit\": " << json_string(r.unit) << ", \"ops\": " << r.ops << ", " << stats
+        << "}";
+  }
+  out << "\n  ]\n}\n";
+  return static_cast<bool>(out);
+}
+
+static void print_usage(const char* argv0) {
+  std::cout << "usage: " << argv0 << " [options]\n"
+            << "\n"
+            << "Times fixed-point conversions, the escape-time kernels, iteration map encoding\n"
+            << "and QOI stills (both checked by decoding), the overlay, event dispatch and V4L2\n"
+            << "buffer round trips, in ns per operation.\n"
+            << "\n"
+            << "options:\n"
+            << "  --filter TEXT       run only the benchmarks whose name contains TEXT\n"
+            << "  --repetitions N     batches timed for each benchmark (default: 10)\n"
+            << "  --min-time MS       time a batch should take at least (default: 50)\n"
+            << "  --video DEV         capture device for the V4L2 benchmark (default: the\n"
+            << "                      first vivid device, skipped without one)\n"
+            << "  --json FILE         also write the results to FILE as JSON\n"
+            << "  -h, --help          show this message\n";
+}
+
+auto main(int argc, char** argv) -> int {
+  std::string filter;
+  std::size_t repetitions = 10;
+  double min_time_ms = 50.0;
+  std::string video_device;
+  std::string json_path;
+
+  {
+    enum : int {
+      opt_filter = 0x100,
+      opt_repetitions,
+      opt_min_time,
+      opt_video,
+      opt_json,
+    };
+
+    static const ::option long_options[] = {
+        {"filter", required_argument, nullptr, opt_filter},
+        {"repetitions", required_argument, nullptr, opt_repetitions},
+        {"min-time", required_argument, nullptr, opt_min_time},
+        {"video", required_argument, nullptr, opt_video},
+        {"json", required_argument, nullptr, opt_json},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    for (int opt; (opt = ::getopt_long(argc, argv, "h", long_options, nullptr)) != -1;) {
+      switch (opt) {
+        case opt_filter:
+          filter = ::optarg;
+          break;
+        case opt_repetitions:
+          repetitions = std::strtoul(::optarg, nullptr, 10);
+          if (repetitions < 1) {
+            print_usage(argv[0]);
+            return -1;
+          }
+          break;
+        case opt_min_time:
+          min_time_ms = std::strtod(::optarg, nullptr);
+          break;
+        case opt_video:
+          video_device = ::optarg;
+          break;
+        case opt_json:
+          json_path = ::optarg;
+          break;
+        case 'h':
+          print_usage(argv[0]);
+          return 0;
+        default:
+          print_usage(argv[0]);
+          return -1;
+      }
+    }
+  }
+
+  std::vector<benchmark> benchmarks;
+  const auto add = [&](std::vector<benchmark> more) {
+    for (auto& b : more) {
+      if (b.name.find(filter) != std::string::npos) {
+        benchmarks.push_back(std::move(b));
+      }
+    }
+  };
+  add(fix_benchmarks());
+  add(kernel_benchmarks());
+  add(itmap_benchmarks());
+  add(snapshot_benchmarks());
+  add(overlay_benchmarks());
+  add(epoll_benchmarks());
+  if (std::string_view{"v4l2/dqbuf_qbuf"}.find(filter) != std::string_view::npos) {
+    add(v4l2_benchmarks(video_device));
+  }
+
+  const auto min_time =
+      std::chrono::nanoseconds{static_cast<std::int64_t>(min_time_ms * 1e6)};
+
+  std::printf("%-24s %12s %12s %10s %12s %12s  %s\n",
+              "benchmark", "median", "mean", "stddev", "min", "max", "ns per");
+  std::vector<result> results;
+  auto failed = false;
+  for (const auto& b : benchmarks) {
+    const auto r = measure(b, repetitions, min_time);
+    if (!r) {
+      std::cerr << b.name << " failed" << std::endl;
+      failed = true;
+      continue;
+    }
+    std::printf("%-24s %12.3f %12.3f %9.2f%% %12.3f %12.3f  %s\n",
+                r->name.c_str(), r->median, r->mean, 100.0 * r->stddev / r->mean, r->min, r->max,
+                r->unit);
+    std::fflush(stdout);
+    results.push_back(*r);
+  }
+
+  if (!json_path.empty() && !write_json(json_path, results, repetitions)) {
+    std::cerr << "failed to write " << json_path << std::endl;
+    return -1;
+  }
+  return failed ? -1 : 0;
+}
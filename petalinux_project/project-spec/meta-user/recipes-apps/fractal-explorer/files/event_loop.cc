@@ -0,0 +1,147 @@
+#include "event_loop.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <sys/timerfd.h>
+#include <unistd.h>
+}
+
+using namespace std::string_literals;
+
+// freed frames and their sizes; there are only ever a handful
+static std::vector<std::pair<std::size_t, void*>> free_frames;
+
+void* frame_pool::allocate(std::size_t size) {
+  const auto it = std::find_if(free_frames.begin(), free_frames.end(), [size](const auto& f) {
+    return f.first == size;
+  });
+  if (it == free_frames.end()) {
+    return ::operator new(size);
+  }
+
+  const auto p = it->second;
+  free_frames.erase(it);
+  return p;
+}
+
+void frame_pool::deallocate(void* p, std::size_t size) noexcept {
+  try {
+    free_frames.emplace_back(size, p);
+  } catch (const std::bad_alloc&) {
+    ::operator delete(p);
+  }
+}
+
+event_loop::event_loop() : epoll_fd_{-1}, events_{}, count_{0}, next_{0} {
+  epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0) {
+    throw std::runtime_error{"epoll_create1: "s + std::strerror(errno)};
+  }
+}
+
+event_loop::~event_loop() {
+  ::close(epoll_fd_);
+}
+
+bool event_loop::run_once() {
+  count_ = ::epoll_wait(epoll_fd_, events_.data(), static_cast<int>(events_.size()), -1);
+  wakeup_time_ = std::chrono::steady_clock::now();
+  if (count_ < 0) {
+    count_ = 0;
+    return errno == EINTR;
+  }
+
+  for (next_ = 0; next_ < count_;) {
+    const auto& e = events_[next_++];
+    const auto watch = static_cast<fd_watch*>(e.data.ptr);
+    if (!watch) {
+      continue;
+    }
+
+    watch->events_ = e.events;
+    if (const auto waiter = std::exchange(watch->waiter_, {})) {
+      waiter.resume();
+    }
+  }
+  count_ = 0;
+  return true;
+}
+
+void event_loop::forget(const fd_watch* watch) {
+  for (auto n = next_; n < count_; ++n) {
+    if (events_[n].data.ptr == watch) {
+      events_[n].data.ptr = nullptr;
+    }
+  }
+}
+
+fd_watch::fd_watch(event_loop& loop, int fd, std::uint32_t events)
+    : loop_{loop}, fd_{fd}, events_{0} {
+  ::epoll_event ep{};
+  ep.events = events | EPOLLERR | EPOLLHUP;
+  ep.data.ptr = this;
+  if (::epoll_ctl(loop_.epoll_fd_, EPOLL_CTL_ADD, fd_, &ep) != 0) {
+    throw std::runtime_error{"epoll_ctl: "s + std::strerror(errno)};
+  }
+}
+
+fd_watch::~fd_watch() {
+  ::epoll_ctl(loop_.epoll_fd_, EPOLL_CTL_DEL, fd_, nullptr);
+  loop_.forget(this);
+}
+
+interval_timer::interval_timer(event_loop& loop, std::chrono::nanoseconds interval)
+    : fd_{-1}, interval_{interval}, next_due_{}, last_due_{} {
+  fd_ = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fd_ < 0) {
+    throw std::runtime_error{"timerfd_create: "s + std::strerror(errno)};
+  }
+
+  ::timespec now{};
+  ::clock_gettime(CLOCK_MONOTONIC, &now);
+  next_due_ = std::chrono::seconds{now.tv_sec} + std::chrono::nanoseconds{now.tv_nsec} + interval;
+
+  ::itimerspec spec{};
+  spec.it_interval.tv_sec = interval / std::chrono::seconds{1};
+  spec.it_interval.tv_nsec = (interval % std::chrono::seconds{1}).count();
+  spec.it_value.tv_sec = next_due_ / std::chrono::seconds{1};
+  spec.it_value.tv_nsec = (next_due_ % std::chrono::seconds{1}).count();
+
+  try {
+    if (::timerfd_settime(fd_, TFD_TIMER_ABSTIME, &spec, nullptr) != 0) {
+      throw std::runtime_error{"timerfd_settime: "s + std::strerror(errno)};
+    }
+    watch_.emplace(loop, fd_);
+  } catch (...) {
+    ::close(fd_);
+    throw;
+  }
+}
+
+interval_timer::~interval_timer() {
+  watch_.reset();
+  ::close(fd_);
+}
+
+std::uint64_t interval_timer::expirations() {
+  if (watch_->events_ & (EPOLLERR | EPOLLHUP)) {
+    return 0;
+  }
+
+  std::uint64_t count{};
+  if (::read(fd_, &count, sizeof count) != sizeof count) {
+    return 0;
+  }
+
+  // the last of the expirations read is the one woken up for
+  last_due_ = next_due_ + static_cast<std::int64_t>(count - 1) * interval_;
+  next_due_ += static_cast<std::int64_t>(count) * interval_;
+  return count;
+}
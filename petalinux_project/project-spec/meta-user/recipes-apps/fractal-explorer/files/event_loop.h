@@ -0,0 +1,245 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <optional>
+#include <utility>
+
+extern "C" {
+#include <sys/epoll.h>
+}
+
+// A small coroutine runtime over epoll, for the explorer's one event loop thread.
+//
+// Flows that wait on the loop are written as coroutines returning task, which wait with co_await
+// on an fd_watch (an fd becoming ready), an interval_timer, or a completion (something the loop's
+// own code finishes, such as a page flip). Awaiting allocates nothing: the coroutine's handle is
+// kept in what it waits for, and the epoll event points at that. Frames come from a pool, so
+// coroutines started again and again, as on every hot plug, do not go to the heap either.
+
+// Frames of the coroutines, kept by size once freed for the next coroutine of that size. Only the
+// loop's thread may start coroutines.
+class frame_pool {
+public:
+  static void* allocate(std::size_t size);
+  static void deallocate(void* p, std::size_t size) noexcept;
+};
+
+// A coroutine started as soon as it is called, which runs up to its first co_await before the
+// call returns. The task owns its frame and destroys it, finished or not, when it goes away.
+class task {
+public:
+  struct promise_type {
+    static void* operator new(std::size_t size) {
+      return frame_pool::allocate(size);
+    }
+    static void operator delete(void* p, std::size_t size) noexcept {
+      frame_pool::deallocate(p, size);
+    }
+
+    task get_return_object() {
+      return task{std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+    std::suspend_never initial_suspend() noexcept {
+      return {};
+    }
+    // kept until the task goes away, so that it can tell it finished
+    std::suspend_always final_suspend() noexcept {
+      return {};
+    }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept {
+      std::terminate();
+    }
+  };
+
+  task() = default;
+  explicit task(std::coroutine_handle<promise_type> handle) : handle_{handle} {}
+  ~task() {
+    if (handle_) {
+      handle_.destroy();
+    }
+  }
+
+  task(task&& other) noexcept : handle_{std::exchange(other.handle_, {})} {}
+  task& operator=(task&& other) noexcept {
+    if (this != &other) {
+      if (handle_) {
+        handle_.destroy();
+      }
+      handle_ = std::exchange(other.handle_, {});
+    }
+    return *this;
+  }
+
+  bool done() const {
+    return !handle_ || handle_.done();
+  }
+
+private:
+  std::coroutine_handle<promise_type> handle_;
+};
+
+class fd_watch;
+
+class event_loop {
+public:
+  // throws std::runtime_error if epoll cannot be set up
+  event_loop();
+  ~event_loop();
+
+  event_loop(const event_loop&) = delete;
+  event_loop& operator=(const event_loop&) = delete;
+
+  int fd() const {
+    return epoll_fd_;
+  }
+
+  // Waits for events and resumes the coroutines waiting on them, each of which runs until it waits
+  // again. Returns false if the wait failed other than by being interrupted.
+  bool run_once();
+
+  // when the last wait returned, to measure how late the events were handled against
+  std::chrono::steady_clock::time_point wakeup_time() const {
+    return wakeup_time_;
+  }
+
+private:
+  friend class fd_watch;
+
+  // drops the events still to be handled for a watch going away
+  void forget(const fd_watch* watch);
+
+  int epoll_fd_;
+  std::array<::epoll_event, 16> events_;
+  int count_;
+  int next_;
+  std::chrono::steady_clock::time_point wakeup_time_;
+};
+
+// An fd registered with the loop for as long as the watch is alive. co_await resumes with the
+// events epoll reported once the fd is ready, level-triggered: a coroutine that does not consume
+// what made it ready is resumed again on the next wait.
+class fd_watch {
+public:
+  // throws std::runtime_error if the fd cannot be added
+  fd_watch(event_loop& loop, int fd, std::uint32_t events = EPOLLIN);
+  ~fd_watch();
+
+  fd_watch(const fd_watch&) = delete;
+  fd_watch& operator=(const fd_watch&) = delete;
+
+  struct awaiter {
+    fd_watch& watch;
+
+    bool await_ready() const noexcept {
+      return false;
+    }
+    void await_suspend(std::coroutine_handle<> handle) noexcept {
+      watch.waiter_ = handle;
+    }
+    std::uint32_t await_resume() const noexcept {
+      return watch.events_;
+    }
+  };
+
+  awaiter operator co_await() noexcept {
+    return {*this};
+  }
+
+private:
+  friend class event_loop;
+  friend class interval_timer;
+
+  event_loop& loop_;
+  int fd_;
+  std::coroutine_handle<> waiter_;
+  std::uint32_t events_;
+};
+
+// A timerfd on CLOCK_MONOTONIC expiring every `interval`, from one interval after it is made.
+// co_await resumes with the number of expirations since the last, or 0 if the timer failed.
+class interval_timer {
+public:
+  // throws std::runtime_error if the timer cannot be set up
+  interval_timer(event_loop& loop, std::chrono::nanoseconds interval);
+  ~interval_timer();
+
+  interval_timer(const interval_timer&) = delete;
+  interval_timer& operator=(const interval_timer&) = delete;
+
+  // of the latest expiration read, CLOCK_MONOTONIC
+  std::chrono::nanoseconds last_due() const {
+    return last_due_;
+  }
+
+  struct awaiter {
+    interval_timer& timer;
+
+    bool await_ready() const noexcept {
+      return false;
+    }
+    void await_suspend(std::coroutine_handle<> handle) noexcept {
+      timer.watch_->waiter_ = handle;
+    }
+    std::uint64_t await_resume() noexcept {
+      return timer.expirations();
+    }
+  };
+
+  awaiter operator co_await() noexcept {
+    return {*this};
+  }
+
+private:
+  std::uint64_t expirations();
+
+  int fd_;
+  std::chrono::nanoseconds interval_;
+  std::chrono::nanoseconds next_due_;
+  std::chrono::nanoseconds last_due_;
+  std::optional<fd_watch> watch_;
+};
+
+// Something that is finished by the loop's own code rather than by an fd, such as a page flip
+// reported by libdrm's event handler, for one coroutine at a time to wait on. complete() resumes
+// the coroutine right away, inside the caller, and if none is waiting yet the value is kept for
+// the next co_await.
+template <typename T>
+class completion {
+public:
+  void complete(T value) {
+    value_ = std::move(value);
+    if (auto waiter = std::exchange(waiter_, {})) {
+      waiter.resume();
+    }
+  }
+
+  struct awaiter {
+    completion& c;
+
+    bool await_ready() const noexcept {
+      return c.value_.has_value();
+    }
+    void await_suspend(std::coroutine_handle<> handle) noexcept {
+      c.waiter_ = handle;
+    }
+    T await_resume() {
+      auto value = std::move(*c.value_);
+      c.value_.reset();
+      return value;
+    }
+  };
+
+  awaiter operator co_await() noexcept {
+    return {*this};
+  }
+
+private:
+  std::optional<T> value_;
+  std::coroutine_handle<> waiter_;
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+// Number formats and modes shared with the fractal generator.
+
+template <std::size_t IntegerWidth>
+class fix {
+  std::uint32_t value_;
+
+public:
+  static constexpr std::size_t value_width = sizeof(std::uint32_t) * 8;
+  static constexpr std::size_t integer_width = IntegerWidth;
+  static constexpr std::size_t fractional_width = value_width - integer_width;
+
+  static constexpr std::uint32_t fractional_mask = (1ul << fractional_width) - 1;
+  static constexpr std::uint32_t intreger_mask = ~fractional_mask;
+
+  static_assert(integer_width < value_width);
+
+  explicit fix(std::uint32_t v) : value_{v} {};
+
+  explicit fix(double v) : value_{double_to_fix(v)} {}
+
+  static std::uint32_t double_to_fix(double v) {
+    struct {
+      std::uint64_t frac : 52;
+      std::uint64_t exp : 11;
+      std::uint64_t sign : 1;
+    } s;
+    std::memcpy(&s, &v, sizeof v);
+
+    const auto frac = static_cast<std::uint64_t>(s.frac) | (1ul << 52);
+    const auto exp = static_cast<std::int16_t>(s.exp) - 1023;
+
+    std::uint32_t ret;
+    if (const std::int32_t shift = 52 - exp - fractional_width; shift >= 64) {
+      // zero and anything below one LSB; the shift count alone would be out of range
+      ret = 0;
+    } else if (shift >= 0) {
+      ret = frac >> shift;
+    } else {
+      ret = frac << -shift;
+    }
+
+    return s.sign ? -ret : ret;
+  }
+
+  inline std::uint32_t value() const {
+    return value_;
+  }
+
+  inline double to_double() const {
+    if (!value_) {
+      return 0.0;
+    }
+    return static_cast<double>(static_cast<std::int32_t>(value_)) / (1ul << fractional_width);
+  }
+};
+
+enum class color_mode : std::uint8_t {
+  gray,
+  red,
+  green,
+  blue,
+  yellow,
+  cyan,
+  magenta,
+  color1,
+};
+
+inline color_mode next_mode(color_mode m) {
+  if (m == color_mode::color1) {
+    return color_mode::gray;
+  } else {
+    return static_cast<color_mode>(static_cast<std::uint8_t>(m) + 1);
+  }
+}
+
+inline color_mode prev_mode(color_mode m) {
+  if (m == color_mode::gray) {
+    return color_mode::color1;
+  } else {
+    return static_cast<color_mode>(static_cast<std::uint8_t>(m) - 1);
+  }
+}
+
+// iteration limit of the generator; counts are 8 bits wide everywhere
+constexpr std::uint32_t fractal_max_iterations = 255;
+
+// Register values of one frame. Pixel (x, y) starts from z = (-x0 + x * dx, -y0 + y * dy).
+struct fractal_params {
+  std::uint32_t x0, y0, dx, dy, cr, ci;
+  std::uint32_t max_iterations = fractal_max_iterations; // 1 to fractal_max_iterations
+};
+
+inline fractal_params make_fractal_params(double x0, double y0, double dx, double dy, double cr,
+                                          double ci) {
+  return {
+      fix<4>::double_to_fix(x0), fix<4>::double_to_fix(y0), fix<4>::double_to_fix(dx),
+      fix<4>::double_to_fix(dy), fix<4>::double_to_fix(cr), fix<4>::double_to_fix(ci),
+  };
+}
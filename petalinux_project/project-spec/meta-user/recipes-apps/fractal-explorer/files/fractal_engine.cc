@@ -0,0 +1,402 @@
+#include "fractal_engine.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <iterator>
+#include <vector>
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define FRACTAL_NEON 1
+#include <arm_neon.h>
+#elif defined(__SSE4_1__)
+#define FRACTAL_SSE41 1
+#include <smmintrin.h>
+#endif
+
+namespace {
+
+// lanes that have to be done before any of them is refilled; refilling costs more than a step
+#ifndef FRACTAL_REFILL_LANES
+#define FRACTAL_REFILL_LANES 2
+#endif
+constexpr std::size_t refill_lanes = FRACTAL_REFILL_LANES;
+
+// Iterates fractal_lanes points at a time, each lane with its own z, c and iteration limit. Lanes
+// whose points are done are refilled once refill_lanes of them are, so lanes seldom wait for slower
+// ones; `next(lane, zr, zi, cr, ci, limit, out)` gives a lane its next point and where its count
+// goes, or returns false once it has none. Finished counts are added to `histogram` if given.
+template <typename Next>
+void iterate_lanes(Next next, fractal_histogram* histogram = nullptr) {
+  std::int32_t zr[fractal_lanes];
+  std::int32_t zi[fractal_lanes];
+  std::int32_t cr[fractal_lanes];
+  std::int32_t ci[fractal_lanes];
+  std::uint32_t limit[fractal_lanes];
+  std::uint32_t count[fractal_lanes];
+  std::uint32_t active[fractal_lanes]; // all ones while the point is being iterated
+  std::uint8_t* out[fractal_lanes];
+  bool live[fractal_lanes];
+
+  const auto refill = [&](std::size_t l) {
+    live[l] = next(l, zr[l], zi[l], cr[l], ci[l], limit[l], out[l]);
+    count[l] = 0;
+    active[l] = live[l] ? ~0u : 0u;
+  };
+
+  std::size_t live_lanes = 0;
+  for (std::size_t l = 0; l < fractal_lanes; ++l) {
+    refill(l);
+    live_lanes += live[l];
+  }
+
+  while (live_lanes > 0) {
+    // idle lanes count as done from the start
+    const auto target = fractal_lanes - live_lanes + std::min(refill_lanes, live_lanes);
+
+#if defined(FRACTAL_NEON)
+    const auto escape = vdupq_n_u64(std::uint64_t{4} << 56);
+    const auto max_count = vld1q_u32(limit);
+
+    auto vzr = vld1q_s32(zr);
+    auto vzi = vld1q_s32(zi);
+    const auto vcr = vld1q_s32(cr);
+    const auto vci = vld1q_s32(ci);
+    auto vcount = vld1q_u32(count);
+    auto vactive = vld1q_u32(active);
+
+    do {
+      const auto zr2_lo = vmull_s32(vget_low_s32(vzr), vget_low_s32(vzr));
+      const auto zr2_hi = vmull_high_s32(vzr, vzr);
+      const auto zi2_lo = vmull_s32(vget_low_s32(vzi), vget_low_s32(vzi));
+      const auto zi2_hi = vmull_high_s32(vzi, vzi);
+      const auto zri_lo = vmull_s32(vget_low_s32(vzr), vget_low_s32(vzi));
+      const auto zri_hi = vmull_high_s32(vzr, vzi);
+
+      const auto sq_lo = vaddq_u64(vreinterpretq_u64_s64(zr2_lo), vreinterpretq_u64_s64(zi2_lo));
+      const auto sq_hi = vaddq_u64(vreinterpretq_u64_s64(zr2_hi), vreinterpretq_u64_s64(zi2_hi));
+      const auto escaped =
+          vcombine_u32(vmovn_u64(vcgtq_u64(sq_lo, escape)), vmovn_u64(vcgtq_u64(sq_hi, escape)));
+      vactive = vbicq_u32(vactive, escaped);
+      vcount = vsubq_u32(vcount, vactive);
+      vactive = vbicq_u32(vactive, vceqq_u32(vcount, max_count));
+
+      // bits 28..59 of the products; those of 2 * zr * zi are bits 27..58 of zr * zi
+      vzr = vaddq_s32(vcombine_s32(vshrn_n_s64(vsubq_s64(zr2_lo, zi2_lo), 28),
+                                   vshrn_n_s64(vsubq_s64(zr2_hi, zi2_hi), 28)),
+                      vcr);
+      vzi = vaddq_s32(vcombine_s32(vshrn_n_s64(zri_lo, 27), vshrn_n_s64(zri_hi, 27)), vci);
+    } while (fractal_lanes - vaddvq_u32(vshrq_n_u32(vactive, 31)) < target);
+
+    vst1q_s32(zr, vzr);
+    vst1q_s32(zi, vzi);
+    vst1q_u32(count, vcount);
+    vst1q_u32(active, vactive);
+#elif defined(FRACTAL_SSE41)
+    // Re(z)^2 + Im(z)^2 is at most 2^63, so it is above 4 exactly when adding this sets the top
+    // bit
+    const auto escape_bias = _mm_set1_epi64x(0x7bff'ffff'ffff'ffff);
+    const auto max_count = _mm_loadu_si128(reinterpret_cast<const __m128i*>(limit));
+
+    auto vzr = _mm_loadu_si128(reinterpret_cast<const __m128i*>(zr));
+    auto vzi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(zi));
+    const auto vcr = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cr));
+    const auto vci = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ci));
+    auto vcount = _mm_loadu_si128(reinterpret_cast<const __m128i*>(count));
+    auto vactive = _mm_loadu_si128(reinterpret_cast<const __m128i*>(active));
+
+    do {
+      // _mm_mul_epi32 multiplies lanes 0 and 2, the odd lanes are shifted down to get theirs
+      const auto zr_odd = _mm_srli_epi64(vzr, 32);
+      const auto zi_odd = _mm_srli_epi64(vzi, 32);
+      const auto zr2_even = _mm_mul_epi32(vzr, vzr);
+      const auto zr2_odd = _mm_mul_epi32(zr_odd, zr_odd);
+      const auto zi2_even = _mm_mul_epi32(vzi, vzi);
+      const auto zi2_odd = _mm_mul_epi32(zi_odd, zi_odd);
+      const auto zri_even = _mm_mul_epi32(vzr, vzi);
+      const auto zri_odd = _mm_mul_epi32(zr_odd, zi_odd);
+
+      const auto sq_even = _mm_add_epi64(_mm_add_epi64(zr2_even, zi2_even), escape_bias);
+      const auto sq_odd = _mm_add_epi64(_mm_add_epi64(zr2_odd, zi2_odd), escape_bias);
+      const auto escaped =
+          _mm_srai_epi32(_mm_blend_epi16(_mm_srli_epi64(sq_even, 32), sq_odd, 0xcc), 31);
+      vactive = _mm_andnot_si128(escaped, vactive);
+      vcount = _mm_sub_epi32(vcount, vactive);
+      vactive = _mm_andnot_si128(_mm_cmpeq_epi32(vcount, max_count), vactive);
+
+      // bits 28..59 of the products; those of 2 * zr * zi are bits 27..58 of zr * zi
+      vzr = _mm_add_epi32(_mm_blend_epi16(_mm_srli_epi64(_mm_sub_epi64(zr2_even, zi2_even), 28),
+                                          _mm_slli_epi64(_mm_sub_epi64(zr2_odd, zi2_odd), 4),
+                                          0xcc),
+                          vcr);
+      vzi = _mm_add_epi32(
+          _mm_blend_epi16(_mm_srli_epi64(zri_even, 27), _mm_slli_epi64(zri_odd, 5), 0xcc), vci);
+    } while (fractal_lanes - static_cast<std::size_t>(std::popcount(static_cast<unsigned int>(
+                                 _mm_movemask_ps(_mm_castsi128_ps(vactive))))) <
+             target);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(zr), vzr);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(zi), vzi);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(count), vcount);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(active), vactive);
+#else
+    static_cast<void>(target);
+    for (std::size_t l = 0; l < fractal_lanes; ++l) {
+      if (live[l]) {
+        count[l] = fractal_iterations(zr[l], zi[l], cr[l], ci[l], limit[l]);
+        active[l] = 0;
+      }
+    }
+#endif
+
+    for (std::size_t l = 0; l < fractal_lanes; ++l) {
+      if (live[l] && !active[l]) {
+        *out[l] = static_cast<std::uint8_t>(count[l]);
+        if (histogram) {
+          ++(*histogram)[count[l]];
+        }
+        refill(l);
+        live_lanes -= !live[l];
+      }
+    }
+  }
+}
+
+} // namespace
+
+void render_iterations(const fractal_params& p, std::uint32_t x, std::uint32_t y,
+                       std::uint32_t width, std::uint32_t height, std::uint8_t* out,
+                       std::size_t stride, fractal_histogram* histogram) {
+  if (width == 0 || height == 0) {
+    return;
+  }
+
+  // the generator steps z0 by adding dx and dy, which wraps the same way as this
+  const auto left = -p.x0 + x * p.dx;
+  const auto top = -p.y0 + y * p.dy;
+
+  // the lanes take pixels in raster order
+  std::uint32_t i = 0;
+  std::uint32_t j = 0;
+  iterate_lanes(
+      [&](std::size_t, std::int32_t& zr, std::int32_t& zi, std::int32_t& cr, std::int32_t& ci,
+          std::uint32_t& limit, std::uint8_t*& dst) {
+        if (j == height) {
+          return false;
+        }
+        zr = static_cast<std::int32_t>(left + i * p.dx);
+        zi = static_cast<std::int32_t>(top + j * p.dy);
+        cr = static_cast<std::int32_t>(p.cr);
+        ci = static_cast<std::int32_t>(p.ci);
+        limit = p.max_iterations;
+        dst = out + j * stride + i;
+        if (++i == width) {
+          i = 0;
+          ++j;
+        }
+        return true;
+      },
+      histogram);
+}
+
+void render_iterations_batch(const fractal_params* params, std::size_t count, std::uint32_t width,
+                             std::uint32_t height, std::uint8_t* const* out, std::size_t stride) {
+  if (width == 0 || height == 0) {
+    return;
+  }
+
+  // each lane works through a frame of its own and then takes the next one nobody has started
+  struct lane_state {
+    std::size_t frame;
+    std::uint32_t i;
+    std::uint32_t j;
+  };
+  lane_state lanes[fractal_lanes];
+  std::size_t next_frame = 0;
+  for (auto& l : lanes) {
+    l = {next_frame++, 0, 0};
+  }
+
+  iterate_lanes([&](std::size_t lane, std::int32_t& zr, std::int32_t& zi, std::int32_t& cr,
+                    std::int32_t& ci, std::uint32_t& limit, std::uint8_t*& dst) {
+    auto& l = lanes[lane];
+    if (l.j == height) {
+      l = {next_frame++, 0, 0};
+    }
+    if (l.frame >= count) {
+      return false;
+    }
+
+    const auto& p = params[l.frame];
+    zr = static_cast<std::int32_t>(-p.x0 + l.i * p.dx);
+    zi = static_cast<std::int32_t>(-p.y0 + l.j * p.dy);
+    cr = static_cast<std::int32_t>(p.cr);
+    ci = static_cast<std::int32_t>(p.ci);
+    limit = p.max_iterations;
+    dst = out[l.frame] + l.j * stride + l.i;
+    if (++l.i == width) {
+      l.i = 0;
+      ++l.j;
+    }
+    return true;
+  });
+}
+
+void render_points(const std::int32_t* zr, const std::int32_t* zi, std::size_t count,
+                   std::uint32_t cr, std::uint32_t ci, std::uint32_t max_iterations,
+                   std::uint8_t* out) {
+  std::size_t k = 0;
+  iterate_lanes([&](std::size_t, std::int32_t& lane_zr, std::int32_t& lane_zi,
+                    std::int32_t& lane_cr, std::int32_t& lane_ci, std::uint32_t& limit,
+                    std::uint8_t*& dst) {
+    if (k == count) {
+      return false;
+    }
+    lane_zr = zr[k];
+    lane_zi = zi[k];
+    lane_cr = static_cast<std::int32_t>(cr);
+    lane_ci = static_cast<std::int32_t>(ci);
+    limit = max_iterations;
+    dst = out + k++;
+    return true;
+  });
+}
+
+static fractal_palette make_palette(color_mode m) {
+  fractal_palette palette{};
+  for (std::uint32_t i = 0; i < palette.size(); ++i) {
+    const auto d = static_cast<std::uint8_t>(i);
+    auto& [r, g, b] = palette[i];
+    switch (m) {
+      case color_mode::gray:
+        r = g = b = d;
+        break;
+      case color_mode::red:
+        r = d;
+        break;
+      case color_mode::green:
+        g = d;
+        break;
+      case color_mode::blue:
+        b = d;
+        break;
+      case color_mode::yellow:
+        r = g = d;
+        break;
+      case color_mode::cyan:
+        g = b = d;
+        break;
+      case color_mode::magenta:
+        r = b = d;
+        break;
+      case color_mode::color1: {
+        // the colorizer ROM, see util/generate_rom_values.tcl
+        const auto f = [](double v) {
+          return static_cast<std::uint8_t>(std::clamp(v, 0.0, 1.0) * 255);
+        };
+        const auto t = static_cast<double>(i) / 255;
+        r = f(9.0 * (1.0 - t) * t * t * t);
+        g = f(15.0 * (1.0 - t) * (1.0 - t) * t * t);
+        b = f(8.5 * (1.0 - t) * (1.0 - t) * (1.0 - t) * t);
+        break;
+      }
+    }
+  }
+  return palette;
+}
+
+const fractal_palette& colorizer_palette(color_mode m) {
+  static const auto palettes = [] {
+    std::array<fractal_palette, 8> p;
+    for (std::size_t i = 0; i < p.size(); ++i) {
+      p[i] = make_palette(static_cast<color_mode>(i));
+    }
+    return p;
+  }();
+
+  // the colorizer falls back to gray for modes it does not know
+  const auto index = static_cast<std::size_t>(m);
+  return palettes[index < palettes.size() ? index : 0];
+}
+
+std::size_t render_antialiased(const fractal_params& p, const fractal_palette& palette,
+                               std::uint32_t samples, std::uint32_t x, std::uint32_t y,
+                               std::uint32_t width, std::uint32_t height, std::uint8_t* rgb,
+                               std::size_t stride) {
+  // counts with a one pixel border, so that the block edges see their neighbours
+  const auto map_stride = std::size_t{width} + 2;
+  thread_local std::vector<std::uint8_t> map;
+  map.resize(map_stride * (height + 2));
+  render_iterations(p, x - 1, y - 1, width + 2, height + 2, map.data(), map_stride);
+
+  thread_local std::vector<std::uint32_t> refined;
+  refined.clear();
+  const auto up = -static_cast<std::ptrdiff_t>(map_stride);
+  const auto down = static_cast<std::ptrdiff_t>(map_stride);
+  for (std::uint32_t j = 0; j < height; ++j) {
+    const auto* m = map.data() + (j + 1) * map_stride + 1;
+    auto* dst = rgb + j * stride;
+    for (std::uint32_t i = 0; i < width; ++i, ++m) {
+      const auto n = *m;
+      std::memcpy(dst + i * 3, palette[n].data(), 3);
+      if (samples > 1 && (m[-1] != n || m[1] != n || m[up] != n || m[down] != n)) {
+        refined.push_back(j * width + i);
+      }
+    }
+  }
+  if (refined.empty()) {
+    return 0;
+  }
+
+  // samples x samples points per pixel, one in each cell of a grid over the pixel and jittered
+  // within it; the jitter hashes the pixel's place in the frame so that tiles agree
+  const auto per_pixel = std::size_t{samples} * samples;
+  thread_local std::vector<std::int32_t> zr;
+  thread_local std::vector<std::int32_t> zi;
+  thread_local std::vector<std::uint8_t> counts;
+  zr.resize(refined.size() * per_pixel);
+  zi.resize(refined.size() * per_pixel);
+  counts.resize(refined.size() * per_pixel);
+
+  const auto dx = std::int64_t{static_cast<std::int32_t>(p.dx)};
+  const auto dy = std::int64_t{static_cast<std::int32_t>(p.dy)};
+  for (std::size_t k = 0; k < refined.size(); ++k) {
+    const auto px = x + refined[k] % width;
+    const auto py = y + refined[k] / width;
+    const auto base_r = -p.x0 + px * p.dx;
+    const auto base_i = -p.y0 + py * p.dy;
+    for (std::uint32_t s = 0; s < per_pixel; ++s) {
+      auto h = px * 0x9e3779b1u ^ py * 0x85ebca77u ^ s * 0xc2b2ae3du;
+      h ^= h >> 15;
+      h *= 0x2c1b3c6du;
+      h ^= h >> 12;
+
+      // offsets from the pixel's own point in 1/256 pixel, within [-1/2, 1/2)
+      const auto u = static_cast<std::int64_t>(((s % samples) * 256 + (h & 0xff)) / samples) - 128;
+      const auto v =
+          static_cast<std::int64_t>(((s / samples) * 256 + ((h >> 8) & 0xff)) / samples) - 128;
+      zr[k * per_pixel + s] =
+          static_cast<std::int32_t>(base_r + static_cast<std::uint32_t>((dx * u) >> 8));
+      zi[k * per_pixel + s] =
+          static_cast<std::int32_t>(base_i + static_cast<std::uint32_t>((dy * v) >> 8));
+    }
+  }
+  render_points(zr.data(), zi.data(), zr.size(), p.cr, p.ci, p.max_iterations, counts.data());
+
+  // resolved through the palette, since averaging counts would invent colours
+  for (std::size_t k = 0; k < refined.size(); ++k) {
+    std::uint32_t sum[3]{};
+    for (std::size_t s = 0; s < per_pixel; ++s) {
+      const auto& c = palette[counts[k * per_pixel + s]];
+      sum[0] += c[0];
+      sum[1] += c[1];
+      sum[2] += c[2];
+    }
+    auto* dst = rgb + refined[k] / width * stride + refined[k] % width * 3;
+    for (std::size_t c = 0; c < 3; ++c) {
+      dst[c] = static_cast<std::uint8_t>((sum[c] + per_pixel / 2) / per_pixel);
+    }
+  }
+
+  return refined.size();
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "fractal.h"
+
+// Software model of the fractal generator and colorizer.
+//
+// Iteration counts match fractal_kernel bit for bit: z is 4.28 fixed point, z^2 keeps bits 28..59
+// of the 64-bit products and wraps when c is added, and a point has escaped once
+// Re(z)^2 + Im(z)^2 > 4 before the step. Pixels are addressed like the generator does, so a frame
+// rendered here is the one the FPGA would produce with the same registers, at any size.
+
+// points iterated together by the vectorized paths (NEON, SSE4.1)
+constexpr std::size_t fractal_lanes = 4;
+
+// iteration count of one point
+inline std::uint8_t fractal_iterations(std::int32_t zr, std::int32_t zi, std::int32_t cr,
+                                       std::int32_t ci,
+                                       std::uint32_t max_iterations = fractal_max_iterations) {
+  constexpr auto escape = std::uint64_t{4} << 56;
+
+  std::uint32_t n = 0;
+  for (; n < max_iterations; ++n) {
+    const auto zr2 = std::int64_t{zr} * zr;
+    const auto zi2 = std::int64_t{zi} * zi;
+    if (static_cast<std::uint64_t>(zr2) + static_cast<std::uint64_t>(zi2) > escape) {
+      break;
+    }
+    const auto zri = static_cast<std::uint64_t>(std::int64_t{zr} * zi);
+    zr = static_cast<std::int32_t>(
+        static_cast<std::uint32_t>(static_cast<std::uint64_t>(zr2 - zi2) >> 28) +
+        static_cast<std::uint32_t>(cr));
+    zi = static_cast<std::int32_t>(static_cast<std::uint32_t>((zri << 1) >> 28) +
+                                   static_cast<std::uint32_t>(ci));
+  }
+  return static_cast<std::uint8_t>(n);
+}
+
+// number of pixels with each iteration count
+using fractal_histogram = std::array<std::uint32_t, 256>;
+
+// Fills a `width` x `height` block of iteration counts whose top left is pixel (x, y) of the frame.
+// The counts are also added to `histogram` if one is given, as the lanes finish them.
+void render_iterations(const fractal_params& p, std::uint32_t x, std::uint32_t y,
+                       std::uint32_t width, std::uint32_t height, std::uint8_t* out,
+                       std::size_t stride, fractal_histogram* histogram = nullptr);
+
+// Renders `count` frames of the same size at once, frame k into out[k]. Each lane of the vector
+// unit works through a different frame, e.g. thumbnails for different values of c.
+void render_iterations_batch(const fractal_params* params, std::size_t count, std::uint32_t width,
+                             std::uint32_t height, std::uint8_t* const* out, std::size_t stride);
+
+// counts of `count` arbitrary points that share one c and iteration limit
+void render_points(const std::int32_t* zr, const std::int32_t* zi, std::size_t count,
+                   std::uint32_t cr, std::uint32_t ci, std::uint32_t max_iterations,
+                   std::uint8_t* out);
+
+// RGB of each iteration count, as fractal_colorizer maps them in mode `m`
+using fractal_palette = std::array<std::array<std::uint8_t, 3>, 256>;
+const fractal_palette& colorizer_palette(color_mode m);
+
+// Renders a block as RGB (3 bytes a pixel), supersampling only where the image has edges: pixels
+// whose count differs from one of their four neighbours get `samples` x `samples` jittered samples,
+// averaged through `palette`. Every other pixel is exactly what the generator shows. Returns how
+// many pixels were refined.
+std::size_t render_antialiased(const fractal_params& p, const fractal_palette& palette,
+                               std::uint32_t samples, std::uint32_t x, std::uint32_t y,
+                               std::uint32_t width, std::uint32_t height, std::uint8_t* rgb,
+                               std::size_t stride);
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// On-disk layout of recorded sessions. Everything is block aligned so that frames can be written
+// with O_DIRECT straight from the capture buffers and mapped back for replay.
+//
+//   [frame_file_header, padded to one block]
+//   [frame_record_header, padded to one block][frame_size bytes, padded to a block multiple]
+//   [frame_record_header, ...
+
+inline constexpr std::size_t frame_file_block_size = 4096;
+inline constexpr char frame_file_magic[8] = {'F', 'R', 'A', 'C', 'T', 'R', 'E', 'C'};
+inline constexpr std::uint32_t frame_file_version = 1;
+
+struct frame_file_header {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t width;
+  std::uint32_t height;
+  std::uint32_t stride;      // bytes per line
+  std::uint32_t fourcc;      // V4L2 pixel format
+  std::uint32_t frame_size;  // bytes of pixel data per frame
+  std::uint64_t record_size; // distance between consecutive records
+};
+
+struct frame_record_header {
+  std::uint64_t sequence;
+  std::int64_t timestamp_ns; // capture time, CLOCK_MONOTONIC
+  double x0, y0, dx, dy, cr, ci;
+};
+
+static_assert(sizeof(frame_file_header) <= frame_file_block_size);
+static_assert(sizeof(frame_record_header) <= frame_file_block_size);
+
+inline constexpr std::uint64_t frame_file_align(std::uint64_t size) {
+  return (size + frame_file_block_size - 1) / frame_file_block_size * frame_file_block_size;
+}
+
+inline constexpr std::uint64_t frame_file_record_size(std::uint32_t frame_size) {
+  return frame_file_block_size + frame_file_align(frame_size);
+}
@@ -0,0 +1,418 @@
+#include "frame_publisher.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <optional>
+#include <stdexcept>
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+}
+
+using namespace std::string_literals;
+
+// a second of frames, so that a consumer reading a slot late still finds it
+static constexpr std::uint32_t slot_count = 64;
+// one frame to read while the next comes in
+static constexpr std::size_t max_consumer_leases = 2;
+
+static std::chrono::nanoseconds monotonic_now() {
+  ::timespec ts{};
+  ::clock_gettime(CLOCK_MONOTONIC, &ts);
+  return std::chrono::seconds{ts.tv_sec} + std::chrono::nanoseconds{ts.tv_nsec};
+}
+
+static bool send_message(int fd, frame_share_op op, std::uint32_t index, std::uint64_t position) {
+  const frame_share_message m{op, index, position};
+  return ::send(fd, &m, sizeof m, MSG_DONTWAIT | MSG_NOSIGNAL) == sizeof m;
+}
+
+frame_publisher::frame_publisher(const char* path, const frame_share_header& layout,
+                                 const std::vector<int>& buffer_fds, std::size_t max_leased,
+                                 std::chrono::nanoseconds lease_timeout)
+    : path_{path},
+      listen_fd_{-1},
+      timer_fd_{-1},
+      epoll_fd_{-1},
+      ring_fd_{-1},
+      ring_{MAP_FAILED},
+      ring_size_{frame_share_ring_size(slot_count)},
+      header_{nullptr},
+      buffer_fds_{buffer_fds},
+      max_leased_{max_leased},
+      lease_timeout_{lease_timeout},
+      published_{0},
+      consumers_accepted_{0},
+      leases_held_{0} {
+  ::sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (path_.size() >= sizeof addr.sun_path) {
+    throw std::runtime_error{path_ + ": path too long"};
+  }
+  std::memcpy(addr.sun_path, path_.c_str(), path_.size() + 1);
+
+  try {
+    ring_fd_ = ::memfd_create("fractal-frames", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (ring_fd_ < 0) {
+      throw std::runtime_error{"memfd_create: "s + std::strerror(errno)};
+    }
+    if (::ftruncate(ring_fd_, static_cast<::off_t>(ring_size_)) != 0) {
+      throw std::runtime_error{"ftruncate: "s + std::strerror(errno)};
+    }
+    // consumers map it read-only, and cannot have it shrink under the explorer
+    if (::fcntl(ring_fd_, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) {
+      throw std::runtime_error{"F_ADD_SEALS: "s + std::strerror(errno)};
+    }
+    ring_ = ::mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd_, 0);
+    if (ring_ == MAP_FAILED) {
+      throw std::runtime_error{"mmap: "s + std::strerror(errno)};
+    }
+    // what consumers are sent: the same memory through a descriptor opened read-only, which they
+    // can neither write through nor map writable
+    const auto rw_path = "/proc/self/fd/"s + std::to_string(ring_fd_);
+    const auto ro_fd = ::open(rw_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (ro_fd < 0) {
+      throw std::runtime_error{rw_path + ": "s + std::strerror(errno)};
+    }
+    ::close(ring_fd_);
+    ring_fd_ = ro_fd;
+
+    header_ = new (ring_) frame_share_header{};
+    std::memcpy(header_->magic, frame_share_magic, sizeof header_->magic);
+    header_->version = frame_share_version;
+    header_->slot_count = slot_count;
+    header_->buffer_count = static_cast<std::uint32_t>(buffer_fds_.size());
+    header_->width = layout.width;
+    header_->height = layout.height;
+    header_->stride = layout.stride;
+    header_->fourcc = layout.fourcc;
+    for (std::uint32_t n = 0; n < slot_count; ++n) {
+      new (&slot(n)) frame_share_slot{frame_share_writing, {}};
+    }
+
+    listen_fd_ = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0) {
+      throw std::runtime_error{"socket: "s + std::strerror(errno)};
+    }
+    // left by an earlier run; anything else there is not ours to remove
+    if (struct ::stat st{}; ::lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+      ::unlink(path);
+    }
+    if (::bind(listen_fd_, reinterpret_cast<const ::sockaddr*>(&addr), sizeof addr) != 0) {
+      throw std::runtime_error{"failed to bind "s + path + ": "s + std::strerror(errno)};
+    }
+    if (::listen(listen_fd_, 8) != 0) {
+      throw std::runtime_error{"listen: "s + std::strerror(errno)};
+    }
+
+    timer_fd_ = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd_ < 0) {
+      throw std::runtime_error{"timerfd_create: "s + std::strerror(errno)};
+    }
+
+    // readable whenever the listening socket, the lease timer or a consumer is
+    epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) {
+      throw std::runtime_error{"epoll_create1: "s + std::strerror(errno)};
+    }
+    for (auto fd : {&listen_fd_, &timer_fd_}) {
+      ::epoll_event ep{};
+      ep.events = EPOLLIN;
+      ep.data.ptr = fd;
+      if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, *fd, &ep) != 0) {
+        throw std::runtime_error{"epoll_ctl: "s + std::strerror(errno)};
+      }
+    }
+  } catch (...) {
+    close_all();
+    throw;
+  }
+}
+
+frame_publisher::~frame_publisher() {
+  close_all();
+}
+
+void frame_publisher::close_all() {
+  for (const auto& c : consumers_) {
+    ::close(c->fd);
+  }
+  consumers_.clear();
+
+  if (listen_fd_ >= 0) {
+    ::close(listen_fd_);
+    ::unlink(path_.c_str());
+  }
+  if (timer_fd_ >= 0) {
+    ::close(timer_fd_);
+  }
+  if (epoll_fd_ >= 0) {
+    ::close(epoll_fd_);
+  }
+  if (ring_ != MAP_FAILED) {
+    ::munmap(ring_, ring_size_);
+  }
+  if (ring_fd_ >= 0) {
+    ::close(ring_fd_);
+  }
+}
+
+frame_share_slot& frame_publisher::slot(std::uint64_t position) {
+  const auto slots = reinterpret_cast<frame_share_slot*>(
+      static_cast<std::uint8_t*>(ring_) + frame_share_slots_offset);
+  return slots[position % slot_count];
+}
+
+std::uint32_t frame_publisher::publish(const frame& f) {
+  const auto position = published_++;
+
+  auto& s = slot(position);
+  s.position.store(frame_share_writing, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  s.frame = {
+      f.index,
+      f.width,
+      f.height,
+      f.max_iterations,
+      f.mode,
+      0,
+      f.sequence,
+      f.timestamp.count(),
+      monotonic_now().count(),
+      f.x0,
+      f.y0,
+      f.dx,
+      f.dy,
+      f.cr,
+      f.ci,
+  };
+  s.position.store(position, std::memory_order_release);
+  header_->published.store(published_, std::memory_order_release);
+
+  const auto now = std::chrono::steady_clock::now();
+  std::uint32_t leases = 0;
+  for (const auto& c : consumers_) {
+    if (c->leases.size() >= max_consumer_leases || leases_held_ >= max_leased_ ||
+        !send_message(c->fd, frame_share_op::frame, f.index, position)) {
+      // a consumer that went away is dropped once completed() hears of it
+      ++c->frames_skipped;
+      continue;
+    }
+
+    c->leases.push_back({position, f.index, now});
+    c->latest_position = position;
+    ++c->frames_leased;
+    ++leases_held_;
+    ++leases;
+  }
+
+  if (leases > 0) {
+    arm_expiry();
+  }
+  return leases;
+}
+
+std::vector<std::uint32_t> frame_publisher::completed() {
+  std::vector<std::uint32_t> ended;
+
+  ::epoll_event events[16];
+  const int count = ::epoll_wait(epoll_fd_, events, 16, 0);
+  for (int i = 0; i < count; ++i) {
+    const auto ptr = events[i].data.ptr;
+    if (ptr == &listen_fd_) {
+      accept_consumers();
+    } else if (ptr == &timer_fd_) {
+      std::uint64_t expirations;
+      [[maybe_unused]] const auto ret = ::read(timer_fd_, &expirations, sizeof expirations);
+      expire(ended);
+    } else {
+      const auto c = static_cast<consumer*>(ptr);
+      if (events[i].events & EPOLLIN) {
+        receive(*c, ended);
+      }
+      if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+        drop(*c, ended);
+      }
+    }
+  }
+
+  // dropped ones are closed and left at -1 until now, as the events may name them more than once
+  consumers_.erase(std::remove_if(consumers_.begin(), consumers_.end(),
+                                  [](const auto& c) { return c->fd < 0; }),
+                   consumers_.end());
+  arm_expiry();
+  return ended;
+}
+
+void frame_publisher::accept_consumers() {
+  for (;;) {
+    const int fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      return;
+    }
+
+    ::ucred cred{};
+    ::socklen_t cred_len = sizeof cred;
+    ::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len);
+
+    // the ring, then every buffer in index order
+    std::vector<int> fds{ring_fd_};
+    fds.insert(fds.end(), buffer_fds_.begin(), buffer_fds_.end());
+
+    frame_share_hello hello{};
+    std::memcpy(hello.magic, frame_share_magic, sizeof hello.magic);
+    hello.version = frame_share_version;
+    hello.buffer_count = static_cast<std::uint32_t>(buffer_fds_.size());
+    hello.max_leases = static_cast<std::uint32_t>(max_consumer_leases);
+    hello.ring_size = ring_size_;
+
+    ::iovec iov{&hello, sizeof hello};
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * fds.size()));
+    ::msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+    const auto cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    std::memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+
+    auto c = std::make_unique<consumer>();
+    c->fd = fd;
+    c->pid = cred.pid;
+    c->latest_position = published_ - 1;
+
+    ::epoll_event ep{};
+    ep.events = EPOLLIN;
+    ep.data.ptr = c.get();
+    if (::sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) != sizeof hello ||
+        ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ep) != 0) {
+      ::close(fd);
+      continue;
+    }
+
+    consumers_.push_back(std::move(c));
+    ++consumers_accepted_;
+  }
+}
+
+void frame_publisher::receive(consumer& c, std::vector<std::uint32_t>& ended) {
+  if (c.fd < 0) {
+    return;
+  }
+
+  const auto now = std::chrono::steady_clock::now();
+  for (;;) {
+    frame_share_message m{};
+    const auto len = ::recv(c.fd, &m, sizeof m, MSG_DONTWAIT);
+    if (len < 0 && (errno == EAGAIN || errno == EINTR)) {
+      return;
+    }
+    if (len <= 0) {
+      drop(c, ended);
+      return;
+    }
+    if (len != sizeof m || m.op != frame_share_op::release) {
+      continue;
+    }
+
+    // one taken back already is returned late, and is no longer held
+    const auto it = std::find_if(c.leases.begin(), c.leases.end(), [&m](const auto& l) {
+      return l.position == m.position;
+    });
+    if (it == c.leases.end()) {
+      continue;
+    }
+
+    const auto held = std::chrono::duration_cast<std::chrono::nanoseconds>(now - it->since);
+    c.hold_time_sum += held;
+    c.hold_time_max = std::max(c.hold_time_max, held);
+    ++c.leases_returned;
+
+    ended.push_back(it->index);
+    c.leases.erase(it);
+    --leases_held_;
+  }
+}
+
+void frame_publisher::drop(consumer& c, std::vector<std::uint32_t>& ended) {
+  if (c.fd < 0) {
+    return;
+  }
+
+  for (const auto& l : c.leases) {
+    ended.push_back(l.index);
+  }
+  leases_held_ -= static_cast<std::uint32_t>(c.leases.size());
+  c.leases.clear();
+
+  ::close(c.fd);
+  c.fd = -1;
+}
+
+void frame_publisher::expire(std::vector<std::uint32_t>& ended) {
+  const auto deadline = std::chrono::steady_clock::now() - lease_timeout_;
+  for (const auto& c : consumers_) {
+    while (!c->leases.empty() && c->leases.front().since <= deadline) {
+      const auto& l = c->leases.front();
+      if (c->fd >= 0) {
+        send_message(c->fd, frame_share_op::revoke, l.index, l.position);
+      }
+      ended.push_back(l.index);
+      ++c->leases_revoked;
+      --leases_held_;
+      c->leases.erase(c->leases.begin());
+    }
+  }
+}
+
+void frame_publisher::arm_expiry() {
+  std::optional<std::chrono::steady_clock::time_point> oldest;
+  for (const auto& c : consumers_) {
+    if (!c->leases.empty() && (!oldest || c->leases.front().since < *oldest)) {
+      oldest = c->leases.front().since;
+    }
+  }
+
+  // steady_clock is CLOCK_MONOTONIC; a zero time disarms the timer
+  ::itimerspec spec{};
+  if (oldest) {
+    const auto due = std::max((*oldest + lease_timeout_).time_since_epoch(),
+                              std::chrono::nanoseconds{1});
+    spec.it_value.tv_sec = due / std::chrono::seconds{1};
+    spec.it_value.tv_nsec = (due % std::chrono::seconds{1}).count();
+  }
+  ::timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+frame_publisher::stats frame_publisher::get_stats() const {
+  stats s{published_, consumers_accepted_, leases_held_, {}};
+  for (const auto& c : consumers_) {
+    if (c->fd < 0) {
+      continue;
+    }
+    s.consumers.push_back({
+        c->pid,
+        c->frames_leased,
+        c->frames_skipped,
+        c->leases_revoked,
+        static_cast<std::uint32_t>(c->leases.size()),
+        published_ - 1 - c->latest_position,
+        c->leases_returned ? c->hold_time_sum / static_cast<std::int64_t>(c->leases_returned)
+                           : std::chrono::nanoseconds{},
+        c->hold_time_max,
+    });
+  }
+  return s;
+}
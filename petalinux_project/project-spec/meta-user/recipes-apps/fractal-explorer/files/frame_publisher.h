@@ -0,0 +1,126 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <sys/types.h>
+}
+
+#include "frame_share.h"
+
+// Shares captured frames with other local processes without copying them, over a Unix socket
+// (see frame_share.h for what the consumers see).
+//
+// Like the recorder, the caller keeps ownership of the buffers: each lease publish() takes on a
+// frame holds its buffer until the index is returned by completed(), once per lease, and
+// event_fd() becomes readable whenever that may be the case. Consumers are accepted and heard
+// from in completed() too, on the caller's thread, and nothing waits on them: a frame is not
+// leased to a consumer holding all it may, or whose socket is full, at most max_leased frames are
+// leased at a time over all of them, and leases held longer than lease_timeout are taken back. A
+// slow consumer skips frames, and the capture queue never waits for it.
+class frame_publisher {
+public:
+  struct frame {
+    std::uint32_t index;
+    std::uint32_t width;
+    std::uint32_t height;
+    std::uint64_t sequence;
+    std::chrono::nanoseconds timestamp; // capture time, CLOCK_MONOTONIC
+    double x0, y0, dx, dy, cr, ci;
+    std::uint32_t max_iterations;
+    std::uint32_t mode; // color_mode
+  };
+
+  struct consumer_stats {
+    ::pid_t pid;
+    std::uint64_t frames_leased;
+    std::uint64_t frames_skipped; // published while it could not take them
+    std::uint64_t leases_revoked;
+    std::uint32_t leases_held;
+    std::uint64_t lag; // frames published since the latest one leased to it
+    std::chrono::nanoseconds hold_time_mean;
+    std::chrono::nanoseconds hold_time_max;
+  };
+
+  struct stats {
+    std::uint64_t frames_published;
+    std::uint64_t consumers_accepted; // since the start
+    std::uint32_t leases_held;
+    std::vector<consumer_stats> consumers; // connected now
+  };
+
+  // Listens on `path`, replacing a socket left there. `layout` gives the size and format of the
+  // buffers, whose fds are `buffer_fds`; they are kept open by the caller.
+  // throws std::runtime_error if the socket or the ring cannot be set up
+  frame_publisher(const char* path, const frame_share_header& layout,
+                  const std::vector<int>& buffer_fds, std::size_t max_leased,
+                  std::chrono::nanoseconds lease_timeout);
+  ~frame_publisher();
+
+  frame_publisher(const frame_publisher&) = delete;
+  frame_publisher& operator=(const frame_publisher&) = delete;
+
+  int event_fd() const {
+    return epoll_fd_;
+  }
+
+  // Writes the frame to the ring and leases it to every consumer that can take it. Returns the
+  // number of leases taken, each of which holds the buffer.
+  std::uint32_t publish(const frame& f);
+
+  // indices of the leases that ended since the last call, returned, taken back, or held by a
+  // consumer that went away; an index appears once per lease
+  std::vector<std::uint32_t> completed();
+
+  stats get_stats() const;
+
+private:
+  struct lease {
+    std::uint64_t position;
+    std::uint32_t index;
+    std::chrono::steady_clock::time_point since;
+  };
+
+  struct consumer {
+    int fd;
+    ::pid_t pid;
+    std::vector<lease> leases; // oldest first
+    std::uint64_t latest_position; // leased last, or published before it connected
+    std::uint64_t frames_leased;
+    std::uint64_t frames_skipped;
+    std::uint64_t leases_revoked;
+    std::uint64_t leases_returned;
+    std::chrono::nanoseconds hold_time_sum;
+    std::chrono::nanoseconds hold_time_max;
+  };
+
+  void accept_consumers();
+  void receive(consumer& c, std::vector<std::uint32_t>& ended);
+  void drop(consumer& c, std::vector<std::uint32_t>& ended);
+  void expire(std::vector<std::uint32_t>& ended);
+  void arm_expiry();
+  void close_all();
+
+  frame_share_slot& slot(std::uint64_t position);
+
+  std::string path_;
+  int listen_fd_;
+  int timer_fd_;
+  int epoll_fd_;
+  int ring_fd_;
+  void* ring_;
+  std::size_t ring_size_;
+  frame_share_header* header_;
+  std::vector<int> buffer_fds_;
+  std::size_t max_leased_;
+  std::chrono::nanoseconds lease_timeout_;
+
+  std::vector<std::unique_ptr<consumer>> consumers_;
+  std::uint64_t published_;
+  std::uint64_t consumers_accepted_;
+  std::uint32_t leases_held_;
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// What other local processes see of the captured frames (see frame_publisher.h), for them to
+// include as they are.
+//
+// A consumer connects to the explorer's SOCK_SEQPACKET socket and is sent a frame_share_hello
+// carrying, as SCM_RIGHTS, the memfd of the metadata ring and then the fd of every capture buffer
+// in index order, dmabufs when the frames come from the generator. Each frame leased to it after
+// that comes as a frame_share_message with op frame; the consumer reads the frame's metadata out
+// of the ring at the position given, reads the pixels of buffer `index`, bracketed with
+// DMA_BUF_IOCTL_SYNC, and sends the same message back with op release. A lease held longer than
+// the explorer allows is taken back, with a revoke message, and the buffer may be written over by
+// then.
+//
+// The ring, mapped read-only, is a frame_share_header followed by slot_count frame_share_slots
+// from frame_share_slots_offset on. Every frame published is written to it, leased or not, so a
+// consumer can also just follow frame_share_header::published.
+
+inline constexpr char frame_share_magic[8] = {'F', 'R', 'A', 'C', 'S', 'H', 'R', 'D'};
+inline constexpr std::uint32_t frame_share_version = 1;
+inline constexpr std::size_t frame_share_slots_offset = 64;
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+
+struct frame_share_header {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t slot_count;
+  std::uint32_t buffer_count;
+  std::uint32_t width; // of the buffers; a frame may take up less of one
+  std::uint32_t height;
+  std::uint32_t stride; // bytes per line
+  std::uint32_t fourcc; // V4L2 pixel format
+  std::uint32_t reserved;
+  std::atomic<std::uint64_t> published; // frames so far; the latest is at position published - 1
+};
+
+struct frame_share_frame {
+  std::uint32_t index; // of the buffer
+  std::uint32_t width; // of the picture, which starts at the top left of the buffer
+  std::uint32_t height;
+  std::uint32_t max_iterations;
+  std::uint32_t mode; // color_mode
+  std::uint32_t reserved;
+  std::uint64_t sequence;
+  std::int64_t timestamp_ns; // capture time, CLOCK_MONOTONIC
+  std::int64_t published_ns; // CLOCK_MONOTONIC
+  double x0, y0, dx, dy, cr, ci;
+};
+
+// A frame is at slot position % slot_count while `position` says so; it is set to
+// frame_share_writing while the slot is being written over.
+struct frame_share_slot {
+  std::atomic<std::uint64_t> position;
+  frame_share_frame frame;
+};
+
+inline constexpr std::uint64_t frame_share_writing = ~std::uint64_t{0};
+
+static_assert(sizeof(frame_share_header) <= frame_share_slots_offset);
+
+struct frame_share_hello {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t buffer_count; // fds after the ring's
+  std::uint32_t max_leases;   // frames a consumer may hold at once
+  std::uint32_t reserved;
+  std::uint64_t ring_size; // bytes to map
+};
+
+enum class frame_share_op : std::uint32_t {
+  frame = 1,   // leased to the consumer
+  release = 2, // given back by it
+  revoke = 3,  // taken back from it
+};
+
+struct frame_share_message {
+  frame_share_op op;
+  std::uint32_t index;
+  std::uint64_t position;
+};
+
+inline constexpr std::size_t frame_share_ring_size(std::uint32_t slot_count) {
+  return frame_share_slots_offset + slot_count * sizeof(frame_share_slot);
+}
+
+// Copies the metadata of the frame at `position` out of the ring mapped at `ring`. False if its
+// slot has been written over since, or is being written.
+inline bool frame_share_read(const void* ring, std::uint64_t position, frame_share_frame& frame) {
+  const auto header = static_cast<const frame_share_header*>(ring);
+  const auto slots = reinterpret_cast<const frame_share_slot*>(
+      static_cast<const std::uint8_t*>(ring) + frame_share_slots_offset);
+  const auto& slot = slots[position % header->slot_count];
+
+  if (slot.position.load(std::memory_order_acquire) != position) {
+    return false;
+  }
+  frame = slot.frame;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return slot.position.load(std::memory_order_relaxed) == position;
+}
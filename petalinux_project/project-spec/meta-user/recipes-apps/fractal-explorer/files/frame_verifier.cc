@@ -0,0 +1,193 @@
+#include "frame_verifier.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <string>
+
+extern "C" {
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <linux/dma-buf.h>
+}
+
+#include "fractal_engine.h"
+
+using namespace std::string_literals;
+using namespace std::chrono_literals;
+
+// mismatches are reported at most this often; the ones in between are only counted
+static constexpr auto report_interval = 1s;
+
+static std::chrono::nanoseconds thread_cpu_time() {
+  ::timespec ts{};
+  ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return std::chrono::seconds{ts.tv_sec} + std::chrono::nanoseconds{ts.tv_nsec};
+}
+
+frame_verifier::frame_verifier(std::uint32_t samples, double budget)
+    : samples_{std::max(samples, 1u)},
+      budget_{budget},
+      event_fd_{-1},
+      points_(samples_),
+      zr_(samples_),
+      zi_(samples_),
+      counts_(samples_),
+      rng_{std::random_device{}()},
+      unreported_{0},
+      busy_{false},
+      start_time_{std::chrono::steady_clock::now()},
+      stats_{},
+      stopping_{false} {
+  event_fd_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (event_fd_ < 0) {
+    throw std::runtime_error{"eventfd: "s + std::strerror(errno)};
+  }
+
+  thread_ = std::thread{&frame_verifier::run, this};
+}
+
+frame_verifier::~frame_verifier() {
+  {
+    std::lock_guard lock{mutex_};
+    stopping_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+
+  ::close(event_fd_);
+}
+
+bool frame_verifier::submit(const frame& f) {
+  {
+    std::lock_guard lock{mutex_};
+    const auto elapsed = std::chrono::steady_clock::now() - start_time_;
+    if (busy_ || stats_.cpu_time > budget_ * elapsed) {
+      ++stats_.frames_skipped;
+      return false;
+    }
+    pending_ = f;
+    busy_ = true;
+  }
+  cv_.notify_one();
+  return true;
+}
+
+std::vector<std::uint32_t> frame_verifier::completed() {
+  std::uint64_t count;
+  [[maybe_unused]] const auto ret = ::read(event_fd_, &count, sizeof count);
+
+  std::vector<std::uint32_t> indices;
+  {
+    std::lock_guard lock{mutex_};
+    indices.swap(completed_);
+  }
+  return indices;
+}
+
+frame_verifier::stats frame_verifier::get_stats() const {
+  std::lock_guard lock{mutex_};
+  auto s = stats_;
+  s.run_time = std::chrono::steady_clock::now() - start_time_;
+  return s;
+}
+
+void frame_verifier::run() {
+  // the checks must never hold up the display loop or the other workers
+  ::setpriority(PRIO_PROCESS, static_cast<::id_t>(::gettid()), 19);
+
+  for (;;) {
+    frame f{};
+    {
+      std::unique_lock lock{mutex_};
+      cv_.wait(lock, [this] { return stopping_ || pending_; });
+      if (stopping_) {
+        break;
+      }
+      f = *pending_;
+      pending_.reset();
+    }
+
+    ::dma_buf_sync sync{};
+    sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ;
+    ::ioctl(f.dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync);
+
+    const auto mismatches = check(f);
+
+    sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ;
+    ::ioctl(f.dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync);
+
+    {
+      std::lock_guard lock{mutex_};
+      completed_.push_back(f.index);
+      busy_ = false;
+      ++stats_.frames_checked;
+      stats_.frames_failed += mismatches > 0;
+      stats_.samples_checked += samples_;
+      stats_.mismatches += mismatches;
+      stats_.cpu_time = thread_cpu_time();
+    }
+
+    const std::uint64_t one = 1;
+    [[maybe_unused]] const auto ret = ::write(event_fd_, &one, sizeof one);
+  }
+}
+
+std::uint64_t frame_verifier::check(const frame& f) {
+  const auto p = make_fractal_params(f.x0, f.y0, f.dx, f.dy, f.cr, f.ci);
+
+  // in address order, so the buffer is read front to back
+  std::uniform_int_distribution<std::uint32_t> pixel{0, f.width * f.height - 1};
+  std::generate(points_.begin(), points_.end(), [&] { return pixel(rng_); });
+  std::sort(points_.begin(), points_.end());
+
+  // the generator steps z0 by adding dx and dy, which wraps the same way as this
+  for (std::size_t n = 0; n < samples_; ++n) {
+    const auto x = points_[n] % f.width;
+    const auto y = points_[n] / f.width;
+    zr_[n] = static_cast<std::int32_t>(-p.x0 + x * p.dx);
+    zi_[n] = static_cast<std::int32_t>(-p.y0 + y * p.dy);
+  }
+  render_points(zr_.data(), zi_.data(), samples_, p.cr, p.ci, f.max_iterations, counts_.data());
+
+  const auto& palette = colorizer_palette(f.mode);
+  const auto now = std::chrono::steady_clock::now();
+  const auto report = now - last_report_ >= report_interval;
+
+  std::uint64_t mismatches = 0;
+  for (std::size_t n = 0; n < samples_; ++n) {
+    const auto x = points_[n] % f.width;
+    const auto y = points_[n] / f.width;
+    std::uint32_t got;
+    std::memcpy(&got, f.data + std::size_t{y} * f.stride + std::size_t{x} * 4, sizeof got);
+    got &= 0xffffffu;
+
+    const auto [r, g, b] = palette[counts_[n]];
+    const auto expected = std::uint32_t{r} << 16 | std::uint32_t{g} << 8 | b;
+    if (got == expected) {
+      continue;
+    }
+
+    if (++mismatches == 1 && report) {
+      std::fprintf(stderr,
+                   "verify: frame %u, pixel (%u, %u) is %06x, expected %06x (%u iterations)",
+                   f.sequence, x, y, got, expected, counts_[n]);
+      if (unreported_ > 0) {
+        std::fprintf(stderr, "; %llu more since the last report",
+                     static_cast<unsigned long long>(unreported_));
+        unreported_ = 0;
+      }
+      std::fputc('\n', stderr);
+      last_report_ = now;
+    } else {
+      ++unreported_;
+    }
+  }
+  return mismatches;
+}
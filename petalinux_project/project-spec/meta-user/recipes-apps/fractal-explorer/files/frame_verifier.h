@@ -0,0 +1,95 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "fractal.h"
+
+// Checks captured frames against the software model on a background thread.
+//
+// Of each frame passed to submit(), a random sample of pixels is rendered again from the
+// parameters the frame was generated with and compared with the buffer, colour for colour. Pixels
+// that differ are counted and reported on stderr, a few a second at most. One frame is checked at
+// a time, and frames are turned down while that one is, or while the thread has used more than its
+// share of a core since it started, so it can be left on; the thread runs at the lowest priority.
+// Like the recorder, the caller leases a buffer with submit() and gets its index back from
+// completed() once it has been read; event_fd() becomes readable at that point.
+class frame_verifier {
+public:
+  struct frame {
+    std::uint32_t index;
+    const std::uint8_t* data; // BGRX32
+    int dmabuf_fd;
+    std::uint32_t width;
+    std::uint32_t height;
+    std::uint32_t stride;
+    std::uint32_t sequence;
+    double x0, y0, dx, dy, cr, ci;
+    std::uint32_t max_iterations; // the generator's iteration limit for the frame
+    color_mode mode;
+  };
+
+  struct stats {
+    std::uint64_t frames_checked;
+    std::uint64_t frames_failed; // with at least one pixel that differs
+    std::uint64_t frames_skipped; // turned down by submit()
+    std::uint64_t samples_checked;
+    std::uint64_t mismatches;
+    std::chrono::nanoseconds cpu_time; // of the checking thread
+    std::chrono::nanoseconds run_time; // since it started
+  };
+
+  // `samples` pixels are checked in each frame; `budget` is the share of one core the checking may
+  // take, e.g. 0.02
+  frame_verifier(std::uint32_t samples, double budget);
+  ~frame_verifier();
+
+  frame_verifier(const frame_verifier&) = delete;
+  frame_verifier& operator=(const frame_verifier&) = delete;
+
+  int event_fd() const {
+    return event_fd_;
+  }
+
+  // false if the frame was turned down, in which case the buffer is not leased
+  bool submit(const frame& f);
+
+  // indices of the buffers done with since the last call
+  std::vector<std::uint32_t> completed();
+
+  stats get_stats() const;
+
+private:
+  void run();
+  std::uint64_t check(const frame& f);
+
+  std::uint32_t samples_;
+  double budget_;
+  int event_fd_;
+
+  // sample points and their counts, reused from frame to frame
+  std::vector<std::uint32_t> points_;
+  std::vector<std::int32_t> zr_;
+  std::vector<std::int32_t> zi_;
+  std::vector<std::uint8_t> counts_;
+  std::mt19937 rng_;
+  std::chrono::steady_clock::time_point last_report_;
+  std::uint64_t unreported_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::optional<frame> pending_;
+  bool busy_;
+  std::vector<std::uint32_t> completed_;
+  std::chrono::steady_clock::time_point start_time_;
+  stats stats_;
+  bool stopping_;
+
+  std::thread thread_;
+};
@@ -0,0 +1,209 @@
+#include "gamepad.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/input.h>
+}
+
+using namespace std::string_literals;
+
+static constexpr std::uint8_t unused = 0xff;
+static constexpr auto bits_per_long = sizeof(unsigned long) * CHAR_BIT;
+
+template <std::size_t Bits>
+using bitmap = std::array<unsigned long, (Bits + bits_per_long - 1) / bits_per_long>;
+
+static bool test_bit(const unsigned long* map, std::size_t n) {
+  return map[n / bits_per_long] >> (n % bits_per_long) & 1;
+}
+
+static std::chrono::nanoseconds monotonic_now() {
+  ::timespec ts{};
+  ::clock_gettime(CLOCK_MONOTONIC, &ts);
+  return std::chrono::seconds{ts.tv_sec} + std::chrono::nanoseconds{ts.tv_nsec};
+}
+
+gamepad::gamepad(const char* path)
+    : fd_{-1},
+      num_axes_{0},
+      num_buttons_{0},
+      axis_numbers_(ABS_CNT, unused),
+      button_numbers_(KEY_CNT, unused),
+      dropped_{false} {
+  fd_ = ::open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd_ < 0) {
+    throw std::runtime_error{"failed to open "s + path + ": "s + std::strerror(errno)};
+  }
+
+  try {
+    bitmap<KEY_CNT> keys{};
+    bitmap<ABS_CNT> abs{};
+    if (::ioctl(fd_, EVIOCGBIT(EV_KEY, sizeof keys), keys.data()) < 0 ||
+        ::ioctl(fd_, EVIOCGBIT(EV_ABS, sizeof abs), abs.data()) < 0) {
+      throw std::runtime_error{"EVIOCGBIT: "s + std::strerror(errno)};
+    }
+
+    // what the joystick interface would have taken on
+    bool joystick = false;
+    for (auto code = BTN_JOYSTICK; code < BTN_DIGI && !joystick; ++code) {
+      joystick = test_bit(keys.data(), code);
+    }
+    if (!joystick) {
+      throw std::runtime_error{path + " is no gamepad"s};
+    }
+
+    // timestamps on the clock everything else is measured with, rather than the wall clock
+    int clock = CLOCK_MONOTONIC;
+    if (::ioctl(fd_, EVIOCSCLOCKID, &clock) < 0) {
+      throw std::runtime_error{"EVIOCSCLOCKID: "s + std::strerror(errno)};
+    }
+
+    char name[256]{};
+    if (::ioctl(fd_, EVIOCGNAME(sizeof name - 1), name) >= 0) {
+      name_ = name;
+    }
+
+    // numbered as the joystick interface does
+    const auto add_button = [this](std::size_t code) {
+      if (num_buttons_ < unused) {
+        button_numbers_[code] = num_buttons_++;
+        button_codes_.push_back(static_cast<std::uint16_t>(code));
+      }
+    };
+    for (std::size_t code = BTN_JOYSTICK; code < KEY_CNT; ++code) {
+      if (test_bit(keys.data(), code)) {
+        add_button(code);
+      }
+    }
+    for (std::size_t code = BTN_MISC; code < BTN_JOYSTICK; ++code) {
+      if (test_bit(keys.data(), code)) {
+        add_button(code);
+      }
+    }
+
+    for (std::size_t code = 0; code < ABS_CNT && num_axes_ < unused; ++code) {
+      if (!test_bit(abs.data(), code)) {
+        continue;
+      }
+
+      ::input_absinfo info{};
+      if (::ioctl(fd_, EVIOCGABS(code), &info) < 0) {
+        throw std::runtime_error{"EVIOCGABS: "s + std::strerror(errno)};
+      }
+      axis_numbers_[code] = num_axes_++;
+      axis_codes_.push_back(static_cast<std::uint16_t>(code));
+      ranges_.push_back({
+          info.minimum + (info.maximum - info.minimum) / 2,
+          std::max((info.maximum - info.minimum) / 2, 1),
+          info.flat,
+      });
+    }
+  } catch (...) {
+    ::close(fd_);
+    throw;
+  }
+
+  axes_.resize(num_axes_);
+  buttons_.resize(num_buttons_);
+}
+
+gamepad::~gamepad() {
+  ::close(fd_);
+}
+
+bool gamepad::read(std::vector<event>& events) {
+  for (;;) {
+    ::input_event buf[64];
+    const auto len = ::read(fd_, buf, sizeof buf);
+    if (len < 0) {
+      return errno == EAGAIN || errno == EINTR;
+    }
+    if (len == 0) {
+      return false;
+    }
+
+    for (std::size_t n = 0; n < static_cast<std::size_t>(len) / sizeof buf[0]; ++n) {
+      const auto& e = buf[n];
+      const auto time =
+          std::chrono::seconds{e.input_event_sec} + std::chrono::microseconds{e.input_event_usec};
+
+      if (e.type == EV_SYN) {
+        if (e.code == SYN_DROPPED) {
+          dropped_ = true;
+        } else if (e.code == SYN_REPORT && dropped_) {
+          dropped_ = false;
+          sync(time, events);
+        }
+        continue;
+      }
+
+      if (dropped_) {
+        continue;
+      }
+
+      if (e.type == EV_KEY && e.code < KEY_CNT && button_numbers_[e.code] != unused) {
+        // held keys repeat with a value of 2
+        set(event::kind::button, button_numbers_[e.code], e.value != 0, time, events);
+      } else if (e.type == EV_ABS && e.code < ABS_CNT && axis_numbers_[e.code] != unused) {
+        const auto number = axis_numbers_[e.code];
+        set(event::kind::axis, number, scale_axis(number, e.value), time, events);
+      }
+    }
+
+    if (static_cast<std::size_t>(len) < sizeof buf) {
+      return true;
+    }
+  }
+}
+
+void gamepad::sync(std::vector<event>& events) {
+  sync(monotonic_now(), events);
+}
+
+void gamepad::sync(std::chrono::nanoseconds time, std::vector<event>& events) {
+  bitmap<KEY_CNT> keys{};
+  if (::ioctl(fd_, EVIOCGKEY(sizeof keys), keys.data()) >= 0) {
+    for (std::size_t n = 0; n < num_buttons_; ++n) {
+      const auto held = test_bit(keys.data(), button_codes_[n]);
+      set(event::kind::button, static_cast<std::uint8_t>(n), held, time, events);
+    }
+  }
+
+  for (std::size_t n = 0; n < num_axes_; ++n) {
+    ::input_absinfo info{};
+    if (::ioctl(fd_, EVIOCGABS(axis_codes_[n]), &info) >= 0) {
+      set(event::kind::axis, static_cast<std::uint8_t>(n), scale_axis(n, info.value), time,
+          events);
+    }
+  }
+}
+
+std::int16_t gamepad::scale_axis(std::size_t number, std::int32_t value) const {
+  const auto& r = ranges_[number];
+  const auto offset = std::int64_t{value} - r.centre;
+  if (std::abs(offset) <= r.flat) {
+    return 0;
+  }
+  return static_cast<std::int16_t>(std::clamp<std::int64_t>(offset * 32767 / r.half_range,
+                                                            -32767, 32767));
+}
+
+void gamepad::set(event::kind type, std::uint8_t number, std::int16_t value,
+                  std::chrono::nanoseconds time, std::vector<event>& events) {
+  auto& state = type == event::kind::axis ? axes_[number] : buttons_[number];
+  if (state != value) {
+    state = value;
+    events.push_back({type, number, value, time});
+  }
+}
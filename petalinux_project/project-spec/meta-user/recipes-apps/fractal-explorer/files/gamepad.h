@@ -0,0 +1,89 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A gamepad read through evdev.
+//
+// Everything pending is read on each call to read(), with the times the kernel stamped the events
+// with on CLOCK_MONOTONIC, the clock of the capture and vblank timestamps. Axes and buttons are
+// numbered as the joystick API numbers them, in the order of their codes, with buttons from
+// BTN_JOYSTICK on first, and axes are scaled to -32767 to 32767 around their centre, so the
+// controls are the same whichever interface a pad would be read through. Any device with joystick
+// or gamepad buttons will do, including one made with uinput.
+class gamepad {
+public:
+  struct event {
+    enum class kind : std::uint8_t {
+      axis,
+      button,
+    };
+
+    kind type;
+    std::uint8_t number;
+    std::int16_t value;
+    std::chrono::nanoseconds time; // CLOCK_MONOTONIC
+  };
+
+  // throws std::runtime_error if `path` cannot be opened or is no gamepad
+  explicit gamepad(const char* path);
+  ~gamepad();
+
+  gamepad(const gamepad&) = delete;
+  gamepad& operator=(const gamepad&) = delete;
+
+  int fd() const {
+    return fd_;
+  }
+
+  const std::string& name() const {
+    return name_;
+  }
+
+  std::uint8_t num_axes() const {
+    return num_axes_;
+  }
+
+  std::uint8_t num_buttons() const {
+    return num_buttons_;
+  }
+
+  // Appends the changes pending, in order, to `events`; false once the device is gone. Events the
+  // kernel had to drop are made up for by reading the state again, as of the next report.
+  bool read(std::vector<event>& events);
+
+  // Appends what differs between the device's state and the one known, as of now. The state starts
+  // out released and centred, so this is called once the pad is opened for what is held already.
+  void sync(std::vector<event>& events);
+
+private:
+  void sync(std::chrono::nanoseconds time, std::vector<event>& events);
+  std::int16_t scale_axis(std::size_t number, std::int32_t value) const;
+  void set(event::kind type, std::uint8_t number, std::int16_t value,
+           std::chrono::nanoseconds time, std::vector<event>& events);
+
+  int fd_;
+  std::string name_;
+  std::uint8_t num_axes_;
+  std::uint8_t num_buttons_;
+
+  // from the event codes to the numbers, 0xff for codes that are not used
+  std::vector<std::uint8_t> axis_numbers_;
+  std::vector<std::uint8_t> button_numbers_;
+  std::vector<std::uint16_t> axis_codes_;
+  std::vector<std::uint16_t> button_codes_;
+
+  struct axis_range {
+    std::int32_t centre;
+    std::int32_t half_range;
+    std::int32_t flat;
+  };
+  std::vector<axis_range> ranges_;
+
+  std::vector<std::int16_t> axes_;
+  std::vector<std::int16_t> buttons_;
+  bool dropped_; // events are skipped up to the next report
+};
@@ -0,0 +1,131 @@
+#include "iteration_governor.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// share of the escaped points that may escape within the top eighth of the limit before it is
+// raised, and the share the limit is lowered to just above; the gap keeps it from hunting
+constexpr double late_threshold = 0.005;
+constexpr double kept_share = 0.998;
+
+// the predicted frame time is kept this far below the target, for frames that cost more than
+// the last one
+constexpr double time_headroom = 0.9;
+
+// weight of the newest frame in the smoothed cost and histogram
+constexpr double smoothing = 0.25;
+
+// the limit grows by at most this much per frame, and by at least 8
+std::uint32_t step_up(std::uint32_t limit) {
+  return limit + std::max(limit / 4, 8u);
+}
+
+} // namespace
+
+iteration_governor::iteration_governor(std::chrono::nanoseconds target_frame_time,
+                                       std::uint32_t min_iterations, std::uint32_t max_iterations)
+    : target_{target_frame_time},
+      min_bound_{std::clamp(min_iterations, 1u, fractal_max_iterations)},
+      max_bound_{std::clamp(max_iterations, min_bound_, fractal_max_iterations)},
+      min_{min_bound_},
+      max_{max_bound_},
+      limit_{std::clamp(64u, min_, max_)},
+      iteration_cost_ns_{0.0},
+      escaped_{},
+      state_{limit_, 0.0f, 0.0f, 0.0f, false} {}
+
+void iteration_governor::set_ceiling(std::uint32_t ceiling) {
+  max_ = std::clamp(ceiling, 1u, max_bound_);
+  min_ = std::min(min_bound_, max_);
+  limit_ = std::clamp(limit_, min_, max_);
+  state_.max_iterations = limit_;
+}
+
+void iteration_governor::update(const fractal_histogram& histogram,
+                                std::chrono::nanoseconds frame_time, double floor_share) {
+  const auto limit = limit_;
+
+  // prefix sums over the counts below the limit: points, and iterations including the final
+  // escape test, which is what a point costs
+  std::array<double, 257> points{};
+  std::array<double, 257> iterations{};
+  for (std::uint32_t n = 0; n < limit; ++n) {
+    points[n + 1] = points[n] + histogram[n];
+    iterations[n + 1] = iterations[n] + static_cast<double>(histogram[n]) * (n + 1);
+  }
+  const auto escaped = points[limit];
+  const auto total = escaped + histogram[limit];
+  if (total == 0) {
+    return;
+  }
+  const auto spent = iterations[limit] + static_cast<double>(histogram[limit]) * (limit + 1);
+
+  const auto cost = static_cast<double>(frame_time.count()) / spent;
+  iteration_cost_ns_ =
+      iteration_cost_ns_ > 0.0 ? iteration_cost_ns_ + (cost - iteration_cost_ns_) * smoothing : cost;
+
+  for (std::uint32_t n = 0; n < escaped_.size(); ++n) {
+    const auto share = n < limit && escaped > 0 ? histogram[n] / escaped : 0.0;
+    escaped_[n] += static_cast<float>((share - escaped_[n]) * smoothing);
+  }
+
+  const auto late_from = limit - std::max(limit / 8, 1u);
+  const auto late = escaped > 0 ? (escaped - points[late_from]) / escaped : 0.0;
+
+  // what the detail in this frame calls for; a frame where nothing escaped tells nothing
+  auto wanted = limit;
+  if (late > late_threshold) {
+    wanted = step_up(limit);
+  } else if (escaped > 0) {
+    std::uint32_t kept = 0;
+    while (points[kept + 1] < escaped * kept_share) {
+      ++kept;
+    }
+    wanted = kept + kept / 4 + 8;
+  }
+  wanted = std::clamp(std::min(wanted, step_up(limit)), min_, max_);
+
+  // iterations a frame like this would take at another limit; escaped points above it would stop
+  // there and those that reached this one would go on to it
+  const auto predicted_ns = [&](std::uint32_t l) {
+    const auto below = std::min(l, limit);
+    return (iterations[below] + (total - points[below]) * (l + 1)) * iteration_cost_ns_ *
+           floor_share;
+  };
+  const auto budget = static_cast<double>(target_.count()) * time_headroom;
+  auto next = wanted;
+  while (next > min_ && predicted_ns(next) > budget) {
+    --next;
+  }
+
+  limit_ = next;
+  state_ = {
+      limit_,
+      static_cast<float>(frame_time.count() / 1e6),
+      static_cast<float>(late),
+      static_cast<float>(histogram[limit] / total),
+      next < wanted,
+  };
+}
+
+std::array<std::uint8_t, 256> iteration_governor::color_map() const {
+  std::array<std::uint8_t, 256> map;
+  map.fill(255);
+
+  double total = 0.0;
+  for (std::uint32_t n = 0; n < limit_; ++n) {
+    total += escaped_[n];
+  }
+
+  // each count goes where the points below it end, so the outermost ones stay at the first entry;
+  // before there is a histogram, counts are stretched over the palette
+  double below = 0.0;
+  for (std::uint32_t n = 0; n < limit_; ++n) {
+    const auto position = total > 0.0 ? below / total : static_cast<double>(n) / limit_;
+    map[n] = static_cast<std::uint8_t>(std::lround(position * 254));
+    below += escaped_[n];
+  }
+  return map;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+#include "fractal_engine.h"
+
+// Picks the iteration limit of software-rendered frames from the counts of the frames before.
+//
+// The generator iterates every point up to fractal_max_iterations, which a CPU cannot afford. After
+// each frame the governor looks at its count histogram: when a noticeable share of the points that
+// escaped did so just below the limit, detail is being cut off and the limit goes up, as it has to
+// when zooming in; when nearly all of them escaped well below it, the limit comes down to just
+// above them. The limit is then capped so that the frame time predicted from the histogram, at the
+// measured cost of an iteration, stays within the target.
+//
+// The histograms of recent frames are also what the colours are normalized with: the escaped
+// counts are spread over the palette by their share of the image (histogram equalization), so the
+// picture keeps its contrast whatever the limit is.
+class iteration_governor {
+public:
+  struct state {
+    std::uint32_t max_iterations;
+    float frame_time_ms;   // of the last frame
+    float late_fraction;   // of the escaped points, those within the top eighth of the limit
+    float inside_fraction; // points that reached the limit
+    bool time_bound;       // the limit is held down by the target frame time
+  };
+
+  // the limit stays within [min_iterations, max_iterations]; equal bounds fix it
+  iteration_governor(std::chrono::nanoseconds target_frame_time, std::uint32_t min_iterations = 32,
+                     std::uint32_t max_iterations = fractal_max_iterations);
+
+  std::chrono::nanoseconds target_frame_time() const {
+    return target_;
+  }
+
+  // limit for the next frame
+  std::uint32_t max_iterations() const {
+    return limit_;
+  }
+
+  // Holds the limit at or below `ceiling`, under the minimum given if need be; a ceiling of
+  // fractal_max_iterations lifts it.
+  void set_ceiling(std::uint32_t ceiling);
+
+  // Feeds back a frame rendered with max_iterations() and how long it took. When frames can be
+  // rendered smaller, `floor_share` is the share of this frame's pixels the smallest one has; the
+  // limit is only held down to what fits the target at that size.
+  void update(const fractal_histogram& histogram, std::chrono::nanoseconds frame_time,
+              double floor_share = 1.0);
+
+  // palette index of each count, for frames rendered with max_iterations(); points that reached
+  // the limit take the last one, as they do in the generator's frames
+  std::array<std::uint8_t, 256> color_map() const;
+
+  state get_state() const {
+    return state_;
+  }
+
+private:
+  std::chrono::nanoseconds target_;
+  std::uint32_t min_bound_;
+  std::uint32_t max_bound_;
+  std::uint32_t min_; // the bounds under the ceiling
+  std::uint32_t max_;
+  std::uint32_t limit_;
+
+  double iteration_cost_ns_; // smoothed, 0 until the first frame
+  std::array<float, 256> escaped_; // smoothed share of the escaped points with each count
+  state state_;
+};
@@ -0,0 +1,653 @@
+#include "itmap.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define ITMAP_NEON 1
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#define ITMAP_SSE2 1
+#include <emmintrin.h>
+#endif
+
+using namespace std::string_literals;
+
+namespace {
+
+enum row_predictor : std::uint8_t {
+  predict_none,
+  predict_up,
+  predict_previous,
+};
+
+constexpr std::size_t max_zero_run = 128;
+constexpr std::size_t max_literal_run = 64;
+constexpr std::size_t max_packed_run = 128; // residuals, two per byte
+
+constexpr std::uint8_t literal_token = 0x80;
+constexpr std::uint8_t packed_token = 0xc0;
+
+// out = a - b
+void subtract_rows(const std::uint8_t* a, const std::uint8_t* b, std::uint8_t* out, std::size_t n) {
+  std::size_t i = 0;
+#if defined(ITMAP_NEON)
+  for (; i + 16 <= n; i += 16) {
+    vst1q_u8(out + i, vsubq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+  }
+#elif defined(ITMAP_SSE2)
+  for (; i + 16 <= n; i += 16) {
+    const auto va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+    const auto vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_sub_epi8(va, vb));
+  }
+#endif
+  for (; i < n; ++i) {
+    out[i] = static_cast<std::uint8_t>(a[i] - b[i]);
+  }
+}
+
+// out = a + b
+void add_rows(const std::uint8_t* a, const std::uint8_t* b, std::uint8_t* out, std::size_t n) {
+  std::size_t i = 0;
+#if defined(ITMAP_NEON)
+  for (; i + 16 <= n; i += 16) {
+    vst1q_u8(out + i, vaddq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+  }
+#elif defined(ITMAP_SSE2)
+  for (; i + 16 <= n; i += 16) {
+    const auto va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+    const auto vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_add_epi8(va, vb));
+  }
+#endif
+  for (; i < n; ++i) {
+    out[i] = static_cast<std::uint8_t>(a[i] + b[i]);
+  }
+}
+
+#if defined(ITMAP_NEON)
+// one nibble per byte of a comparison result
+std::uint64_t neon_mask(uint8x16_t cmp) {
+  const auto narrowed = vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4);
+  return vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+}
+#endif
+
+std::size_t count_zeros(const std::uint8_t* p, std::size_t n) {
+  std::size_t count = 0;
+  std::size_t i = 0;
+#if defined(ITMAP_NEON)
+  const auto zero = vdupq_n_u8(0);
+  while (i + 16 <= n) {
+    // 16-bit lanes gain at most 2 per step
+    auto acc = vdupq_n_u16(0);
+    for (std::size_t j = 0; j < 16384 && i + 16 <= n; ++j, i += 16) {
+      acc = vpadalq_u8(acc, vshrq_n_u8(vceqq_u8(vld1q_u8(p + i), zero), 7));
+    }
+    count += vaddlvq_u16(acc);
+  }
+#elif defined(ITMAP_SSE2)
+  const auto zero = _mm_setzero_si128();
+  const auto one = _mm_set1_epi8(1);
+  auto acc = _mm_setzero_si128();
+  for (; i + 16 <= n; i += 16) {
+    const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+    const auto ones = _mm_and_si128(_mm_cmpeq_epi8(v, zero), one);
+    acc = _mm_add_epi64(acc, _mm_sad_epu8(ones, zero));
+  }
+  count += static_cast<std::size_t>(_mm_cvtsi128_si32(acc)) +
+           static_cast<std::size_t>(_mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+#endif
+  for (; i < n; ++i) {
+    count += p[i] == 0;
+  }
+  return count;
+}
+
+// number of leading zero bytes
+std::size_t zero_run_length(const std::uint8_t* p, std::size_t n) {
+  std::size_t i = 0;
+#if defined(ITMAP_NEON)
+  const auto zero = vdupq_n_u8(0);
+  for (; i + 16 <= n; i += 16) {
+    const auto nonzero = ~neon_mask(vceqq_u8(vld1q_u8(p + i), zero));
+    if (nonzero) {
+      return i + static_cast<std::size_t>(__builtin_ctzll(nonzero)) / 4;
+    }
+  }
+#elif defined(ITMAP_SSE2)
+  const auto zero = _mm_setzero_si128();
+  for (; i + 16 <= n; i += 16) {
+    const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+    const auto nonzero = ~_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) & 0xffff;
+    if (nonzero) {
+      return i + static_cast<std::size_t>(__builtin_ctz(nonzero));
+    }
+  }
+#endif
+  for (; i < n && p[i] == 0; ++i) {
+  }
+  return i;
+}
+
+#if defined(ITMAP_NEON)
+// residuals in [-8, 7]
+uint8x16_t neon_small(uint8x16_t v) {
+  return vcltq_u8(vaddq_u8(v, vdupq_n_u8(8)), vdupq_n_u8(16));
+}
+#elif defined(ITMAP_SSE2)
+__m128i sse2_small(__m128i v) {
+  const auto t = _mm_add_epi8(v, _mm_set1_epi8(8));
+  return _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(15)), t);
+}
+#endif
+
+bool is_small(std::uint8_t r) {
+  return static_cast<std::uint8_t>(r + 8) < 16;
+}
+
+// number of leading residuals that fit in a nibble, stopping where four zeros begin so that longer
+// zero runs are left to run tokens
+std::size_t packed_run_length(const std::uint8_t* p, std::size_t n) {
+  std::size_t i = 0;
+#if defined(ITMAP_NEON)
+  const auto zero = vdupq_n_u8(0);
+  for (; i + 19 <= n; i += 16) {
+    const auto z0 = vceqq_u8(vld1q_u8(p + i), zero);
+    const auto z1 = vceqq_u8(vld1q_u8(p + i + 1), zero);
+    const auto z2 = vceqq_u8(vld1q_u8(p + i + 2), zero);
+    const auto z3 = vceqq_u8(vld1q_u8(p + i + 3), zero);
+    const auto zeros = vandq_u8(vandq_u8(z0, z1), vandq_u8(z2, z3));
+    const auto stop = neon_mask(vorrq_u8(vmvnq_u8(neon_small(vld1q_u8(p + i))), zeros));
+    if (stop) {
+      return i + static_cast<std::size_t>(__builtin_ctzll(stop)) / 4;
+    }
+  }
+#elif defined(ITMAP_SSE2)
+  const auto zero = _mm_setzero_si128();
+  const auto load = [p](std::size_t offset) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + offset));
+  };
+  for (; i + 19 <= n; i += 16) {
+    const auto v = load(i);
+    const auto z01 = _mm_and_si128(_mm_cmpeq_epi8(v, zero), _mm_cmpeq_epi8(load(i + 1), zero));
+    const auto z23 =
+        _mm_and_si128(_mm_cmpeq_epi8(load(i + 2), zero), _mm_cmpeq_epi8(load(i + 3), zero));
+    const auto small = _mm_movemask_epi8(sse2_small(v));
+    const auto zeros = _mm_movemask_epi8(_mm_and_si128(z01, z23));
+    if (const auto stop = (~small & 0xffff) | zeros; stop) {
+      return i + static_cast<std::size_t>(__builtin_ctz(stop));
+    }
+  }
+#endif
+  for (; i < n && is_small(p[i]); ++i) {
+    if (i + 3 < n && p[i] == 0 && p[i + 1] == 0 && p[i + 2] == 0 && p[i + 3] == 0) {
+      break;
+    }
+  }
+  return i;
+}
+
+// number of leading residuals before two consecutive ones that fit in a nibble
+std::size_t literal_run_length(const std::uint8_t* p, std::size_t n) {
+  std::size_t i = 0;
+#if defined(ITMAP_NEON)
+  for (; i + 17 <= n; i += 16) {
+    const auto s0 = neon_small(vld1q_u8(p + i));
+    const auto s1 = neon_small(vld1q_u8(p + i + 1));
+    if (const auto pairs = neon_mask(vandq_u8(s0, s1)); pairs) {
+      return i + static_cast<std::size_t>(__builtin_ctzll(pairs)) / 4;
+    }
+  }
+#elif defined(ITMAP_SSE2)
+  for (; i + 17 <= n; i += 16) {
+    const auto s0 = sse2_small(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i)));
+    const auto s1 = sse2_small(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 1)));
+    if (const auto pairs = _mm_movemask_epi8(_mm_and_si128(s0, s1)); pairs) {
+      return i + static_cast<std::size_t>(__builtin_ctz(pairs));
+    }
+  }
+#endif
+  for (; i + 1 < n; ++i) {
+    if (is_small(p[i]) && is_small(p[i + 1])) {
+      return i;
+    }
+  }
+  return n;
+}
+
+// two residuals per byte, the first one in the low nibble
+void pack_nibbles(const std::uint8_t* res, std::size_t bytes, std::uint8_t* out) {
+  std::size_t i = 0;
+#if defined(ITMAP_NEON)
+  for (; i + 16 <= bytes; i += 16) {
+    const auto v = vld2q_u8(res + i * 2);
+    vst1q_u8(out + i, vorrq_u8(vandq_u8(v.val[0], vdupq_n_u8(0x0f)), vshlq_n_u8(v.val[1], 4)));
+  }
+#elif defined(ITMAP_SSE2)
+  const auto lo_mask = _mm_set1_epi16(0x000f);
+  const auto hi_mask = _mm_set1_epi16(0x00f0);
+  const auto pack = [&](std::size_t offset) {
+    const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(res + offset));
+    return _mm_or_si128(_mm_and_si128(v, lo_mask), _mm_and_si128(_mm_srli_epi16(v, 4), hi_mask));
+  };
+  for (; i + 16 <= bytes; i += 16) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                     _mm_packus_epi16(pack(i * 2), pack(i * 2 + 16)));
+  }
+#endif
+  for (; i < bytes; ++i) {
+    out[i] = static_cast<std::uint8_t>((res[i * 2] & 0x0f) | (res[i * 2 + 1] << 4));
+  }
+}
+
+void unpack_nibbles(const std::uint8_t* in, std::size_t bytes, std::uint8_t* res) {
+  std::size_t i = 0;
+#if defined(ITMAP_NEON)
+  const auto mask = vdupq_n_u8(0x0f);
+  const auto sign = vdupq_n_u8(0x08);
+  for (; i + 16 <= bytes; i += 16) {
+    const auto v = vld1q_u8(in + i);
+    uint8x16x2_t r;
+    r.val[0] = vsubq_u8(veorq_u8(vandq_u8(v, mask), sign), sign);
+    r.val[1] = vsubq_u8(veorq_u8(vshrq_n_u8(v, 4), sign), sign);
+    vst2q_u8(res + i * 2, r);
+  }
+#elif defined(ITMAP_SSE2)
+  const auto mask = _mm_set1_epi8(0x0f);
+  const auto sign = _mm_set1_epi8(0x08);
+  for (; i + 16 <= bytes; i += 16) {
+    const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    const auto lo = _mm_sub_epi8(_mm_xor_si128(_mm_and_si128(v, mask), sign), sign);
+    const auto hi =
+        _mm_sub_epi8(_mm_xor_si128(_mm_and_si128(_mm_srli_epi16(v, 4), mask), sign), sign);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(res + i * 2), _mm_unpacklo_epi8(lo, hi));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(res + i * 2 + 16), _mm_unpackhi_epi8(lo, hi));
+  }
+#endif
+  for (; i < bytes; ++i) {
+    res[i * 2] = static_cast<std::uint8_t>(((in[i] & 0x0f) ^ 0x08) - 0x08);
+    res[i * 2 + 1] = static_cast<std::uint8_t>(((in[i] >> 4) ^ 0x08) - 0x08);
+  }
+}
+
+std::uint8_t* encode_residual(const std::uint8_t* res, std::size_t n, std::uint8_t* out) {
+  std::size_t x = 0;
+  while (x < n) {
+    if (auto zeros = zero_run_length(res + x, n - x); zeros >= 2 || zeros == n - x) {
+      x += zeros;
+      for (; zeros > max_zero_run; zeros -= max_zero_run) {
+        *out++ = max_zero_run - 1;
+      }
+      *out++ = static_cast<std::uint8_t>(zeros - 1);
+      continue;
+    }
+
+    if (auto packed = packed_run_length(res + x, n - x) & ~std::size_t{1}; packed > 0) {
+      while (packed > 0) {
+        const auto len = std::min(packed, max_packed_run);
+        *out++ = static_cast<std::uint8_t>(packed_token + len / 2 - 1);
+        pack_nibbles(res + x, len / 2, out);
+        out += len / 2;
+        x += len;
+        packed -= len;
+      }
+      continue;
+    }
+
+    auto literals = std::max<std::size_t>(literal_run_length(res + x, n - x), 1);
+    while (literals > 0) {
+      const auto len = std::min(literals, max_literal_run);
+      *out++ = static_cast<std::uint8_t>(literal_token + len - 1);
+      std::memcpy(out, res + x, len);
+      out += len;
+      x += len;
+      literals -= len;
+    }
+  }
+  return out;
+}
+
+// worst case: every run is a literal of a single residual, two bytes for one; no other run costs
+// more than a byte per residual
+constexpr std::size_t max_row_payload(std::size_t width) {
+  return 1 + 2 * width;
+}
+
+} // namespace
+
+void itmap_extract_channel(
+    const std::uint8_t* src, std::uint8_t* dst, std::size_t pixels, unsigned int channel) {
+  std::size_t i = 0;
+#if defined(ITMAP_NEON)
+  for (; i + 16 <= pixels; i += 16) {
+    const auto px = vld4q_u8(src + i * 4);
+    vst1q_u8(dst + i, px.val[channel]);
+  }
+#elif defined(ITMAP_SSE2)
+  const auto shift = _mm_cvtsi32_si128(static_cast<int>(channel * 8));
+  const auto mask = _mm_set1_epi32(0xff);
+  const auto load = [&](std::size_t offset) {
+    const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + offset));
+    return _mm_and_si128(_mm_srl_epi32(v, shift), mask);
+  };
+  for (; i + 16 <= pixels; i += 16) {
+    const auto lo = _mm_packs_epi32(load(i * 4), load(i * 4 + 16));
+    const auto hi = _mm_packs_epi32(load(i * 4 + 32), load(i * 4 + 48));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(lo, hi));
+  }
+#endif
+  for (; i < pixels; ++i) {
+    dst[i] = src[i * 4 + channel];
+  }
+}
+
+itmap_encoder::itmap_encoder(const char* path, std::uint32_t width, std::uint32_t height,
+                             std::uint32_t keyframe_interval)
+    : fd_{-1},
+      width_{width},
+      height_{height},
+      keyframe_interval_{std::max<std::uint32_t>(keyframe_interval, 1)},
+      offset_{0},
+      prev_(std::size_t{width} * height),
+      residual_(std::size_t{width} * 2),
+      payload_(max_row_payload(width) * height) {
+  fd_ = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    throw std::runtime_error{"failed to open "s + path + ": "s + std::strerror(errno)};
+  }
+
+  itmap_file_header header{};
+  std::memcpy(header.magic, itmap_magic, sizeof header.magic);
+  header.version = itmap_version;
+  header.width = width_;
+  header.height = height_;
+  header.keyframe_interval = keyframe_interval_;
+  try {
+    write(&header, sizeof header);
+  } catch (...) {
+    ::close(fd_);
+    throw;
+  }
+}
+
+itmap_encoder::~itmap_encoder() {
+  itmap_trailer trailer{};
+  trailer.index_offset = offset_;
+  trailer.frame_count = index_.size();
+  std::memcpy(trailer.magic, itmap_index_magic, sizeof trailer.magic);
+
+  try {
+    write(index_.data(), index_.size() * sizeof(itmap_index_entry));
+    write(&trailer, sizeof trailer);
+  } catch (const std::exception& e) {
+    std::cerr << "itmap: " << e.what() << std::endl;
+  }
+  ::close(fd_);
+}
+
+void itmap_encoder::add_frame(
+    const std::uint8_t* data, std::size_t stride, const itmap_frame_info& info) {
+  const bool key = index_.size() % keyframe_interval_ == 0;
+  auto* const up_residual = residual_.data();
+  auto* const prev_residual = residual_.data() + width_;
+
+  auto* out = payload_.data();
+  for (std::uint32_t y = 0; y < height_; ++y) {
+    const auto* row = data + y * stride;
+    auto* const prev_row = prev_.data() + std::size_t{y} * width_;
+
+    if (y == 0 && key) {
+      *out++ = predict_none;
+      out = encode_residual(row, width_, out);
+    } else if (y == 0) {
+      subtract_rows(row, prev_row, prev_residual, width_);
+      *out++ = predict_previous;
+      out = encode_residual(prev_residual, width_, out);
+    } else {
+      subtract_rows(row, row - stride, up_residual, width_);
+      if (!key) {
+        subtract_rows(row, prev_row, prev_residual, width_);
+      }
+      if (key || count_zeros(up_residual, width_) >= count_zeros(prev_residual, width_)) {
+        *out++ = predict_up;
+        out = encode_residual(up_residual, width_, out);
+      } else {
+        *out++ = predict_previous;
+        out = encode_residual(prev_residual, width_, out);
+      }
+    }
+
+    std::memcpy(prev_row, row, width_);
+  }
+
+  itmap_frame_header header{};
+  header.size = static_cast<std::uint32_t>(out - payload_.data());
+  header.flags = key ? itmap_flag_key : 0;
+  header.info = info;
+
+  itmap_index_entry entry{};
+  entry.offset = offset_;
+  entry.flags = header.flags;
+  entry.sequence = info.sequence;
+  entry.timestamp_ns = info.timestamp_ns;
+
+  write(&header, sizeof header);
+  write(payload_.data(), header.size);
+  index_.push_back(entry);
+}
+
+void itmap_encoder::write(const void* data, std::size_t length) {
+  const auto* p = static_cast<const std::uint8_t*>(data);
+  while (length > 0) {
+    const auto ret = ::write(fd_, p, length);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error{"write: "s + std::strerror(errno)};
+    }
+
+    p += ret;
+    length -= ret;
+    offset_ += ret;
+  }
+}
+
+itmap_reader::itmap_reader(const char* path) : data_{nullptr}, size_{0}, header_{}, decoded_{0} {
+  const auto fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error{"failed to open "s + path + ": "s + std::strerror(errno)};
+  }
+
+  struct ::stat st;
+  if (::fstat(fd, &st) == -1) {
+    ::close(fd);
+    throw std::runtime_error{"fstat: "s + std::strerror(errno)};
+  }
+  size_ = static_cast<std::size_t>(st.st_size);
+  if (size_ < sizeof header_) {
+    ::close(fd);
+    throw std::runtime_error{path + ": not an iteration map stream"s};
+  }
+
+  const auto ptr = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (ptr == MAP_FAILED) {
+    throw std::runtime_error{"mmap: "s + std::strerror(errno)};
+  }
+  data_ = static_cast<const std::uint8_t*>(ptr);
+  ::madvise(ptr, size_, MADV_SEQUENTIAL);
+
+  std::memcpy(&header_, data_, sizeof header_);
+  if (std::memcmp(header_.magic, itmap_magic, sizeof header_.magic) != 0 ||
+      header_.version != itmap_version) {
+    ::munmap(ptr, size_);
+    throw std::runtime_error{path + ": not an iteration map stream"s};
+  }
+
+  itmap_trailer trailer{};
+  if (size_ >= sizeof header_ + sizeof trailer) {
+    std::memcpy(&trailer, data_ + size_ - sizeof trailer, sizeof trailer);
+  }
+  const auto index_size = trailer.frame_count * sizeof(itmap_index_entry);
+  if (std::memcmp(trailer.magic, itmap_index_magic, sizeof trailer.magic) == 0 &&
+      trailer.index_offset + index_size + sizeof trailer == size_) {
+    index_.resize(trailer.frame_count);
+    std::memcpy(index_.data(), data_ + trailer.index_offset, index_size);
+  } else {
+    // the writer did not finish; recover every complete frame
+    std::size_t offset = sizeof header_;
+    itmap_frame_header fh;
+    while (offset + sizeof fh <= size_) {
+      std::memcpy(&fh, data_ + offset, sizeof fh);
+      if (offset + sizeof fh + fh.size > size_) {
+        break;
+      }
+      index_.push_back({offset, fh.flags, 0, fh.info.sequence, fh.info.timestamp_ns});
+      offset += sizeof fh + fh.size;
+    }
+    std::cerr << "itmap: " << path << " has no index, recovered " << index_.size() << " frames"
+              << std::endl;
+  }
+
+  current_.resize(std::size_t{header_.width} * header_.height);
+  prev_.resize(current_.size());
+}
+
+itmap_reader::~itmap_reader() {
+  ::munmap(const_cast<std::uint8_t*>(data_), size_);
+}
+
+itmap_frame_info itmap_reader::info(std::size_t frame) const {
+  // payloads have arbitrary lengths, so frame headers are not necessarily aligned
+  itmap_frame_header fh;
+  std::memcpy(&fh, data_ + index_.at(frame).offset, sizeof fh);
+  return fh.info;
+}
+
+void itmap_reader::decode(std::size_t frame, std::uint8_t* out, std::size_t stride) {
+  if (frame >= index_.size()) {
+    throw std::out_of_range{"itmap: frame out of range"};
+  }
+
+  auto key = frame;
+  while (key > 0 && !(index_[key].flags & itmap_flag_key)) {
+    --key;
+  }
+
+  // continue from the last decoded frame if it lies between the key frame and the target
+  auto next = key;
+  if (decoded_ > key && decoded_ <= frame + 1) {
+    next = decoded_;
+  }
+  for (; next <= frame; ++next) {
+    decode_one(next);
+  }
+
+  const auto width = header_.width;
+  for (std::uint32_t y = 0; y < header_.height; ++y) {
+    std::memcpy(out + y * stride, current_.data() + std::size_t{y} * width, width);
+  }
+}
+
+void itmap_reader::decode_one(std::size_t frame) {
+  decoded_ = 0;
+  current_.swap(prev_);
+
+  itmap_frame_header fh;
+  const auto offset = index_[frame].offset;
+  std::memcpy(&fh, data_ + offset, sizeof fh);
+  const auto* src = data_ + offset + sizeof fh;
+  const auto* const end = src + fh.size;
+  if (end > data_ + size_) {
+    throw std::runtime_error{"itmap: truncated frame"};
+  }
+
+  const auto corrupt = [] { return std::runtime_error{"itmap: corrupt frame"}; };
+  const auto width = header_.width;
+  std::uint8_t unpacked[max_packed_run];
+  for (std::uint32_t y = 0; y < header_.height; ++y) {
+    auto* const row = current_.data() + std::size_t{y} * width;
+    if (src == end) {
+      throw corrupt();
+    }
+
+    const std::uint8_t* pred = nullptr;
+    switch (*src++) {
+    case predict_none:
+      break;
+    case predict_up:
+      if (y == 0) {
+        throw corrupt();
+      }
+      pred = row - width;
+      break;
+    case predict_previous:
+      if (fh.flags & itmap_flag_key) {
+        throw corrupt();
+      }
+      pred = prev_.data() + std::size_t{y} * width;
+      break;
+    default:
+      throw corrupt();
+    }
+
+    for (std::size_t x = 0; x < width;) {
+      if (src == end) {
+        throw corrupt();
+      }
+      const auto token = *src++;
+      if (token < literal_token) {
+        const std::size_t n = token + 1;
+        if (x + n > width) {
+          throw corrupt();
+        }
+        if (pred) {
+          std::memcpy(row + x, pred + x, n);
+        } else {
+          std::memset(row + x, 0, n);
+        }
+        x += n;
+        continue;
+      }
+
+      const auto* residual = src;
+      std::size_t n, bytes;
+      if (token < packed_token) {
+        n = bytes = token - literal_token + 1;
+      } else {
+        bytes = token - packed_token + 1;
+        n = bytes * 2;
+      }
+      if (x + n > width || bytes > static_cast<std::size_t>(end - src)) {
+        throw corrupt();
+      }
+      if (token >= packed_token) {
+        unpack_nibbles(src, bytes, unpacked);
+        residual = unpacked;
+      }
+      if (pred) {
+        add_rows(residual, pred + x, row + x, n);
+      } else {
+        std::memcpy(row + x, residual, n);
+      }
+      src += bytes;
+      x += n;
+    }
+  }
+
+  decoded_ = frame + 1;
+}
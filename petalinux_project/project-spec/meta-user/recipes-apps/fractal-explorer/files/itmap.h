@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Compressed stream of 8-bit iteration maps.
+//
+// Every row is predicted either from the row above or from the same row of the previous frame,
+// whichever leaves more zeros, and the residual is stored as runs of zeros, runs of small values
+// packed two per byte, and literal bytes.
+// Key frames only use the row above so that decoding can start there. An index of all frames is
+// appended when the stream is closed; the reader rebuilds it by scanning if it is missing.
+//
+//   [itmap_file_header]
+//   [itmap_frame_header][payload] ...
+//   [itmap_index_entry] * frame_count
+//   [itmap_trailer]
+//
+// Payload of a row: one predictor byte, then tokens until the row is complete:
+//   0x00-0x7f  (token + 1) zeros
+//   0x80-0xbf  (token - 0x7f) literal residual bytes follow
+//   0xc0-0xff  (token - 0xbf) bytes follow, each holding two residuals in [-8, 7], low nibble first
+
+inline constexpr char itmap_magic[8] = {'F', 'R', 'A', 'C', 'I', 'T', 'M', '1'};
+inline constexpr char itmap_index_magic[8] = {'F', 'R', 'A', 'C', 'I', 'D', 'X', '1'};
+inline constexpr std::uint32_t itmap_version = 1;
+inline constexpr std::uint32_t itmap_flag_key = 1u << 0;
+
+struct itmap_file_header {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t width;
+  std::uint32_t height;
+  std::uint32_t keyframe_interval;
+};
+
+struct itmap_frame_info {
+  std::uint64_t sequence;
+  std::int64_t timestamp_ns;
+  double x0, y0, dx, dy, cr, ci;
+};
+
+struct itmap_frame_header {
+  std::uint32_t size; // payload bytes
+  std::uint32_t flags;
+  itmap_frame_info info;
+};
+
+struct itmap_index_entry {
+  std::uint64_t offset; // of the frame header
+  std::uint32_t flags;
+  std::uint32_t reserved;
+  std::uint64_t sequence;
+  std::int64_t timestamp_ns;
+};
+
+struct itmap_trailer {
+  std::uint64_t index_offset;
+  std::uint64_t frame_count;
+  char magic[8];
+};
+
+// Extracts one 8-bit channel of 32-bit pixels, e.g. the iteration count of a gray frame.
+void itmap_extract_channel(
+    const std::uint8_t* src, std::uint8_t* dst, std::size_t pixels, unsigned int channel);
+
+class itmap_encoder {
+public:
+  itmap_encoder(const char* path, std::uint32_t width, std::uint32_t height,
+                std::uint32_t keyframe_interval = 64);
+  ~itmap_encoder();
+
+  itmap_encoder(const itmap_encoder&) = delete;
+  itmap_encoder& operator=(const itmap_encoder&) = delete;
+
+  // `data` holds one byte per pixel with `stride` bytes per row
+  void add_frame(const std::uint8_t* data, std::size_t stride, const itmap_frame_info& info);
+
+  std::uint64_t frames() const {
+    return index_.size();
+  }
+
+  std::uint64_t bytes_written() const {
+    return offset_;
+  }
+
+private:
+  void write(const void* data, std::size_t length);
+
+  int fd_;
+  std::uint32_t width_;
+  std::uint32_t height_;
+  std::uint32_t keyframe_interval_;
+  std::uint64_t offset_;
+
+  std::vector<std::uint8_t> prev_;     // previous frame, tightly packed
+  std::vector<std::uint8_t> residual_; // scratch rows
+  std::vector<std::uint8_t> payload_;
+  std::vector<itmap_index_entry> index_;
+};
+
+// Random access reader over a memory mapped stream.
+class itmap_reader {
+public:
+  explicit itmap_reader(const char* path);
+  ~itmap_reader();
+
+  itmap_reader(const itmap_reader&) = delete;
+  itmap_reader& operator=(const itmap_reader&) = delete;
+
+  std::uint32_t width() const {
+    return header_.width;
+  }
+
+  std::uint32_t height() const {
+    return header_.height;
+  }
+
+  std::size_t frames() const {
+    return index_.size();
+  }
+
+  itmap_frame_info info(std::size_t frame) const;
+
+  // Decodes `frame` into `out` (one byte per pixel, `stride` bytes per row). Sequential access
+  // decodes one frame per call; seeking backwards or far ahead restarts at a key frame.
+  void decode(std::size_t frame, std::uint8_t* out, std::size_t stride);
+
+private:
+  void decode_one(std::size_t frame);
+
+  const std::uint8_t* data_;
+  std::size_t size_;
+  itmap_file_header header_;
+  std::vector<itmap_index_entry> index_;
+
+  std::vector<std::uint8_t> current_;
+  std::vector<std::uint8_t> prev_;
+  std::size_t decoded_; // index of the frame in current_ + 1, 0 if none
+};
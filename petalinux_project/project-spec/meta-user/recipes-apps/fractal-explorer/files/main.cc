@@ -1,13 +1,20 @@
+#include <algorithm>
 #include <array>
 #include <chrono>
 #include <cmath>
 #include <cstdint>
 #include <cstring>
+#include <deque>
+#include <fstream>
+#include <future>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <stdexcept>
 #include <string_view>
+#include <thread>
+#include <vector>
 
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
@@ -20,18 +27,35 @@
 #include <xf86drmMode.h>
 
 #include <cairo.h>
-#include <cairo-gl.h>
+
+#include "event_loop.h"
+#include "fractal.h"
+#include "frame_publisher.h"
+#include "frame_verifier.h"
+#include "gamepad.h"
+#include "overlay.h"
+#include "realtime.h"
+#include "recorder.h"
+#include "replay.h"
+#include "scroll_compositor.h"
+#include "snapshot.h"
+#include "software_source.h"
+#include "split_renderer.h"
 
 extern "C" {
 #include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
 #include <sys/epoll.h>
+#include <sys/inotify.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
-#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
-#include <linux/joystick.h>
+#include <linux/v4l2-subdev.h>
 #include <linux/videodev2.h>
 }
 
@@ -40,6 +64,24 @@ using namespace std::string_literals;
 
 static constexpr std::uint32_t num_buffers = 8;
 
+// fewest rows the generator is left with when the CPU renders the rest; a frame has to be longer
+// than its pipeline
+static constexpr std::uint32_t split_min_rows = 8;
+
+// the view is updated and the animation stepped this often
+static constexpr std::chrono::nanoseconds timer_interval = 10ms;
+
+// how fast the controls held down move the view, in scale_q (the log of the scale) and screen
+// pixels per second
+static constexpr double zoom_rate = 0.1;
+static constexpr double fast_zoom_rate = 1.0;
+static constexpr double pan_rate = 200.0;
+static constexpr double min_scale_q = -2.0;
+static constexpr double max_scale_q = 7.25;
+
+// the view is predicted no further ahead than this
+static constexpr std::chrono::nanoseconds max_input_lead = 100ms;
+
 static constexpr auto vertex_shader_src = R"(
 attribute vec4 a_position;
 attribute vec2 a_texCoord;
@@ -51,6 +93,40 @@ void main()
 }
 )";
 
+// u_transform moves the quad from where the frame was generated to where the current view
+// expects it: xy is the scale and zw the offset in clip space
+// u_tex_scale is the share of the texture the picture takes up, for frames rendered smaller than
+// their buffer; the sampler scales them up
+static constexpr auto frame_vertex_shader_src = R"(
+attribute vec4 a_position;
+attribute vec2 a_texCoord;
+uniform vec4 u_transform;
+uniform vec2 u_tex_scale;
+varying vec2 v_texCoord;
+void main()
+{
+   gl_Position = vec4(a_position.xy * u_transform.xy + u_transform.zw, a_position.zw);
+   v_texCoord = a_texCoord * u_tex_scale;
+}
+)";
+
+static constexpr auto blend_vertex_shader_src = R"(
+attribute vec4 a_position;
+attribute vec2 a_texCoord;
+uniform vec4 u_transform;
+uniform vec4 u_prev_transform;
+uniform vec2 u_tex_scale;
+uniform vec2 u_prev_tex_scale;
+varying vec2 v_texCoord;
+varying vec2 v_prevTexCoord;
+void main()
+{
+   gl_Position = vec4(a_position.xy * u_transform.xy + u_transform.zw, a_position.zw);
+   v_texCoord = a_texCoord * u_tex_scale;
+   v_prevTexCoord = (a_texCoord * u_prev_transform.xy + u_prev_transform.zw) * u_prev_tex_scale;
+}
+)";
+
 static constexpr auto fragment_shader_src = R"(
 #extension GL_OES_EGL_image_external: require
 precision mediump float;
@@ -62,9 +138,43 @@ void main()
 }
 )";
 
+static constexpr auto blend_fragment_shader_src = R"(
+#extension GL_OES_EGL_image_external: require
+precision mediump float;
+varying vec2 v_texCoord;
+varying vec2 v_prevTexCoord;
+uniform samplerExternalOES s_texture;
+uniform samplerExternalOES s_texture_prev;
+uniform float u_mix;
+void main()
+{
+  gl_FragColor = mix(texture2D(s_texture_prev, v_prevTexCoord), texture2D(s_texture, v_texCoord), u_mix);
+}
+)";
+
+// cairo stores ARGB32 as native-endian words, i.e. BGRA bytes on little-endian machines.
+static constexpr auto overlay_fragment_shader_src = R"(
+precision mediump float;
+varying vec2 v_texCoord;
+uniform sampler2D s_texture;
+void main()
+{
+  gl_FragColor = texture2D(s_texture, v_texCoord).bgra;
+}
+)";
+
+enum damage_flags : std::uint32_t {
+  damage_frame = 1u << 0,   // a new video buffer is ready to be shown
+  damage_overlay = 1u << 1, // the overlay text changed
+  damage_palette = 1u << 2, // the colour mode changed
+  damage_view = 1u << 3,    // the view moved and the last frame has to be reprojected
+};
+
 static ::PFNEGLCREATEIMAGEKHRPROC eglCreateImageKHR;
 static ::PFNEGLDESTROYIMAGEKHRPROC eglDestroyImageKHR;
 static ::PFNGLEGLIMAGETARGETTEXTURE2DOESPROC glEGLImageTargetTexture2DOES;
+static ::PFNGLGETPROGRAMBINARYOESPROC glGetProgramBinaryOES; // null without the extension
+static ::PFNGLPROGRAMBINARYOESPROC glProgramBinaryOES;
 
 template <class T>
 static inline T get_egl_proc(const char* proc_name) {
@@ -73,12 +183,98 @@ static inline T get_egl_proc(const char* proc_name) {
 
 class fractal_controller;
 
+// parameters of the generator registers; every captured frame is tagged with the set it was
+// generated with
+struct view_params {
+  double x0, y0, dx, dy, cr, ci;
+
+  bool operator==(const view_params&) const = default;
+};
+
+// When each phase of starting up began and ended, measured from the start. Phases may run on
+// different threads at the same time.
+class startup_timeline {
+  struct phase {
+    const char* name;
+    std::chrono::nanoseconds begin;
+    std::chrono::nanoseconds end;
+  };
+
+  std::chrono::steady_clock::time_point start_;
+  std::mutex mutex_;
+  std::vector<phase> phases_;
+  bool reported_;
+
+public:
+  startup_timeline() : start_{std::chrono::steady_clock::now()}, reported_{false} {}
+
+  // records the phase `name` from now until the returned object is destroyed
+  auto measure(const char* name) {
+    struct scope {
+      startup_timeline* timeline;
+      const char* name;
+      std::chrono::nanoseconds begin;
+
+      ~scope() {
+        timeline->add(name, begin, timeline->elapsed());
+      }
+    };
+    return scope{this, name, elapsed()};
+  }
+
+  // records an instant
+  void mark(const char* name) {
+    const auto t = elapsed();
+    add(name, t, t);
+  }
+
+  bool reported() const {
+    return reported_;
+  }
+
+  void report() {
+    ::timespec boot{};
+    ::clock_gettime(CLOCK_BOOTTIME, &boot);
+
+    std::lock_guard lock{mutex_};
+    // in the order they began; they are added as they end
+    std::stable_sort(phases_.begin(), phases_.end(), [](const phase& a, const phase& b) {
+      return a.begin < b.begin;
+    });
+    const auto ms = [](std::chrono::nanoseconds t) { return t.count() / 1e6; };
+    std::printf("startup:\n");
+    for (const auto& p : phases_) {
+      if (p.begin == p.end) {
+        std::printf("  %-24s at %8.1f ms\n", p.name, ms(p.begin));
+      } else {
+        std::printf("  %-24s %8.1f ms  (%.1f to %.1f)\n",
+                    p.name, ms(p.end - p.begin), ms(p.begin), ms(p.end));
+      }
+    }
+    std::printf("  %.2f s after boot\n", boot.tv_sec + boot.tv_nsec / 1e9);
+    std::fflush(stdout);
+    reported_ = true;
+  }
+
+private:
+  std::chrono::nanoseconds elapsed() const {
+    return std::chrono::steady_clock::now() - start_;
+  }
+
+  void add(const char* name, std::chrono::nanoseconds begin, std::chrono::nanoseconds end) {
+    std::lock_guard lock{mutex_};
+    phases_.push_back({name, begin, end});
+  }
+};
+
 struct window_context {
+  // of the frames, as negotiated with the capture device; the display scales them to its mode
   int width;
   int height;
 
   int drm_fd;
   std::uint32_t crtc_id;
+  std::uint32_t crtc_index;
   std::uint32_t connector_id;
   ::drmModeModeInfo display_mode;
 
@@ -94,56 +290,200 @@ struct window_context {
   ::EGLContext egl_context;
   ::EGLSurface egl_surface;
 
-  struct {
+  struct frame_program {
     ::GLuint program;
     ::GLuint a_position;
     ::GLuint a_tex_coord;
     ::GLuint s_texture;
+    ::GLuint s_texture_prev;
+    ::GLuint u_transform;
+    ::GLuint u_prev_transform;
+    ::GLuint u_tex_scale;
+    ::GLuint u_prev_tex_scale;
+    ::GLuint u_mix;
+  };
+
+  struct {
+    frame_program copy;
+    frame_program blend;
     ::GLuint textures[num_buffers];
   } texture;
 
-  ::cairo_device_t* cairo_device;
-  ::cairo_surface_t* cairo_surface;
+  struct {
+    ::GLuint program;
+    ::GLuint a_position;
+    ::GLuint a_tex_coord;
+    ::GLuint s_texture;
+    ::GLuint texture;
+    ::cairo_surface_t* surface;
+    bool dirty;
+    bool cache_enabled;
+  } overlay;
 
   int video_fd;
+  std::unique_ptr<replay_source> replay;     // stands in for the capture device when set
+  std::unique_ptr<software_source> software; // likewise, rendering on the CPU
+  // renders the bottom of each frame when set, below the rows the source made
+  std::unique_ptr<split_renderer> split;
+  std::uint32_t split_rows;         // asked of the source, latched by the frame it starts next
+  std::uint32_t pending_split_rows; // latched by the frame being generated
+  std::optional<std::uint32_t> split_last_sequence;
+  std::chrono::nanoseconds split_last_timestamp;
+  // When set, the generator makes frames only when asked, and while the view is panned only the
+  // strip coming into view; the rest is moved over from the latest frame.
+  std::unique_ptr<scroll_compositor> scroll;
+  struct scroll_frame {
+    std::array<std::uint32_t, 6> view; // x0, y0, dx, dy, cr, ci as written to the registers
+    std::uint32_t max_iterations;
+    color_mode mode;
+    std::int32_t shift_x, shift_y; // from the frame before, when only a region is made
+    std::optional<scroll_compositor::region> roi;
+  };
+  std::optional<scroll_frame> scroll_requested; // being generated
+  std::optional<scroll_frame> scroll_latest;    // arrived last, whole or being completed
+  std::optional<std::uint32_t> scroll_latest_index;
+  std::deque<std::uint32_t> scroll_job_bases; // frames the completions still read from
+  std::uint64_t scroll_full_frames;
   struct buffer_context {
     std::uint8_t* ptr;
     std::uint32_t length;
     std::uint32_t offset;
     int fd;
+    view_params params;
+    std::uint32_t width; // of the picture, which starts at the top left of the buffer
+    std::uint32_t height;
+    std::uint32_t max_iterations;
+    std::chrono::nanoseconds timestamp; // capture time, CLOCK_MONOTONIC
+    std::uint32_t sequence;
+    std::uint32_t refs;
   };
   std::array<buffer_context, num_buffers> video_buffers;
   std::optional<std::uint32_t> processing_buffer_index;
   std::optional<std::uint32_t> displaying_buffer_index;
+  std::optional<std::uint32_t> previous_buffer_index; // only held while blending
+  bool blend_enabled;
+
+  std::uint32_t v4l2_bytesperline;
+  std::uint32_t v4l2_queued_buffers;
+  // the generator cannot be back-pressured, so frames are dropped while nothing is queued
+  std::optional<std::chrono::steady_clock::time_point> v4l2_starved_since;
+  std::uint64_t v4l2_lost_frames; // not while scrolling, where frames wait for a buffer
+
+  std::unique_ptr<recorder> frame_recorder;
+  float record_bandwidth; // MB/s
+  bool palette_locked;    // iteration maps are being recorded from gray frames
+  std::uint64_t record_bytes_last;
+
+  // shares the frames with other local processes when set
+  std::unique_ptr<frame_publisher> publisher;
+
+  std::unique_ptr<snapshot_writer> snapshots;
+  float snapshot_time_ms; // encode time of the last still, 0 if none was taken
+
+  // checks a share of the frames against the software model when set
+  std::unique_ptr<frame_verifier> verifier;
+  double verify_fraction;
+  double verify_credit; // a frame is checked each time this reaches 1
+  // The colorizer's mode is not latched by the frames, so the ones around a change may have
+  // pixels of both palettes; none is checked until a few have gone by.
+  color_mode verify_mode;
+  std::uint32_t verify_settle_frames;
+
+  // how late the event loop wakes up for the timer, the captured frames and the vblanks, measured
+  // when set
+  struct latency_stats {
+    latency_histogram timer;
+    latency_histogram capture;
+    latency_histogram display;
+  };
+  std::unique_ptr<latency_stats> latency;
+  std::optional<std::chrono::steady_clock::time_point> latency_end; // exits then, if set
+
+  // view written to the registers, and the one latched by the frame currently being generated
+  view_params view;
+  view_params pending_view;
+  // the view as of now, which frames are reprojected to; `view` runs ahead of it while predicting
+  view_params current_view;
+  std::uint32_t pending_max_iterations; // likewise for the iteration limit
+  bool reprojection_enabled;
 
   float v4l2_fps;
   std::uint64_t v4l2_total_frames;
+  std::chrono::nanoseconds v4l2_last_timestamp; // of the latest frame, CLOCK_MONOTONIC
   std::chrono::steady_clock::time_point v4l2_fps_updated_time;
 
   float display_fps;
+  float display_refresh_rate;
   std::uint64_t display_total_frames;
+  std::uint64_t display_total_vblanks;
   std::uint64_t display_fps_updated_time;
+  std::uint64_t display_window_frames;
+  std::uint64_t display_window_vblanks;
+  std::optional<unsigned int> display_last_sequence;
+  std::chrono::nanoseconds display_last_vblank_time; // CLOCK_MONOTONIC
+
+  // frame pacing: spread of the intervals between consecutive commits
+  float display_jitter_ms;
+  std::chrono::nanoseconds display_last_commit_time;
+  double display_window_interval_sum;
+  double display_window_interval_sq_sum;
+
+  // what has to be redrawn on the next vblank; nothing is committed while this is empty
+  std::uint32_t damage;
+
+  float compositor_time_ms;
+  std::chrono::steady_clock::duration compositor_time_total;     // current stats window
+  std::chrono::steady_clock::duration compositor_time_run_total; // since startup
 
   bool running;
-  int epoll_fd;
+  std::unique_ptr<event_loop> loop;
+  std::unique_ptr<interval_timer> timer;
   int display_fd;
-  int timer_fd;
-  int joystick_fd;
+  int signal_fd;
 
   struct app_state {
     bool animation;
     std::uint64_t animation_frame;
     double cr, ci, scale, scale_q, offset_x, offset_y;
+
+    bool operator==(const app_state&) const = default;
   } app;
 
-  struct {
-    std::uint8_t num_axes;
-    std::uint8_t num_buttons;
-    std::unique_ptr<std::int16_t[]> axes;
-    std::unique_ptr<std::int16_t[]> buttons;
-  } joystick;
+  std::unique_ptr<gamepad> pad;
+  const char* pad_path;                  // the only device taken if set, else any gamepad
+  std::vector<gamepad::event> pad_events; // read at once, reused
+
+  // The controls held down, whose motion has been applied to `app` up to `input_time`. The view
+  // written runs `input_lead` ahead of it, to where it will be once the frame generated with it is
+  // shown, if `input_prediction` is set.
+  struct input_state {
+    bool zoom_in, zoom_out, fast;
+    int pan_x, pan_y; // -1, 0 or 1
+  } input;
+  std::chrono::nanoseconds input_time; // CLOCK_MONOTONIC
+  std::chrono::nanoseconds input_lead;
+  bool input_prediction;
+  latency_histogram input_latency; // from the events to the view written with them
 
   std::unique_ptr<fractal_controller> fractal_ctl;
+
+  // reported once the first captured frame has been flipped to
+  startup_timeline startup;
+  bool first_frame_flip_queued;
+
+  // watches for the gamepad to appear, which it may do at any time
+  int input_watch_fd;
+  int input_dir_watch; // of /dev/input, or -1 while only /dev is watched for it
+
+  // the vblank the display waits for, reported by libdrm, whether it flipped to a frame or not
+  struct vblank {
+    unsigned int sequence, sec, usec;
+  };
+  completion<vblank> drm_vblank;
+
+  // last, so that they are destroyed before anything they use
+  task pad_task;
+  std::vector<task> tasks;
 };
 
 static inline void perror_exit(const char* str) {
@@ -211,82 +551,94 @@ static ::GLuint create_gl_program(const char* vshader_src, const char* fshader_s
   return program;
 }
 
-template <std::size_t IntegerWidth>
-class fix {
-  std::uint32_t value_;
-
-public:
-  static constexpr std::size_t value_width = sizeof(std::uint32_t) * 8;
-  static constexpr std::size_t integer_width = IntegerWidth;
-  static constexpr std::size_t fractional_width = value_width - integer_width;
-
-  static constexpr std::uint32_t fractional_mask = (1ul << fractional_width) - 1;
-  static constexpr std::uint32_t intreger_mask = ~fractional_mask;
-
-  static_assert(integer_width < value_width);
-
-  explicit fix(std::uint32_t v) : value_{v} {};
-
-  explicit fix(double v) : value_{double_to_fix(v)} {}
-
-  static std::uint32_t double_to_fix(double v) {
-    struct {
-      std::uint64_t frac : 52;
-      std::uint64_t exp : 11;
-      std::uint64_t sign : 1;
-    } s;
-    std::memcpy(&s, &v, sizeof v);
-
-    const auto frac = static_cast<std::uint64_t>(s.frac) | (1ul << 52);
-    const auto exp = static_cast<std::int16_t>(s.exp) - 1023;
-
-    std::uint32_t ret;
-    if (const std::int32_t shift = 52 - exp - fractional_width; shift >= 0) {
-      ret = frac >> shift;
-    } else {
-      ret = frac << -shift;
+// FNV-1a of the strings, to name cached programs after what they were built from
+static std::uint64_t hash_strings(std::initializer_list<std::string_view> strings) {
+  std::uint64_t h = 0xcbf29ce484222325;
+  for (const auto s : strings) {
+    for (const auto c : s) {
+      h = (h ^ static_cast<std::uint8_t>(c)) * 0x100000001b3;
     }
-
-    return s.sign ? -ret : ret;
+    h = (h ^ 0xff) * 0x100000001b3; // so that moving text between strings changes it
   }
+  return h;
+}
 
-  inline std::uint32_t value() const {
-    return value_;
+// Like create_gl_program, but the linked program is kept in `cache_dir` with
+// GL_OES_get_program_binary and loaded from there the next time, which saves compiling the
+// shaders on every start. The file is named after the sources and the driver, so an update of
+// either builds the program anew; so does a binary the driver turns down.
+static ::GLuint load_gl_program(const char* vshader_src, const char* fshader_src,
+                                const std::string& cache_dir) {
+  if (cache_dir.empty() || !glProgramBinaryOES) {
+    return create_gl_program(vshader_src, fshader_src);
   }
 
-  inline double to_double() const {
-    if (!value_) {
-      return 0.0;
+  const auto gl_string = [](::GLenum name) {
+    const auto str = ::glGetString(name);
+    return str ? std::string_view{reinterpret_cast<const char*>(str)} : std::string_view{};
+  };
+  char name[32];
+  std::snprintf(
+      name,
+      sizeof name,
+      "%016llx.bin",
+      static_cast<unsigned long long>(hash_strings({
+          vshader_src,
+          fshader_src,
+          gl_string(GL_VENDOR),
+          gl_string(GL_RENDERER),
+          gl_string(GL_VERSION),
+      })));
+  const auto path = cache_dir + '/' + name;
+
+  // the binary format, then the binary
+  if (std::ifstream in{path, std::ios::binary}; in) {
+    ::GLenum format{};
+    std::vector<char> binary{std::istreambuf_iterator<char>{in}, {}};
+    if (binary.size() > sizeof format) {
+      std::memcpy(&format, binary.data(), sizeof format);
+
+      const auto program = ::glCreateProgram();
+      glProgramBinaryOES(program,
+                         format,
+                         binary.data() + sizeof format,
+                         static_cast<::GLint>(binary.size() - sizeof format));
+      ::GLint linked{};
+      ::glGetProgramiv(program, GL_LINK_STATUS, &linked);
+      if (linked) {
+        return program;
+      }
+      ::glDeleteProgram(program);
     }
-    return static_cast<double>(static_cast<std::int32_t>(value_)) / (1ul << fractional_width);
   }
-};
 
-enum class color_mode : std::uint8_t {
-  gray,
-  red,
-  green,
-  blue,
-  yellow,
-  cyan,
-  magenta,
-  color1,
-};
-
-color_mode next_mode(color_mode m) {
-  if (m == color_mode::color1) {
-    return color_mode::gray;
-  } else {
-    return static_cast<color_mode>(static_cast<std::uint8_t>(m) + 1);
+  const auto program = create_gl_program(vshader_src, fshader_src);
+  if (!program) {
+    return 0;
   }
-}
 
-color_mode prev_mode(color_mode m) {
-  if (m == color_mode::gray) {
-    return color_mode::color1;
-  } else {
-    return static_cast<color_mode>(static_cast<std::uint8_t>(m) - 1);
+  ::GLint length{};
+  ::glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+  if (length > 0) {
+    ::GLenum format{};
+    std::vector<char> binary(sizeof format + length);
+    glGetProgramBinaryOES(program, length, &length, &format, binary.data() + sizeof format);
+    std::memcpy(binary.data(), &format, sizeof format);
+    binary.resize(sizeof format + length);
+
+    // written aside and renamed, so that a start cut short leaves no half of one behind
+    ::mkdir(cache_dir.c_str(), 0755);
+    const auto tmp_path = path + ".tmp";
+    std::ofstream out{tmp_path, std::ios::binary};
+    out.write(binary.data(), static_cast<std::streamsize>(binary.size()));
+    out.close();
+    if (!out || ::rename(tmp_path.c_str(), path.c_str()) != 0) {
+      std::cerr << "failed to cache a GL program in " << cache_dir << std::endl;
+      ::unlink(tmp_path.c_str());
+    }
   }
+
+  return program;
 }
 
 class fractal_controller {
@@ -314,6 +666,21 @@ public:
     }
   }
 
+  // registers backed by plain memory, for running without the generator
+  fractal_controller() : fd_{-1}, reg_{static_cast<std::uint32_t*>(MAP_FAILED)} {
+    const auto s = ::sysconf(_SC_PAGESIZE);
+    if (s < 0) {
+      throw std::runtime_error{"failed to get page size: "s + std::strerror(errno)};
+    }
+    size_ = static_cast<std::size_t>(s);
+
+    reg_ = static_cast<std::uint32_t*>(
+        ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (reg_ == MAP_FAILED) {
+      throw std::runtime_error{"mmap: "s + std::strerror(errno)};
+    }
+  }
+
   ~fractal_controller() {
     if (fd_ > 0) {
       ::close(fd_);
@@ -332,12 +699,56 @@ public:
     reg_[0] = (static_cast<std::uint32_t>(mode) << 8) | (reg_[0] & ~0xf00);
   }
 
+  // rows of the frames started from now on; 0 for the height the generator was built with
+  std::uint32_t height() const {
+    return reg_[3];
+  }
+
+  void set_height(std::uint32_t height) {
+    reg_[3] = height;
+  }
+
+  // iteration limit of the frames started from now on; the points that reach it take the longest,
+  // so a lower one speeds up views with much of the set in them
+  std::uint32_t max_iter() const {
+    const auto n = reg_[1] & 0xff;
+    return n ? n : fractal_max_iterations;
+  }
+
+  void set_max_iter(std::uint32_t max_iter) {
+    reg_[1] = std::clamp(max_iter, 1u, fractal_max_iterations);
+  }
+
+  // whether frames start back to back, or only on request_frame()
+  bool auto_restart() const {
+    return reg_[0] & 0x80;
+  }
+
+  void set_auto_restart(bool enabled) {
+    reg_[0] = enabled ? reg_[0] | 0x80 : reg_[0] & ~0x80u;
+  }
+
+  // starts a frame with the registers as written so far, unless auto_restart() is set
+  void request_frame() {
+    reg_[9] = (reg_[9] + 1) & 0xff;
+  }
+
+  // part of the frames started from now on to make, all of it when `width` or `height` is 0; its
+  // pixels come one after another in lines of the frame's width, the last one padded out
+  void set_roi(std::uint32_t x, std::uint32_t y, std::uint32_t width, std::uint32_t height) {
+    reg_[5] = y << 16 | x;
+    reg_[7] = height << 16 | width;
+  }
+
 #define FRACTAL_CONTROLLER_GETTER_SETTER(name, index) \
   fix<4> name() const {                               \
     return fix<4>{reg_[index]};                       \
   }                                                   \
   void set_##name(double name) {                      \
     reg_[index] = fix<4>::double_to_fix(name);        \
+  }                                                   \
+  void set_##name(fix<4> name) {                      \
+    reg_[index] = name.value();                       \
   }
 
   FRACTAL_CONTROLLER_GETTER_SETTER(x0, 4u)
@@ -367,7 +778,7 @@ inline auto drm_mode_get_encoder(int fd, std::uint32_t encoder_id) {
       ::drmModeGetEncoder(fd, encoder_id), deleter};
 }
 
-std::tuple<std::uint32_t, std::uint32_t, ::drmModeModeInfo> init_drm(int fd) {
+std::tuple<std::uint32_t, std::uint32_t, std::uint32_t, ::drmModeModeInfo> init_drm(int fd) {
   const auto resources = drm_mode_get_resources(fd);
   if (!resources) {
     throw std::runtime_error{"drmModeGetResources"};
@@ -427,7 +838,16 @@ std::tuple<std::uint32_t, std::uint32_t, ::drmModeModeInfo> init_drm(int fd) {
     mode = &connector->modes[0];
   }
 
-  return std::make_tuple(crtc_id, connector->connector_id, *mode);
+  // vblank events address the crtc by its index rather than by its id
+  std::uint32_t crtc_index{};
+  for (int i = 0; i < resources->count_crtcs; ++i) {
+    if (resources->crtcs[i] == crtc_id) {
+      crtc_index = i;
+      break;
+    }
+  }
+
+  return std::make_tuple(crtc_id, crtc_index, connector->connector_id, *mode);
 }
 
 std::tuple<::EGLDisplay, ::EGLConfig, ::EGLContext> init_egl(::EGLDisplay display) {
@@ -500,6 +920,57 @@ static std::uint32_t get_gbm_bo_fb_id(int drm_fd, ::gbm_bo* bo) {
   return fb_id;
 }
 
+// Texture coordinates of a frame generated with `frame`, as an affine function (xy: scale,
+// zw: offset) of texture coordinates of a frame generated with `current`. A pixel (px, py) was
+// computed at z = (px * dx - x0) + (py * dy - y0)i, so both views are affine in pixel space.
+static std::array<double, 4> texcoord_transform(
+    const view_params& frame, const view_params& current, int width, int height) {
+  if (frame.dx == 0.0 || frame.dy == 0.0 || current.dx == 0.0 || current.dy == 0.0) {
+    // captured before the first parameters were written
+    return {1.0, 1.0, 0.0, 0.0};
+  }
+
+  return {
+      current.dx / frame.dx,
+      current.dy / frame.dy,
+      (frame.x0 - current.x0) / (width * frame.dx),
+      (frame.y0 - current.y0) / (height * frame.dy),
+  };
+}
+
+// Clip space transform that moves the quad of a frame generated with `frame` to where the view
+// `current` shows the same points.
+static std::array<::GLfloat, 4> reprojection_transform(
+    const view_params& frame, const view_params& current, int width, int height) {
+  const auto [ax, ay, bx, by] = texcoord_transform(frame, current, width, height);
+
+  return {
+      static_cast<::GLfloat>(1.0 / ax),
+      static_cast<::GLfloat>(1.0 / ay),
+      static_cast<::GLfloat>((1.0 - 2.0 * bx) / ax - 1.0),
+      static_cast<::GLfloat>(1.0 - (1.0 - 2.0 * by) / ay),
+  };
+}
+
+// How far the blend from the previous to the displayed frame has progressed at the next vblank.
+// The displayed frame is promoted when the one after it is captured, so the transition spans the
+// time from that capture over one generator frame interval.
+static float blend_factor(const ::window_context* ctx) {
+  const auto& prev = ctx->video_buffers[ctx->previous_buffer_index.value()];
+  const auto& cur = ctx->video_buffers[ctx->displaying_buffer_index.value()];
+  const auto& next = ctx->video_buffers[ctx->processing_buffer_index.value()];
+
+  const auto interval = cur.timestamp - prev.timestamp;
+  if (interval <= std::chrono::nanoseconds::zero()) {
+    return 1.0f;
+  }
+
+  const auto refresh_period = std::chrono::nanoseconds{1'000'000'000 / ctx->display_mode.vrefresh};
+  const auto display_time = ctx->display_last_vblank_time + refresh_period;
+
+  return std::clamp((display_time - next.timestamp) / (interval * 1.0f), 0.0f, 1.0f);
+}
+
 static void redraw_main_surface(::window_context* ctx) {
   if (!::eglMakeCurrent(ctx->egl_display, ctx->egl_surface, ctx->egl_surface, ctx->egl_context)) {
     std::cerr << "eglMakeCurrent failed" << std::endl;
@@ -531,12 +1002,53 @@ static void redraw_main_surface(::window_context* ctx) {
     };
     // clang-format on
 
-    const auto& t = ctx->texture;
+    const auto index = ctx->displaying_buffer_index.value();
+    const auto& params = ctx->video_buffers[index].params;
+
+    std::array<::GLfloat, 4> transform{1.0f, 1.0f, 0.0f, 0.0f};
+    if (ctx->reprojection_enabled) {
+      transform = reprojection_transform(params, ctx->current_view, ctx->width, ctx->height);
+    }
+
+    const auto picture_scale = [ctx](std::uint32_t i) {
+      const auto& b = ctx->video_buffers[i];
+      return std::array<::GLfloat, 2>{
+          static_cast<::GLfloat>(b.width) / ctx->width,
+          static_cast<::GLfloat>(b.height) / ctx->height,
+      };
+    };
+
+    const auto blend = ctx->previous_buffer_index && ctx->processing_buffer_index;
+    const auto mix = blend ? blend_factor(ctx) : 1.0f;
+    const auto& t = blend && mix < 1.0f ? ctx->texture.blend : ctx->texture.copy;
 
     ::glUseProgram(t.program);
 
     ::glActiveTexture(GL_TEXTURE0);
-    ::glBindTexture(GL_TEXTURE_EXTERNAL_OES, t.textures[ctx->displaying_buffer_index.value()]);
+    ::glBindTexture(GL_TEXTURE_EXTERNAL_OES, ctx->texture.textures[index]);
+
+    if (&t == &ctx->texture.blend) {
+      const auto prev_index = ctx->previous_buffer_index.value();
+      const auto prev_transform = texcoord_transform(
+          ctx->video_buffers[prev_index].params, params, ctx->width, ctx->height);
+      const ::GLfloat prev_transform_f[] = {
+          static_cast<::GLfloat>(prev_transform[0]),
+          static_cast<::GLfloat>(prev_transform[1]),
+          static_cast<::GLfloat>(prev_transform[2]),
+          static_cast<::GLfloat>(prev_transform[3]),
+      };
+
+      ::glActiveTexture(GL_TEXTURE1);
+      ::glBindTexture(GL_TEXTURE_EXTERNAL_OES, ctx->texture.textures[prev_index]);
+
+      ::glUniform1i(t.s_texture_prev, 1);
+      ::glUniform4fv(t.u_prev_transform, 1, prev_transform_f);
+      ::glUniform2f(t.u_prev_tex_scale, picture_scale(prev_index)[0], picture_scale(prev_index)[1]);
+      ::glUniform1f(t.u_mix, mix);
+
+      // keep compositing at display rate until the transition is complete
+      ctx->damage |= damage_frame;
+    }
 
     ::glVertexAttribPointer(t.a_position, 3, GL_FLOAT, GL_FALSE, 0, tex_pos);
     ::glVertexAttribPointer(t.a_tex_coord, 2, GL_FLOAT, GL_FALSE, 0, tex_coord);
@@ -545,11 +1057,18 @@ static void redraw_main_surface(::window_context* ctx) {
     ::glEnableVertexAttribArray(t.a_tex_coord);
 
     ::glUniform1i(t.s_texture, 0);
+    ::glUniform4fv(t.u_transform, 1, transform.data());
+    ::glUniform2f(t.u_tex_scale, picture_scale(index)[0], picture_scale(index)[1]);
     ::glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, indices);
 
     ::glDisableVertexAttribArray(t.a_position);
     ::glDisableVertexAttribArray(t.a_tex_coord);
     ::glUseProgram(0);
+
+    if (&t == &ctx->texture.blend) {
+      ::glBindTexture(GL_TEXTURE_EXTERNAL_OES, 0);
+      ::glActiveTexture(GL_TEXTURE0);
+    }
   }
 }
 
@@ -559,357 +1078,1533 @@ static void flush_main_surface(::window_context* ctx) {
     return;
   }
 
-  ::cairo_gl_surface_swapbuffers(ctx->cairo_surface);
+  ::eglSwapBuffers(ctx->egl_display, ctx->egl_surface);
   ::glBindTexture(GL_TEXTURE_EXTERNAL_OES, 0);
 }
 
+static void render_overlay_texture(::window_context* ctx) {
+  auto& o = ctx->overlay;
+
+  constexpr auto max_len = 2047; // overlay_max_lines of them
+  char str[max_len + 1] = {};
+  int len = 0;
+  const auto append = [&str, &len](const char* format, auto... args) {
+    if (len >= 0 && len < max_len) {
+      len += std::snprintf(str + len, max_len - len, format, args...);
+    }
+  };
+
+  append(
+      "c: %12.8f%+.8fi,  max iter: %u\n"
+      "x: %12.8f,  y:  %12.8f,  scale: %12.8f\n"
+      "\n"
+      "fps (fpga / display): %.4f / %.4f,  refresh: %.2f Hz\n"
+      "compositor: %.3f ms,  pacing jitter: %.3f ms%s\n",
+      ctx->app.cr,
+      ctx->app.ci,
+      ctx->fractal_ctl->max_iter(),
+      ctx->app.offset_x,
+      ctx->app.offset_y,
+      ctx->app.scale * ctx->app.scale,
+      ctx->v4l2_fps,
+      ctx->display_fps,
+      ctx->display_refresh_rate,
+      ctx->compositor_time_ms,
+      ctx->display_jitter_ms,
+      ctx->blend_enabled && ctx->app.animation ? ",  blending" : "");
+
+  if (ctx->frame_recorder) {
+    const auto stats = ctx->frame_recorder->get_stats();
+    append(
+        "rec: %llu frames,  %.1f MB/s,  skipped: %llu,  lost: %llu\n",
+        static_cast<unsigned long long>(stats.frames_written),
+        ctx->record_bandwidth,
+        static_cast<unsigned long long>(stats.frames_skipped),
+        static_cast<unsigned long long>(ctx->v4l2_lost_frames));
+  }
+
+  if (ctx->publisher) {
+    const auto stats = ctx->publisher->get_stats();
+    std::uint64_t lag = 0, skipped = 0;
+    for (const auto& c : stats.consumers) {
+      lag = std::max(lag, c.lag);
+      skipped += c.frames_skipped;
+    }
+    append(
+        "share: %zu consumers,  %u leased,  lag: %llu frames,  skipped: %llu\n",
+        stats.consumers.size(),
+        stats.leases_held,
+        static_cast<unsigned long long>(lag),
+        static_cast<unsigned long long>(skipped));
+  }
+
+  if (ctx->snapshot_time_ms > 0.0f) {
+    append("snapshot: %.1f ms\n", ctx->snapshot_time_ms);
+  }
+
+  if (ctx->software) {
+    const auto state = ctx->software->get_state();
+    const auto& g = state.iterations;
+    append(
+        "cpu: %.2f ms,  %ux%u (%.0f%%),  iterations: %u%s\n"
+        "late: %.2f%%,  inside: %.1f%%\n",
+        g.frame_time_ms,
+        state.width,
+        state.height,
+        state.scale * 100.0f,
+        g.max_iterations,
+        g.time_bound ? " (time bound)" : "",
+        g.late_fraction * 100.0f,
+        g.inside_fraction * 100.0f);
+  }
+
+  if (ctx->split) {
+    const auto state = ctx->split->get_state();
+    append(
+        "split: %u rows on the %s (%.1f ms),  %u on the CPU (%.1f ms)\n",
+        state.hardware_rows,
+        ctx->software ? "stand-in" : "generator",
+        state.hardware_time_ms,
+        ctx->height - state.hardware_rows,
+        state.cpu_time_ms);
+  }
+
+  if (ctx->scroll) {
+    const auto stats = ctx->scroll->get_stats();
+    const auto frames = std::max<std::uint64_t>(stats.frames_composed, 1);
+    append(
+        "scroll: %llu strips (%.1f%% of a frame, %.2f ms to compose),  %llu whole\n",
+        static_cast<unsigned long long>(stats.frames_composed),
+        100.0 * stats.pixels_generated / frames / (ctx->width * ctx->height),
+        static_cast<double>(stats.compose_time / frames / 1.0ms),
+        static_cast<unsigned long long>(ctx->scroll_full_frames));
+  }
+
+  if (ctx->verifier) {
+    const auto stats = ctx->verifier->get_stats();
+    append(
+        "verify: %llu frames,  %llu pixels,  %llu wrong%s,  cpu: %.2f%%\n",
+        static_cast<unsigned long long>(stats.frames_checked),
+        static_cast<unsigned long long>(stats.samples_checked),
+        static_cast<unsigned long long>(stats.mismatches),
+        stats.mismatches > 0 ? " (!)" : "",
+        100.0 * stats.cpu_time / std::max(stats.run_time, std::chrono::nanoseconds{1}));
+  }
+
+  if (ctx->pad && ctx->input_latency.count() > 0) {
+    append(
+        "input: %.1f ms ahead,  latency p99 / max: %.0f / %.0f us\n",
+        static_cast<double>(ctx->input_lead / 1.0ms),
+        ctx->input_latency.percentile(99.0),
+        ctx->input_latency.max());
+  }
+
+  if (ctx->latency) {
+    const auto& l = *ctx->latency;
+    append(
+        "wakeup p99 / max: timer %.0f / %.0f us,  capture %.0f / %.0f,  vblank %.0f / %.0f\n",
+        l.timer.percentile(99.0),
+        l.timer.max(),
+        l.capture.percentile(99.0),
+        l.capture.max(),
+        l.display.percentile(99.0),
+        l.display.max());
+  }
+
+  len = std::clamp(len, 0, max_len);
+  draw_overlay(o.surface, {str, static_cast<std::size_t>(len)});
+
+  ::glBindTexture(GL_TEXTURE_2D, o.texture);
+  ::glTexSubImage2D(
+      GL_TEXTURE_2D,
+      0,
+      0,
+      0,
+      overlay_width,
+      overlay_height,
+      GL_RGBA,
+      GL_UNSIGNED_BYTE,
+      ::cairo_image_surface_get_data(o.surface));
+  ::glBindTexture(GL_TEXTURE_2D, 0);
+}
+
 static void redraw_overlay_surface(::window_context* ctx) {
   if (!::eglMakeCurrent(ctx->egl_display, ctx->egl_surface, ctx->egl_surface, ctx->egl_context)) {
     std::cerr << "eglMakeCurrent failed" << std::endl;
     return;
   }
 
-  const auto width = ctx->width;
-  const auto height = ctx->height;
+  auto& o = ctx->overlay;
 
-  if (!ctx->cairo_surface) {
-    ctx->cairo_surface =
-        ::cairo_gl_surface_create_for_egl(ctx->cairo_device, ctx->egl_surface, width, height);
+  // the text only changes a few times per second; everything else is a single textured quad
+  if (o.dirty || !o.cache_enabled) {
+    render_overlay_texture(ctx);
+    o.dirty = false;
   }
-  auto cr = ::cairo_create(ctx->cairo_surface);
 
-  ::cairo_set_source_rgba(cr, 0.125, 0.125, 0.125, 0.75);
-  ::cairo_rectangle(cr, 31.5, 63.5, 497, 149);
-  ::cairo_fill_preserve(cr);
+  const auto w = static_cast<float>(ctx->display_mode.hdisplay);
+  const auto h = static_cast<float>(ctx->display_mode.vdisplay);
+  const auto left = 2.0f * overlay_x / w - 1.0f;
+  const auto right = 2.0f * (overlay_x + overlay_width) / w - 1.0f;
+  const auto top = 1.0f - 2.0f * overlay_y / h;
+  const auto bottom = 1.0f - 2.0f * (overlay_y + overlay_height) / h;
+
+  // clang-format off
+  const GLfloat tex_pos[] = {
+      left,  top,    0.0f,
+      left,  bottom, 0.0f,
+      right, bottom, 0.0f,
+      right, top,    0.0f,
+  };
+
+  static constexpr GLfloat tex_coord[] = {
+      0.0f, 0.0f,
+      0.0f, 1.0f,
+      1.0f, 1.0f,
+      1.0f, 0.0f,
+  };
 
-  ::cairo_set_line_width(cr, 1.0);
-  ::cairo_set_source_rgba(cr, 0, 0, 0, 1.0);
-  ::cairo_stroke(cr);
+  static constexpr GLushort indices[] = {
+    0, 1, 2,
+    0, 2, 3,
+  };
+  // clang-format on
 
-  ::cairo_set_source_rgba(cr, 1.0, 1.0, 1.0, 1.0);
-  ::cairo_select_font_face(cr, "monospace", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
+  ::glUseProgram(o.program);
 
-  ::cairo_set_font_size(cr, 32);
-  ::cairo_move_to(cr, 48.0, 104.0);
-  ::cairo_show_text(cr, "Julia Set Explorer");
+  ::glEnable(GL_BLEND);
+  ::glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA); // cairo surfaces are premultiplied
 
-  ::cairo_set_font_size(cr, 16);
-  ::cairo_move_to(cr, 400.0, 104.0);
-  ::cairo_show_text(cr, "by @myon___");
+  ::glActiveTexture(GL_TEXTURE0);
+  ::glBindTexture(GL_TEXTURE_2D, o.texture);
 
-  constexpr auto max_len = 255;
-  char str[max_len] = {};
-  const auto len = std::snprintf(
-      str,
-      max_len,
-      "c: %12.8f%+.8fi\n"
-      "x: %12.8f,  y:  %12.8f,  scale: %12.8f\n"
-      "\n"
-      "fps (fpga / display): %.4f / %.4f\n",
-      ctx->app.cr,
-      ctx->app.ci,
-      ctx->app.offset_x,
-      ctx->app.offset_y,
-      ctx->app.scale * ctx->app.scale,
-      ctx->v4l2_fps,
-      ctx->display_fps);
-
-  if (len >= 0) {
-    ::cairo_set_font_size(cr, 13);
-    int y = 0;
-    for (char* p = str; p <= str + len;) {
-      auto nl = std::strchr(p, '\n');
-      if (!nl) {
-        break;
-      }
-      *nl = '\0';
-      ::cairo_move_to(cr, 48.0, 134.0 + 20 * y++);
-      ::cairo_show_text(cr, p);
-      p = nl + 1;
-    }
-  }
+  ::glVertexAttribPointer(o.a_position, 3, GL_FLOAT, GL_FALSE, 0, tex_pos);
+  ::glVertexAttribPointer(o.a_tex_coord, 2, GL_FLOAT, GL_FALSE, 0, tex_coord);
+
+  ::glEnableVertexAttribArray(o.a_position);
+  ::glEnableVertexAttribArray(o.a_tex_coord);
 
-  ::cairo_destroy(cr);
+  ::glUniform1i(o.s_texture, 0);
+  ::glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, indices);
+
+  ::glDisableVertexAttribArray(o.a_position);
+  ::glDisableVertexAttribArray(o.a_tex_coord);
+  ::glBindTexture(GL_TEXTURE_2D, 0);
+  ::glDisable(GL_BLEND);
+  ::glUseProgram(0);
 }
 
 static void redraw(void* data) {
   auto ctx = static_cast<::window_context*>(data);
 
+  const auto start = std::chrono::steady_clock::now();
+
   redraw_main_surface(ctx);
   redraw_overlay_surface(ctx);
 
   flush_main_surface(ctx);
+
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  ctx->compositor_time_total += elapsed;
+  ctx->compositor_time_run_total += elapsed;
 }
 
-static void drm_page_flip_handler(
-    [[maybe_unused]] int fd, [[maybe_unused]] unsigned int frame, unsigned int sec,
-    unsigned int usec, void* data) {
-  auto ctx = static_cast<window_context*>(data);
+static void invalidate_overlay(window_context* ctx) {
+  ctx->overlay.dirty = true;
+  ctx->damage |= damage_overlay;
+}
 
-  if (!ctx->gbm_bo_next) {
-    ::drmModeRmFB(ctx->drm_fd, ctx->fb_id);
-    ctx->fb_id = ctx->fb_id_next;
+static void update_display_stats(
+    window_context* ctx, unsigned int sequence, unsigned int sec, unsigned int usec,
+    bool committed) {
+  const auto vblanks = ctx->display_last_sequence ? sequence - *ctx->display_last_sequence : 1u;
+  ctx->display_last_sequence = sequence;
 
-    ::gbm_surface_release_buffer(ctx->gbm_surface, ctx->gbm_bo);
-    ctx->gbm_bo = ctx->gbm_bo_next;
-    ctx->gbm_bo_next = nullptr;
+  const auto time = static_cast<std::uint64_t>(sec) * 1'000'000 + usec;
+  ctx->display_last_vblank_time = std::chrono::microseconds{time};
+  if (ctx->latency) {
+    const auto wakeup = ctx->loop->wakeup_time().time_since_epoch();
+    ctx->latency->display.add(wakeup - ctx->display_last_vblank_time);
   }
 
-  if (++ctx->display_total_frames % 5 == 0) {
-    const auto time = static_cast<std::uint64_t>(sec) * 1'000'000 + usec;
-    ctx->display_fps = 5'000'000.0f / (time - ctx->display_fps_updated_time);
-    ctx->display_fps_updated_time = time;
+  ctx->display_total_vblanks += vblanks;
+  ctx->display_window_vblanks += vblanks;
+  if (committed) {
+    ++ctx->display_total_frames;
+    ++ctx->display_window_frames;
+
+    const auto interval = (ctx->display_last_vblank_time - ctx->display_last_commit_time) / 1.0ms;
+    ctx->display_last_commit_time = ctx->display_last_vblank_time;
+    ctx->display_window_interval_sum += interval;
+    ctx->display_window_interval_sq_sum += interval * interval;
   }
 
-  redraw(ctx);
+  // idle periods produce no flips, so the rates are sampled over a fixed time window
+  if (const auto elapsed = time - ctx->display_fps_updated_time; elapsed >= 1'000'000) {
+    const auto n = ctx->display_window_frames;
 
-  ctx->gbm_bo_next = ::gbm_surface_lock_front_buffer(ctx->gbm_surface);
-  ctx->fb_id_next = get_gbm_bo_fb_id(ctx->drm_fd, ctx->gbm_bo_next);
+    ctx->display_fps = n * 1'000'000.0f / elapsed;
+    ctx->display_refresh_rate = ctx->display_window_vblanks * 1'000'000.0f / elapsed;
+    ctx->compositor_time_ms = n ? (ctx->compositor_time_total / n) / 1.0ms : 0.0f;
 
-  if (::drmModePageFlip(
-          ctx->drm_fd, ctx->crtc_id, ctx->fb_id_next, DRM_MODE_PAGE_FLIP_EVENT, ctx)) {
-    std::cerr << "failed to queue page flip: " << std::strerror(errno) << std::endl;
-    ctx->running = false;
+    if (n > 1) {
+      const auto mean = ctx->display_window_interval_sum / n;
+      const auto var = ctx->display_window_interval_sq_sum / n - mean * mean;
+      ctx->display_jitter_ms = std::sqrt(std::max(var, 0.0));
+    } else {
+      ctx->display_jitter_ms = 0.0f;
+    }
+
+    ctx->display_fps_updated_time = time;
+    ctx->display_window_frames = 0;
+    ctx->display_window_vblanks = 0;
+    ctx->display_window_interval_sum = 0.0;
+    ctx->display_window_interval_sq_sum = 0.0;
+    ctx->compositor_time_total = {};
+
+    invalidate_overlay(ctx);
   }
 }
 
-static void handle_drm_events(window_context* ctx, std::uint32_t events) {
-  if (events & EPOLLERR || events & EPOLLHUP) {
-    ctx->running = false;
-    return;
+static bool request_vblank_event(window_context* ctx) {
+  std::uint32_t crtc_select = 0;
+  if (ctx->crtc_index > 1) {
+    crtc_select = (ctx->crtc_index << DRM_VBLANK_HIGH_CRTC_SHIFT) & DRM_VBLANK_HIGH_CRTC_MASK;
+  } else if (ctx->crtc_index == 1) {
+    crtc_select = DRM_VBLANK_SECONDARY;
   }
 
-  if (!(events & EPOLLIN)) {
-    return;
+  ::drmVBlank vbl{};
+  vbl.request.type =
+      static_cast<::drmVBlankSeqType>(DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT | crtc_select);
+  vbl.request.sequence = 1;
+  vbl.request.signal = reinterpret_cast<unsigned long>(ctx);
+  if (::drmWaitVBlank(ctx->drm_fd, &vbl)) {
+    std::cerr << "failed to request vblank event: " << std::strerror(errno) << std::endl;
+    return false;
   }
 
-  ::drmEventContext ev{};
-  ev.version = DRM_EVENT_CONTEXT_VERSION;
-  ev.page_flip_handler = drm_page_flip_handler;
-
-  ::drmHandleEvent(ctx->drm_fd, &ev);
+  return true;
 }
 
-static void handle_v4l2_events(window_context* ctx, std::uint32_t events) {
-  if (events & EPOLLERR || events & EPOLLHUP) {
-    ctx->running = false;
-    return;
+// Hands every readiness of `fd` to `handler`, for the sources that take each event on its own.
+static task dispatch_events(
+    window_context* ctx, int fd, void (*handler)(window_context*, std::uint32_t)) {
+  fd_watch watch{*ctx->loop, fd};
+  for (;;) {
+    handler(ctx, co_await watch);
   }
+}
 
-  if (!(events & EPOLLIN)) {
-    return;
-  }
+// The display, one vblank at a time: composites and flips to a new frame if anything visible
+// changed, releasing the buffer shown before once the flip is done, otherwise just waits for the
+// next vblank.
+static task run_display(window_context* ctx) {
+  for (;;) {
+    if (!ctx->damage) {
+      if (!request_vblank_event(ctx)) {
+        break;
+      }
+      const auto v = co_await ctx->drm_vblank;
+      update_display_stats(ctx, v.sequence, v.sec, v.usec, false);
+      continue;
+    }
 
-  std::uint32_t new_index{};
-  {
-    ::v4l2_plane planes[VIDEO_MAX_PLANES];
-    ::v4l2_buffer buf{};
-    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-    buf.memory = V4L2_MEMORY_MMAP;
-    buf.length = VIDEO_MAX_PLANES;
-    buf.m.planes = planes;
-    if (::ioctl(ctx->video_fd, VIDIOC_DQBUF, &buf) == -1) {
-      std::cerr << "VIDIOC_DQBUF: " << std::strerror(errno) << std::endl;
-      ctx->running = false;
+    ctx->damage = 0;
+    if (ctx->displaying_buffer_index) {
+      ctx->first_frame_flip_queued = true;
+    }
+    redraw(ctx);
+
+    ctx->gbm_bo_next = ::gbm_surface_lock_front_buffer(ctx->gbm_surface);
+    ctx->fb_id_next = get_gbm_bo_fb_id(ctx->drm_fd, ctx->gbm_bo_next);
+
+    if (::drmModePageFlip(
+            ctx->drm_fd, ctx->crtc_id, ctx->fb_id_next, DRM_MODE_PAGE_FLIP_EVENT, ctx)) {
+      std::cerr << "failed to queue page flip: " << std::strerror(errno) << std::endl;
+      break;
+    }
+
+    const auto v = co_await ctx->drm_vblank;
+
+    ::drmModeRmFB(ctx->drm_fd, ctx->fb_id);
+    ctx->fb_id = ctx->fb_id_next;
+
+    ::gbm_surface_release_buffer(ctx->gbm_surface, ctx->gbm_bo);
+    ctx->gbm_bo = ctx->gbm_bo_next;
+    ctx->gbm_bo_next = nullptr;
+
+    update_display_stats(ctx, v.sequence, v.sec, v.usec, true);
+
+    if (ctx->first_frame_flip_queued && !ctx->startup.reported()) {
+      ctx->startup.mark("first frame on screen");
+      ctx->startup.report();
+    }
+  }
+
+  ctx->running = false;
+}
+
+// a flip done or a vblank passed, whichever the display is waiting for
+static void drm_vblank_handler(
+    [[maybe_unused]] int fd, unsigned int frame, unsigned int sec, unsigned int usec,
+    void* data) {
+  static_cast<window_context*>(data)->drm_vblank.complete({frame, sec, usec});
+}
+
+static void handle_drm_events(window_context* ctx, std::uint32_t events) {
+  if (events & EPOLLERR || events & EPOLLHUP) {
+    ctx->running = false;
+    return;
+  }
+
+  if (!(events & EPOLLIN)) {
+    return;
+  }
+
+  ::drmEventContext ev{};
+  ev.version = DRM_EVENT_CONTEXT_VERSION;
+  ev.vblank_handler = drm_vblank_handler;
+  ev.page_flip_handler = drm_vblank_handler;
+
+  ::drmHandleEvent(ctx->drm_fd, &ev);
+}
+
+// binds the texture of buffer `index` to its pixels as the capture format lays them out
+static bool import_video_buffer(window_context* ctx, std::uint32_t index) {
+  const auto& b = ctx->video_buffers[index];
+
+  // clang-format off
+  const ::EGLint attrs[] = {
+    EGL_IMAGE_PRESERVED_KHR,       EGL_TRUE,
+    EGL_WIDTH,                     ctx->width,
+    EGL_HEIGHT,                    ctx->height,
+    EGL_LINUX_DRM_FOURCC_EXT,      DRM_FORMAT_ABGR8888,
+    EGL_DMA_BUF_PLANE0_FD_EXT,     b.fd,
+    EGL_DMA_BUF_PLANE0_OFFSET_EXT, static_cast<::EGLint>(b.offset),
+    EGL_DMA_BUF_PLANE0_PITCH_EXT,  static_cast<::EGLint>(ctx->v4l2_bytesperline),
+    EGL_NONE
+  };
+  // clang-format on
+
+  ::EGLImageKHR image =
+      ::eglCreateImageKHR(ctx->egl_display, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, nullptr, attrs);
+  if (image == EGL_NO_IMAGE_KHR) {
+    return false;
+  }
+
+  ::glBindTexture(GL_TEXTURE_EXTERNAL_OES, ctx->texture.textures[index]);
+  ::glEGLImageTargetTexture2DOES(GL_TEXTURE_EXTERNAL_OES, image);
+  ::glBindTexture(GL_TEXTURE_EXTERNAL_OES, 0);
+
+  // the texture keeps the buffer referenced
+  ::eglDestroyImageKHR(ctx->egl_display, image);
+
+  return true;
+}
+
+static bool queue_video_buffer(window_context* ctx, std::uint32_t index) {
+  if (ctx->replay) {
+    ctx->replay->release(index);
+    return true;
+  }
+  if (ctx->software) {
+    ctx->software->release(index);
+    return true;
+  }
+
+  ::v4l2_plane planes[VIDEO_MAX_PLANES];
+  ::v4l2_buffer buf{};
+  buf.index = index;
+  buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  buf.memory = V4L2_MEMORY_MMAP;
+  buf.length = VIDEO_MAX_PLANES;
+  buf.m.planes = planes;
+  if (::ioctl(ctx->video_fd, VIDIOC_QUERYBUF, &buf) == -1) {
+    std::cerr << "VIDIOC_QUERYBUF: " << std::strerror(errno) << std::endl;
+    return false;
+  }
+  if (::ioctl(ctx->video_fd, VIDIOC_QBUF, &buf) == -1) {
+    std::cerr << "VIDIOC_QBUF: " << std::strerror(errno) << std::endl;
+    return false;
+  }
+
+  if (ctx->v4l2_queued_buffers++ == 0 && ctx->v4l2_starved_since) {
+    const auto starved = std::chrono::steady_clock::now() - *ctx->v4l2_starved_since;
+    ctx->v4l2_lost_frames += static_cast<std::uint64_t>(ctx->v4l2_fps * (starved / 1.0s));
+    ctx->v4l2_starved_since.reset();
+  }
+
+  return true;
+}
+
+// Asks the generator for a frame of the current view, unless it is making one. While the view is
+// only panned from the latest frame, by less than half of it, that takes just the strip coming into
+// view, along one axis at a time; anything else takes a whole frame. Nothing is asked for while the
+// latest frame is of the view to within half a pixel, nor while no buffer is queued to take it.
+static void request_scroll_frame(window_context* ctx) {
+  if (ctx->scroll_requested || ctx->v4l2_queued_buffers == 0) {
+    return;
+  }
+
+  auto& c = *ctx->fractal_ctl;
+  const auto& v = ctx->view;
+  window_context::scroll_frame f{
+      {
+          fix<4>::double_to_fix(v.x0),
+          fix<4>::double_to_fix(v.y0),
+          fix<4>::double_to_fix(v.dx),
+          fix<4>::double_to_fix(v.dy),
+          fix<4>::double_to_fix(v.cr),
+          fix<4>::double_to_fix(v.ci),
+      },
+      c.max_iter(),
+      c.mode(),
+      0,
+      0,
+      std::nullopt,
+  };
+
+  const auto& l = ctx->scroll_latest;
+  const auto only_panned = l && l->max_iterations == f.max_iterations && l->mode == f.mode &&
+                           std::equal(f.view.begin() + 2, f.view.end(), l->view.begin() + 2);
+  if (only_panned) {
+    // Pixel (x, y) with the view moved by s pixels is (x + s, y) of the latest frame when
+    // x0 = latest x0 - s * dx. The registers wrap around, so the differences are taken in them.
+    const auto pixels = [](std::uint32_t latest, std::uint32_t next, std::uint32_t step) {
+      const auto diff = static_cast<double>(static_cast<std::int32_t>(latest - next));
+      return step ? static_cast<std::int32_t>(std::lround(diff / static_cast<std::int32_t>(step)))
+                  : 0;
+    };
+    const auto sx = pixels(l->view[0], f.view[0], f.view[2]);
+    const auto sy = pixels(l->view[1], f.view[1], f.view[3]);
+
+    if (sx == 0 && sy == 0) {
       return;
     }
-    new_index = buf.index;
+
+    if (std::abs(sx) < ctx->width / 2 && std::abs(sy) < ctx->height / 2) {
+      const auto w = static_cast<std::uint32_t>(ctx->width);
+      const auto h = static_cast<std::uint32_t>(ctx->height);
+      f.view[0] = l->view[0];
+      f.view[1] = l->view[1];
+      if (sx != 0) {
+        const auto n = static_cast<std::uint32_t>(std::abs(sx));
+        f.view[0] -= static_cast<std::uint32_t>(sx) * f.view[2];
+        f.shift_x = sx;
+        f.roi = scroll_compositor::region{sx > 0 ? w - n : 0, 0, n, h};
+      } else {
+        const auto n = static_cast<std::uint32_t>(std::abs(sy));
+        f.view[1] -= static_cast<std::uint32_t>(sy) * f.view[3];
+        f.shift_y = sy;
+        f.roi = scroll_compositor::region{0, sy > 0 ? h - n : 0, w, n};
+      }
+    }
+  }
+
+  c.set_x0(fix<4>{f.view[0]});
+  c.set_y0(fix<4>{f.view[1]});
+  c.set_dx(fix<4>{f.view[2]});
+  c.set_dy(fix<4>{f.view[3]});
+  c.set_cr(fix<4>{f.view[4]});
+  c.set_ci(fix<4>{f.view[5]});
+  if (f.roi) {
+    c.set_roi(f.roi->x, f.roi->y, f.roi->width, f.roi->height);
+  } else {
+    c.set_roi(0, 0, 0, 0);
+  }
+  c.request_frame();
+
+  ctx->scroll_requested = f;
+}
+
+// Dequeued buffers are reference counted; each role holding one (processing, displaying,
+// previous) owns a reference, and the buffer goes back to the driver when the last one is gone.
+static void retain_video_buffer(window_context* ctx, std::uint32_t index) {
+  ++ctx->video_buffers[index].refs;
+}
+
+static void release_video_buffer(window_context* ctx, std::uint32_t index) {
+  if (--ctx->video_buffers[index].refs != 0) {
+    return;
+  }
+
+  if (!queue_video_buffer(ctx, index)) {
+    ctx->running = false;
+    return;
+  }
+
+  // a frame may have been waiting for the buffer
+  if (ctx->scroll) {
+    request_scroll_frame(ctx);
+  }
+}
+
+// leases every so many complete frames to the verifier, tagged with what they were made with
+static void verify_video_buffer(window_context* ctx, std::uint32_t index) {
+  const auto mode = ctx->fractal_ctl->mode();
+  if (mode != ctx->verify_mode) {
+    ctx->verify_mode = mode;
+    ctx->verify_settle_frames = 2;
+  }
+  if (ctx->verify_settle_frames > 0) {
+    --ctx->verify_settle_frames;
+    return;
+  }
+
+  ctx->verify_credit += ctx->verify_fraction;
+  if (ctx->verify_credit < 1.0) {
+    return;
   }
+  ctx->verify_credit -= 1.0;
+
+  const auto& b = ctx->video_buffers[index];
+  const frame_verifier::frame f{
+      index,
+      b.ptr + b.offset,
+      b.fd,
+      b.width,
+      b.height,
+      ctx->v4l2_bytesperline,
+      b.sequence,
+      b.params.x0,
+      b.params.y0,
+      b.params.dx,
+      b.params.dy,
+      b.params.cr,
+      b.params.ci,
+      b.max_iterations,
+      mode,
+  };
+  // turned down often, while busy or over budget; the buffer has no references of its own yet
+  if (ctx->verifier->submit(f)) {
+    retain_video_buffer(ctx, index);
+  }
+}
 
+// a new frame is ready in buffer `new_index`, which has been tagged with its parameters
+static void receive_video_buffer(window_context* ctx, std::uint32_t new_index) {
   if (++ctx->v4l2_total_frames % 5 == 0) {
     const auto now = std::chrono::steady_clock::now();
     ctx->v4l2_fps = 5'000'000.0f / ((now - ctx->v4l2_fps_updated_time) / 1us);
     ctx->v4l2_fps_updated_time = now;
+
+    if (ctx->frame_recorder) {
+      const auto bytes = ctx->frame_recorder->get_stats().bytes_written;
+      ctx->record_bandwidth = (bytes - ctx->record_bytes_last) * ctx->v4l2_fps / 5.0f / 1e6f;
+      ctx->record_bytes_last = bytes;
+    }
+
+    invalidate_overlay(ctx);
   }
 
+  if (ctx->v4l2_total_frames == 1) {
+    ctx->startup.mark("first frame");
+  }
+
+  if (ctx->frame_recorder) {
+    // the recorder leases the buffer until its write completes
+    const auto& b = ctx->video_buffers[new_index];
+    const recorder::frame f{
+        new_index,
+        b.ptr + b.offset,
+        b.fd,
+        {b.sequence,
+         b.timestamp.count(),
+         b.params.x0,
+         b.params.y0,
+         b.params.dx,
+         b.params.dy,
+         b.params.cr,
+         b.params.ci},
+    };
+    // A fresh buffer has no references yet, so one turned down must not be released here: that
+    // would give it back to the driver while it is about to be displayed.
+    if (ctx->frame_recorder->submit(f)) {
+      retain_video_buffer(ctx, new_index);
+    }
+  }
+
+  if (ctx->publisher) {
+    // each consumer the frame is leased to holds the buffer until it gives it back
+    const auto& b = ctx->video_buffers[new_index];
+    const frame_publisher::frame f{
+        new_index,
+        b.width,
+        b.height,
+        b.sequence,
+        b.timestamp,
+        b.params.x0,
+        b.params.y0,
+        b.params.dx,
+        b.params.dy,
+        b.params.cr,
+        b.params.ci,
+        b.max_iterations,
+        static_cast<std::uint32_t>(ctx->fractal_ctl->mode()),
+    };
+    for (auto n = ctx->publisher->publish(f); n > 0; --n) {
+      retain_video_buffer(ctx, new_index);
+    }
+  }
+
+  if (ctx->verifier) {
+    verify_video_buffer(ctx, new_index);
+  }
+
+  // blending needs the frame before the displayed one; otherwise it goes back right away
+  if (ctx->previous_buffer_index) {
+    release_video_buffer(ctx, ctx->previous_buffer_index.value());
+    ctx->previous_buffer_index.reset();
+  }
   if (ctx->displaying_buffer_index) {
+    if (ctx->blend_enabled && ctx->app.animation) {
+      ctx->previous_buffer_index = ctx->displaying_buffer_index;
+    } else {
+      release_video_buffer(ctx, ctx->displaying_buffer_index.value());
+    }
+  }
+
+  retain_video_buffer(ctx, new_index);
+  ctx->displaying_buffer_index = ctx->processing_buffer_index;
+  ctx->processing_buffer_index = new_index;
+
+  if (ctx->displaying_buffer_index) {
+    ctx->damage |= damage_frame;
+  }
+}
+
+// A frame of which the source made the top rows, b.height of them, has arrived. The CPU renders
+// the rest into the same buffer while the source makes the next frame, which is then asked for
+// the rows that balance the two.
+static void split_video_buffer(window_context* ctx, std::uint32_t index) {
+  const auto& b = ctx->video_buffers[index];
+
+  // the interval from the frame before is how long the source took, unless frames were lost
+  if (ctx->split_last_sequence && b.sequence == *ctx->split_last_sequence + 1) {
+    ctx->split->hardware_frame(b.height, b.timestamp - ctx->split_last_timestamp);
+  }
+  ctx->split_last_sequence = b.sequence;
+  ctx->split_last_timestamp = b.timestamp;
+
+  ctx->split->submit({
+      index,
+      b.ptr + b.offset,
+      b.fd,
+      ctx->v4l2_bytesperline,
+      b.height,
+      b.params.x0,
+      b.params.y0,
+      b.params.dx,
+      b.params.dy,
+      b.params.cr,
+      b.params.ci,
+      b.max_iterations,
+      ctx->fractal_ctl->mode(),
+  });
+
+  ctx->split_rows = ctx->split->hardware_rows();
+  if (ctx->software) {
+    ctx->software->set_rows(ctx->split_rows);
+  } else {
+    ctx->fractal_ctl->set_height(ctx->split_rows);
+  }
+}
+
+// The frame asked for last has arrived, and becomes the latest. A whole one is shown as it is; of
+// one with only a region, the rest is moved over from the frame before first, which is held until
+// then. Either way, the next frame can be asked for right away.
+static void scroll_video_buffer(window_context* ctx, std::uint32_t index) {
+  if (!ctx->scroll_requested) {
+    // not asked for, so made with whatever was in the registers
+    if (!queue_video_buffer(ctx, index)) {
+      ctx->running = false;
+    }
+    return;
+  }
+
+  const auto f = *ctx->scroll_requested;
+  ctx->scroll_requested.reset();
+
+  auto& b = ctx->video_buffers[index];
+  b.params = {
+      fix<4>{f.view[0]}.to_double(),
+      fix<4>{f.view[1]}.to_double(),
+      fix<4>{f.view[2]}.to_double(),
+      fix<4>{f.view[3]}.to_double(),
+      fix<4>{f.view[4]}.to_double(),
+      fix<4>{f.view[5]}.to_double(),
+  };
+  b.width = static_cast<std::uint32_t>(ctx->width);
+  b.height = static_cast<std::uint32_t>(ctx->height);
+  b.max_iterations = f.max_iterations;
+
+  const auto base_index = ctx->scroll_latest_index;
+  ctx->scroll_latest = f;
+  ctx->scroll_latest_index = index;
+  retain_video_buffer(ctx, index);
+
+  if (f.roi) {
+    // the completion takes over the reference the frame before was held with as the latest
+    const auto& base = ctx->video_buffers[base_index.value()];
+    ctx->scroll_job_bases.push_back(base_index.value());
+    ctx->scroll->submit({
+        index,
+        b.ptr + b.offset,
+        b.fd,
+        base.ptr + base.offset,
+        base.fd,
+        ctx->v4l2_bytesperline,
+        f.shift_x,
+        f.shift_y,
+        *f.roi,
+    });
+  } else {
+    ++ctx->scroll_full_frames;
+    if (base_index) {
+      release_video_buffer(ctx, *base_index);
+    }
+    receive_video_buffer(ctx, index);
+  }
+
+  request_scroll_frame(ctx);
+}
+
+static void handle_v4l2_events(window_context* ctx, std::uint32_t events) {
+  if (events & EPOLLERR || events & EPOLLHUP) {
+    ctx->running = false;
+    return;
+  }
+
+  if (!(events & EPOLLIN)) {
+    return;
+  }
+
+  std::uint32_t new_index{};
+  {
     ::v4l2_plane planes[VIDEO_MAX_PLANES];
     ::v4l2_buffer buf{};
-    buf.index = ctx->displaying_buffer_index.value();
     buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
     buf.memory = V4L2_MEMORY_MMAP;
     buf.length = VIDEO_MAX_PLANES;
     buf.m.planes = planes;
-    if (::ioctl(ctx->video_fd, VIDIOC_QUERYBUF, &buf) == -1) {
-      std::cerr << "VIDIOC_QUERYBUF: " << std::strerror(errno) << std::endl;
+    if (::ioctl(ctx->video_fd, VIDIOC_DQBUF, &buf) == -1) {
+      std::cerr << "VIDIOC_DQBUF: " << std::strerror(errno) << std::endl;
       ctx->running = false;
       return;
     }
-    if (::ioctl(ctx->video_fd, VIDIOC_QBUF, &buf) == -1) {
-      std::cerr << "VIDIOC_QBUF: " << std::strerror(errno) << std::endl;
-      ctx->running = false;
-      return;
+    new_index = buf.index;
+
+    auto& b = ctx->video_buffers[new_index];
+    b.timestamp = std::chrono::seconds{buf.timestamp.tv_sec} +
+                  std::chrono::microseconds{buf.timestamp.tv_usec};
+    b.sequence = buf.sequence;
+    ctx->v4l2_last_timestamp = b.timestamp;
+    if (ctx->latency) {
+      ctx->latency->capture.add(ctx->loop->wakeup_time().time_since_epoch() - b.timestamp);
+    }
+
+    // where the picture starts is up to the driver, frame by frame
+    if (buf.m.planes[0].data_offset != b.offset) {
+      b.offset = buf.m.planes[0].data_offset;
+      if (!import_video_buffer(ctx, new_index)) {
+        std::cerr << "failed to import buffer " << new_index << std::endl;
+        ctx->running = false;
+        return;
+      }
+    }
+
+    if (--ctx->v4l2_queued_buffers == 0 && !ctx->scroll) {
+      ctx->v4l2_starved_since = std::chrono::steady_clock::now();
     }
   }
 
-  ctx->displaying_buffer_index = ctx->processing_buffer_index;
-  ctx->processing_buffer_index = new_index;
+  if (ctx->scroll) {
+    scroll_video_buffer(ctx, new_index);
+    return;
+  }
+
+  // The generator latches its registers when it starts a frame, which is right after the
+  // previous one completed. Whatever was written at the previous dequeue is what this frame used.
+  ctx->video_buffers[new_index].params = ctx->pending_view;
+  ctx->pending_view = ctx->view;
+  ctx->video_buffers[new_index].max_iterations = ctx->pending_max_iterations;
+  ctx->pending_max_iterations = ctx->fractal_ctl->max_iter();
+
+  if (ctx->split) {
+    // so is the height
+    ctx->video_buffers[new_index].height = ctx->pending_split_rows;
+    ctx->pending_split_rows = ctx->split_rows;
+
+    split_video_buffer(ctx, new_index);
+  } else {
+    receive_video_buffer(ctx, new_index);
+  }
 }
 
-static void handle_timer_events(window_context* ctx, std::uint32_t events) {
+static void handle_replay_events(window_context* ctx, std::uint32_t events) {
+  if (events & EPOLLERR || events & EPOLLHUP) {
+    ctx->running = false;
+    return;
+  }
+
+  if (!(events & EPOLLIN)) {
+    return;
+  }
+
+  if (const auto f = ctx->replay->next(); f) {
+    auto& b = ctx->video_buffers[f->index];
+    b.timestamp = f->timestamp;
+    b.sequence = f->sequence;
+    b.params = {f->x0, f->y0, f->dx, f->dy, f->cr, f->ci};
+    b.max_iterations = fractal_max_iterations;
+
+    // show the frames as recorded
+    ctx->view = b.params;
+    ctx->current_view = b.params;
+    ctx->pending_view = b.params;
+
+    receive_video_buffer(ctx, f->index);
+  }
+
+  if (ctx->replay->finished()) {
+    ctx->running = false;
+  }
+}
+
+static void handle_software_events(window_context* ctx, std::uint32_t events) {
+  if (events & EPOLLERR || events & EPOLLHUP) {
+    ctx->running = false;
+    return;
+  }
+
+  if (!(events & EPOLLIN)) {
+    return;
+  }
+
+  for (const auto& f : ctx->software->completed()) {
+    auto& b = ctx->video_buffers[f.index];
+    b.timestamp = f.timestamp;
+    b.sequence = f.sequence;
+    b.params = {f.x0, f.y0, f.dx, f.dy, f.cr, f.ci};
+    ctx->v4l2_last_timestamp = b.timestamp;
+    b.width = f.width;
+    b.height = f.height;
+    b.max_iterations = f.max_iterations;
+
+    if (ctx->split) {
+      split_video_buffer(ctx, f.index);
+    } else {
+      receive_video_buffer(ctx, f.index);
+    }
+  }
+}
+
+static void handle_split_events(window_context* ctx, std::uint32_t events) {
   if (events & EPOLLERR || events & EPOLLHUP) {
     ctx->running = false;
     return;
   }
 
   if (events & EPOLLIN) {
-    std::uint64_t exp{};
-    if (::read(ctx->timer_fd, &exp, sizeof exp) != sizeof exp) {
-      std::cerr << "timer_fd read: " << std::strerror(errno) << std::endl;
-      ctx->running = false;
+    for (const auto& r : ctx->split->completed()) {
+      ctx->video_buffers[r.index].height = ctx->height;
+      receive_video_buffer(ctx, r.index);
+    }
+  }
+}
+
+static void handle_scroll_events(window_context* ctx, std::uint32_t events) {
+  if (events & EPOLLERR || events & EPOLLHUP) {
+    ctx->running = false;
+    return;
+  }
+
+  if (events & EPOLLIN) {
+    for (const auto& r : ctx->scroll->completed()) {
+      release_video_buffer(ctx, ctx->scroll_job_bases.front());
+      ctx->scroll_job_bases.pop_front();
+      receive_video_buffer(ctx, r.index);
+    }
+  }
+}
+
+static void handle_verifier_events(window_context* ctx, std::uint32_t events) {
+  if (events & EPOLLERR || events & EPOLLHUP) {
+    ctx->running = false;
+    return;
+  }
+
+  if (events & EPOLLIN) {
+    for (const auto index : ctx->verifier->completed()) {
+      release_video_buffer(ctx, index);
+    }
+  }
+}
+
+static void handle_publisher_events(window_context* ctx, std::uint32_t events) {
+  if (events & EPOLLERR || events & EPOLLHUP) {
+    ctx->running = false;
+    return;
+  }
+
+  if (events & EPOLLIN) {
+    for (const auto index : ctx->publisher->completed()) {
+      release_video_buffer(ctx, index);
+    }
+  }
+}
+
+static void handle_recorder_events(window_context* ctx, std::uint32_t events) {
+  if (events & EPOLLERR || events & EPOLLHUP) {
+    ctx->running = false;
+    return;
+  }
+
+  if (events & EPOLLIN) {
+    for (const auto index : ctx->frame_recorder->completed()) {
+      release_video_buffer(ctx, index);
+    }
+  }
+}
+
+// leases the displayed buffer to the snapshot writer
+static void take_snapshot(window_context* ctx) {
+  if (!ctx->displaying_buffer_index) {
+    return;
+  }
+
+  const auto index = ctx->displaying_buffer_index.value();
+  const auto& b = ctx->video_buffers[index];
+  const snapshot_writer::frame f{
+      index,
+      b.ptr + b.offset,
+      b.fd,
+      b.width,
+      b.height,
+      ctx->v4l2_bytesperline,
+      b.sequence,
+  };
+  retain_video_buffer(ctx, index);
+  if (!ctx->snapshots->submit(f)) {
+    release_video_buffer(ctx, index);
+    std::cerr << "snapshot: still encoding the previous one" << std::endl;
+  }
+}
+
+static void handle_snapshot_events(window_context* ctx, std::uint32_t events) {
+  if (events & EPOLLERR || events & EPOLLHUP) {
+    ctx->running = false;
+    return;
+  }
+
+  if (events & EPOLLIN) {
+    for (const auto& r : ctx->snapshots->completed()) {
+      release_video_buffer(ctx, r.index);
+
+      if (r.ok) {
+        ctx->snapshot_time_ms = r.encode_time / 1.0ms;
+        std::cout << "snapshot: " << r.path << " (" << r.bytes << " bytes in "
+                  << ctx->snapshot_time_ms << " ms)" << std::endl;
+        invalidate_overlay(ctx);
+      }
+    }
+  }
+}
+
+static void handle_signal_events(window_context* ctx, std::uint32_t events) {
+  if (events & EPOLLERR || events & EPOLLHUP) {
+    ctx->running = false;
+    return;
+  }
+
+  if (events & EPOLLIN) {
+    ::signalfd_siginfo info{};
+    if (::read(ctx->signal_fd, &info, sizeof info) != sizeof info) {
       return;
     }
 
-    auto& app = ctx->app;
+    if (info.ssi_signo == SIGUSR1) {
+      take_snapshot(ctx);
+    }
+  }
+}
+
+// Moves `app` on by `dt` of the controls in `input`. Panning is by screen pixels, which cover more
+// of the plane the further out the view is, so it is integrated along with the zoom.
+static void advance_app(
+    const window_context* ctx, window_context::app_state& app,
+    const window_context::input_state& input, std::chrono::nanoseconds dt) {
+  const auto t = std::chrono::duration<double>{dt}.count();
+  if (t <= 0.0) {
+    return;
+  }
 
-    double shift_x = 0;
-    double shift_y = 0;
+  const auto rate = (input.fast ? fast_zoom_rate : zoom_rate) * (input.zoom_in - input.zoom_out);
+  const auto q0 = app.scale_q;
+  auto q1 = q0 + rate * t;
+  if (rate < 0.0) {
+    q1 = std::max(q1, std::min(q0, min_scale_q));
+  } else if (rate > 0.0) {
+    q1 = std::min(q1, std::max(q0, max_scale_q));
+  }
 
-    if (ctx->joystick_fd >= 0) {
-      const auto& j = ctx->joystick;
+  // the integral of 1 / scale over the interval, zooming until the limit and then not
+  const auto zoom_time = rate != 0.0 ? (q1 - q0) / rate : 0.0;
+  auto inv_scale_time = (t - zoom_time) * std::exp(1.0 - q1);
+  if (rate != 0.0) {
+    inv_scale_time += (std::exp(1.0 - q0) - std::exp(1.0 - q1)) / rate;
+  }
 
-      const auto scale_step = j.buttons[6] ? 0.01 : 0.001;
-      if (j.buttons[1] && app.scale_q >= -2.0) app.scale_q -= scale_step;
-      if (j.buttons[2] && app.scale_q <= 7.25) app.scale_q += scale_step;
+  // a screen pixel is 2 / hdisplay of the plane at a scale of 1, either way
+  const auto pixel = 2.0 / ctx->display_mode.hdisplay;
+  app.scale_q = q1;
+  app.scale = std::exp(q1 - 1.0);
+  app.offset_x += pixel * pan_rate * input.pan_x * inv_scale_time;
+  app.offset_y += pixel * pan_rate * input.pan_y * inv_scale_time;
+}
 
-      if (j.axes[4] > 0) shift_x += 2.0;
-      if (j.axes[4] < 0) shift_x -= 2.0;
+// applies the motion of the controls held since the last call, up to `time`
+static void integrate_input(window_context* ctx, std::chrono::nanoseconds time) {
+  // recorded frames carry their own view
+  if (!ctx->replay) {
+    advance_app(ctx, ctx->app, ctx->input, time - ctx->input_time);
+  }
+  ctx->input_time = std::max(ctx->input_time, time);
+}
 
-      if (j.axes[5] < 0) shift_y += 2.0;
-      if (j.axes[5] > 0) shift_y -= 2.0;
+// How long until a frame generated with a view written now is shown: the generator latches it when
+// the frame in progress completes, makes the next frame with it, and that is flipped to on the
+// vblank after.
+static std::chrono::nanoseconds input_lead(
+    const window_context* ctx, std::chrono::nanoseconds now) {
+  if (!ctx->input_prediction || ctx->v4l2_fps <= 0.0f) {
+    return 0ns;
+  }
+
+  const auto refresh_rate = ctx->display_refresh_rate > 0.0f ? ctx->display_refresh_rate
+                                                              : ctx->display_mode.vrefresh;
+  const std::chrono::nanoseconds frame{static_cast<std::int64_t>(1e9 / ctx->v4l2_fps)};
+  const std::chrono::nanoseconds refresh{
+      static_cast<std::int64_t>(1e9 / std::max(refresh_rate, 1.0f))};
+
+  // frames follow each other from the latest one on, whether or not they were dequeued
+  const auto since = std::max(now - ctx->v4l2_last_timestamp, 0ns);
+  const auto latch = ctx->v4l2_last_timestamp + (since / frame + 1) * frame;
+  return std::clamp(latch + frame + refresh - now, 0ns, max_input_lead);
+}
+
+// the view `app` is of; the frames are stretched over the whole screen, so its shape is the
+// screen's
+static view_params view_of(const window_context* ctx, const window_context::app_state& app) {
+  const auto ratio = static_cast<double>(ctx->display_mode.vdisplay) / ctx->display_mode.hdisplay;
+  const auto scale_inv = 1.0 / app.scale;
+  const auto x1 = 1.0 * scale_inv;
+  const auto y1 = ratio * scale_inv;
+  return {
+      x1 - app.offset_x,
+      y1 + app.offset_y,
+      2.0 * x1 / ctx->width,
+      2.0 * y1 / ctx->height,
+      app.cr,
+      app.ci,
+  };
+}
+
+// Brings the view up to `now` and writes it, ahead by the input lead, to wherever frames are made.
+// The animation is stepped `animation_steps` timer intervals on.
+static void update_view(
+    window_context* ctx, std::chrono::nanoseconds now, std::uint64_t animation_steps) {
+  auto& app = ctx->app;
+  const auto prev_app = app;
+  const auto prev_view = ctx->current_view;
+
+  integrate_input(ctx, now);
+  app.scale = std::exp(app.scale_q - 1.0);
+
+  if (app.animation) {
+    const auto i = (app.animation_frame + animation_steps) % 10000;
+
+    const auto t = (static_cast<double>(i) / 10000) * 6.28;
+    app.cr = 0.7885 * std::cos(t);
+    app.ci = 0.7885 * std::sin(t);
+
+    app.animation_frame = i;
+  } else {
+    app.cr = -0.4;
+    app.ci = 0.6;
+  }
+
+  auto ahead = app;
+  ctx->input_lead = input_lead(ctx, now);
+  advance_app(ctx, ahead, ctx->input, ctx->input_lead);
+
+  ctx->current_view = view_of(ctx, app);
+  ctx->view = view_of(ctx, ahead);
+
+  // while scrolling, the registers are written only with each frame asked for
+  if (ctx->scroll) {
+    request_scroll_frame(ctx);
+  } else {
+    const auto& v = ctx->view;
+    ctx->fractal_ctl->set_x0(v.x0);
+    ctx->fractal_ctl->set_y0(v.y0);
+    ctx->fractal_ctl->set_dx(v.dx);
+    ctx->fractal_ctl->set_dy(v.dy);
+    ctx->fractal_ctl->set_cr(v.cr);
+    ctx->fractal_ctl->set_ci(v.ci);
+  }
+
+  if (ctx->software) {
+    const auto& v = ctx->view;
+    ctx->software->set_view(v.x0, v.y0, v.dx, v.dy, v.cr, v.ci, ctx->fractal_ctl->mode());
+  }
+
+  if (app != prev_app) {
+    invalidate_overlay(ctx);
+  }
+
+  // pan and zoom are shown by moving the last frame until a frame generated with them arrives
+  if (ctx->reprojection_enabled && ctx->current_view != prev_view) {
+    ctx->damage |= damage_view;
+  }
+}
+
+// Brings the view up to date on every tick of the timer, and ends a latency run once it is over.
+static task run_timer(window_context* ctx) {
+  for (;;) {
+    const auto exp = co_await *ctx->timer;
+    if (exp == 0) {
+      std::cerr << "timer failed" << std::endl;
+      break;
     }
 
-    app.scale = std::exp(app.scale_q - 1.0);
+    if (ctx->latency) {
+      const auto wakeup = ctx->loop->wakeup_time();
+      ctx->latency->timer.add(wakeup.time_since_epoch() - ctx->timer->last_due());
+      if (ctx->latency_end && wakeup >= *ctx->latency_end) {
+        break;
+      }
+    }
+
+    // recorded frames carry their own view; input is ignored while replaying
+    if (ctx->replay) {
+      continue;
+    }
+
+    update_view(ctx, std::chrono::steady_clock::now().time_since_epoch(), exp);
+  }
+
+  ctx->running = false;
+}
+
+// the gamepad was unplugged; another one, or the same again, is attached when it turns up
+static void detach_gamepad(window_context* ctx) {
+  integrate_input(ctx, std::chrono::steady_clock::now().time_since_epoch());
+  ctx->pad.reset();
+  ctx->input = {};
+  std::cout << "gamepad detached" << std::endl;
+}
+
+// whether the event changes what the view does
+static bool moves_view(const gamepad::event& e) {
+  if (e.type == gamepad::event::kind::axis) {
+    return e.number == 4 || e.number == 5;
+  }
+  return e.number == 1 || e.number == 2 || e.number == 6 || (e.number == 8 && e.value);
+}
+
+// Applies the events read into ctx->pad_events, in order. The motion up to each event is that of
+// the controls as they were before it, and the view is written once all of them are in.
+static void apply_gamepad_events(window_context* ctx) {
+  auto& input = ctx->input;
+  bool moved = false;
+
+  for (const auto& e : ctx->pad_events) {
+    integrate_input(ctx, e.time);
+    moved |= moves_view(e);
+
+    if (e.type == gamepad::event::kind::axis) {
+      const auto direction = (e.value > 0) - (e.value < 0);
+      if (e.number == 4) input.pan_x = direction;
+      if (e.number == 5) input.pan_y = -direction;
+      continue;
+    }
+
+    if (e.number == 1) input.zoom_out = e.value;
+    if (e.number == 2) input.zoom_in = e.value;
+    if (e.number == 6) input.fast = e.value;
+
+    if (!e.value) {
+      continue;
+    }
+
+    if (e.number == 4 && !ctx->palette_locked) {
+      ctx->fractal_ctl->set_mode(prev_mode(ctx->fractal_ctl->mode()));
+      ctx->damage |= damage_palette;
+    }
+    if (e.number == 5 && !ctx->palette_locked) {
+      ctx->fractal_ctl->set_mode(next_mode(ctx->fractal_ctl->mode()));
+      ctx->damage |= damage_palette;
+    }
+
+    if (e.number == 3) {
+      take_snapshot(ctx);
+    }
+
+    // shallower limits for more frames per second, down to an eighth and back around
+    if (e.number == 0) {
+      const auto n = ctx->fractal_ctl->max_iter();
+      const auto next = n > 32 ? n / 2 : fractal_max_iterations;
+      ctx->fractal_ctl->set_max_iter(next);
+      if (ctx->software) {
+        ctx->software->set_max_iterations(next);
+      }
+      invalidate_overlay(ctx);
+    }
+
+    if (e.number == 8) {
+      ctx->app.scale = 1.0;
+      ctx->app.scale_q = 1.0;
+      ctx->app.offset_x = 0.0;
+      ctx->app.offset_y = 0.0;
+    }
+
+    if (e.number == 9) {
+      ctx->app.animation = !ctx->app.animation;
+      ctx->app.animation_frame = 0;
+    }
+  }
+
+  if (!moved || ctx->replay) {
+    return;
+  }
+
+  // rather than on the next tick
+  update_view(ctx, std::chrono::steady_clock::now().time_since_epoch(), 0);
+
+  const auto written = std::chrono::steady_clock::now().time_since_epoch();
+  for (const auto& e : ctx->pad_events) {
+    if (moves_view(e)) {
+      ctx->input_latency.add(written - e.time);
+    }
+  }
+}
+
+// Reads the gamepad until it is unplugged.
+static task run_gamepad(window_context* ctx) {
+  {
+    fd_watch watch{*ctx->loop, ctx->pad->fd()};
+    for (;;) {
+      const auto events = co_await watch;
+      if (events & EPOLLERR || events & EPOLLHUP) {
+        break;
+      }
+
+      ctx->pad_events.clear();
+      const auto present = ctx->pad->read(ctx->pad_events);
+      apply_gamepad_events(ctx);
+      if (!present) {
+        break;
+      }
+    }
+  }
+
+  detach_gamepad(ctx);
+}
+
+// Opens the gamepad at `path` if there is one. Whatever is held down already counts from now.
+static bool attach_gamepad(window_context* ctx, const char* path) {
+  try {
+    ctx->pad = std::make_unique<gamepad>(path);
+  } catch (const std::exception& e) {
+    // most input devices are no gamepads, and udev may not have given this one its permissions yet
+    if (ctx->pad_path && ::access(path, R_OK) == 0) {
+      std::cerr << e.what() << std::endl;
+    }
+    return false;
+  }
+
+  ctx->pad_task = run_gamepad(ctx);
+
+  std::cout << "gamepad attached: " << ctx->pad->name() << " (" << path << "), "
+            << int{ctx->pad->num_axes()} << " axes, " << int{ctx->pad->num_buttons()}
+            << " buttons" << std::endl;
+
+  ctx->input_time = std::chrono::steady_clock::now().time_since_epoch();
+  ctx->pad_events.clear();
+  ctx->pad->sync(ctx->pad_events);
+  apply_gamepad_events(ctx);
+  return true;
+}
+
+// the one asked for, or the first gamepad among the event devices
+static bool attach_any_gamepad(window_context* ctx) {
+  if (ctx->pad_path) {
+    return attach_gamepad(ctx, ctx->pad_path);
+  }
+
+  for (int n = 0; n < 32; ++n) {
+    char path[32];
+    std::snprintf(path, sizeof path, "/dev/input/event%d", n);
+    if (attach_gamepad(ctx, path)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// /dev/input, or /dev until that is created; the gamepad is attached when it appears in it
+static bool watch_input_dir(window_context* ctx) {
+  ctx->input_dir_watch =
+      ::inotify_add_watch(ctx->input_watch_fd, "/dev/input", IN_CREATE | IN_ATTRIB);
+  if (ctx->input_dir_watch >= 0) {
+    return true;
+  }
+  return ::inotify_add_watch(ctx->input_watch_fd, "/dev", IN_CREATE | IN_ONLYDIR) >= 0;
+}
+
+static void handle_input_watch_events(window_context* ctx, std::uint32_t events) {
+  if (events & EPOLLERR || events & EPOLLHUP) {
+    ctx->running = false;
+    return;
+  }
 
-    {
-      constexpr auto ratio = 1080.0 / 1920.0;
-      const auto scale_inv = 1.0 / app.scale;
-      const auto x1 = 1.0 * scale_inv;
-      const auto y1 = ratio * scale_inv;
-      const auto dx = 2.0 * x1 / 1920.0;
-      const auto dy = 2.0 * y1 / 1080.0;
+  if (!(events & EPOLLIN)) {
+    return;
+  }
 
-      app.offset_x += dx * shift_x;
-      app.offset_y += dy * shift_y;
-      const auto x0 = x1 - app.offset_x;
-      const auto y0 = y1 + app.offset_y;
+  alignas(::inotify_event) char buf[4096];
+  const auto len = ::read(ctx->input_watch_fd, buf, sizeof buf);
+  for (auto p = buf; len > 0 && p < buf + len;) {
+    const auto e = reinterpret_cast<const ::inotify_event*>(p);
+    p += sizeof(::inotify_event) + e->len;
 
-      ctx->fractal_ctl->set_x0(x0);
-      ctx->fractal_ctl->set_y0(y0);
-      ctx->fractal_ctl->set_dx(dx);
-      ctx->fractal_ctl->set_dy(dy);
+    if (e->wd != ctx->input_dir_watch) {
+      // /dev/input itself appeared
+      if (ctx->input_dir_watch < 0 && e->len && std::string_view{e->name} == "input" &&
+          watch_input_dir(ctx) && ctx->input_dir_watch >= 0) {
+        ::inotify_rm_watch(ctx->input_watch_fd, e->wd);
+        if (!ctx->pad) {
+          attach_any_gamepad(ctx);
+        }
+      }
+      continue;
     }
 
-    if (app.animation) {
-      const auto i = (app.animation_frame + exp) % 10000;
-
-      const auto t = (static_cast<double>(i) / 10000) * 6.28;
-      app.cr = 0.7885 * std::cos(t);
-      app.ci = 0.7885 * std::sin(t);
+    if (ctx->pad || !e->len) {
+      continue;
+    }
 
-      app.animation_frame = i;
-    } else {
-      app.cr = -0.4;
-      app.ci = 0.6;
+    const auto path = "/dev/input/"s + e->name;
+    if (ctx->pad_path ? path == ctx->pad_path : std::string_view{e->name}.starts_with("event")) {
+      attach_gamepad(ctx, path.c_str());
     }
-    ctx->fractal_ctl->set_cr(app.cr);
-    ctx->fractal_ctl->set_ci(app.ci);
   }
 }
 
-static void handle_joystick_events(window_context* ctx, std::uint32_t events) {
-  if (events & EPOLLERR || events & EPOLLHUP) {
-    ctx->running = false;
-    return;
-  }
+// Sets the frame size on the generator's subdevice, which adjusts `format` to the size it will
+// make. The subdevice is found by the name the driver gives it, after its device.
+static bool set_generator_format(::v4l2_subdev_format* format) {
+  for (int n = 0; n < 16; ++n) {
+    char path[48], buf[64];
+    std::snprintf(path, sizeof path, "/sys/class/video4linux/v4l-subdev%d/name", n);
 
-  if (events & EPOLLIN) {
-    ::js_event jse{};
-    if (::read(ctx->joystick_fd, &jse, sizeof jse) != sizeof jse) {
-      std::cerr << "joystick_fd read: " << std::strerror(errno) << std::endl;
-      ctx->running = false;
-      return;
-    }
+    const int fd = ::open(path, O_RDONLY);
+    if (fd < 0) continue;
 
-    switch (jse.type & ~JS_EVENT_INIT) {
-      case JS_EVENT_AXIS:
-        if (jse.number < ctx->joystick.num_axes) {
-          ctx->joystick.axes[jse.number] = jse.value;
-        }
-        break;
-      case JS_EVENT_BUTTON:
-        if (jse.number < ctx->joystick.num_buttons) {
-          ctx->joystick.buttons[jse.number] = jse.value;
-        }
+    const auto len = ::read(fd, buf, sizeof buf);
+    ::close(fd);
+    if (len < 0) continue;
 
-        if (jse.number == 4 && jse.value) {
-          ctx->fractal_ctl->set_mode(prev_mode(ctx->fractal_ctl->mode()));
-        }
-        if (jse.number == 5 && jse.value) {
-          ctx->fractal_ctl->set_mode(next_mode(ctx->fractal_ctl->mode()));
-        }
+    if (!std::string_view{buf, static_cast<std::size_t>(len)}.ends_with("fractal\n")) {
+      continue;
+    }
 
-        if (jse.number == 8 && jse.value) {
-          ctx->app.scale = 1.0;
-          ctx->app.scale_q = 1.0;
-          ctx->app.offset_x = 0.0;
-          ctx->app.offset_y = 0.0;
-        }
+    std::snprintf(path, sizeof path, "/dev/v4l-subdev%d", n);
+    const int subdev_fd = ::open(path, O_RDWR);
+    if (subdev_fd < 0) {
+      perror_exit("open");
+    }
 
-        if (jse.number == 9 && jse.value) {
-          ctx->app.animation = !ctx->app.animation;
-          ctx->app.animation_frame = 0;
-        }
-        break;
+    if (::ioctl(subdev_fd, VIDIOC_SUBDEV_S_FMT, format) == -1) {
+      perror_exit("VIDIOC_SUBDEV_S_FMT");
     }
+    ::close(subdev_fd);
 
-    return;
+    return true;
   }
-}
 
-auto main() -> int {
-  window_context ctx{};
-  ctx.width = 1920;
-  ctx.height = 1080;
+  std::cerr << "failed to find fractal subdevice" << std::endl;
+  return false;
+}
 
-  ctx.video_fd = ::open("/dev/video0", O_RDWR);
-  if (ctx.video_fd < 0) {
+// opens the capture device, allocates and maps its buffers, and queues all of them
+static bool init_v4l2(window_context* ctx) {
+  ctx->video_fd = ::open("/dev/video0", O_RDWR);
+  if (ctx->video_fd < 0) {
     perror_exit("open");
   }
 
   {
     ::v4l2_capability cap{};
 
-    if (::ioctl(ctx.video_fd, VIDIOC_QUERYCAP, &cap) == -1) {
+    if (::ioctl(ctx->video_fd, VIDIOC_QUERYCAP, &cap) == -1) {
       perror_exit("VIDIOC_QUERYCAP");
     }
 
     if (!(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE_MPLANE)) {
-      return -1;
+      return false;
     }
 
     if (!(cap.capabilities & V4L2_CAP_STREAMING)) {
-      return -1;
+      return false;
     }
   }
 
   {
+    // the generator decides which sizes it can make, and the capture format has to agree with it
+    ::v4l2_subdev_format subdev_format{};
+    subdev_format.which = V4L2_SUBDEV_FORMAT_ACTIVE;
+    subdev_format.pad = 0;
+    subdev_format.format.width = ctx->width;
+    subdev_format.format.height = ctx->height;
+    if (!set_generator_format(&subdev_format)) {
+      return false;
+    }
+
     ::v4l2_format format{};
     format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-    format.fmt.pix_mp.width = ctx.width;
-    format.fmt.pix_mp.height = ctx.height;
+    format.fmt.pix_mp.width = subdev_format.format.width;
+    format.fmt.pix_mp.height = subdev_format.format.height;
     format.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_BGRX32;
     format.fmt.pix_mp.field = V4L2_FIELD_ANY;
     format.fmt.pix_mp.num_planes = 1;
     format.fmt.pix_mp.plane_fmt[0].bytesperline = 0;
 
-    if (::ioctl(ctx.video_fd, VIDIOC_S_FMT, &format) == -1) {
+    if (::ioctl(ctx->video_fd, VIDIOC_S_FMT, &format) == -1) {
       perror_exit("VIDIOC_S_FMT");
     }
 
-    if (::ioctl(ctx.video_fd, VIDIOC_G_FMT, &format) == -1) {
+    if (::ioctl(ctx->video_fd, VIDIOC_G_FMT, &format) == -1) {
       perror_exit("VIDIOC_G_FMT");
     }
+
+    if (format.fmt.pix_mp.width != subdev_format.format.width ||
+        format.fmt.pix_mp.height != subdev_format.format.height) {
+      std::cerr << "capture size " << format.fmt.pix_mp.width << 'x' << format.fmt.pix_mp.height
+                << " does not match the generator's " << subdev_format.format.width << 'x'
+                << subdev_format.format.height << std::endl;
+      return false;
+    }
+
+    // everything downstream follows the negotiated format, whatever was asked for
+    ctx->width = static_cast<int>(format.fmt.pix_mp.width);
+    ctx->height = static_cast<int>(format.fmt.pix_mp.height);
+    ctx->v4l2_bytesperline = format.fmt.pix_mp.plane_fmt[0].bytesperline;
+
+    std::cout << "capture: " << ctx->width << 'x' << ctx->height << ", "
+              << ctx->v4l2_bytesperline << " bytes per line" << std::endl;
   }
 
   {
@@ -917,9 +2612,9 @@ auto main() -> int {
     req.count = num_buffers;
     req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
     req.memory = V4L2_MEMORY_MMAP;
-    if (::ioctl(ctx.video_fd, VIDIOC_REQBUFS, &req) == -1) {
+    if (::ioctl(ctx->video_fd, VIDIOC_REQBUFS, &req) == -1) {
       if (errno == EINVAL) {
-        return -1;
+        return false;
       } else {
         perror_exit("VIDIOC_REQBUFS");
       }
@@ -933,7 +2628,7 @@ auto main() -> int {
       buf.memory = V4L2_MEMORY_MMAP;
       buf.length = VIDEO_MAX_PLANES;
       buf.m.planes = planes;
-      if (::ioctl(ctx.video_fd, VIDIOC_QUERYBUF, &buf) == -1) {
+      if (::ioctl(ctx->video_fd, VIDIOC_QUERYBUF, &buf) == -1) {
         perror_exit("VIDIOC_QUERYBUF");
       }
 
@@ -942,7 +2637,7 @@ auto main() -> int {
           buf.m.planes[0].length,
           PROT_READ | PROT_WRITE,
           MAP_SHARED,
-          ctx.video_fd,
+          ctx->video_fd,
           buf.m.planes[0].m.mem_offset);
       if (mem == MAP_FAILED) {
         perror_exit("mmap");
@@ -952,16 +2647,23 @@ auto main() -> int {
       exbuf.index = i;
       exbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
       exbuf.plane = 0;
-      if (::ioctl(ctx.video_fd, VIDIOC_EXPBUF, &exbuf) == -1) {
+      if (::ioctl(ctx->video_fd, VIDIOC_EXPBUF, &exbuf) == -1) {
         perror_exit("VIDIOC_EXPBUF");
       }
 
-      auto& bufinfo = ctx.video_buffers.at(i);
+      auto& bufinfo = ctx->video_buffers.at(i);
       bufinfo = {
-          static_cast<std::uint8_t*>(mem), // mem
-          buf.m.planes[0].length,          // length
-          buf.m.planes[0].data_offset,     // offset
-          exbuf.fd                         // fd
+          static_cast<std::uint8_t*>(mem),         // mem
+          buf.m.planes[0].length,                  // length
+          buf.m.planes[0].data_offset,             // offset
+          exbuf.fd,                                // fd
+          {},                                      // params
+          static_cast<std::uint32_t>(ctx->width),  // width
+          static_cast<std::uint32_t>(ctx->height), // height
+          fractal_max_iterations,                  // max_iterations
+          {},                                      // timestamp
+          0,                                       // sequence
+          0,                                       // refs
       };
 
       std::printf(
@@ -972,105 +2674,788 @@ auto main() -> int {
           bufinfo.offset,
           bufinfo.fd);
 
-      if (::ioctl(ctx.video_fd, VIDIOC_QBUF, &buf) == -1) {
+      if (::ioctl(ctx->video_fd, VIDIOC_QBUF, &buf) == -1) {
         perror_exit("VIDIOC_QBUF");
       }
     }
-  }
 
-  ctx.drm_fd = ::open("/dev/dri/card0", O_RDWR);
-  if (ctx.drm_fd < 0) {
-    perror_exit("open");
+    ctx->v4l2_queued_buffers = req.count;
   }
 
-  std::tie(ctx.crtc_id, ctx.connector_id, ctx.display_mode) = init_drm(ctx.drm_fd);
-  std::cout << "connector: " << ctx.connector_id << ", mode: " << ctx.display_mode.hdisplay << 'x'
-            << ctx.display_mode.vdisplay << " @ " << ctx.display_mode.vrefresh
-            << " Hz, crtc: " << ctx.crtc_id << std::endl;
+  return true;
+}
+
+static void print_usage(const char* argv0) {
+  std::cout << "usage: " << argv0 << " [options]\n"
+            << "\n"
+            << "options:\n"
+            << "  --no-overlay-cache  re-render the overlay text on every frame\n"
+            << "  --no-reprojection   show frames as generated instead of moving them to the\n"
+            << "                      current view while panning and zooming\n"
+            << "  --no-prediction     write the view as it is, instead of as it will be by the\n"
+            << "                      time the frame made with it is shown\n"
+            << "  --input DEVICE      the evdev device to take input from (default: the first\n"
+            << "                      gamepad to turn up in /dev/input)\n"
+            << "  --blend             blend between the two latest frames at display rate in\n"
+            << "                      animation mode\n"
+            << "  --record FILE       record every captured frame to FILE\n"
+            << "  --record-queue N    frames the recorder may hold at once (default: 2)\n"
+            << "  --record-format FMT raw (default) or itmap, compressed iteration counts of\n"
+            << "                      gray frames; the colour mode stays gray while recording\n"
+            << "  --replay FILE       show a recording instead of the generator's output\n"
+            << "  --replay-speed X    replay at X times the recorded pace, or as fast as frames\n"
+            << "                      are displayed if 0 (default: 1)\n"
+            << "  --replay-loop       start over at the end of the recording instead of exiting\n"
+            << "  --software          render frames on the CPU instead of the generator\n"
+            << "  --software-threads N\n"
+            << "                      rendering threads (default: one per core)\n"
+            << "  --frame-time MS     time the CPU may spend on a frame; the iteration limit is\n"
+            << "                      chosen to fit (default: 16.7)\n"
+            << "  --iterations N      fix the iteration limit of CPU frames instead\n"
+            << "  --no-normalize      colour CPU frames by their raw counts, as the generator\n"
+            << "                      does, instead of spreading them over the palette\n"
+            << "  --min-scale F       smallest resolution CPU frames may be rendered at to keep\n"
+            << "                      to the frame time, as a share of the full one (default:\n"
+            << "                      0.5; 1 keeps it fixed, as does recording)\n"
+            << "  --split             render the bottom of each frame on the CPU while the\n"
+            << "                      generator (or --software, standing in for it) makes the\n"
+            << "                      top, moving the split to where both take as long\n"
+            << "  --split-threads N   threads rendering the bottom (default: one per core)\n"
+            << "  --scroll            have the generator make frames only when the view changes,\n"
+            << "                      and while panning only the strip coming into view, moving\n"
+            << "                      the rest over from the frame before\n"
+            << "  --verify FRACTION   check FRACTION of the generated frames against the software\n"
+            << "                      model, on a sample of pixels each\n"
+            << "  --verify-samples N  pixels checked in each of them (default: 256)\n"
+            << "  --verify-budget PERCENT\n"
+            << "                      share of one core the checks may take; frames are left\n"
+            << "                      out to keep to it (default: 2)\n"
+            << "  --publish SOCKET    share the frames with local processes through the Unix\n"
+            << "                      socket SOCKET, passing them the buffers' fds\n"
+            << "  --publish-leases N  frames the consumers may hold at once, together (default:\n"
+            << "                      2, at most 4)\n"
+            << "  --publish-timeout MS\n"
+            << "                      how long a consumer may hold a frame before it is taken\n"
+            << "                      back (default: 100)\n"
+            << "  --capture-size WxH  size of the generated or CPU-rendered frames, which are\n"
+            << "                      scaled to the display (default: the display mode's)\n"
+            << "  --snapshot-dir DIR  where stills (button 3 or SIGUSR1) are saved (default: .)\n"
+            << "  --snapshot-format FMT\n"
+            << "                      png (default) or qoi\n"
+            << "  --program-cache DIR where linked GL programs are kept for the next start, or\n"
+            << "                      nowhere if empty (default: /var/cache/fractal-explorer)\n"
+            << "  --realtime          run the event loop, which captures, controls and displays,\n"
+            << "                      at SCHED_FIFO on a core of its own, with all memory locked\n"
+            << "  --rt-cpu N          its core; the other threads run on the rest (default: the\n"
+            << "                      last one)\n"
+            << "  --rt-priority N     its priority, 1 to 99 (default: 50)\n"
+            << "  --latency SECONDS   measure how late the loop wakes up for the timer, captured\n"
+            << "                      frames and vblanks, then exit and print it; 0 keeps going\n"
+            << "  --latency-load N    keep the cores busy with N threads of memory traffic and\n"
+            << "                      page faults meanwhile (default: 0)\n"
+            << "  -h, --help          show this message\n";
+}
 
-  ctx.gbm_device = ::gbm_create_device(ctx.drm_fd);
-  if (!ctx.gbm_device) {
-    return -1;
+auto main(int argc, char** argv) -> int {
+  window_context ctx{};
+  ctx.overlay.cache_enabled = true;
+  ctx.reprojection_enabled = true;
+  ctx.input_prediction = true;
+
+  const char* record_path = nullptr;
+  std::size_t record_queue = 2;
+  auto record_format = recorder::format::raw;
+  const char* replay_path = nullptr;
+  double replay_speed = 1.0;
+  bool replay_loop = false;
+  bool software = false;
+  unsigned int software_threads = 0;
+  double frame_time_ms = 1000.0 / 60.0;
+  std::uint32_t iterations = 0;
+  bool normalize = true;
+  double min_scale = 0.5;
+  bool split = false;
+  unsigned int split_threads = 0;
+  bool scroll = false;
+  double verify_fraction = 0.0;
+  std::uint32_t verify_samples = 256;
+  double verify_budget = 2.0;
+  const char* publish_path = nullptr;
+  std::size_t publish_leases = 2;
+  double publish_timeout_ms = 100.0;
+  unsigned int capture_width = 0, capture_height = 0;
+  const char* snapshot_dir = ".";
+  auto snapshot_format = snapshot_writer::format::png;
+  std::string program_cache = "/var/cache/fractal-explorer";
+  bool realtime = false;
+  unsigned int rt_cpu = std::max(std::thread::hardware_concurrency(), 1u) - 1;
+  int rt_priority = 50;
+  std::optional<double> latency_seconds;
+  unsigned int latency_load = 0;
+
+  {
+    enum : int {
+      opt_no_overlay_cache = 0x100,
+      opt_no_reprojection,
+      opt_no_prediction,
+      opt_input,
+      opt_blend,
+      opt_record,
+      opt_record_queue,
+      opt_record_format,
+      opt_replay,
+      opt_replay_speed,
+      opt_replay_loop,
+      opt_software,
+      opt_software_threads,
+      opt_frame_time,
+      opt_iterations,
+      opt_no_normalize,
+      opt_min_scale,
+      opt_split,
+      opt_split_threads,
+      opt_scroll,
+      opt_verify,
+      opt_verify_samples,
+      opt_verify_budget,
+      opt_publish,
+      opt_publish_leases,
+      opt_publish_timeout,
+      opt_capture_size,
+      opt_snapshot_dir,
+      opt_snapshot_format,
+      opt_program_cache,
+      opt_realtime,
+      opt_rt_cpu,
+      opt_rt_priority,
+      opt_latency,
+      opt_latency_load,
+    };
+
+    static const ::option long_options[] = {
+        {"no-overlay-cache", no_argument, nullptr, opt_no_overlay_cache},
+        {"no-reprojection", no_argument, nullptr, opt_no_reprojection},
+        {"no-prediction", no_argument, nullptr, opt_no_prediction},
+        {"input", required_argument, nullptr, opt_input},
+        {"blend", no_argument, nullptr, opt_blend},
+        {"record", required_argument, nullptr, opt_record},
+        {"record-queue", required_argument, nullptr, opt_record_queue},
+        {"record-format", required_argument, nullptr, opt_record_format},
+        {"replay", required_argument, nullptr, opt_replay},
+        {"replay-speed", required_argument, nullptr, opt_replay_speed},
+        {"replay-loop", no_argument, nullptr, opt_replay_loop},
+        {"software", no_argument, nullptr, opt_software},
+        {"software-threads", required_argument, nullptr, opt_software_threads},
+        {"frame-time", required_argument, nullptr, opt_frame_time},
+        {"iterations", required_argument, nullptr, opt_iterations},
+        {"no-normalize", no_argument, nullptr, opt_no_normalize},
+        {"min-scale", required_argument, nullptr, opt_min_scale},
+        {"split", no_argument, nullptr, opt_split},
+        {"split-threads", required_argument, nullptr, opt_split_threads},
+        {"scroll", no_argument, nullptr, opt_scroll},
+        {"verify", required_argument, nullptr, opt_verify},
+        {"verify-samples", required_argument, nullptr, opt_verify_samples},
+        {"verify-budget", required_argument, nullptr, opt_verify_budget},
+        {"publish", required_argument, nullptr, opt_publish},
+        {"publish-leases", required_argument, nullptr, opt_publish_leases},
+        {"publish-timeout", required_argument, nullptr, opt_publish_timeout},
+        {"capture-size", required_argument, nullptr, opt_capture_size},
+        {"snapshot-dir", required_argument, nullptr, opt_snapshot_dir},
+        {"snapshot-format", required_argument, nullptr, opt_snapshot_format},
+        {"program-cache", required_argument, nullptr, opt_program_cache},
+        {"realtime", no_argument, nullptr, opt_realtime},
+        {"rt-cpu", required_argument, nullptr, opt_rt_cpu},
+        {"rt-priority", required_argument, nullptr, opt_rt_priority},
+        {"latency", required_argument, nullptr, opt_latency},
+        {"latency-load", required_argument, nullptr, opt_latency_load},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    for (int opt; (opt = ::getopt_long(argc, argv, "h", long_options, nullptr)) != -1;) {
+      switch (opt) {
+        case opt_no_overlay_cache:
+          ctx.overlay.cache_enabled = false;
+          break;
+        case opt_no_reprojection:
+          ctx.reprojection_enabled = false;
+          break;
+        case opt_no_prediction:
+          ctx.input_prediction = false;
+          break;
+        case opt_input:
+          ctx.pad_path = ::optarg;
+          break;
+        case opt_blend:
+          ctx.blend_enabled = true;
+          break;
+        case opt_record:
+          record_path = ::optarg;
+          break;
+        case opt_record_queue:
+          record_queue = std::strtoul(::optarg, nullptr, 10);
+          break;
+        case opt_record_format:
+          if (std::string_view{::optarg} == "raw") {
+            record_format = recorder::format::raw;
+          } else if (std::string_view{::optarg} == "itmap") {
+            record_format = recorder::format::itmap;
+          } else {
+            print_usage(argv[0]);
+            return -1;
+          }
+          break;
+        case opt_replay:
+          replay_path = ::optarg;
+          break;
+        case opt_replay_speed:
+          replay_speed = std::strtod(::optarg, nullptr);
+          break;
+        case opt_replay_loop:
+          replay_loop = true;
+          break;
+        case opt_software:
+          software = true;
+          break;
+        case opt_software_threads:
+          software_threads = static_cast<unsigned int>(std::strtoul(::optarg, nullptr, 10));
+          break;
+        case opt_frame_time:
+          frame_time_ms = std::strtod(::optarg, nullptr);
+          break;
+        case opt_iterations:
+          iterations = static_cast<std::uint32_t>(std::strtoul(::optarg, nullptr, 10));
+          if (iterations < 1 || iterations > fractal_max_iterations) {
+            print_usage(argv[0]);
+            return -1;
+          }
+          break;
+        case opt_no_normalize:
+          normalize = false;
+          break;
+        case opt_min_scale:
+          min_scale = std::strtod(::optarg, nullptr);
+          break;
+        case opt_split:
+          split = true;
+          break;
+        case opt_split_threads:
+          split_threads = static_cast<unsigned int>(std::strtoul(::optarg, nullptr, 10));
+          break;
+        case opt_scroll:
+          scroll = true;
+          break;
+        case opt_verify:
+          verify_fraction = std::strtod(::optarg, nullptr);
+          if (!(verify_fraction > 0.0 && verify_fraction <= 1.0)) {
+            print_usage(argv[0]);
+            return -1;
+          }
+          break;
+        case opt_verify_samples:
+          verify_samples = static_cast<std::uint32_t>(std::strtoul(::optarg, nullptr, 10));
+          if (verify_samples < 1) {
+            print_usage(argv[0]);
+            return -1;
+          }
+          break;
+        case opt_verify_budget:
+          verify_budget = std::strtod(::optarg, nullptr);
+          break;
+        case opt_publish:
+          publish_path = ::optarg;
+          break;
+        case opt_publish_leases:
+          // the rest stay with the capture queue and the display
+          publish_leases = std::strtoul(::optarg, nullptr, 10);
+          if (publish_leases < 1 || publish_leases > num_buffers / 2) {
+            print_usage(argv[0]);
+            return -1;
+          }
+          break;
+        case opt_publish_timeout:
+          publish_timeout_ms = std::strtod(::optarg, nullptr);
+          if (!(publish_timeout_ms > 0.0)) {
+            print_usage(argv[0]);
+            return -1;
+          }
+          break;
+        case opt_capture_size:
+          if (std::sscanf(::optarg, "%ux%u", &capture_width, &capture_height) != 2 ||
+              capture_width == 0 || capture_height == 0) {
+            print_usage(argv[0]);
+            return -1;
+          }
+          break;
+        case opt_snapshot_dir:
+          snapshot_dir = ::optarg;
+          break;
+        case opt_snapshot_format:
+          if (std::string_view{::optarg} == "png") {
+            snapshot_format = snapshot_writer::format::png;
+          } else if (std::string_view{::optarg} == "qoi") {
+            snapshot_format = snapshot_writer::format::qoi;
+          } else {
+            print_usage(argv[0]);
+            return -1;
+          }
+          break;
+        case opt_program_cache:
+          program_cache = ::optarg;
+          break;
+        case opt_realtime:
+          realtime = true;
+          break;
+        case opt_rt_cpu:
+          rt_cpu = static_cast<unsigned int>(std::strtoul(::optarg, nullptr, 10));
+          break;
+        case opt_rt_priority:
+          rt_priority = static_cast<int>(std::strtol(::optarg, nullptr, 10));
+          if (rt_priority < 1 || rt_priority > 99) {
+            print_usage(argv[0]);
+            return -1;
+          }
+          break;
+        case opt_latency:
+          latency_seconds = std::strtod(::optarg, nullptr);
+          if (!(*latency_seconds >= 0.0)) {
+            print_usage(argv[0]);
+            return -1;
+          }
+          break;
+        case opt_latency_load:
+          latency_load = static_cast<unsigned int>(std::strtoul(::optarg, nullptr, 10));
+          break;
+        case 'h':
+          print_usage(argv[0]);
+          return 0;
+        default:
+          print_usage(argv[0]);
+          return -1;
+      }
+    }
   }
 
-  ctx.gbm_surface = ::gbm_surface_create(
-      ctx.gbm_device,
-      ctx.display_mode.hdisplay,
-      ctx.display_mode.vdisplay,
-      GBM_FORMAT_ARGB8888,
-      GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING);
-  if (!ctx.gbm_surface) {
-    std::cerr << "gbm_surface_create: failed to create gbm surface" << std::endl;
+  if (replay_path && split) {
+    std::cerr << "--split needs the generator or --software" << std::endl;
     return -1;
   }
 
-  std::tie(ctx.egl_display, ctx.egl_config, ctx.egl_context) = init_egl(ctx.gbm_device);
-
-  ctx.egl_surface = ::eglCreateWindowSurface(
-      ctx.egl_display,
-      ctx.egl_config,
-      reinterpret_cast<::EGLNativeWindowType>(ctx.gbm_surface),
-      nullptr);
-  if (ctx.egl_surface == EGL_NO_SURFACE) {
-    std::cerr << "failed to create egl surface" << std::endl;
+  if (scroll && (replay_path || software || split)) {
+    std::cerr << "--scroll needs the generator, and cannot be used with --split" << std::endl;
     return -1;
   }
 
-  if (!::eglMakeCurrent(ctx.egl_display, ctx.egl_surface, ctx.egl_surface, ctx.egl_context)) {
+  if (verify_fraction > 0.0 && (replay_path || software)) {
+    std::cerr << "--verify needs the generator" << std::endl;
     return -1;
   }
 
-  if (!(::eglCreateImageKHR = get_egl_proc<::PFNEGLCREATEIMAGEKHRPROC>("eglCreateImageKHR"))) {
-    std::cerr << "eglCreateImageKHR" << std::endl;
+  if (latency_load > 0 && !latency_seconds) {
+    std::cerr << "--latency-load needs --latency" << std::endl;
     return -1;
   }
 
-  if (!(::eglDestroyImageKHR = get_egl_proc<::PFNEGLDESTROYIMAGEKHRPROC>("eglDestroyImageKHR"))) {
-    std::cerr << "eglDestroyImageKHR" << std::endl;
-    return -1;
+  {
+    // every thread started from here on inherits the mask, so only the signalfd sees the signal
+    ::sigset_t mask;
+    ::sigemptyset(&mask);
+    ::sigaddset(&mask, SIGUSR1);
+    if (::pthread_sigmask(SIG_BLOCK, &mask, nullptr) != 0) {
+      perror_exit("pthread_sigmask");
+    }
+
+    ctx.signal_fd = ::signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (ctx.signal_fd < 0) {
+      perror_exit("signalfd");
+    }
   }
 
-  if (!(::glEGLImageTargetTexture2DOES =
-            get_egl_proc<::PFNGLEGLIMAGETARGETTEXTURE2DOESPROC>("glEGLImageTargetTexture2DOES"))) {
-    std::cerr << "glEGLImageTargetTexture2DOES" << std::endl;
+  try {
+    ctx.snapshots = std::make_unique<snapshot_writer>(snapshot_dir, snapshot_format);
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
     return -1;
   }
 
-  ctx.texture.program = create_gl_program(vertex_shader_src, fragment_shader_src);
-  if (!ctx.texture.program) {
-    return -1;
+  {
+    const auto phase = ctx.startup.measure("drm");
+
+    ctx.drm_fd = ::open("/dev/dri/card0", O_RDWR);
+    if (ctx.drm_fd < 0) {
+      perror_exit("open");
+    }
+
+    std::tie(ctx.crtc_id, ctx.crtc_index, ctx.connector_id, ctx.display_mode) =
+        init_drm(ctx.drm_fd);
+    std::cout << "connector: " << ctx.connector_id << ", mode: " << ctx.display_mode.hdisplay
+              << 'x' << ctx.display_mode.vdisplay << " @ " << ctx.display_mode.vrefresh
+              << " Hz, crtc: " << ctx.crtc_id << std::endl;
+  }
+
+  // frames are made at the display's size unless asked otherwise
+  ctx.width = capture_width ? static_cast<int>(capture_width) : ctx.display_mode.hdisplay;
+  ctx.height = capture_height ? static_cast<int>(capture_height) : ctx.display_mode.vdisplay;
+
+  // The capture side and the display side need each other only once the buffers are imported as
+  // textures. Until then the source is set up on a thread of its own, and the overlay's font is
+  // loaded on another, while the GPU driver starts and the shaders are built here.
+  auto source_ready = std::async(std::launch::async, [&]() -> bool {
+    const auto phase = ctx.startup.measure("source");
+
+    if (replay_path) {
+      try {
+        ctx.replay = std::make_unique<replay_source>(
+            replay_path, num_buffers, replay_speed, replay_loop);
+      } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+      }
+
+      ctx.video_fd = -1;
+      ctx.width = static_cast<int>(ctx.replay->width());
+      ctx.height = static_cast<int>(ctx.replay->height());
+      ctx.v4l2_bytesperline = ctx.replay->stride();
+      for (auto i = 0u; i < num_buffers; ++i) {
+        const auto& b = ctx.replay->get_buffer(i);
+        ctx.video_buffers[i] = {
+            b.ptr,                                  // mem
+            b.length,                               // length
+            0,                                      // offset
+            b.fd,                                   // fd
+            {},                                     // params
+            static_cast<std::uint32_t>(ctx.width),  // width
+            static_cast<std::uint32_t>(ctx.height), // height
+            fractal_max_iterations,                 // max_iterations
+            {},                                     // timestamp
+            0,                                      // sequence
+            0,                                      // refs
+        };
+      }
+      std::cout << "replaying " << replay_path << " (" << ctx.width << 'x' << ctx.height << ')'
+                << std::endl;
+    } else if (software) {
+      // iteration maps are recorded from raw counts, and recordings have one frame size; standing
+      // in for the generator, frames are what it would make
+      const auto itmap = record_path && record_format == recorder::format::itmap;
+      if (split) {
+        iterations = fractal_max_iterations;
+      }
+      try {
+        ctx.software = std::make_unique<software_source>(
+            ctx.width,
+            ctx.height,
+            num_buffers,
+            software_threads,
+            std::chrono::nanoseconds{static_cast<std::int64_t>(frame_time_ms * 1e6)},
+            iterations ? iterations : 1,
+            iterations ? iterations : fractal_max_iterations,
+            normalize && !itmap && !split,
+            record_path || split ? 1.0 : min_scale);
+      } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+      }
+
+      ctx.video_fd = -1;
+      ctx.v4l2_bytesperline = ctx.software->stride();
+      for (auto i = 0u; i < num_buffers; ++i) {
+        const auto& b = ctx.software->get_buffer(i);
+        ctx.video_buffers[i] = {
+            b.ptr,                                  // mem
+            b.length,                               // length
+            0,                                      // offset
+            b.fd,                                   // fd
+            {},                                     // params
+            static_cast<std::uint32_t>(ctx.width),  // width
+            static_cast<std::uint32_t>(ctx.height), // height
+            fractal_max_iterations,                 // max_iterations
+            {},                                     // timestamp
+            0,                                      // sequence
+            0,                                      // refs
+        };
+      }
+      std::cout << "rendering on the CPU (" << ctx.width << 'x' << ctx.height << ')' << std::endl;
+    } else if (!init_v4l2(&ctx)) {
+      return false;
+    }
+
+    if (split) {
+      try {
+        ctx.split = std::make_unique<split_renderer>(
+            ctx.width, ctx.height, split_threads, split_min_rows);
+      } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+      }
+
+      // until the first frame arrives, the source makes whole frames
+      ctx.split_rows = ctx.height;
+      ctx.pending_split_rows = ctx.height;
+      std::cout << "splitting frames between the "
+                << (ctx.software ? "CPU stand-in" : "generator") << " and the CPU" << std::endl;
+    }
+
+    if (scroll) {
+      try {
+        ctx.scroll = std::make_unique<scroll_compositor>(ctx.width, ctx.height);
+      } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+      }
+    }
+
+    if (verify_fraction > 0.0) {
+      try {
+        ctx.verifier = std::make_unique<frame_verifier>(verify_samples, verify_budget / 100.0);
+      } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+      }
+      ctx.verify_fraction = verify_fraction;
+      std::cout << "checking " << verify_fraction * 100.0 << "% of the frames, " << verify_samples
+                << " pixels each" << std::endl;
+    }
+
+    if (record_path) {
+      frame_file_header header{};
+      std::memcpy(header.magic, frame_file_magic, sizeof header.magic);
+      header.version = frame_file_version;
+      header.width = ctx.width;
+      header.height = ctx.height;
+      header.stride = ctx.v4l2_bytesperline;
+      header.fourcc = V4L2_PIX_FMT_BGRX32;
+      header.frame_size = ctx.v4l2_bytesperline * ctx.height;
+      header.record_size = frame_file_record_size(header.frame_size);
+
+      try {
+        ctx.frame_recorder =
+            std::make_unique<recorder>(record_path, header, record_queue, record_format);
+      } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+      }
+      std::cout << "recording to " << record_path << std::endl;
+    }
+
+    if (publish_path) {
+      frame_share_header layout{};
+      layout.width = ctx.width;
+      layout.height = ctx.height;
+      layout.stride = ctx.v4l2_bytesperline;
+      layout.fourcc = V4L2_PIX_FMT_BGRX32;
+
+      std::vector<int> fds;
+      for (const auto& b : ctx.video_buffers) {
+        fds.push_back(b.fd);
+      }
+
+      try {
+        ctx.publisher = std::make_unique<frame_publisher>(
+            publish_path,
+            layout,
+            fds,
+            publish_leases,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::duration<double, std::milli>{publish_timeout_ms}));
+      } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+      }
+      std::cout << "sharing frames on " << publish_path << std::endl;
+    }
+
+    if (ctx.replay || ctx.software) {
+      // nothing reads the registers, but the controls keep working
+      ctx.fractal_ctl = std::make_unique<fractal_controller>();
+    }
+
+    for (int n = 0; n < 16 && !ctx.fractal_ctl; ++n) {
+      char path[32], buf[16];
+      std::snprintf(path, sizeof path, "/sys/class/uio/uio%d/name", n);
+
+      const int fd = ::open(path, O_RDONLY);
+      if (fd < 0) continue;
+
+      const auto len = ::read(fd, buf, sizeof buf);
+      ::close(fd);
+      if (len < 0) continue;
+
+      if (std::string_view{buf, static_cast<std::size_t>(len)} == "fractal\n") {
+        std::snprintf(path, sizeof path, "/dev/uio%d", n);
+
+        std::cout << "fractal uio device: " << path << std::endl;
+        ctx.fractal_ctl = std::make_unique<fractal_controller>(path);
+        break;
+      }
+    }
+
+    if (!ctx.fractal_ctl) {
+      std::cerr << "failed to find fractal uio device" << std::endl;
+      return false;
+    }
+
+    if (ctx.scroll) {
+      // from the first frame on, so that every frame is one asked for
+      ctx.fractal_ctl->set_auto_restart(false);
+    }
+
+    return true;
+  });
+
+  auto overlay_ready = std::async(std::launch::async, [&]() -> bool {
+    const auto phase = ctx.startup.measure("overlay font");
+
+    ctx.overlay.surface =
+        ::cairo_image_surface_create(CAIRO_FORMAT_ARGB32, overlay_width, overlay_height);
+    if (::cairo_surface_status(ctx.overlay.surface) != CAIRO_STATUS_SUCCESS) {
+      std::cerr << "failed to create cairo image surface" << std::endl;
+      return false;
+    }
+
+    // the first text drawn loads the font
+    draw_overlay(ctx.overlay.surface, {});
+    return true;
+  });
+
+  {
+    const auto phase = ctx.startup.measure("egl");
+
+    ctx.gbm_device = ::gbm_create_device(ctx.drm_fd);
+    if (!ctx.gbm_device) {
+      return -1;
+    }
+
+    ctx.gbm_surface = ::gbm_surface_create(
+        ctx.gbm_device,
+        ctx.display_mode.hdisplay,
+        ctx.display_mode.vdisplay,
+        GBM_FORMAT_ARGB8888,
+        GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING);
+    if (!ctx.gbm_surface) {
+      std::cerr << "gbm_surface_create: failed to create gbm surface" << std::endl;
+      return -1;
+    }
+
+    std::tie(ctx.egl_display, ctx.egl_config, ctx.egl_context) = init_egl(ctx.gbm_device);
+
+    ctx.egl_surface = ::eglCreateWindowSurface(
+        ctx.egl_display,
+        ctx.egl_config,
+        reinterpret_cast<::EGLNativeWindowType>(ctx.gbm_surface),
+        nullptr);
+    if (ctx.egl_surface == EGL_NO_SURFACE) {
+      std::cerr << "failed to create egl surface" << std::endl;
+      return -1;
+    }
+
+    if (!::eglMakeCurrent(ctx.egl_display, ctx.egl_surface, ctx.egl_surface, ctx.egl_context)) {
+      return -1;
+    }
+
+    if (!(::eglCreateImageKHR = get_egl_proc<::PFNEGLCREATEIMAGEKHRPROC>("eglCreateImageKHR"))) {
+      std::cerr << "eglCreateImageKHR" << std::endl;
+      return -1;
+    }
+
+    if (!(::eglDestroyImageKHR = get_egl_proc<::PFNEGLDESTROYIMAGEKHRPROC>("eglDestroyImageKHR"))) {
+      std::cerr << "eglDestroyImageKHR" << std::endl;
+      return -1;
+    }
+
+    if (!(::glEGLImageTargetTexture2DOES = get_egl_proc<::PFNGLEGLIMAGETARGETTEXTURE2DOESPROC>(
+              "glEGLImageTargetTexture2DOES"))) {
+      std::cerr << "glEGLImageTargetTexture2DOES" << std::endl;
+      return -1;
+    }
+
+    // optional; without it, the shaders are compiled on every start
+    if (const auto extensions = ::glGetString(GL_EXTENSIONS);
+        extensions && std::string_view{reinterpret_cast<const char*>(extensions)}.find(
+                          "GL_OES_get_program_binary") != std::string_view::npos) {
+      ::GLint formats{};
+      ::glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &formats);
+      if (formats > 0) {
+        ::glGetProgramBinaryOES =
+            get_egl_proc<::PFNGLGETPROGRAMBINARYOESPROC>("glGetProgramBinaryOES");
+        ::glProgramBinaryOES = get_egl_proc<::PFNGLPROGRAMBINARYOESPROC>("glProgramBinaryOES");
+        if (!::glGetProgramBinaryOES || !::glProgramBinaryOES) {
+          ::glGetProgramBinaryOES = nullptr;
+          ::glProgramBinaryOES = nullptr;
+        }
+      }
+    }
   }
 
-  ctx.texture.a_position = ::glGetAttribLocation(ctx.texture.program, "a_position");
-  ctx.texture.a_tex_coord = ::glGetAttribLocation(ctx.texture.program, "a_texCoord");
-  ctx.texture.s_texture = ::glGetUniformLocation(ctx.texture.program, "s_texture");
+  {
+    const auto phase = ctx.startup.measure("gl programs");
+
+    for (auto [t, vshader_src, fshader_src] : {
+             std::make_tuple(&ctx.texture.copy, frame_vertex_shader_src, fragment_shader_src),
+             std::make_tuple(
+                 &ctx.texture.blend, blend_vertex_shader_src, blend_fragment_shader_src),
+         }) {
+      t->program = load_gl_program(vshader_src, fshader_src, program_cache);
+      if (!t->program) {
+        return -1;
+      }
+
+      t->a_position = ::glGetAttribLocation(t->program, "a_position");
+      t->a_tex_coord = ::glGetAttribLocation(t->program, "a_texCoord");
+      t->s_texture = ::glGetUniformLocation(t->program, "s_texture");
+      t->s_texture_prev = ::glGetUniformLocation(t->program, "s_texture_prev");
+      t->u_transform = ::glGetUniformLocation(t->program, "u_transform");
+      t->u_prev_transform = ::glGetUniformLocation(t->program, "u_prev_transform");
+      t->u_tex_scale = ::glGetUniformLocation(t->program, "u_tex_scale");
+      t->u_prev_tex_scale = ::glGetUniformLocation(t->program, "u_prev_tex_scale");
+      t->u_mix = ::glGetUniformLocation(t->program, "u_mix");
+    }
+
+    ctx.overlay.program =
+        load_gl_program(vertex_shader_src, overlay_fragment_shader_src, program_cache);
+    if (!ctx.overlay.program) {
+      return -1;
+    }
+
+    ctx.overlay.a_position = ::glGetAttribLocation(ctx.overlay.program, "a_position");
+    ctx.overlay.a_tex_coord = ::glGetAttribLocation(ctx.overlay.program, "a_texCoord");
+    ctx.overlay.s_texture = ::glGetUniformLocation(ctx.overlay.program, "s_texture");
+
+    ::glGenTextures(1, &ctx.overlay.texture);
+    ::glBindTexture(GL_TEXTURE_2D, ctx.overlay.texture);
+    ::glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    ::glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    ::glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    ::glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    ::glTexImage2D(
+        GL_TEXTURE_2D,
+        0,
+        GL_RGBA,
+        overlay_width,
+        overlay_height,
+        0,
+        GL_RGBA,
+        GL_UNSIGNED_BYTE,
+        nullptr);
+    ::glBindTexture(GL_TEXTURE_2D, 0);
+    ctx.overlay.dirty = true;
+  }
+
+  // both are waited for, whatever the first returns
+  const auto source_ok = source_ready.get();
+  if (!overlay_ready.get() || !source_ok) {
+    return -1;
+  }
 
   {
+    const auto phase = ctx.startup.measure("import buffers");
+
     ::glGenTextures(num_buffers, ctx.texture.textures);
     for (auto i = 0u; i < num_buffers; ++i) {
-      // clang-format off
-      ::EGLint attrs[] = {
-        EGL_IMAGE_PRESERVED_KHR,       EGL_TRUE,
-        EGL_WIDTH,                     ctx.width,
-        EGL_HEIGHT,                    ctx.height,
-        EGL_LINUX_DRM_FOURCC_EXT,      DRM_FORMAT_ABGR8888,
-        EGL_DMA_BUF_PLANE0_FD_EXT,     ctx.video_buffers[i].fd,
-        EGL_DMA_BUF_PLANE0_OFFSET_EXT, static_cast<::EGLint>(ctx.video_buffers[i].offset),
-        EGL_DMA_BUF_PLANE0_PITCH_EXT,  ctx.width * 4,
-        EGL_NONE
-      };
-      // clang-format on
-
-      ::EGLImageKHR image = ::eglCreateImageKHR(
-          ctx.egl_display, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, nullptr, attrs);
-      if (image == EGL_NO_IMAGE_KHR) {
+      if (!import_video_buffer(&ctx, i)) {
         std::cerr << "failed to create image" << std::endl;
         return -1;
       }
-
-      ::glBindTexture(GL_TEXTURE_EXTERNAL_OES, ctx.texture.textures[i]);
-      ::glEGLImageTargetTexture2DOES(GL_TEXTURE_EXTERNAL_OES, image);
-      ::glBindTexture(GL_TEXTURE_EXTERNAL_OES, 0);
     }
   }
 
@@ -1078,78 +3463,58 @@ auto main() -> int {
   ctx.v4l2_total_frames = 0;
   ctx.v4l2_fps_updated_time = std::chrono::steady_clock::now();
 
-  ::v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-  if (::ioctl(ctx.video_fd, VIDIOC_STREAMON, &type) == -1) {
-    perror_exit("VIDIOC_STREAMON");
+  if (ctx.video_fd >= 0) {
+    ::v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    if (::ioctl(ctx.video_fd, VIDIOC_STREAMON, &type) == -1) {
+      perror_exit("VIDIOC_STREAMON");
+    }
   }
 
-  ctx.cairo_device = ::cairo_egl_device_create(ctx.egl_display, ctx.egl_context);
-  if (::cairo_device_status(ctx.cairo_device) != CAIRO_STATUS_SUCCESS) {
-    std::cerr << "failed to create cairo egl device" << std::endl;
+  try {
+    ctx.loop = std::make_unique<event_loop>();
+    ctx.timer = std::make_unique<interval_timer>(*ctx.loop, timer_interval);
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
     return -1;
   }
-  ctx.cairo_surface = nullptr;
+  // anything started from here on may stop it
+  ctx.running = true;
 
-  ctx.epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
-  if (ctx.epoll_fd < 0) {
-    perror_exit("epoll_create1");
+  if (ctx.replay) {
+    ctx.tasks.push_back(dispatch_events(&ctx, ctx.replay->event_fd(), handle_replay_events));
+  } else if (ctx.software) {
+    ctx.tasks.push_back(dispatch_events(&ctx, ctx.software->event_fd(), handle_software_events));
+  } else {
+    ctx.tasks.push_back(dispatch_events(&ctx, ctx.video_fd, handle_v4l2_events));
   }
 
-  {
-    ::epoll_event ep{};
-    ep.events = EPOLLIN | EPOLLERR | EPOLLHUP;
-    ep.data.ptr = reinterpret_cast<void*>(handle_v4l2_events);
-    ::epoll_ctl(ctx.epoll_fd, EPOLL_CTL_ADD, ctx.video_fd, &ep);
+  if (ctx.split) {
+    ctx.tasks.push_back(dispatch_events(&ctx, ctx.split->event_fd(), handle_split_events));
   }
 
-  ctx.timer_fd = ::timerfd_create(CLOCK_REALTIME, 0);
-  if (ctx.timer_fd < 0) {
-    perror_exit("timerfd_create");
+  if (ctx.scroll) {
+    ctx.tasks.push_back(dispatch_events(&ctx, ctx.scroll->event_fd(), handle_scroll_events));
   }
 
-  {
-    ::timespec now{};
-    if (clock_gettime(CLOCK_REALTIME, &now) != 0) {
-      perror_exit("clock_gettime");
-    }
+  if (ctx.verifier) {
+    ctx.tasks.push_back(dispatch_events(&ctx, ctx.verifier->event_fd(), handle_verifier_events));
+  }
 
-    ::itimerspec nexttime{};
-    nexttime.it_interval.tv_sec = 0;
-    nexttime.it_interval.tv_nsec = 10'000'000; // 10 [ms]
-    nexttime.it_value.tv_sec = nexttime.it_interval.tv_sec + now.tv_sec;
-    nexttime.it_value.tv_nsec = nexttime.it_interval.tv_nsec + now.tv_nsec;
+  ctx.tasks.push_back(run_timer(&ctx));
 
-    if (::timerfd_settime(ctx.timer_fd, TFD_TIMER_ABSTIME, &nexttime, nullptr) != 0) {
-      perror_exit("timerfd_settime");
-    }
+  if (ctx.frame_recorder) {
+    ctx.tasks.push_back(
+        dispatch_events(&ctx, ctx.frame_recorder->event_fd(), handle_recorder_events));
   }
 
-  {
-    ::epoll_event ep{};
-    ep.events = EPOLLIN | EPOLLERR | EPOLLHUP;
-    ep.data.ptr = reinterpret_cast<void*>(handle_timer_events);
-    ::epoll_ctl(ctx.epoll_fd, EPOLL_CTL_ADD, ctx.timer_fd, &ep);
+  if (ctx.publisher) {
+    ctx.tasks.push_back(
+        dispatch_events(&ctx, ctx.publisher->event_fd(), handle_publisher_events));
   }
 
-  ctx.joystick_fd = ::open("/dev/input/js0", O_RDONLY);
-  if (ctx.joystick_fd < 0) {
-    std::cerr << "failed to open /dev/input/js0: " << std::strerror(errno) << std::endl;
-  } else {
-    if (::ioctl(ctx.joystick_fd, JSIOCGAXES, &ctx.joystick.num_axes) < 0) {
-      perror_exit("JSIOCGAXES");
-    }
-    if (::ioctl(ctx.joystick_fd, JSIOCGBUTTONS, &ctx.joystick.num_buttons) < 0) {
-      perror_exit("JSIOCGBUTTONS");
-    }
-
-    ctx.joystick.axes = std::make_unique<std::int16_t[]>(ctx.joystick.num_axes);
-    ctx.joystick.buttons = std::make_unique<std::int16_t[]>(ctx.joystick.num_buttons);
+  ctx.tasks.push_back(dispatch_events(&ctx, ctx.snapshots->event_fd(), handle_snapshot_events));
 
-    ::epoll_event ep{};
-    ep.events = EPOLLIN | EPOLLERR | EPOLLHUP;
-    ep.data.ptr = reinterpret_cast<void*>(handle_joystick_events);
-    ::epoll_ctl(ctx.epoll_fd, EPOLL_CTL_ADD, ctx.joystick_fd, &ep);
-  }
+  ctx.tasks.push_back(dispatch_events(&ctx, ctx.signal_fd, handle_signal_events));
 
   ctx.app.animation = false;
   ctx.app.scale = 1.0;
@@ -1157,34 +3522,40 @@ auto main() -> int {
   ctx.app.offset_x = 0.0;
   ctx.app.offset_y = 0.0;
 
-  for (int n = 0; n < 16; ++n) {
-    char path[32], buf[16];
-    std::snprintf(path, sizeof path, "/sys/class/uio/uio%d/name", n);
-
-    const int fd = ::open(path, O_RDONLY);
-    if (fd < 0) continue;
-
-    const auto len = ::read(fd, buf, sizeof buf);
-    ::close(fd);
-    if (len < 0) continue;
+  ctx.pending_max_iterations = ctx.fractal_ctl->max_iter();
 
-    if (std::string_view{buf, static_cast<std::size_t>(len)} == "fractal\n") {
-      std::snprintf(path, sizeof path, "/dev/uio%d", n);
+  if (ctx.frame_recorder && record_format == recorder::format::itmap) {
+    ctx.fractal_ctl->set_mode(color_mode::gray);
+    ctx.palette_locked = true;
+  }
 
-      std::cout << "fractal uio device: " << path << std::endl;
-      ctx.fractal_ctl = std::make_unique<fractal_controller>(path);
-      break;
-    }
+  // the gamepad may be plugged in at any time, and is attached when it is
+  ctx.input_watch_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (ctx.input_watch_fd < 0) {
+    perror_exit("inotify_init1");
+  }
+  // watched before looking for it, so that it cannot appear in between unnoticed
+  if (!watch_input_dir(&ctx)) {
+    std::cerr << "failed to watch /dev/input: " << std::strerror(errno) << std::endl;
   }
 
-  if (!ctx.fractal_ctl) {
-    std::cerr << "failed to find fractal uio device" << std::endl;
-    return -1;
+  ctx.tasks.push_back(dispatch_events(&ctx, ctx.input_watch_fd, handle_input_watch_events));
+
+  if (!attach_any_gamepad(&ctx)) {
+    std::cout << "no gamepad yet" << std::endl;
   }
 
   ctx.display_fps = 0.0f;
+  ctx.display_refresh_rate = 0.0f;
   ctx.display_total_frames = 0;
+  ctx.display_total_vblanks = 0;
   ctx.display_fps_updated_time = 0;
+  ctx.display_window_frames = 0;
+  ctx.display_window_vblanks = 0;
+
+  ctx.compositor_time_ms = 0.0f;
+  ctx.compositor_time_total = {};
+  ctx.compositor_time_run_total = {};
 
   {
     ::glClearColor(0.0, 0.0, 0.0, 1.0);
@@ -1201,37 +3572,150 @@ auto main() -> int {
     }
   }
 
-  {
-    ::epoll_event ep{};
-    ep.events = EPOLLIN | EPOLLERR | EPOLLHUP;
-    ep.data.ptr = reinterpret_cast<void*>(handle_drm_events);
-    ::epoll_ctl(ctx.epoll_fd, EPOLL_CTL_ADD, ctx.drm_fd, &ep);
-  }
+  ctx.tasks.push_back(dispatch_events(&ctx, ctx.drm_fd, handle_drm_events));
 
-  {
-    redraw(&ctx);
+  // the first frame is drawn and flipped to right away
+  invalidate_overlay(&ctx);
+  ctx.tasks.push_back(run_display(&ctx));
+  if (!ctx.running) {
+    return -1;
+  }
 
-    ctx.gbm_bo_next = ::gbm_surface_lock_front_buffer(ctx.gbm_surface);
-    ctx.fb_id_next = get_gbm_bo_fb_id(ctx.drm_fd, ctx.gbm_bo_next);
+  if (latency_seconds) {
+    ctx.latency = std::make_unique<window_context::latency_stats>();
+  }
 
-    if (::drmModePageFlip(
-            ctx.drm_fd, ctx.crtc_id, ctx.fb_id_next, DRM_MODE_PAGE_FLIP_EVENT, &ctx)) {
-      std::cerr << "failed to queue page flip: " << std::strerror(errno) << std::endl;
+  if (realtime) {
+    try {
+      enter_realtime(rt_cpu, rt_priority);
+    } catch (const std::exception& e) {
+      std::cerr << e.what() << std::endl;
       return -1;
     }
+    // mlockall() leaves the mappings of device buffers alone
+    for (const auto& b : ctx.video_buffers) {
+      prefault(b.ptr, b.length);
+    }
+    std::cout << "real-time on cpu " << rt_cpu << " at priority " << rt_priority << std::endl;
   }
 
-  ctx.running = true;
-  for (;;) {
-    if (!ctx.running) {
+  // started from the loop's thread, but spread over every core
+  std::unique_ptr<synthetic_load> load;
+  if (latency_load > 0) {
+    load = std::make_unique<synthetic_load>(latency_load);
+  }
+
+  const auto latency_start = std::chrono::steady_clock::now();
+  if (latency_seconds && *latency_seconds > 0.0) {
+    ctx.latency_end =
+        latency_start + std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::duration<double>{*latency_seconds});
+  }
+
+  while (ctx.running) {
+    if (!ctx.loop->run_once()) {
+      std::perror("epoll_wait");
       break;
     }
+  }
+
+  load.reset();
+
+  if (const auto& l = ctx.input_latency; l.count() > 0) {
+    std::printf(
+        "applied %llu input events, latency mean %.1f us, p99 %.1f us, max %.1f us\n",
+        static_cast<unsigned long long>(l.count()),
+        l.mean(),
+        l.percentile(99.0),
+        l.max());
+  }
 
-    ::epoll_event ep[16];
-    int count = ::epoll_wait(ctx.epoll_fd, ep, 16, -1);
-    for (int i = 0; i < count; ++i) {
-      using handler_type = void (*)(window_context*, std::uint32_t);
-      reinterpret_cast<handler_type>(ep[i].data.ptr)(&ctx, ep[i].events);
+  if (ctx.latency) {
+    const auto elapsed = std::chrono::steady_clock::now() - latency_start;
+    std::printf(
+        "wakeup latency over %.1f s (%s, %u load threads), in us:\n",
+        std::chrono::duration<double>{elapsed}.count(),
+        realtime ? "real-time" : "normal scheduling",
+        latency_load);
+    const auto print = [](const char* name, const latency_histogram& h) {
+      std::printf(
+          "  %-8s %8llu events, mean %7.1f, p50 %7.1f, p99 %7.1f, p99.9 %7.1f, max %7.1f\n",
+          name,
+          static_cast<unsigned long long>(h.count()),
+          h.mean(),
+          h.percentile(50.0),
+          h.percentile(99.0),
+          h.percentile(99.9),
+          h.max());
+    };
+    print("timer", ctx.latency->timer);
+    print("capture", ctx.latency->capture);
+    print("vblank", ctx.latency->display);
+  }
+
+  if (ctx.frame_recorder) {
+    const auto stats = ctx.frame_recorder->get_stats();
+    std::cout << "recorded " << stats.frames_written << " frames (" << stats.bytes_written
+              << " bytes in " << stats.write_time / 1ms << " ms), skipped "
+              << stats.frames_skipped << ", lost " << ctx.v4l2_lost_frames << std::endl;
+  }
+
+  if (ctx.publisher) {
+    const auto stats = ctx.publisher->get_stats();
+    std::cout << "shared " << stats.frames_published << " frames with "
+              << stats.consumers_accepted << " consumers" << std::endl;
+    for (const auto& c : stats.consumers) {
+      std::cout << "  pid " << c.pid << ": leased " << c.frames_leased << ", skipped "
+                << c.frames_skipped << ", revoked " << c.leases_revoked << ", held "
+                << c.hold_time_mean / 1.0ms << " ms on average, " << c.hold_time_max / 1.0ms
+                << " ms at most, " << c.lag << " frames behind" << std::endl;
     }
   }
+
+  if (ctx.replay) {
+    const auto stats = ctx.replay->get_stats();
+    const auto frames = std::max<std::uint64_t>(ctx.display_total_frames, 1);
+    std::cout << "replayed " << stats.frames_delivered << " frames (" << stats.loops
+              << " loops), dropped " << stats.frames_dropped << "; displayed "
+              << ctx.display_total_frames << " frames in " << ctx.display_total_vblanks
+              << " vblanks, compositor " << ctx.compositor_time_run_total / frames / 1.0ms
+              << " ms/frame" << std::endl;
+  }
+
+  if (ctx.software) {
+    const auto stats = ctx.software->get_stats();
+    const auto frames = std::max<std::uint64_t>(stats.frames_rendered, 1);
+    std::cout << "rendered " << stats.frames_rendered << " frames on the CPU, "
+              << stats.render_time / frames / 1.0ms << " ms/frame, mean resolution "
+              << 100.0 * stats.pixels_sum / frames / (ctx.width * ctx.height)
+              << "% of the pixels, mean iteration limit "
+              << static_cast<double>(stats.iterations_limit_sum) / frames << std::endl;
+  }
+
+  if (ctx.split) {
+    const auto stats = ctx.split->get_stats();
+    const auto frames = std::max<std::uint64_t>(stats.frames_rendered, 1);
+    std::cout << "split " << stats.frames_rendered << " frames, the CPU rendering "
+              << static_cast<double>(stats.rows_rendered) / frames << " rows of "
+              << ctx.height << " in " << stats.render_time / frames / 1.0ms << " ms/frame"
+              << std::endl;
+  }
+
+  if (ctx.scroll) {
+    const auto stats = ctx.scroll->get_stats();
+    const auto frames = std::max<std::uint64_t>(stats.frames_composed, 1);
+    std::cout << "scrolled " << stats.frames_composed << " frames, generating "
+              << 100.0 * stats.pixels_generated / frames / (ctx.width * ctx.height)
+              << "% of each and composing it in " << stats.compose_time / frames / 1.0ms
+              << " ms; " << ctx.scroll_full_frames << " whole frames" << std::endl;
+  }
+
+  if (ctx.verifier) {
+    const auto stats = ctx.verifier->get_stats();
+    std::cout << "verified " << stats.frames_checked << " frames (" << stats.frames_skipped
+              << " left out), " << stats.mismatches << " of " << stats.samples_checked
+              << " pixels wrong in " << stats.frames_failed << " frames, using "
+              << 100.0 * stats.cpu_time / std::max(stats.run_time, std::chrono::nanoseconds{1})
+              << "% of a core" << std::endl;
+  }
 }
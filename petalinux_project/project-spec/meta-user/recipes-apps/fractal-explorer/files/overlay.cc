@@ -0,0 +1,51 @@
+#include "overlay.h"
+
+#include <algorithm>
+#include <string>
+
+void draw_overlay(::cairo_surface_t* surface, std::string_view text) {
+  const auto lines = std::min<std::ptrdiff_t>(
+      std::count(text.begin(), text.end(), '\n'), overlay_max_lines);
+
+  auto cr = ::cairo_create(surface);
+
+  ::cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+  ::cairo_paint(cr);
+  ::cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+
+  // keep drawing in screen coordinates
+  ::cairo_translate(cr, -overlay_x, -overlay_y);
+
+  ::cairo_set_source_rgba(cr, 0.125, 0.125, 0.125, 0.75);
+  ::cairo_rectangle(cr, 31.5, 63.5, 497, 69 + 20 * lines);
+  ::cairo_fill_preserve(cr);
+
+  ::cairo_set_line_width(cr, 1.0);
+  ::cairo_set_source_rgba(cr, 0, 0, 0, 1.0);
+  ::cairo_stroke(cr);
+
+  ::cairo_set_source_rgba(cr, 1.0, 1.0, 1.0, 1.0);
+  ::cairo_select_font_face(cr, "monospace", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
+
+  ::cairo_set_font_size(cr, 32);
+  ::cairo_move_to(cr, 48.0, 104.0);
+  ::cairo_show_text(cr, "Julia Set Explorer");
+
+  ::cairo_set_font_size(cr, 16);
+  ::cairo_move_to(cr, 400.0, 104.0);
+  ::cairo_show_text(cr, "by @myon___");
+
+  ::cairo_set_font_size(cr, 13);
+  std::string line;
+  int y = 0;
+  for (auto nl = text.find('\n'); nl != std::string_view::npos && y < lines;
+       nl = text.find('\n')) {
+    line.assign(text.substr(0, nl));
+    ::cairo_move_to(cr, 48.0, 134.0 + 20 * y++);
+    ::cairo_show_text(cr, line.c_str());
+    text.remove_prefix(nl + 1);
+  }
+
+  ::cairo_destroy(cr);
+  ::cairo_surface_flush(surface);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string_view>
+
+#include <cairo.h>
+
+// the overlay panel is rasterised once into a texture of this size and position
+constexpr int overlay_x = 24;
+constexpr int overlay_y = 56;
+constexpr int overlay_width = 512;
+// lines of text the panel has room for below the title, with every stat line shown at once
+constexpr int overlay_max_lines = 16;
+// down to the border of the panel holding that many, which is 69 + 20 * lines high from y 63.5
+constexpr int overlay_height = 64 + 69 + 20 * overlay_max_lines - overlay_y;
+
+// Draws the panel into `surface`, an overlay_width x overlay_height ARGB32 image, with the title
+// and then `text` one line per '\n'; a last line without one is left out, as are lines past
+// overlay_max_lines.
+void draw_overlay(::cairo_surface_t* surface, std::string_view text);
@@ -0,0 +1,172 @@
+#include "realtime.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+extern "C" {
+#include <dirent.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+}
+
+using namespace std::string_literals;
+
+// Faults in the stack below the caller, which mlockall() would otherwise lock only as it grows.
+[[gnu::noinline]] static void prefault_stack() {
+  constexpr std::size_t size = 256 << 10;
+  [[maybe_unused]] volatile std::uint8_t stack[size];
+  const auto page_size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+  for (std::size_t offset = 0; offset < size; offset += page_size) {
+    stack[offset] = 0;
+  }
+}
+
+void enter_realtime(unsigned int cpu, int priority) {
+  const auto cpus = std::max(std::thread::hardware_concurrency(), 1u);
+  if (cpu >= cpus || cpu >= CPU_SETSIZE) {
+    throw std::runtime_error{"no cpu " + std::to_string(cpu)};
+  }
+
+  if (::mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+    throw std::runtime_error{"mlockall: "s + std::strerror(errno)};
+  }
+
+  // the other threads are moved first, so that none is left on the core once this one owns it
+  if (cpus > 1) {
+    ::cpu_set_t others;
+    CPU_ZERO(&others);
+    for (auto n = 0u; n < cpus && n < CPU_SETSIZE; ++n) {
+      if (n != cpu) {
+        CPU_SET(n, &others);
+      }
+    }
+
+    ::DIR* dir = ::opendir("/proc/self/task");
+    if (!dir) {
+      throw std::runtime_error{"/proc/self/task: "s + std::strerror(errno)};
+    }
+    const auto self = ::gettid();
+    while (const auto entry = ::readdir(dir)) {
+      const auto tid = static_cast<::pid_t>(std::strtol(entry->d_name, nullptr, 10));
+      // the thread may have exited since it was listed
+      if (tid > 0 && tid != self && ::sched_setaffinity(tid, sizeof others, &others) != 0 &&
+          errno != ESRCH) {
+        const auto error = errno;
+        ::closedir(dir);
+        throw std::runtime_error{"sched_setaffinity: "s + std::strerror(error)};
+      }
+    }
+    ::closedir(dir);
+  }
+
+  ::cpu_set_t own;
+  CPU_ZERO(&own);
+  CPU_SET(cpu, &own);
+  if (::sched_setaffinity(0, sizeof own, &own) != 0) {
+    throw std::runtime_error{"sched_setaffinity: "s + std::strerror(errno)};
+  }
+
+  // threads started from here on fall back to the normal policy instead of taking the core over
+  ::sched_param param{};
+  param.sched_priority = priority;
+  if (::sched_setscheduler(0, SCHED_FIFO | SCHED_RESET_ON_FORK, &param) != 0) {
+    throw std::runtime_error{"sched_setscheduler: "s + std::strerror(errno)};
+  }
+
+  prefault_stack();
+}
+
+void prefault(const void* data, std::size_t length) {
+  const auto page_size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+  const auto bytes = static_cast<const volatile std::uint8_t*>(data);
+  for (std::size_t offset = 0; offset < length; offset += page_size) {
+    static_cast<void>(bytes[offset]);
+  }
+}
+
+latency_histogram::latency_histogram() : buckets_{}, count_{0}, sum_{}, max_{} {}
+
+void latency_histogram::add(std::chrono::nanoseconds latency) {
+  // a timestamp taken a little after the wakeup reads as a negative delay
+  latency = std::max(latency, std::chrono::nanoseconds{0});
+
+  const auto us = static_cast<std::size_t>(latency / std::chrono::microseconds{1});
+  ++buckets_[std::min(us, num_buckets)];
+  ++count_;
+  sum_ += latency;
+  max_ = std::max(max_, latency);
+}
+
+double latency_histogram::mean() const {
+  return count_ ? sum_.count() / 1e3 / count_ : 0.0;
+}
+
+double latency_histogram::percentile(double p) const {
+  if (count_ == 0) {
+    return 0.0;
+  }
+
+  // the upper edge of the bucket the percentile falls in
+  const auto rank = std::max<std::uint64_t>(static_cast<std::uint64_t>(p / 100.0 * count_), 1);
+  std::uint64_t seen = 0;
+  for (std::size_t n = 0; n < num_buckets; ++n) {
+    seen += buckets_[n];
+    if (seen >= rank) {
+      return std::min(static_cast<double>(n + 1), max());
+    }
+  }
+  return max();
+}
+
+double latency_histogram::max() const {
+  return max_.count() / 1e3;
+}
+
+synthetic_load::synthetic_load(unsigned int threads) : stopping_{false} {
+  for (auto n = 0u; n < threads; ++n) {
+    threads_.emplace_back(&synthetic_load::run, this);
+  }
+}
+
+synthetic_load::~synthetic_load() {
+  stopping_ = true;
+  for (auto& t : threads_) {
+    t.join();
+  }
+}
+
+void synthetic_load::run() {
+  // started from the real-time thread, whose core is the one that matters most
+  ::cpu_set_t all;
+  CPU_ZERO(&all);
+  for (auto n = 0u; n < std::thread::hardware_concurrency() && n < CPU_SETSIZE; ++n) {
+    CPU_SET(n, &all);
+  }
+  ::sched_setaffinity(0, sizeof all, &all);
+
+  // larger than the caches, so that every copy goes out to memory
+  constexpr std::size_t copy_size = 8 << 20;
+  constexpr std::size_t map_size = 1 << 20;
+  std::vector<std::uint8_t> from(copy_size, 1), to(copy_size);
+  const auto page_size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+
+  while (!stopping_) {
+    std::memcpy(to.data(), from.data(), copy_size);
+
+    // fresh pages to fault in, and a TLB shootdown on every core the process ran on
+    void* mem =
+        ::mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem != MAP_FAILED) {
+      for (std::size_t offset = 0; offset < map_size; offset += page_size) {
+        static_cast<std::uint8_t*>(mem)[offset] = 1;
+      }
+      ::munmap(mem, map_size);
+    }
+  }
+}
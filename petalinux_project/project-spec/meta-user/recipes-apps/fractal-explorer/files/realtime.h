@@ -0,0 +1,62 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+// Puts the calling thread on core `cpu` at SCHED_FIFO `priority`, moves every other thread of the
+// process to the remaining cores, and locks all of its memory, present and future, so that it
+// never waits for a page fault. Threads the caller starts afterwards run on its core but under
+// the normal policy. Throws std::runtime_error if any of it is refused.
+void enter_realtime(unsigned int cpu, int priority);
+
+// Touches every page of [data, data + length), for mappings mlockall() leaves alone, such as the
+// ones of device buffers.
+void prefault(const void* data, std::size_t length);
+
+// Distribution of the delays between an event being due and the thread waking up for it, in
+// steps of a microsecond up to 10 ms; longer ones are only counted and kept as the maximum.
+class latency_histogram {
+public:
+  latency_histogram();
+
+  void add(std::chrono::nanoseconds latency);
+
+  std::uint64_t count() const {
+    return count_;
+  }
+
+  // in microseconds; 0 if nothing was added
+  double mean() const;
+  double percentile(double p) const;
+  double max() const;
+
+private:
+  static constexpr std::size_t num_buckets = 10'000;
+
+  std::array<std::uint32_t, num_buckets + 1> buckets_; // the last one for everything longer
+  std::uint64_t count_;
+  std::chrono::nanoseconds sum_;
+  std::chrono::nanoseconds max_;
+};
+
+// Threads keeping every core busy copying memory around and mapping and unmapping pages, at the
+// normal policy, to see how the latencies hold up under load. They run until destroyed.
+class synthetic_load {
+public:
+  explicit synthetic_load(unsigned int threads);
+  ~synthetic_load();
+
+  synthetic_load(const synthetic_load&) = delete;
+  synthetic_load& operator=(const synthetic_load&) = delete;
+
+private:
+  void run();
+
+  std::atomic<bool> stopping_;
+  std::vector<std::thread> threads_;
+};
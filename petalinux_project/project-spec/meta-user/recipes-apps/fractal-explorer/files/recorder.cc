@@ -0,0 +1,298 @@
+#include "recorder.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/dma-buf.h>
+}
+
+using namespace std::string_literals;
+
+static constexpr std::size_t bounce_buffer_size = 1 << 20;
+
+recorder::recorder(const char* path, const frame_file_header& header, std::size_t queue_depth,
+                   format fmt)
+    : fd_{-1},
+      event_fd_{-1},
+      direct_{true},
+      zero_copy_{true},
+      width_{header.width},
+      height_{header.height},
+      stride_{header.stride},
+      frame_size_{header.frame_size},
+      offset_{0},
+      queue_depth_{queue_depth},
+      bounce_{nullptr},
+      bounce_size_{bounce_buffer_size},
+      stopping_{false},
+      frames_written_{0},
+      frames_skipped_{0},
+      bytes_written_{0},
+      write_time_ns_{0} {
+  if (fmt == format::itmap) {
+    encoder_ = std::make_unique<itmap_encoder>(path, width_, height_);
+    iterations_.resize(std::size_t{width_} * height_);
+
+    event_fd_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (event_fd_ < 0) {
+      throw std::runtime_error{"eventfd: "s + std::strerror(errno)};
+    }
+
+    thread_ = std::thread{&recorder::run, this};
+    return;
+  }
+
+  fd_ = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+  if (fd_ < 0 && errno == EINVAL) {
+    // e.g. tmpfs does not support direct I/O
+    direct_ = false;
+    zero_copy_ = false;
+    fd_ = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  }
+  if (fd_ < 0) {
+    throw std::runtime_error{"failed to open "s + path + ": "s + std::strerror(errno)};
+  }
+
+  event_fd_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (event_fd_ < 0) {
+    ::close(fd_);
+    throw std::runtime_error{"eventfd: "s + std::strerror(errno)};
+  }
+
+  bounce_ = static_cast<std::uint8_t*>(std::aligned_alloc(frame_file_block_size, bounce_size_));
+  if (!bounce_) {
+    ::close(event_fd_);
+    ::close(fd_);
+    throw std::runtime_error{"failed to allocate the bounce buffer"};
+  }
+
+  std::memset(bounce_, 0, frame_file_block_size);
+  std::memcpy(bounce_, &header, sizeof header);
+  if (!write_all(bounce_, frame_file_block_size)) {
+    std::free(bounce_);
+    ::close(event_fd_);
+    ::close(fd_);
+    throw std::runtime_error{"failed to write the file header: "s + std::strerror(errno)};
+  }
+
+  thread_ = std::thread{&recorder::run, this};
+}
+
+recorder::~recorder() {
+  {
+    std::lock_guard lock{mutex_};
+    stopping_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+
+  std::free(bounce_);
+  ::close(event_fd_);
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+bool recorder::submit(const frame& f) {
+  {
+    std::lock_guard lock{mutex_};
+    if (queue_.size() >= queue_depth_) {
+      ++frames_skipped_;
+      return false;
+    }
+    queue_.push_back(f);
+  }
+  cv_.notify_one();
+  return true;
+}
+
+std::vector<std::uint32_t> recorder::completed() {
+  std::uint64_t count;
+  [[maybe_unused]] const auto ret = ::read(event_fd_, &count, sizeof count);
+
+  std::vector<std::uint32_t> ret_indices;
+  {
+    std::lock_guard lock{mutex_};
+    ret_indices.swap(completed_);
+  }
+  return ret_indices;
+}
+
+recorder::stats recorder::get_stats() const {
+  return {
+      frames_written_.load(),
+      frames_skipped_.load(),
+      bytes_written_.load(),
+      std::chrono::nanoseconds{write_time_ns_.load()},
+  };
+}
+
+void recorder::run() {
+  for (;;) {
+    frame f;
+    {
+      std::unique_lock lock{mutex_};
+      cv_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        break;
+      }
+      // stays queued while being written so that it counts against the queue depth
+      f = queue_.front();
+    }
+
+    if (encoder_) {
+      encode_frame(f);
+    } else {
+      write_frame(f);
+    }
+
+    {
+      std::lock_guard lock{mutex_};
+      queue_.pop_front();
+      completed_.push_back(f.index);
+    }
+
+    const std::uint64_t one = 1;
+    [[maybe_unused]] const auto ret = ::write(event_fd_, &one, sizeof one);
+  }
+}
+
+void recorder::write_frame(const frame& f) {
+  const auto start = std::chrono::steady_clock::now();
+
+  std::memset(bounce_, 0, frame_file_block_size);
+  std::memcpy(bounce_, &f.header, sizeof f.header);
+  if (!write_all(bounce_, frame_file_block_size)) {
+    std::cerr << "recorder: write: " << std::strerror(errno) << std::endl;
+    return;
+  }
+
+  ::dma_buf_sync sync{};
+  sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ;
+  if (::ioctl(f.dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync) == -1) {
+    std::cerr << "recorder: DMA_BUF_IOCTL_SYNC: " << std::strerror(errno) << std::endl;
+  }
+
+  // The bulk of the frame goes to the disk straight from the capture buffer. Buffers the kernel
+  // cannot pin for direct I/O (e.g. PFN mappings of CMA memory) are staged instead.
+  const auto payload_offset = offset_;
+  const auto aligned = reinterpret_cast<std::uintptr_t>(f.data) % frame_file_block_size == 0;
+  std::size_t done = 0;
+  if (!direct_) {
+    // the page cache makes its own copy anyway
+    if (write_all(f.data, frame_size_)) {
+      done = frame_size_;
+      const auto padding = frame_file_align(frame_size_) - frame_size_;
+      std::memset(bounce_, 0, padding);
+      write_all(bounce_, padding);
+    } else {
+      std::cerr << "recorder: write: " << std::strerror(errno) << std::endl;
+    }
+  } else if (zero_copy_ && aligned) {
+    const auto length = frame_size_ / frame_file_block_size * frame_file_block_size;
+    if (write_all(f.data, length)) {
+      done = length;
+    } else if (errno == EFAULT || errno == EINVAL) {
+      std::cerr << "recorder: capture buffers do not support direct I/O, staging frames"
+                << std::endl;
+      zero_copy_ = false;
+      // what got out before the failure is written again, and counted once
+      bytes_written_ -= offset_ - payload_offset;
+      offset_ = payload_offset;
+    } else {
+      std::cerr << "recorder: write: " << std::strerror(errno) << std::endl;
+    }
+  }
+  write_staged(f.data + done, frame_size_ - done);
+
+  sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ;
+  ::ioctl(f.dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync);
+
+  ++frames_written_;
+  write_time_ns_ += std::chrono::nanoseconds{std::chrono::steady_clock::now() - start}.count();
+}
+
+void recorder::encode_frame(const frame& f) {
+  const auto start = std::chrono::steady_clock::now();
+
+  // the buffer is only needed until the iteration counts have been picked out
+  ::dma_buf_sync sync{};
+  sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ;
+  if (::ioctl(f.dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync) == -1) {
+    std::cerr << "recorder: DMA_BUF_IOCTL_SYNC: " << std::strerror(errno) << std::endl;
+  }
+  for (std::uint32_t y = 0; y < height_; ++y) {
+    itmap_extract_channel(
+        f.data + std::size_t{y} * stride_, iterations_.data() + std::size_t{y} * width_, width_, 0);
+  }
+  sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ;
+  ::ioctl(f.dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync);
+
+  const itmap_frame_info info{
+      f.header.sequence,
+      f.header.timestamp_ns,
+      f.header.x0,
+      f.header.y0,
+      f.header.dx,
+      f.header.dy,
+      f.header.cr,
+      f.header.ci,
+  };
+  try {
+    const auto before = encoder_->bytes_written();
+    encoder_->add_frame(iterations_.data(), width_, info);
+    bytes_written_ += encoder_->bytes_written() - before;
+  } catch (const std::exception& e) {
+    std::cerr << "recorder: " << e.what() << std::endl;
+    return;
+  }
+
+  ++frames_written_;
+  write_time_ns_ += std::chrono::nanoseconds{std::chrono::steady_clock::now() - start}.count();
+}
+
+void recorder::write_staged(const std::uint8_t* data, std::size_t length) {
+  while (length > 0) {
+    const auto n = std::min(length, bounce_size_);
+    const auto padded = frame_file_align(n);
+
+    std::memcpy(bounce_, data, n);
+    std::memset(bounce_ + n, 0, padded - n);
+    if (!write_all(bounce_, padded)) {
+      std::cerr << "recorder: write: " << std::strerror(errno) << std::endl;
+      return;
+    }
+
+    data += n;
+    length -= n;
+  }
+}
+
+bool recorder::write_all(const std::uint8_t* data, std::size_t length) {
+  while (length > 0) {
+    const auto ret = ::pwrite(fd_, data, length, static_cast<::off_t>(offset_));
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+
+    data += ret;
+    length -= ret;
+    offset_ += ret;
+    bytes_written_ += ret;
+  }
+  return true;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "frame_file.h"
+#include "itmap.h"
+
+// Streams captured frames to disk on a dedicated thread.
+//
+// The caller keeps ownership of the buffers: a submitted frame is leased to the recorder until its
+// index is returned by completed(), and event_fd() becomes readable whenever that may be the case.
+// At most queue_depth frames are leased at a time, so a slow disk makes the recorder skip frames
+// instead of starving the capture queue.
+//
+// Frames are stored either as they are (see frame_file.h) or, for gray frames whose pixels are the
+// iteration counts, as a compressed iteration map stream (see itmap.h).
+class recorder {
+public:
+  enum class format {
+    raw,
+    itmap,
+  };
+
+  struct frame {
+    std::uint32_t index;
+    const std::uint8_t* data;
+    int dmabuf_fd;
+    frame_record_header header;
+  };
+
+  struct stats {
+    std::uint64_t frames_written;
+    std::uint64_t frames_skipped;
+    std::uint64_t bytes_written;
+    std::chrono::nanoseconds write_time;
+  };
+
+  recorder(const char* path, const frame_file_header& header, std::size_t queue_depth,
+           format fmt = format::raw);
+  ~recorder();
+
+  recorder(const recorder&) = delete;
+  recorder& operator=(const recorder&) = delete;
+
+  int event_fd() const {
+    return event_fd_;
+  }
+
+  // returns false, and counts the frame as skipped, if the queue is full
+  bool submit(const frame& f);
+
+  // indices of frames that have been written since the last call
+  std::vector<std::uint32_t> completed();
+
+  stats get_stats() const;
+
+private:
+  void run();
+  void write_frame(const frame& f);
+  void encode_frame(const frame& f);
+  bool write_all(const std::uint8_t* data, std::size_t length);
+  void write_staged(const std::uint8_t* data, std::size_t length);
+
+  int fd_;
+  int event_fd_;
+  bool direct_;    // the file is opened with O_DIRECT
+  bool zero_copy_; // capture buffers can be handed to direct I/O as they are
+  std::uint32_t width_;
+  std::uint32_t height_;
+  std::uint32_t stride_;
+  std::uint32_t frame_size_;
+  std::uint64_t offset_;
+  std::size_t queue_depth_;
+
+  // block aligned staging area for record headers and, when the capture buffers cannot be used
+  // for direct I/O, for the pixel data
+  std::uint8_t* bounce_;
+  std::size_t bounce_size_;
+
+  std::unique_ptr<itmap_encoder> encoder_;
+  std::vector<std::uint8_t> iterations_; // one byte per pixel
+
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<frame> queue_;
+  std::vector<std::uint32_t> completed_;
+  bool stopping_;
+
+  std::atomic<std::uint64_t> frames_written_;
+  std::atomic<std::uint64_t> frames_skipped_;
+  std::atomic<std::uint64_t> bytes_written_;
+  std::atomic<std::int64_t> write_time_ns_;
+
+  std::thread thread_;
+};
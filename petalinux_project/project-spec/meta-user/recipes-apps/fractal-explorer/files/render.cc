@@ -0,0 +1,883 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <getopt.h>
+#include <signal.h>
+}
+
+#include "fractal.h"
+#include "fractal_engine.h"
+#include "tiled_tiff.h"
+
+// Renders Julia set images of any size with the software engine, one tile at a time.
+
+static std::atomic<bool> interrupted{false};
+
+static void handle_interrupt(int) {
+  interrupted = true;
+}
+
+static bool parse_pair(const char* s, double& a, double& b) {
+  char* end;
+  a = std::strtod(s, &end);
+  if (end == s || *end != ',') {
+    return false;
+  }
+  s = end + 1;
+  b = std::strtod(s, &end);
+  return end != s && *end == '\0';
+}
+
+static bool parse_size(const char* s, std::uint32_t& width, std::uint32_t& height) {
+  char* end;
+  width = static_cast<std::uint32_t>(std::strtoul(s, &end, 10));
+  if (end == s || *end != 'x') {
+    return false;
+  }
+  s = end + 1;
+  height = static_cast<std::uint32_t>(std::strtoul(s, &end, 10));
+  return end != s && *end == '\0' && width > 0 && height > 0;
+}
+
+// six register values in hex: x0, y0, dx, dy, cr, ci
+static bool parse_registers(const char* s, fractal_params& params) {
+  std::uint32_t* fields[] = {&params.x0, &params.y0, &params.dx, &params.dy, &params.cr, &params.ci};
+  for (std::size_t i = 0; i < std::size(fields); ++i) {
+    char* end;
+    *fields[i] = static_cast<std::uint32_t>(std::strtoul(s, &end, 16));
+    if (end == s || *end != (i + 1 < std::size(fields) ? ',' : '\0')) {
+      return false;
+    }
+    s = end + 1;
+  }
+  return true;
+}
+
+static bool parse_mode(std::string_view s, color_mode& mode) {
+  constexpr std::string_view names[] = {
+      "gray", "red", "green", "blue", "yellow", "cyan", "magenta", "color1",
+  };
+  for (std::size_t i = 0; i < std::size(names); ++i) {
+    if (s == names[i]) {
+      mode = static_cast<color_mode>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+// iteration counts to padded RGB tile rows
+static void colorize(const fractal_palette& palette, const std::uint8_t* iterations,
+                     std::size_t stride, std::uint32_t width, std::uint32_t height,
+                     std::uint32_t tile_size, std::uint8_t* rgb) {
+  if (width < tile_size || height < tile_size) {
+    std::fill(rgb, rgb + std::size_t{tile_size} * tile_size * 3, 0);
+  }
+  for (std::uint32_t j = 0; j < height; ++j) {
+    const auto* src = iterations + j * stride;
+    auto* dst = rgb + std::size_t{j} * tile_size * 3;
+    for (std::uint32_t i = 0; i < width; ++i) {
+      std::memcpy(dst + i * 3, palette[src[i]].data(), 3);
+    }
+  }
+}
+
+// Runs job(i) for every i below `jobs` on `threads` threads, showing progress, until all of them
+// are done or the run is interrupted. A job returns how many pixels it rendered. Returns false if
+// the run did not finish.
+template <typename Job>
+static bool run_jobs(std::size_t jobs, unsigned int threads, Job job, std::uint64_t& pixels,
+                     std::chrono::duration<double>& elapsed) {
+  {
+    struct ::sigaction sa{};
+    sa.sa_handler = handle_interrupt;
+    ::sigemptyset(&sa.sa_mask);
+    ::sigaction(SIGINT, &sa, nullptr);
+    ::sigaction(SIGTERM, &sa, nullptr);
+  }
+
+  std::atomic<std::size_t> next_job{0};
+  std::atomic<std::size_t> jobs_finished{0};
+  std::atomic<std::uint64_t> pixels_rendered{0};
+  std::atomic<bool> failed{false};
+
+  const auto worker = [&] {
+    try {
+      for (std::size_t i; !interrupted && !failed && (i = next_job.fetch_add(1)) < jobs;) {
+        pixels_rendered += job(i);
+        ++jobs_finished;
+      }
+    } catch (const std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      failed = true;
+    }
+  };
+
+  const auto start = std::chrono::steady_clock::now();
+  const auto mpixels_per_second = [&] {
+    const std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+    return static_cast<double>(pixels_rendered) / 1e6 / std::max(t.count(), 1e-9);
+  };
+
+  std::vector<std::thread> pool;
+  for (unsigned int i = 0; i < threads; ++i) {
+    pool.emplace_back(worker);
+  }
+
+  bool shown = false;
+  for (unsigned int tick = 1; jobs_finished < jobs && !interrupted && !failed; ++tick) {
+    std::this_thread::sleep_for(std::chrono::milliseconds{100});
+    if (tick % 10 == 0) {
+      std::fprintf(stderr, "\r%5.1f%%  %.1f Mpixel/s",
+                   100.0 * static_cast<double>(jobs_finished) / static_cast<double>(jobs),
+                   mpixels_per_second());
+      shown = true;
+    }
+  }
+  for (auto& t : pool) {
+    t.join();
+  }
+  if (shown) {
+    std::fprintf(stderr, "\n");
+  }
+
+  pixels = pixels_rendered;
+  elapsed = std::chrono::steady_clock::now() - start;
+  if (failed) {
+    return false;
+  }
+  if (jobs_finished < jobs) {
+    std::cout << "interrupted at " << 100 * jobs_finished / jobs << "%; run again to resume"
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static void print_usage(const char* argv0) {
+  std::cout << "usage: " << argv0 << " [options] OUTPUT.tif\n"
+            << "       " << argv0 << " atlas [options] OUTPUT.tif\n"
+            << "       " << argv0 << " generator [options]\n"
+            << "\n"
+            << "Renders the Julia set of c into a tiled TIFF, bit-exact with the generator.\n"
+            << "An interrupted render resumes when run again with the same options.\n"
+            << "\n"
+            << "options:\n"
+            << "  --size WxH          image size in pixels (default: 32768x32768)\n"
+            << "  --c RE,IM           the constant c (default: -0.4,0.6)\n"
+            << "  --center RE,IM      centre of the view (default: 0,0)\n"
+            << "  --span W            width of the view on the complex plane (default: 3)\n"
+            << "  --mode MODE         gray, red, green, blue, yellow, cyan, magenta or color1\n"
+            << "                      (default: color1)\n"
+            << "  --tile N            tile size, a multiple of 16 (default: 256)\n"
+            << "  --aa N              supersample pixels on edges with NxN samples, 2 or 4\n"
+            << "                      (default: off)\n"
+            << "  --threads N         render threads (default: one per core)\n"
+            << "  -h, --help          show this message\n";
+}
+
+static void print_atlas_usage(const char* argv0) {
+  std::cout << "usage: " << argv0 << " atlas [options] OUTPUT.tif\n"
+            << "       " << argv0 << " atlas --benchmark [options]\n"
+            << "\n"
+            << "Renders a grid of Julia set thumbnails for c spread evenly over a rectangle of\n"
+            << "the c-plane, several values of c at once in the lanes of the vector unit.\n"
+            << "\n"
+            << "options:\n"
+            << "  --grid COLSxROWS    thumbnails across and down (default: 16x16)\n"
+            << "  --c-min RE,IM       c of the top left thumbnail (default: -2,-1.25)\n"
+            << "  --c-max RE,IM       c of the bottom right thumbnail (default: 0.5,1.25)\n"
+            << "  --thumb N           thumbnail size, a multiple of 16 (default: 128)\n"
+            << "  --center RE,IM      centre of each view (default: 0,0)\n"
+            << "  --span W            width of each view on the complex plane (default: 3.5)\n"
+            << "  --mode MODE         as for posters (default: color1)\n"
+            << "  --threads N         render threads (default: one per core)\n"
+            << "  --one-by-one        render each thumbnail on its own, with the lanes taking\n"
+            << "                      neighbouring pixels instead of different values of c\n"
+            << "  --benchmark         time the thumbnails on one thread both ways instead of\n"
+            << "                      writing the atlas\n"
+            << "  -h, --help          show this message\n";
+}
+
+static void print_generator_usage(const char* argv0) {
+  std::cout << "usage: " << argv0 << " generator [options]\n"
+            << "\n"
+            << "Models the generator on one frame: renders its iteration counts, checks a frame\n"
+            << "captured from a simulation against them, and counts the cycles the frame takes\n"
+            << "with pixels recycled as they finish and with every pixel held for the deepest.\n"
+            << "\n"
+            << "options:\n"
+            << "  --size WxH          frame size in pixels (default: 384x216)\n"
+            << "  --registers X0,Y0,DX,DY,CR,CI\n"
+            << "                      register values in hex (default: those of the generator\n"
+            << "                      testbench)\n"
+            << "  --c RE,IM           the constant c, instead of registers\n"
+            << "  --center RE,IM      centre of the view (default: 0,0)\n"
+            << "  --span W            width of the view on the complex plane (default: 3)\n"
+            << "  --max-iter N        iteration limit, 1 to 255 (default: 255)\n"
+            << "  --parallels N       kernels in the ring (default: 29, as built)\n"
+            << "  --reorder-depth N   pixels the reorder buffer holds (default: 4096)\n"
+            << "  --clock MHZ         generator clock for frame rates (default: 300)\n"
+            << "  --compare FILE      binary PGM of counts, such as the testbench's out.pgm\n"
+            << "  --output FILE       write the counts as a binary PGM\n"
+            << "  -h, --help          show this message\n";
+}
+
+static bool read_pgm(const std::string& path, std::uint32_t& width, std::uint32_t& height,
+                     std::vector<std::uint8_t>& pixels) {
+  std::ifstream in{path, std::ios::binary};
+  std::string magic;
+  unsigned int max_value;
+  if (!(in >> magic >> width >> height >> max_value) || magic != "P5" || max_value != 255) {
+    return false;
+  }
+  in.get();
+  pixels.resize(std::size_t{width} * height);
+  return static_cast<bool>(in.read(reinterpret_cast<char*>(pixels.data()), pixels.size()));
+}
+
+static bool write_pgm(const std::string& path, std::uint32_t width, std::uint32_t height,
+                      const std::vector<std::uint8_t>& pixels) {
+  std::ofstream out{path, std::ios::binary};
+  out << "P5\n" << width << ' ' << height << "\n255\n";
+  out.write(reinterpret_cast<const char*>(pixels.data()), pixels.size());
+  return static_cast<bool>(out);
+}
+
+// A pixel with n iterations visits n + 1 kernels, as it is not counted in the one it is fed to,
+// and goes around the whole ring each time it passes.
+static std::uint64_t passes(std::uint8_t n, std::uint32_t parallels) {
+  return (std::uint64_t{n} + parallels) / parallels;
+}
+
+// Cycles between the starts of two frames of these counts when every slot of the ring takes the
+// next pixel as soon as it comes around empty, as fractal_generator does. Frames are run back to
+// back and the third is measured, for the reorder buffer and the ring to be as full as they get.
+static std::uint64_t recycling_frame_cycles(const std::vector<std::uint8_t>& counts,
+                                            std::uint32_t parallels,
+                                            std::uint32_t reorder_depth) {
+  constexpr std::uint32_t stages = 9; // of a kernel
+  constexpr std::size_t frames = 3;
+  constexpr auto none = std::numeric_limits<std::size_t>::max();
+  constexpr auto never = std::numeric_limits<std::uint64_t>::max();
+
+  const auto slots = std::size_t{parallels} * stages;
+  const auto n = counts.size();
+  const auto total = n * frames;
+
+  std::vector<std::size_t> slot_pixel(slots, none);
+  std::vector<std::uint64_t> slot_free_at(slots, 0);
+  std::vector<std::uint64_t> retired_at(total, never);
+  std::uint64_t frame_start[frames] = {};
+
+  std::size_t next_in = 0;
+  std::size_t next_out = 0;
+  for (std::uint64_t t = 0; next_out < total; ++t) {
+    const auto k = t % slots;
+    if (slot_pixel[k] != none && slot_free_at[k] <= t) {
+      retired_at[slot_pixel[k]] = t;
+      slot_pixel[k] = none;
+    }
+    if (slot_pixel[k] == none && next_in < total && next_in - next_out < reorder_depth) {
+      slot_pixel[k] = next_in;
+      slot_free_at[k] = t + passes(counts[next_in % n], parallels) * slots;
+      ++next_in;
+    }
+
+    // written into the buffer, read back, then output
+    if (next_out < next_in && retired_at[next_out] != never && retired_at[next_out] + 2 <= t) {
+      if (next_out % n == 0) {
+        frame_start[next_out / n] = t;
+      }
+      ++next_out;
+    }
+  }
+  return frame_start[2] - frame_start[1];
+}
+
+static int check_generator(int argc, char** argv) {
+  std::uint32_t width = 384;
+  std::uint32_t height = 216;
+  fractal_params params{0x10000000, 0x09000000, 0x00155555, 0x00155555, 0xf9999999, 0x09999999};
+  bool c_given = false;
+  double cr = -0.4;
+  double ci = 0.6;
+  double center_r = 0.0;
+  double center_i = 0.0;
+  double span = 3.0;
+  std::uint32_t max_iter = fractal_max_iterations;
+  std::uint32_t parallels = 29;
+  std::uint32_t reorder_depth = 4096;
+  double clock_mhz = 300.0;
+  std::string compare;
+  std::string output;
+
+  {
+    enum : int {
+      opt_size = 0x100,
+      opt_registers,
+      opt_c,
+      opt_center,
+      opt_span,
+      opt_max_iter,
+      opt_parallels,
+      opt_reorder_depth,
+      opt_clock,
+      opt_compare,
+      opt_output,
+    };
+
+    static const ::option long_options[] = {
+        {"size", required_argument, nullptr, opt_size},
+        {"registers", required_argument, nullptr, opt_registers},
+        {"c", required_argument, nullptr, opt_c},
+        {"center", required_argument, nullptr, opt_center},
+        {"span", required_argument, nullptr, opt_span},
+        {"max-iter", required_argument, nullptr, opt_max_iter},
+        {"parallels", required_argument, nullptr, opt_parallels},
+        {"reorder-depth", required_argument, nullptr, opt_reorder_depth},
+        {"clock", required_argument, nullptr, opt_clock},
+        {"compare", required_argument, nullptr, opt_compare},
+        {"output", required_argument, nullptr, opt_output},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    for (int opt; (opt = ::getopt_long(argc, argv, "h", long_options, nullptr)) != -1;) {
+      bool ok = true;
+      switch (opt) {
+        case opt_size:
+          ok = parse_size(::optarg, width, height);
+          break;
+        case opt_registers:
+          ok = parse_registers(::optarg, params);
+          break;
+        case opt_c:
+          ok = parse_pair(::optarg, cr, ci);
+          c_given = true;
+          break;
+        case opt_center:
+          ok = parse_pair(::optarg, center_r, center_i);
+          break;
+        case opt_span:
+          span = std::strtod(::optarg, nullptr);
+          ok = span > 0.0;
+          break;
+        case opt_max_iter:
+          max_iter = static_cast<std::uint32_t>(std::strtoul(::optarg, nullptr, 10));
+          ok = max_iter >= 1 && max_iter <= fractal_max_iterations;
+          break;
+        case opt_parallels:
+          parallels = static_cast<std::uint32_t>(std::strtoul(::optarg, nullptr, 10));
+          ok = parallels > 0;
+          break;
+        case opt_reorder_depth:
+          reorder_depth = static_cast<std::uint32_t>(std::strtoul(::optarg, nullptr, 10));
+          ok = reorder_depth > 0;
+          break;
+        case opt_clock:
+          clock_mhz = std::strtod(::optarg, nullptr);
+          ok = clock_mhz > 0.0;
+          break;
+        case opt_compare:
+          compare = ::optarg;
+          break;
+        case opt_output:
+          output = ::optarg;
+          break;
+        case 'h':
+          print_generator_usage(argv[0]);
+          return 0;
+        default:
+          ok = false;
+          break;
+      }
+      if (!ok) {
+        print_generator_usage(argv[0]);
+        return -1;
+      }
+    }
+  }
+
+  if (::optind != argc) {
+    print_generator_usage(argv[0]);
+    return -1;
+  }
+
+  if (c_given) {
+    const auto d = span / width;
+    params = make_fractal_params(span / 2 - center_r, d * height / 2 - center_i, d, d, cr, ci);
+  }
+  params.max_iterations = max_iter;
+
+  std::vector<std::uint8_t> counts(std::size_t{width} * height);
+  render_iterations(params, 0, 0, width, height, counts.data(), width);
+
+  if (!output.empty() && !write_pgm(output, width, height, counts)) {
+    std::cerr << "failed to write " << output << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  int status = 0;
+  if (!compare.empty()) {
+    std::uint32_t w;
+    std::uint32_t h;
+    std::vector<std::uint8_t> frame;
+    if (!read_pgm(compare, w, h, frame)) {
+      std::cerr << "failed to read " << compare << " as a binary PGM" << std::endl;
+      return EXIT_FAILURE;
+    }
+    if (w != width || h != height) {
+      std::cerr << compare << " is " << w << "x" << h << ", not " << width << "x" << height
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    std::size_t mismatches = 0;
+    for (std::size_t i = 0; i < counts.size(); ++i) {
+      if (frame[i] != counts[i]) {
+        if (mismatches < 8) {
+          std::printf("(%zu, %zu): %u, expected %u\n", i % width, i / width, frame[i], counts[i]);
+        }
+        ++mismatches;
+      }
+    }
+    std::printf("%s: %zu of %zu pixels differ\n", compare.c_str(), mismatches, counts.size());
+    status = mismatches == 0 ? 0 : EXIT_FAILURE;
+  }
+
+  std::uint64_t total_passes = 0;
+  std::uint32_t deepest = 0;
+  for (const auto n : counts) {
+    total_passes += passes(n, parallels);
+    deepest = std::max<std::uint32_t>(deepest, n);
+  }
+  const auto pixels = counts.size();
+
+  // every batch of pixels goes around as often as a pixel reaching the limit would need
+  const auto fixed = pixels * passes(static_cast<std::uint8_t>(max_iter), parallels);
+  const auto recycling = recycling_frame_cycles(counts, parallels, reorder_depth);
+  const auto fps = [clock_mhz](std::uint64_t cycles) {
+    return clock_mhz * 1e6 / static_cast<double>(cycles);
+  };
+
+  std::printf("%ux%u, limit %u (deepest pixel %u), %u kernels, %.2f passes per pixel\n", width,
+              height, max_iter, deepest, parallels,
+              static_cast<double>(total_passes) / static_cast<double>(pixels));
+  std::printf("  fixed schedule: %10llu cycles, %8.2f fps at %g MHz\n",
+              static_cast<unsigned long long>(fixed), fps(fixed), clock_mhz);
+  std::printf("  recycling:      %10llu cycles, %8.2f fps at %g MHz\n",
+              static_cast<unsigned long long>(recycling), fps(recycling), clock_mhz);
+  std::printf("  speedup:        %10.2fx\n",
+              static_cast<double>(fixed) / static_cast<double>(recycling));
+
+  return status;
+}
+
+static int render_poster(int argc, char** argv) {
+  std::uint32_t width = 32768;
+  std::uint32_t height = 32768;
+  double cr = -0.4;
+  double ci = 0.6;
+  double center_r = 0.0;
+  double center_i = 0.0;
+  double span = 3.0;
+  auto mode = color_mode::color1;
+  std::uint32_t tile_size = 256;
+  std::uint32_t aa = 1;
+  unsigned int threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+  {
+    enum : int {
+      opt_size = 0x100,
+      opt_c,
+      opt_center,
+      opt_span,
+      opt_mode,
+      opt_tile,
+      opt_aa,
+      opt_threads,
+    };
+
+    static const ::option long_options[] = {
+        {"size", required_argument, nullptr, opt_size},
+        {"c", required_argument, nullptr, opt_c},
+        {"center", required_argument, nullptr, opt_center},
+        {"span", required_argument, nullptr, opt_span},
+        {"mode", required_argument, nullptr, opt_mode},
+        {"tile", required_argument, nullptr, opt_tile},
+        {"aa", required_argument, nullptr, opt_aa},
+        {"threads", required_argument, nullptr, opt_threads},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    for (int opt; (opt = ::getopt_long(argc, argv, "h", long_options, nullptr)) != -1;) {
+      bool ok = true;
+      switch (opt) {
+        case opt_size:
+          ok = parse_size(::optarg, width, height);
+          break;
+        case opt_c:
+          ok = parse_pair(::optarg, cr, ci);
+          break;
+        case opt_center:
+          ok = parse_pair(::optarg, center_r, center_i);
+          break;
+        case opt_span:
+          span = std::strtod(::optarg, nullptr);
+          ok = span > 0.0;
+          break;
+        case opt_mode:
+          ok = parse_mode(::optarg, mode);
+          break;
+        case opt_tile:
+          tile_size = static_cast<std::uint32_t>(std::strtoul(::optarg, nullptr, 10));
+          break;
+        case opt_aa:
+          aa = static_cast<std::uint32_t>(std::strtoul(::optarg, nullptr, 10));
+          ok = aa == 1 || aa == 2 || aa == 4;
+          break;
+        case opt_threads:
+          threads = static_cast<unsigned int>(std::strtoul(::optarg, nullptr, 10));
+          ok = threads > 0;
+          break;
+        case 'h':
+          print_usage(argv[0]);
+          return 0;
+        default:
+          ok = false;
+          break;
+      }
+      if (!ok) {
+        print_usage(argv[0]);
+        return -1;
+      }
+    }
+  }
+
+  if (::optind + 1 != argc) {
+    print_usage(argv[0]);
+    return -1;
+  }
+  const std::string output = argv[::optind];
+
+  // the same registers the explorer would write for this view; rows go down as Im(z) grows, as
+  // the generator scans them
+  const auto d = span / width;
+  const auto params = make_fractal_params(span / 2 - center_r, d * height / 2 - center_i, d, d,
+                                          cr, ci);
+  const auto& palette = colorizer_palette(mode);
+
+  // also what a resumed render is checked against
+  char description[256];
+  std::snprintf(description, sizeof description,
+                "fractal-render c=%.17g,%.17g center=%.17g,%.17g span=%.17g mode=%u aa=%u "
+                "registers=%08x,%08x,%08x,%08x,%08x,%08x",
+                cr, ci, center_r, center_i, span, static_cast<unsigned int>(mode), aa, params.x0,
+                params.y0, params.dx, params.dy, params.cr, params.ci);
+
+  try {
+    tiled_tiff_writer writer{output, width, height, tile_size, description};
+    if (writer.tiles_done() > 0) {
+      std::cout << "resuming: " << writer.tiles_done() << " of " << writer.tile_count()
+                << " tiles already written" << std::endl;
+    }
+
+    std::atomic<std::uint64_t> refined{0};
+    const auto job = [&](std::size_t tile) -> std::uint64_t {
+      if (writer.done(tile)) {
+        return 0;
+      }
+
+      const auto t = std::size_t{tile_size};
+      thread_local std::vector<std::uint8_t> iterations;
+      thread_local std::vector<std::uint8_t> rgb;
+      iterations.resize(t * t);
+      rgb.resize(t * t * 3);
+
+      const auto x = static_cast<std::uint32_t>(tile % writer.tiles_across()) * tile_size;
+      const auto y = static_cast<std::uint32_t>(tile / writer.tiles_across()) * tile_size;
+      const auto w = std::min(tile_size, width - x);
+      const auto h = std::min(tile_size, height - y);
+      if (aa > 1) {
+        if (w < tile_size || h < tile_size) {
+          std::fill(rgb.begin(), rgb.end(), 0);
+        }
+        refined += render_antialiased(params, palette, aa, x, y, w, h, rgb.data(), t * 3);
+      } else {
+        render_iterations(params, x, y, w, h, iterations.data(), t);
+        colorize(palette, iterations.data(), t, w, h, tile_size, rgb.data());
+      }
+      writer.write_tile(tile, rgb.data());
+      return std::uint64_t{w} * h;
+    };
+
+    std::uint64_t pixels;
+    std::chrono::duration<double> elapsed;
+    if (!run_jobs(writer.tile_count(), threads, job, pixels, elapsed)) {
+      return EXIT_FAILURE;
+    }
+
+    writer.finish();
+    std::printf("%s: %ux%u, %.3f Mpixel in %.1f s, %.1f Mpixel/s on %u threads\n", output.c_str(),
+                width, height, static_cast<double>(pixels) / 1e6, elapsed.count(),
+                static_cast<double>(pixels) / 1e6 / elapsed.count(), threads);
+    if (aa > 1 && pixels > 0) {
+      // the border and the refined pixels' samples, against aa x aa samples everywhere
+      const auto fraction = static_cast<double>(refined) / static_cast<double>(pixels);
+      std::printf("antialiasing: %.1f%% of pixels refined with %ux%u samples, %.1f%% of the cost "
+                  "of supersampling them all\n",
+                  100.0 * fraction, aa, aa, 100.0 * (1.0 + fraction * aa * aa) / (aa * aa));
+    }
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return 0;
+}
+
+static int render_atlas(int argc, char** argv) {
+  std::uint32_t cols = 16;
+  std::uint32_t rows = 16;
+  double cr_min = -2.0;
+  double ci_min = -1.25;
+  double cr_max = 0.5;
+  double ci_max = 1.25;
+  std::uint32_t thumb = 128;
+  double center_r = 0.0;
+  double center_i = 0.0;
+  double span = 3.5;
+  auto mode = color_mode::color1;
+  unsigned int threads = std::max(std::thread::hardware_concurrency(), 1u);
+  bool one_by_one = false;
+  bool benchmark = false;
+
+  {
+    enum : int {
+      opt_grid = 0x100,
+      opt_c_min,
+      opt_c_max,
+      opt_thumb,
+      opt_center,
+      opt_span,
+      opt_mode,
+      opt_threads,
+      opt_one_by_one,
+      opt_benchmark,
+    };
+
+    static const ::option long_options[] = {
+        {"grid", required_argument, nullptr, opt_grid},
+        {"c-min", required_argument, nullptr, opt_c_min},
+        {"c-max", required_argument, nullptr, opt_c_max},
+        {"thumb", required_argument, nullptr, opt_thumb},
+        {"center", required_argument, nullptr, opt_center},
+        {"span", required_argument, nullptr, opt_span},
+        {"mode", required_argument, nullptr, opt_mode},
+        {"threads", required_argument, nullptr, opt_threads},
+        {"one-by-one", no_argument, nullptr, opt_one_by_one},
+        {"benchmark", no_argument, nullptr, opt_benchmark},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    for (int opt; (opt = ::getopt_long(argc, argv, "h", long_options, nullptr)) != -1;) {
+      bool ok = true;
+      switch (opt) {
+        case opt_grid:
+          ok = parse_size(::optarg, cols, rows);
+          break;
+        case opt_c_min:
+          ok = parse_pair(::optarg, cr_min, ci_min);
+          break;
+        case opt_c_max:
+          ok = parse_pair(::optarg, cr_max, ci_max);
+          break;
+        case opt_thumb:
+          thumb = static_cast<std::uint32_t>(std::strtoul(::optarg, nullptr, 10));
+          ok = thumb > 0 && thumb % 16 == 0;
+          break;
+        case opt_center:
+          ok = parse_pair(::optarg, center_r, center_i);
+          break;
+        case opt_span:
+          span = std::strtod(::optarg, nullptr);
+          ok = span > 0.0;
+          break;
+        case opt_mode:
+          ok = parse_mode(::optarg, mode);
+          break;
+        case opt_threads:
+          threads = static_cast<unsigned int>(std::strtoul(::optarg, nullptr, 10));
+          ok = threads > 0;
+          break;
+        case opt_one_by_one:
+          one_by_one = true;
+          break;
+        case opt_benchmark:
+          benchmark = true;
+          break;
+        case 'h':
+          print_atlas_usage(argv[0]);
+          return 0;
+        default:
+          ok = false;
+          break;
+      }
+      if (!ok) {
+        print_atlas_usage(argv[0]);
+        return -1;
+      }
+    }
+  }
+
+  if (::optind + (benchmark ? 0 : 1) != argc) {
+    print_atlas_usage(argv[0]);
+    return -1;
+  }
+
+  // thumbnail k is tile k of the atlas
+  const auto count = std::size_t{cols} * rows;
+  std::vector<fractal_params> params;
+  const auto d = span / thumb;
+  for (std::uint32_t row = 0; row < rows; ++row) {
+    for (std::uint32_t col = 0; col < cols; ++col) {
+      const auto cr = cr_min + (cr_max - cr_min) * col / std::max(cols - 1, 1u);
+      const auto ci = ci_min + (ci_max - ci_min) * row / std::max(rows - 1, 1u);
+      params.push_back(
+          make_fractal_params(span / 2 - center_r, span / 2 - center_i, d, d, cr, ci));
+    }
+  }
+
+  const auto pixels_per_thumb = std::size_t{thumb} * thumb;
+
+  if (benchmark) {
+    std::vector<std::uint8_t> batched(count * pixels_per_thumb);
+    std::vector<std::uint8_t> separate(count * pixels_per_thumb);
+    std::vector<std::uint8_t*> out;
+    for (std::size_t k = 0; k < count; ++k) {
+      out.push_back(batched.data() + k * pixels_per_thumb);
+    }
+
+    const auto t0 = std::chrono::steady_clock::now();
+    render_iterations_batch(params.data(), count, thumb, thumb, out.data(), thumb);
+    const auto t1 = std::chrono::steady_clock::now();
+    for (std::size_t k = 0; k < count; ++k) {
+      render_iterations(params[k], 0, 0, thumb, thumb, separate.data() + k * pixels_per_thumb,
+                        thumb);
+    }
+    const auto t2 = std::chrono::steady_clock::now();
+
+    const std::chrono::duration<double, std::milli> batched_time = t1 - t0;
+    const std::chrono::duration<double, std::milli> separate_time = t2 - t1;
+    std::printf("%zu thumbnails of %ux%u, one thread, %zu lanes\n", count, thumb, thumb,
+                fractal_lanes);
+    std::printf("  batched across c: %8.3f ms per thumbnail\n", batched_time.count() / count);
+    std::printf("  one by one:       %8.3f ms per thumbnail\n", separate_time.count() / count);
+    std::printf("  speedup:          %8.2fx\n", separate_time / batched_time);
+    if (batched != separate) {
+      std::cerr << "batched and separate renders differ" << std::endl;
+      return EXIT_FAILURE;
+    }
+    return 0;
+  }
+
+  const std::string output = argv[::optind];
+  const auto& palette = colorizer_palette(mode);
+
+  char description[256];
+  std::snprintf(description, sizeof description,
+                "fractal-render atlas grid=%ux%u c-min=%.17g,%.17g c-max=%.17g,%.17g "
+                "center=%.17g,%.17g span=%.17g mode=%u",
+                cols, rows, cr_min, ci_min, cr_max, ci_max, center_r, center_i, span,
+                static_cast<unsigned int>(mode));
+
+  try {
+    tiled_tiff_writer writer{output, cols * thumb, rows * thumb, thumb, description};
+    if (writer.tiles_done() > 0) {
+      std::cout << "resuming: " << writer.tiles_done() << " of " << writer.tile_count()
+                << " thumbnails already written" << std::endl;
+    }
+
+    // a job is one thumbnail per lane
+    const auto job = [&](std::size_t batch) -> std::uint64_t {
+      const auto first = batch * fractal_lanes;
+      const auto n = std::min(fractal_lanes, count - first);
+      bool done = true;
+      for (std::size_t k = first; k < first + n; ++k) {
+        done = done && writer.done(k);
+      }
+      if (done) {
+        return 0;
+      }
+
+      thread_local std::vector<std::uint8_t> iterations;
+      thread_local std::vector<std::uint8_t> rgb;
+      iterations.resize(fractal_lanes * pixels_per_thumb);
+      rgb.resize(pixels_per_thumb * 3);
+
+      std::uint8_t* out[fractal_lanes];
+      for (std::size_t l = 0; l < fractal_lanes; ++l) {
+        out[l] = iterations.data() + l * pixels_per_thumb;
+      }
+      if (one_by_one) {
+        for (std::size_t l = 0; l < n; ++l) {
+          render_iterations(params[first + l], 0, 0, thumb, thumb, out[l], thumb);
+        }
+      } else {
+        render_iterations_batch(params.data() + first, n, thumb, thumb, out, thumb);
+      }
+
+      for (std::size_t l = 0; l < n; ++l) {
+        colorize(palette, out[l], thumb, thumb, thumb, thumb, rgb.data());
+        writer.write_tile(first + l, rgb.data());
+      }
+      return n * pixels_per_thumb;
+    };
+
+    std::uint64_t pixels;
+    std::chrono::duration<double> elapsed;
+    const auto batches = (count + fractal_lanes - 1) / fractal_lanes;
+    if (!run_jobs(batches, threads, job, pixels, elapsed)) {
+      return EXIT_FAILURE;
+    }
+
+    writer.finish();
+    const auto thumbs = static_cast<double>(pixels / pixels_per_thumb);
+    std::printf("%s: %ux%u thumbnails of %ux%u in %.1f s, %.1f thumbnails/s on %u threads\n",
+                output.c_str(), cols, rows, thumb, thumb, elapsed.count(),
+                thumbs / elapsed.count(), threads);
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return 0;
+}
+
+auto main(int argc, char** argv) -> int {
+  if (argc > 1 && std::string_view{argv[1]} == "atlas") {
+    // getopt sees "atlas" as the program name
+    return render_atlas(argc - 1, argv + 1);
+  }
+  if (argc > 1 && std::string_view{argv[1]} == "generator") {
+    return check_generator(argc - 1, argv + 1);
+  }
+  return render_poster(argc, argv);
+}
@@ -0,0 +1,316 @@
+#include "replay.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <linux/dma-buf.h>
+#include <linux/udmabuf.h>
+#include <linux/videodev2.h>
+}
+
+#include "frame_file.h"
+
+using namespace std::string_literals;
+
+static std::chrono::nanoseconds monotonic_now() {
+  ::timespec ts{};
+  ::clock_gettime(CLOCK_MONOTONIC, &ts);
+  return std::chrono::seconds{ts.tv_sec} + std::chrono::nanoseconds{ts.tv_nsec};
+}
+
+replay_source::replay_source(const char* path, std::size_t num_buffers, double speed, bool loop)
+    : data_{nullptr},
+      size_{0},
+      raw_stride_{0},
+      record_size_{0},
+      width_{0},
+      height_{0},
+      udmabuf_fd_{-1},
+      timer_fd_{-1},
+      speed_{speed},
+      loop_{loop},
+      waiting_{false},
+      finished_{false},
+      cursor_{0},
+      start_{0},
+      base_timestamp_{0},
+      frames_delivered_{0},
+      frames_dropped_{0},
+      loops_{0} {
+  try {
+    char magic[8]{};
+    {
+      const auto fd = ::open(path, O_RDONLY | O_CLOEXEC);
+      if (fd < 0) {
+        throw std::runtime_error{"failed to open "s + path + ": "s + std::strerror(errno)};
+      }
+      [[maybe_unused]] const auto ret = ::read(fd, magic, sizeof magic);
+      ::close(fd);
+    }
+
+    if (std::memcmp(magic, itmap_magic, sizeof magic) == 0) {
+      itmap_ = std::make_unique<itmap_reader>(path);
+      width_ = itmap_->width();
+      height_ = itmap_->height();
+      iterations_.resize(std::size_t{width_} * height_);
+      for (std::size_t i = 0; i < itmap_->frames(); ++i) {
+        infos_.push_back(itmap_->info(i));
+      }
+    } else if (std::memcmp(magic, frame_file_magic, sizeof magic) == 0) {
+      const auto fd = ::open(path, O_RDONLY | O_CLOEXEC);
+      if (fd < 0) {
+        throw std::runtime_error{"failed to open "s + path + ": "s + std::strerror(errno)};
+      }
+      struct ::stat st;
+      if (::fstat(fd, &st) == -1) {
+        ::close(fd);
+        throw std::runtime_error{"fstat: "s + std::strerror(errno)};
+      }
+      size_ = static_cast<std::size_t>(st.st_size);
+      const auto ptr = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      ::close(fd);
+      if (ptr == MAP_FAILED) {
+        throw std::runtime_error{"mmap: "s + std::strerror(errno)};
+      }
+      data_ = static_cast<const std::uint8_t*>(ptr);
+      ::madvise(ptr, size_, MADV_SEQUENTIAL);
+
+      if (size_ < frame_file_block_size) {
+        throw std::runtime_error{path + ": not a recording"s};
+      }
+      frame_file_header header;
+      std::memcpy(&header, data_, sizeof header);
+      if (header.version != frame_file_version || header.fourcc != V4L2_PIX_FMT_BGRX32 ||
+          header.stride < header.width * 4 || header.record_size < frame_file_block_size) {
+        throw std::runtime_error{path + ": unsupported recording"s};
+      }
+      width_ = header.width;
+      height_ = header.height;
+      raw_stride_ = header.stride;
+      record_size_ = header.record_size;
+
+      // a recording cut short keeps every complete record
+      const auto records = (size_ - frame_file_block_size) / record_size_;
+      for (std::size_t i = 0; i < records; ++i) {
+        frame_record_header r;
+        std::memcpy(&r, data_ + frame_file_block_size + i * record_size_, sizeof r);
+        infos_.push_back({r.sequence, r.timestamp_ns, r.x0, r.y0, r.dx, r.dy, r.cr, r.ci});
+      }
+    } else {
+      throw std::runtime_error{path + ": not a recording"s};
+    }
+
+    if (infos_.empty()) {
+      throw std::runtime_error{path + ": no frames"s};
+    }
+
+    udmabuf_fd_ = ::open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+    if (udmabuf_fd_ < 0) {
+      throw std::runtime_error{"failed to open /dev/udmabuf: "s + std::strerror(errno)};
+    }
+
+    const auto page_size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    const auto length = (std::size_t{stride()} * height_ + page_size - 1) / page_size * page_size;
+    for (std::size_t i = 0; i < num_buffers; ++i) {
+      // udmabuf wants a sealed memfd so that its pages cannot go away underneath the device
+      const auto memfd = ::memfd_create("replay", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+      if (memfd < 0) {
+        throw std::runtime_error{"memfd_create: "s + std::strerror(errno)};
+      }
+      if (::ftruncate(memfd, static_cast<::off_t>(length)) == -1 ||
+          ::fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK) == -1) {
+        ::close(memfd);
+        throw std::runtime_error{"memfd: "s + std::strerror(errno)};
+      }
+
+      ::udmabuf_create create{};
+      create.memfd = static_cast<std::uint32_t>(memfd);
+      create.flags = UDMABUF_FLAGS_CLOEXEC;
+      create.offset = 0;
+      create.size = length;
+      const auto dmabuf_fd = ::ioctl(udmabuf_fd_, UDMABUF_CREATE, &create);
+      if (dmabuf_fd < 0) {
+        ::close(memfd);
+        throw std::runtime_error{"UDMABUF_CREATE: "s + std::strerror(errno)};
+      }
+
+      const auto ptr = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+      ::close(memfd);
+      if (ptr == MAP_FAILED) {
+        ::close(dmabuf_fd);
+        throw std::runtime_error{"mmap: "s + std::strerror(errno)};
+      }
+
+      buffers_.push_back({static_cast<std::uint8_t*>(ptr), static_cast<std::uint32_t>(length),
+                          dmabuf_fd});
+      free_.push_back(static_cast<std::uint32_t>(i));
+    }
+
+    timer_fd_ = ::timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (timer_fd_ < 0) {
+      throw std::runtime_error{"timerfd_create: "s + std::strerror(errno)};
+    }
+  } catch (...) {
+    release_resources();
+    throw;
+  }
+
+  // hand out the first buffers in index order
+  std::reverse(free_.begin(), free_.end());
+
+  start_ = monotonic_now();
+  base_timestamp_ = infos_.front().timestamp_ns;
+  arm();
+}
+
+replay_source::~replay_source() {
+  release_resources();
+}
+
+void replay_source::release_resources() {
+  if (timer_fd_ >= 0) {
+    ::close(timer_fd_);
+  }
+  for (const auto& b : buffers_) {
+    ::munmap(b.ptr, b.length);
+    ::close(b.fd);
+  }
+  if (udmabuf_fd_ >= 0) {
+    ::close(udmabuf_fd_);
+  }
+  if (data_) {
+    ::munmap(const_cast<std::uint8_t*>(data_), size_);
+  }
+}
+
+std::optional<replay_source::frame> replay_source::next() {
+  std::uint64_t expirations;
+  [[maybe_unused]] const auto ret = ::read(timer_fd_, &expirations, sizeof expirations);
+
+  if (finished_ || waiting_) {
+    return std::nullopt;
+  }
+
+  if (free_.empty()) {
+    if (speed_ <= 0.0) {
+      // picked up again by release()
+      waiting_ = true;
+    } else {
+      ++frames_dropped_;
+      advance();
+      arm();
+    }
+    return std::nullopt;
+  }
+
+  const auto index = free_.back();
+  free_.pop_back();
+  fill(index);
+
+  const auto& info = infos_[cursor_];
+  const frame f{
+      index,
+      static_cast<std::uint32_t>(frames_delivered_),
+      monotonic_now(),
+      info.x0,
+      info.y0,
+      info.dx,
+      info.dy,
+      info.cr,
+      info.ci,
+  };
+  ++frames_delivered_;
+
+  advance();
+  arm();
+  return f;
+}
+
+void replay_source::release(std::uint32_t index) {
+  free_.push_back(index);
+  if (waiting_) {
+    waiting_ = false;
+    arm();
+  }
+}
+
+void replay_source::fill(std::uint32_t index) {
+  auto& b = buffers_[index];
+
+  ::dma_buf_sync sync{};
+  sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE;
+  ::ioctl(b.fd, DMA_BUF_IOCTL_SYNC, &sync);
+
+  const auto dst_stride = std::size_t{stride()};
+  if (itmap_) {
+    itmap_->decode(cursor_, iterations_.data(), width_);
+
+    // gray, as the colorizer shows iteration counts by default
+    for (std::uint32_t y = 0; y < height_; ++y) {
+      const auto* src = iterations_.data() + std::size_t{y} * width_;
+      auto* dst = reinterpret_cast<std::uint32_t*>(b.ptr + y * dst_stride);
+      for (std::uint32_t x = 0; x < width_; ++x) {
+        dst[x] = 0xff000000u | src[x] * 0x010101u;
+      }
+    }
+  } else {
+    const auto* src = data_ + frame_file_block_size + cursor_ * record_size_ + frame_file_block_size;
+    if (raw_stride_ == dst_stride) {
+      std::memcpy(b.ptr, src, dst_stride * height_);
+    } else {
+      for (std::uint32_t y = 0; y < height_; ++y) {
+        std::memcpy(b.ptr + y * dst_stride, src + std::size_t{y} * raw_stride_, dst_stride);
+      }
+    }
+  }
+
+  sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE;
+  ::ioctl(b.fd, DMA_BUF_IOCTL_SYNC, &sync);
+}
+
+void replay_source::advance() {
+  if (++cursor_ < infos_.size()) {
+    return;
+  }
+
+  if (!loop_) {
+    finished_ = true;
+    return;
+  }
+
+  cursor_ = 0;
+  ++loops_;
+  start_ = monotonic_now();
+}
+
+void replay_source::arm() {
+  if (finished_) {
+    return;
+  }
+
+  // unpaced replays fire right away; an absolute time in the past expires immediately
+  auto due = std::chrono::nanoseconds{1};
+  if (speed_ > 0.0) {
+    const auto offset = static_cast<double>(infos_[cursor_].timestamp_ns - base_timestamp_);
+    due = start_ + std::chrono::nanoseconds{static_cast<std::int64_t>(offset / speed_)};
+  }
+
+  ::itimerspec spec{};
+  spec.it_value.tv_sec = static_cast<::time_t>(due.count() / 1'000'000'000);
+  spec.it_value.tv_nsec = static_cast<long>(due.count() % 1'000'000'000);
+  if (::timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr) == -1) {
+    std::cerr << "replay: timerfd_settime: " << std::strerror(errno) << std::endl;
+  }
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "itmap.h"
+
+// Plays a recorded session (frame_file.h or itmap.h) back in place of the capture device.
+//
+// Frames are copied into udmabuf-backed buffers, so they reach the display through the same
+// dmabuf import as captured ones. event_fd() becomes readable when the next frame is due; frames
+// are paced by their recorded timestamps divided by `speed`, or delivered as fast as buffers are
+// returned if `speed` is 0. Like the generator, a paced replay drops frames when no buffer is free.
+class replay_source {
+public:
+  struct buffer {
+    std::uint8_t* ptr;
+    std::uint32_t length;
+    int fd; // dmabuf
+  };
+
+  struct frame {
+    std::uint32_t index;
+    std::uint32_t sequence;
+    std::chrono::nanoseconds timestamp; // delivery time, CLOCK_MONOTONIC
+    double x0, y0, dx, dy, cr, ci;
+  };
+
+  struct stats {
+    std::uint64_t frames_delivered;
+    std::uint64_t frames_dropped;
+    std::uint64_t loops;
+  };
+
+  replay_source(const char* path, std::size_t num_buffers, double speed, bool loop);
+  ~replay_source();
+
+  replay_source(const replay_source&) = delete;
+  replay_source& operator=(const replay_source&) = delete;
+
+  std::uint32_t width() const {
+    return width_;
+  }
+
+  std::uint32_t height() const {
+    return height_;
+  }
+
+  // bytes per line of the buffers, which hold BGRX32 pixels
+  std::uint32_t stride() const {
+    return width_ * 4;
+  }
+
+  std::size_t num_buffers() const {
+    return buffers_.size();
+  }
+
+  const buffer& get_buffer(std::size_t index) const {
+    return buffers_.at(index);
+  }
+
+  int event_fd() const {
+    return timer_fd_;
+  }
+
+  // the next frame, if one is due and a buffer was free for it
+  std::optional<frame> next();
+
+  // gives a buffer handed out by next() back
+  void release(std::uint32_t index);
+
+  // the last frame has been delivered and looping is disabled
+  bool finished() const {
+    return finished_;
+  }
+
+  stats get_stats() const {
+    return {frames_delivered_, frames_dropped_, loops_};
+  }
+
+private:
+  void release_resources();
+  void fill(std::uint32_t index);
+  void advance();
+  void arm();
+
+  // raw recording
+  const std::uint8_t* data_;
+  std::size_t size_;
+  std::uint32_t raw_stride_;
+  std::uint64_t record_size_;
+
+  // iteration map stream
+  std::unique_ptr<itmap_reader> itmap_;
+  std::vector<std::uint8_t> iterations_;
+
+  std::uint32_t width_;
+  std::uint32_t height_;
+  std::vector<itmap_frame_info> infos_; // recorded, one per frame
+
+  int udmabuf_fd_;
+  std::vector<buffer> buffers_;
+  std::vector<std::uint32_t> free_;
+
+  int timer_fd_;
+  double speed_;
+  bool loop_;
+  bool waiting_; // unpaced and out of buffers
+  bool finished_;
+  std::size_t cursor_;
+  std::chrono::nanoseconds start_;
+  std::int64_t base_timestamp_;
+
+  std::uint64_t frames_delivered_;
+  std::uint64_t frames_dropped_;
+  std::uint64_t loops_;
+};
@@ -0,0 +1,146 @@
+#include "scroll_compositor.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+extern "C" {
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/dma-buf.h>
+}
+
+using namespace std::string_literals;
+
+scroll_compositor::scroll_compositor(std::uint32_t width, std::uint32_t height)
+    : width_{width},
+      height_{height},
+      event_fd_{-1},
+      region_pixels_(std::size_t{width} * height),
+      stats_{},
+      stopping_{false} {
+  event_fd_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (event_fd_ < 0) {
+    throw std::runtime_error{"eventfd: "s + std::strerror(errno)};
+  }
+
+  thread_ = std::thread{&scroll_compositor::run, this};
+}
+
+scroll_compositor::~scroll_compositor() {
+  {
+    std::lock_guard lock{mutex_};
+    stopping_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+
+  ::close(event_fd_);
+}
+
+void scroll_compositor::submit(const frame& f) {
+  {
+    std::lock_guard lock{mutex_};
+    pending_.push_back(f);
+  }
+  cv_.notify_one();
+}
+
+std::vector<scroll_compositor::result> scroll_compositor::completed() {
+  std::uint64_t count;
+  [[maybe_unused]] const auto ret = ::read(event_fd_, &count, sizeof count);
+
+  std::vector<result> results;
+  {
+    std::lock_guard lock{mutex_};
+    results.swap(completed_);
+  }
+  return results;
+}
+
+scroll_compositor::stats scroll_compositor::get_stats() const {
+  std::lock_guard lock{mutex_};
+  return stats_;
+}
+
+void scroll_compositor::run() {
+  for (;;) {
+    frame f{};
+    {
+      std::unique_lock lock{mutex_};
+      cv_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+      if (stopping_) {
+        break;
+      }
+      f = pending_.front();
+      pending_.pop_front();
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+
+    ::dma_buf_sync sync{};
+    sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_RW;
+    ::ioctl(f.dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync);
+    sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ;
+    ::ioctl(f.base_dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync);
+
+    compose(f);
+
+    sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ;
+    ::ioctl(f.base_dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync);
+    sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_RW;
+    ::ioctl(f.dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync);
+
+    const auto compose_time = std::chrono::steady_clock::now() - start;
+
+    {
+      std::lock_guard lock{mutex_};
+      completed_.push_back({f.index, compose_time});
+      ++stats_.frames_composed;
+      stats_.pixels_generated += std::uint64_t{f.roi.width} * f.roi.height;
+      stats_.compose_time += compose_time;
+    }
+
+    const std::uint64_t one = 1;
+    [[maybe_unused]] const auto ret = ::write(event_fd_, &one, sizeof one);
+  }
+}
+
+void scroll_compositor::compose(const frame& f) {
+  constexpr std::size_t pixel_size = sizeof(std::uint32_t);
+
+  // The region is in the rows the frame before is moved into, so it is taken out first. Its
+  // pixels run on across the stride's padding.
+  const auto region_size = std::size_t{f.roi.width} * f.roi.height;
+  const auto row_pixels = std::size_t{width_};
+  for (std::size_t n = 0; n < region_size; n += row_pixels) {
+    std::memcpy(region_pixels_.data() + n,
+                f.data + n / row_pixels * f.stride,
+                std::min(row_pixels, region_size - n) * pixel_size);
+  }
+
+  const auto width = static_cast<std::int32_t>(width_);
+  const auto height = static_cast<std::int32_t>(height_);
+  const auto x_begin = std::max(0, -f.shift_x);
+  const auto x_end = std::min(width, width - f.shift_x);
+  for (std::int32_t y = 0; y < height; ++y) {
+    const auto base_y = y + f.shift_y;
+    if (base_y < 0 || base_y >= height || x_begin >= x_end) {
+      continue;
+    }
+    std::memcpy(f.data + std::size_t(y) * f.stride + std::size_t(x_begin) * pixel_size,
+                f.base_data + std::size_t(base_y) * f.stride +
+                    std::size_t(x_begin + f.shift_x) * pixel_size,
+                std::size_t(x_end - x_begin) * pixel_size);
+  }
+
+  for (std::uint32_t j = 0; j < f.roi.height; ++j) {
+    std::memcpy(f.data + std::size_t{f.roi.y + j} * f.stride + std::size_t{f.roi.x} * pixel_size,
+                region_pixels_.data() + std::size_t{j} * f.roi.width,
+                std::size_t{f.roi.width} * pixel_size);
+  }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Completes frames of which the generator made only a region, from the frame before them.
+//
+// While the view is only panned, a frame is the one before it moved by whole pixels, apart from
+// the strip that comes into view. The generator is asked for just that strip, which it outputs
+// packed into lines of the frame's width at the start of the buffer, and submit() fills in the
+// rest from the frame before, bit for bit as the generator would have made it.
+// Frames are finished in the order they were submitted; completed() returns them and event_fd()
+// becomes readable when there are some.
+class scroll_compositor {
+public:
+  struct region {
+    std::uint32_t x, y, width, height;
+  };
+
+  struct frame {
+    std::uint32_t index;
+    std::uint8_t* data; // BGRX32, the region's pixels one after another from the start
+    int dmabuf_fd;
+    const std::uint8_t* base_data; // the frame before, whole
+    int base_dmabuf_fd;
+    std::uint32_t stride;
+    // pixel (x, y) of the frame is pixel (x + shift_x, y + shift_y) of the one before, where
+    // that is outside the region
+    std::int32_t shift_x, shift_y;
+    region roi;
+  };
+
+  struct result {
+    std::uint32_t index;
+    std::chrono::nanoseconds compose_time;
+  };
+
+  struct stats {
+    std::uint64_t frames_composed;
+    std::uint64_t pixels_generated; // of the frames composed
+    std::chrono::nanoseconds compose_time;
+  };
+
+  scroll_compositor(std::uint32_t width, std::uint32_t height);
+  ~scroll_compositor();
+
+  scroll_compositor(const scroll_compositor&) = delete;
+  scroll_compositor& operator=(const scroll_compositor&) = delete;
+
+  int event_fd() const {
+    return event_fd_;
+  }
+
+  // completes `f`; both buffers are leased until completed() returns it
+  void submit(const frame& f);
+
+  // frames finished since the last call
+  std::vector<result> completed();
+
+  stats get_stats() const;
+
+private:
+  void run();
+  void compose(const frame& f);
+
+  std::uint32_t width_;
+  std::uint32_t height_;
+  int event_fd_;
+  std::vector<std::uint32_t> region_pixels_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<frame> pending_;
+  std::vector<result> completed_;
+  stats stats_;
+  bool stopping_;
+
+  std::thread thread_;
+};
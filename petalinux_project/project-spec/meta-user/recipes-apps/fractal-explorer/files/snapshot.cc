@@ -0,0 +1,423 @@
+#include "snapshot.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <stdexcept>
+
+#include <zlib.h>
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <linux/dma-buf.h>
+}
+
+using namespace std::string_literals;
+
+namespace {
+
+constexpr int png_compression_level = 3;
+constexpr std::size_t deflate_window = 32768;
+
+bool write_all(int fd, const void* data, std::size_t length) {
+  const auto* p = static_cast<const std::uint8_t*>(data);
+  while (length > 0) {
+    const auto ret = ::write(fd, p, length);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    p += ret;
+    length -= ret;
+  }
+  return true;
+}
+
+void put_be32(std::uint8_t* p, std::uint32_t v) {
+  p[0] = static_cast<std::uint8_t>(v >> 24);
+  p[1] = static_cast<std::uint8_t>(v >> 16);
+  p[2] = static_cast<std::uint8_t>(v >> 8);
+  p[3] = static_cast<std::uint8_t>(v);
+}
+
+bool write_png_chunk(int fd, const char* type, const std::uint8_t* data, std::size_t length) {
+  std::uint8_t head[8];
+  put_be32(head, static_cast<std::uint32_t>(length));
+  std::memcpy(head + 4, type, 4);
+
+  auto crc = ::crc32(0, head + 4, 4);
+  if (length > 0) {
+    // a null buffer would reset the checksum
+    crc = ::crc32(crc, data, static_cast<::uInt>(length));
+  }
+  std::uint8_t tail[4];
+  put_be32(tail, static_cast<std::uint32_t>(crc));
+
+  return write_all(fd, head, sizeof head) && write_all(fd, data, length) &&
+         write_all(fd, tail, sizeof tail);
+}
+
+// PNG scanline of BGRX pixels: filter type byte, then RGB with the Up filter applied
+void filter_row(const std::uint8_t* row, const std::uint8_t* above, std::uint32_t width,
+                std::uint8_t* out) {
+  if (!above) {
+    *out++ = 0; // None
+    for (std::uint32_t x = 0; x < width; ++x, out += 3) {
+      out[0] = row[x * 4 + 2];
+      out[1] = row[x * 4 + 1];
+      out[2] = row[x * 4 + 0];
+    }
+    return;
+  }
+
+  *out++ = 2; // Up
+  for (std::uint32_t x = 0; x < width; ++x, out += 3) {
+    out[0] = static_cast<std::uint8_t>(row[x * 4 + 2] - above[x * 4 + 2]);
+    out[1] = static_cast<std::uint8_t>(row[x * 4 + 1] - above[x * 4 + 1]);
+    out[2] = static_cast<std::uint8_t>(row[x * 4 + 0] - above[x * 4 + 0]);
+  }
+}
+
+struct png_band {
+  std::uint32_t first_row;
+  std::uint32_t last_row; // exclusive
+  bool last;
+
+  std::vector<std::uint8_t> output;
+  ::uLong adler;
+  std::size_t input_length;
+  bool ok;
+};
+
+void deflate_band(const snapshot_writer::frame& f, png_band& band) {
+  // compression must not take CPU time from the display loop
+  ::setpriority(PRIO_PROCESS, static_cast<::id_t>(::gettid()), 10);
+
+  const auto row_bytes = 1 + std::size_t{f.width} * 3;
+  std::vector<std::uint8_t> line(row_bytes);
+  const auto row = [&f](std::uint32_t y) { return f.data + std::size_t{y} * f.stride; };
+
+  ::z_stream zs{};
+  band.ok = ::deflateInit2(&zs, png_compression_level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) ==
+            Z_OK;
+  if (!band.ok) {
+    return;
+  }
+
+  // bands are independent deflate streams; priming each with the data before it keeps matches
+  // across band boundaries
+  if (band.first_row > 0) {
+    const auto rows = static_cast<std::uint32_t>(
+        std::min<std::size_t>((deflate_window + row_bytes - 1) / row_bytes, band.first_row));
+    std::vector<std::uint8_t> dict(rows * row_bytes);
+    for (std::uint32_t i = 0; i < rows; ++i) {
+      const auto y = band.first_row - rows + i;
+      filter_row(row(y), y > 0 ? row(y - 1) : nullptr, f.width, dict.data() + i * row_bytes);
+    }
+    const auto length = std::min(dict.size(), deflate_window);
+    ::deflateSetDictionary(&zs, dict.data() + dict.size() - length, static_cast<::uInt>(length));
+  }
+
+  band.output.resize(::deflateBound(&zs, (band.last_row - band.first_row) * row_bytes) + 16);
+  zs.next_out = band.output.data();
+  zs.avail_out = static_cast<::uInt>(band.output.size());
+
+  band.adler = ::adler32(0, nullptr, 0);
+  band.input_length = 0;
+  for (auto y = band.first_row; y < band.last_row; ++y) {
+    filter_row(row(y), y > 0 ? row(y - 1) : nullptr, f.width, line.data());
+    band.adler = ::adler32(band.adler, line.data(), static_cast<::uInt>(row_bytes));
+    band.input_length += row_bytes;
+
+    zs.next_in = line.data();
+    zs.avail_in = static_cast<::uInt>(row_bytes);
+    // a sync flush ends a band on a byte boundary without marking the last block
+    const auto flush = y + 1 < band.last_row ? Z_NO_FLUSH : band.last ? Z_FINISH : Z_SYNC_FLUSH;
+    const auto ret = ::deflate(&zs, flush);
+    if (ret == Z_STREAM_ERROR || zs.avail_in != 0 || (flush == Z_FINISH && ret != Z_STREAM_END)) {
+      band.ok = false;
+      break;
+    }
+  }
+
+  band.output.resize(band.output.size() - zs.avail_out);
+  ::deflateEnd(&zs);
+}
+
+} // namespace
+
+snapshot_writer::snapshot_writer(std::string directory, format fmt, unsigned int threads)
+    : directory_{std::move(directory)},
+      format_{fmt},
+      threads_{threads},
+      event_fd_{-1},
+      busy_{false},
+      stopping_{false} {
+  if (threads_ == 0) {
+    threads_ = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+  }
+
+  event_fd_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (event_fd_ < 0) {
+    throw std::runtime_error{"eventfd: "s + std::strerror(errno)};
+  }
+
+  thread_ = std::thread{&snapshot_writer::run, this};
+}
+
+snapshot_writer::~snapshot_writer() {
+  {
+    std::lock_guard lock{mutex_};
+    stopping_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+
+  ::close(event_fd_);
+}
+
+bool snapshot_writer::submit(const frame& f) {
+  {
+    std::lock_guard lock{mutex_};
+    if (busy_) {
+      return false;
+    }
+    busy_ = true;
+    pending_ = f;
+  }
+  cv_.notify_one();
+  return true;
+}
+
+std::vector<snapshot_writer::result> snapshot_writer::completed() {
+  std::uint64_t count;
+  [[maybe_unused]] const auto ret = ::read(event_fd_, &count, sizeof count);
+
+  std::vector<result> results;
+  {
+    std::lock_guard lock{mutex_};
+    results.swap(completed_);
+  }
+  return results;
+}
+
+void snapshot_writer::run() {
+  for (;;) {
+    frame f;
+    {
+      std::unique_lock lock{mutex_};
+      cv_.wait(lock, [this] { return stopping_ || pending_; });
+      if (!pending_) {
+        break;
+      }
+      f = *pending_;
+      pending_.reset();
+    }
+
+    auto r = encode(f);
+
+    {
+      std::lock_guard lock{mutex_};
+      completed_.push_back(std::move(r));
+      busy_ = false;
+    }
+
+    const std::uint64_t one = 1;
+    [[maybe_unused]] const auto ret = ::write(event_fd_, &one, sizeof one);
+  }
+}
+
+snapshot_writer::result snapshot_writer::encode(const frame& f) {
+  const auto start = std::chrono::steady_clock::now();
+
+  char name[64];
+  {
+    const auto now = std::time(nullptr);
+    std::tm tm{};
+    ::localtime_r(&now, &tm);
+    char date[32];
+    std::strftime(date, sizeof date, "%Y%m%d-%H%M%S", &tm);
+    std::snprintf(name, sizeof name, "/snapshot-%s-%06u.%s", date, f.sequence,
+                  format_ == format::png ? "png" : "qoi");
+  }
+
+  result r{f.index, false, directory_ + name, 0, {}};
+
+  const auto fd = ::open(r.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    std::cerr << "snapshot: failed to open " << r.path << ": " << std::strerror(errno)
+              << std::endl;
+    return r;
+  }
+
+  ::dma_buf_sync sync{};
+  sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ;
+  ::ioctl(f.dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync);
+
+  r.ok = format_ == format::png ? write_png(fd, f) : write_qoi(fd, f);
+
+  sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ;
+  ::ioctl(f.dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync);
+
+  if (!r.ok) {
+    std::cerr << "snapshot: failed to write " << r.path << ": " << std::strerror(errno)
+              << std::endl;
+  }
+  r.bytes = static_cast<std::uint64_t>(std::max<::off_t>(::lseek(fd, 0, SEEK_CUR), 0));
+  ::close(fd);
+
+  r.encode_time = std::chrono::steady_clock::now() - start;
+  return r;
+}
+
+bool snapshot_writer::write_png(int fd, const frame& f) {
+  std::vector<png_band> bands(std::min(threads_, f.height));
+  for (std::size_t i = 0; i < bands.size(); ++i) {
+    bands[i].first_row = static_cast<std::uint32_t>(f.height * i / bands.size());
+    bands[i].last_row = static_cast<std::uint32_t>(f.height * (i + 1) / bands.size());
+    bands[i].last = i + 1 == bands.size();
+  }
+
+  {
+    std::vector<std::thread> workers;
+    for (auto& band : bands) {
+      workers.emplace_back(deflate_band, std::cref(f), std::ref(band));
+    }
+    for (auto& w : workers) {
+      w.join();
+    }
+  }
+
+  if (!std::all_of(bands.begin(), bands.end(), [](const auto& b) { return b.ok; })) {
+    errno = EIO;
+    return false;
+  }
+
+  static constexpr std::uint8_t signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+  if (!write_all(fd, signature, sizeof signature)) {
+    return false;
+  }
+
+  std::uint8_t ihdr[13];
+  put_be32(ihdr, f.width);
+  put_be32(ihdr + 4, f.height);
+  ihdr[8] = 8;  // bit depth
+  ihdr[9] = 2;  // RGB
+  ihdr[10] = 0; // deflate
+  ihdr[11] = 0; // adaptive filtering
+  ihdr[12] = 0; // no interlace
+  if (!write_png_chunk(fd, "IHDR", ihdr, sizeof ihdr)) {
+    return false;
+  }
+
+  // one zlib stream split over an IDAT per band
+  auto adler = bands.front().adler;
+  for (std::size_t i = 1; i < bands.size(); ++i) {
+    adler = ::adler32_combine(adler, bands[i].adler, static_cast<::z_off_t>(bands[i].input_length));
+  }
+
+  static constexpr std::uint8_t zlib_header[] = {0x78, 0x01};
+  bands.front().output.insert(
+      bands.front().output.begin(), std::begin(zlib_header), std::end(zlib_header));
+  std::uint8_t zlib_trailer[4];
+  put_be32(zlib_trailer, static_cast<std::uint32_t>(adler));
+  bands.back().output.insert(
+      bands.back().output.end(), std::begin(zlib_trailer), std::end(zlib_trailer));
+
+  for (const auto& band : bands) {
+    if (!write_png_chunk(fd, "IDAT", band.output.data(), band.output.size())) {
+      return false;
+    }
+  }
+
+  return write_png_chunk(fd, "IEND", nullptr, 0);
+}
+
+bool snapshot_writer::write_qoi(int fd, const frame& f) {
+  std::vector<std::uint8_t> out;
+  out.reserve(1 << 20);
+
+  const auto flush = [fd, &out] {
+    const auto ok = write_all(fd, out.data(), out.size());
+    out.clear();
+    return ok;
+  };
+
+  out.insert(out.end(), {'q', 'o', 'i', 'f'});
+  out.resize(14);
+  put_be32(out.data() + 4, f.width);
+  put_be32(out.data() + 8, f.height);
+  out[12] = 3; // RGB
+  out[13] = 0; // sRGB
+
+  // alpha is always 255, but the index starts out with zeros for it, as the decoder's does, so
+  // that black does not match a slot that has not been written
+  struct rgba {
+    std::uint8_t r, g, b, a;
+    bool operator==(const rgba&) const = default;
+  };
+  rgba index[64]{};
+  rgba prev{0, 0, 0, 255};
+  unsigned int run = 0;
+
+  for (std::uint32_t y = 0; y < f.height; ++y) {
+    const auto* row = f.data + std::size_t{y} * f.stride;
+    for (std::uint32_t x = 0; x < f.width; ++x) {
+      const rgba px{row[x * 4 + 2], row[x * 4 + 1], row[x * 4 + 0], 255};
+
+      if (px == prev) {
+        if (++run == 62) {
+          out.push_back(static_cast<std::uint8_t>(0xc0 | (run - 1)));
+          run = 0;
+        }
+        continue;
+      }
+      if (run > 0) {
+        out.push_back(static_cast<std::uint8_t>(0xc0 | (run - 1)));
+        run = 0;
+      }
+
+      const auto hash = (px.r * 3 + px.g * 5 + px.b * 7 + px.a * 11) % 64;
+      if (index[hash] == px) {
+        out.push_back(static_cast<std::uint8_t>(hash));
+      } else {
+        index[hash] = px;
+
+        const auto dr = static_cast<std::int8_t>(px.r - prev.r);
+        const auto dg = static_cast<std::int8_t>(px.g - prev.g);
+        const auto db = static_cast<std::int8_t>(px.b - prev.b);
+        const auto dr_dg = dr - dg;
+        const auto db_dg = db - dg;
+        if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+          out.push_back(static_cast<std::uint8_t>(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+        } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 &&
+                   db_dg <= 7) {
+          out.push_back(static_cast<std::uint8_t>(0x80 | (dg + 32)));
+          out.push_back(static_cast<std::uint8_t>((dr_dg + 8) << 4 | (db_dg + 8)));
+        } else {
+          out.insert(out.end(), {0xfe, px.r, px.g, px.b});
+        }
+      }
+      prev = px;
+    }
+
+    if (out.size() >= (1 << 20) - 4096 && !flush()) {
+      return false;
+    }
+  }
+
+  if (run > 0) {
+    out.push_back(static_cast<std::uint8_t>(0xc0 | (run - 1)));
+  }
+  out.insert(out.end(), {0, 0, 0, 0, 0, 0, 0, 1});
+  return flush();
+}
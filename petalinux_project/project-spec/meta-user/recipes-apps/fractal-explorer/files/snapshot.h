@@ -0,0 +1,80 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Encodes stills of displayed frames on a background thread.
+//
+// Like the recorder, the caller leases a buffer with submit() and gets its index back from
+// completed() once the encoder is done reading it; event_fd() becomes readable at that point. One
+// still is encoded at a time. PNG is compressed by several threads at once, each deflating a band
+// of rows primed with the tail of the band above (as pigz does), and the pixels are read straight
+// from the buffer; QOI is a single fast pass.
+class snapshot_writer {
+public:
+  enum class format {
+    png,
+    qoi,
+  };
+
+  struct frame {
+    std::uint32_t index;
+    const std::uint8_t* data; // BGRX32
+    int dmabuf_fd;
+    std::uint32_t width;
+    std::uint32_t height;
+    std::uint32_t stride;
+    std::uint32_t sequence;
+  };
+
+  struct result {
+    std::uint32_t index;
+    bool ok;
+    std::string path;
+    std::uint64_t bytes;
+    std::chrono::nanoseconds encode_time;
+  };
+
+  // `threads` is the number of PNG compression threads, 0 for one per core but one
+  snapshot_writer(std::string directory, format fmt, unsigned int threads = 0);
+  ~snapshot_writer();
+
+  snapshot_writer(const snapshot_writer&) = delete;
+  snapshot_writer& operator=(const snapshot_writer&) = delete;
+
+  int event_fd() const {
+    return event_fd_;
+  }
+
+  // returns false if a still is already being encoded
+  bool submit(const frame& f);
+
+  // stills finished since the last call; their buffers can be released
+  std::vector<result> completed();
+
+private:
+  void run();
+  result encode(const frame& f);
+  bool write_png(int fd, const frame& f);
+  bool write_qoi(int fd, const frame& f);
+
+  std::string directory_;
+  format format_;
+  unsigned int threads_;
+  int event_fd_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::optional<frame> pending_;
+  bool busy_;
+  std::vector<result> completed_;
+  bool stopping_;
+
+  std::thread thread_;
+};
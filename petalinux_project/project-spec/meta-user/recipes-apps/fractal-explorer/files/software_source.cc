@@ -0,0 +1,381 @@
+#include "software_source.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <linux/dma-buf.h>
+#include <linux/udmabuf.h>
+}
+
+using namespace std::string_literals;
+
+// rows a thread renders at a time; the counts of a band stay in cache until they are coloured
+static constexpr std::uint32_t band_rows = 8;
+
+// the resolution is chosen for frames to take this share of the target, leaving room for frames
+// that cost more than the last one
+static constexpr double frame_time_headroom = 0.9;
+
+// largest change of the resolution per frame, per axis; it drops faster than it recovers
+static constexpr double scale_step_down = 0.8;
+static constexpr double scale_step_up = 1.05;
+
+static std::chrono::nanoseconds monotonic_now() {
+  ::timespec ts{};
+  ::clock_gettime(CLOCK_MONOTONIC, &ts);
+  return std::chrono::seconds{ts.tv_sec} + std::chrono::nanoseconds{ts.tv_nsec};
+}
+
+software_source::software_source(std::uint32_t width, std::uint32_t height,
+                                 std::size_t num_buffers, unsigned int threads,
+                                 std::chrono::nanoseconds target_frame_time,
+                                 std::uint32_t min_iterations, std::uint32_t max_iterations,
+                                 bool normalize, double min_scale)
+    : width_{width},
+      height_{height},
+      normalize_{normalize},
+      min_scale_{std::clamp(min_scale, 1.0 / 16, 1.0)},
+      scale_{1.0},
+      udmabuf_fd_{-1},
+      event_fd_{-1},
+      governor_{target_frame_time, min_iterations, max_iterations},
+      view_{0.0, 0.0, 0.0, 0.0, 0.0, 0.0, color_mode{}, height, fractal_max_iterations},
+      state_{governor_.get_state(), 1.0f, width, height},
+      stats_{},
+      stopping_{false},
+      job_{},
+      generation_{0},
+      busy_workers_{0},
+      next_band_{0},
+      stopping_workers_{false} {
+  if (threads == 0) {
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+
+  try {
+    udmabuf_fd_ = ::open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+    if (udmabuf_fd_ < 0) {
+      throw std::runtime_error{"failed to open /dev/udmabuf: "s + std::strerror(errno)};
+    }
+
+    const auto page_size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    const auto length = (std::size_t{stride()} * height_ + page_size - 1) / page_size * page_size;
+    for (std::size_t i = 0; i < num_buffers; ++i) {
+      // udmabuf wants a sealed memfd so that its pages cannot go away underneath the device
+      const auto memfd = ::memfd_create("software", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+      if (memfd < 0) {
+        throw std::runtime_error{"memfd_create: "s + std::strerror(errno)};
+      }
+      if (::ftruncate(memfd, static_cast<::off_t>(length)) == -1 ||
+          ::fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK) == -1) {
+        ::close(memfd);
+        throw std::runtime_error{"memfd: "s + std::strerror(errno)};
+      }
+
+      ::udmabuf_create create{};
+      create.memfd = static_cast<std::uint32_t>(memfd);
+      create.flags = UDMABUF_FLAGS_CLOEXEC;
+      create.offset = 0;
+      create.size = length;
+      const auto dmabuf_fd = ::ioctl(udmabuf_fd_, UDMABUF_CREATE, &create);
+      if (dmabuf_fd < 0) {
+        ::close(memfd);
+        throw std::runtime_error{"UDMABUF_CREATE: "s + std::strerror(errno)};
+      }
+
+      const auto ptr = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+      ::close(memfd);
+      if (ptr == MAP_FAILED) {
+        ::close(dmabuf_fd);
+        throw std::runtime_error{"mmap: "s + std::strerror(errno)};
+      }
+
+      buffers_.push_back({static_cast<std::uint8_t*>(ptr), static_cast<std::uint32_t>(length),
+                          dmabuf_fd});
+      free_.push_back(static_cast<std::uint32_t>(i));
+    }
+
+    event_fd_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (event_fd_ < 0) {
+      throw std::runtime_error{"eventfd: "s + std::strerror(errno)};
+    }
+  } catch (...) {
+    release_resources();
+    throw;
+  }
+
+  // hand out the first buffers in index order
+  std::reverse(free_.begin(), free_.end());
+
+  // the frame thread renders too
+  histograms_.resize(threads);
+  for (std::size_t i = 1; i < threads; ++i) {
+    workers_.emplace_back(&software_source::work, this, i);
+  }
+  thread_ = std::thread{&software_source::run, this};
+}
+
+software_source::~software_source() {
+  {
+    std::lock_guard lock{mutex_};
+    stopping_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+
+  {
+    std::lock_guard lock{work_mutex_};
+    stopping_workers_ = true;
+  }
+  work_cv_.notify_all();
+  for (auto& w : workers_) {
+    w.join();
+  }
+
+  release_resources();
+}
+
+void software_source::release_resources() {
+  if (event_fd_ >= 0) {
+    ::close(event_fd_);
+  }
+  for (const auto& b : buffers_) {
+    ::munmap(b.ptr, b.length);
+    ::close(b.fd);
+  }
+  if (udmabuf_fd_ >= 0) {
+    ::close(udmabuf_fd_);
+  }
+}
+
+void software_source::set_view(double x0, double y0, double dx, double dy, double cr, double ci,
+                               color_mode mode) {
+  std::lock_guard lock{mutex_};
+  view_ = {x0, y0, dx, dy, cr, ci, mode, view_.rows, view_.max_iterations};
+}
+
+void software_source::set_rows(std::uint32_t rows) {
+  std::lock_guard lock{mutex_};
+  view_.rows = std::clamp(rows, 1u, height_);
+}
+
+void software_source::set_max_iterations(std::uint32_t max_iterations) {
+  std::lock_guard lock{mutex_};
+  view_.max_iterations = std::clamp(max_iterations, 1u, fractal_max_iterations);
+}
+
+std::vector<software_source::frame> software_source::completed() {
+  std::uint64_t count;
+  [[maybe_unused]] const auto ret = ::read(event_fd_, &count, sizeof count);
+
+  std::vector<frame> frames;
+  {
+    std::lock_guard lock{mutex_};
+    frames.swap(completed_);
+  }
+  return frames;
+}
+
+void software_source::release(std::uint32_t index) {
+  {
+    std::lock_guard lock{mutex_};
+    free_.push_back(index);
+  }
+  cv_.notify_one();
+}
+
+software_source::state software_source::get_state() const {
+  std::lock_guard lock{mutex_};
+  return state_;
+}
+
+software_source::stats software_source::get_stats() const {
+  std::lock_guard lock{mutex_};
+  return stats_;
+}
+
+void software_source::run() {
+  auto next_start = std::chrono::steady_clock::now();
+  for (;;) {
+    std::uint32_t index;
+    view v;
+    {
+      std::unique_lock lock{mutex_};
+      cv_.wait(lock, [this] { return stopping_ || !free_.empty(); });
+      if (!stopping_) {
+        cv_.wait_until(lock, next_start, [this] { return stopping_; });
+      }
+      if (stopping_) {
+        break;
+      }
+      index = free_.back();
+      free_.pop_back();
+      v = view_;
+    }
+
+    // frames of part of the rows are rendered at full size, and sooner
+    const auto partial = v.rows < height_;
+    const auto scale = partial ? 1.0 : scale_;
+
+    const auto start = std::chrono::steady_clock::now();
+    next_start = std::max(next_start + governor_.target_frame_time() * v.rows / height_, start);
+
+    // Pixel i of a frame rendered k times smaller is shown where pixel (i + 1/2) k - 1/2 of a full
+    // size one would be, so it is computed there. A column and a row past the picture are
+    // rendered too, when there is room, for the upscaling filter to read.
+    const auto w = std::max(static_cast<std::uint32_t>(std::lround(width_ * scale)), 1u);
+    const auto h = std::max(static_cast<std::uint32_t>(std::lround(height_ * scale)), 1u);
+    const auto kx = static_cast<double>(width_) / w;
+    const auto ky = static_cast<double>(height_) / h;
+    job_.width = std::min(w + 1, width_);
+    job_.height = std::min({h + 1, height_, v.rows});
+    job_.params = make_fractal_params(
+        v.x0 - (kx - 1.0) / 2 * v.dx, v.y0 - (ky - 1.0) / 2 * v.dy, v.dx * kx, v.dy * ky, v.cr, v.ci);
+    // the governor's counts and colours have to be of the limit the frame is rendered with
+    governor_.set_ceiling(v.max_iterations);
+    job_.params.max_iterations = governor_.max_iterations();
+    {
+      const auto& palette = colorizer_palette(v.mode);
+      auto map = governor_.color_map();
+      if (!normalize_) {
+        for (std::size_t n = 0; n < map.size(); ++n) {
+          map[n] = static_cast<std::uint8_t>(n);
+        }
+      }
+      for (std::size_t n = 0; n < map.size(); ++n) {
+        const auto& [r, g, b] = palette[map[n]];
+        job_.colors[n] = 0xff000000u | std::uint32_t{r} << 16 | std::uint32_t{g} << 8 | b;
+      }
+    }
+
+    const auto& buf = buffers_[index];
+    job_.dst = buf.ptr;
+
+    ::dma_buf_sync sync{};
+    sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE;
+    ::ioctl(buf.fd, DMA_BUF_IOCTL_SYNC, &sync);
+
+    for (auto& h : histograms_) {
+      h.fill(0);
+    }
+    {
+      std::lock_guard lock{work_mutex_};
+      next_band_ = 0;
+      busy_workers_ = workers_.size();
+      ++generation_;
+    }
+    work_cv_.notify_all();
+
+    render_bands(histograms_[0]);
+    {
+      std::unique_lock lock{work_mutex_};
+      done_cv_.wait(lock, [this] { return busy_workers_ == 0; });
+    }
+
+    sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE;
+    ::ioctl(buf.fd, DMA_BUF_IOCTL_SYNC, &sync);
+
+    const auto render_time = std::chrono::steady_clock::now() - start;
+
+    auto& histogram = histograms_[0];
+    for (std::size_t i = 1; i < histograms_.size(); ++i) {
+      for (std::size_t n = 0; n < histogram.size(); ++n) {
+        histogram[n] += histograms_[i][n];
+      }
+    }
+    const auto smallest = std::max(width_ * min_scale_, 1.0) * std::max(height_ * min_scale_, 1.0);
+    governor_.update(histogram, render_time, std::min(smallest / (static_cast<double>(w) * h), 1.0));
+
+    // time scales with the number of pixels, i.e. with the square of the scale
+    if (!partial) {
+      const auto target = std::chrono::duration<double>{governor_.target_frame_time()};
+      const auto ratio = std::sqrt(target * frame_time_headroom / render_time);
+      scale_ = std::clamp(scale_ * std::clamp(ratio, scale_step_down, scale_step_up), min_scale_,
+                          1.0);
+    }
+
+    {
+      std::lock_guard lock{mutex_};
+      completed_.push_back({
+          index,
+          static_cast<std::uint32_t>(stats_.frames_rendered),
+          monotonic_now(),
+          v.x0,
+          v.y0,
+          v.dx,
+          v.dy,
+          v.cr,
+          v.ci,
+          w,
+          std::min(h, v.rows),
+          job_.params.max_iterations,
+          render_time,
+      });
+      state_ = {governor_.get_state(), static_cast<float>(scale_), w, h};
+      ++stats_.frames_rendered;
+      stats_.render_time += render_time;
+      stats_.iterations_limit_sum += job_.params.max_iterations;
+      stats_.pixels_sum += std::uint64_t{w} * std::min(h, v.rows);
+    }
+
+    const std::uint64_t one = 1;
+    [[maybe_unused]] const auto ret = ::write(event_fd_, &one, sizeof one);
+  }
+}
+
+void software_source::work(std::size_t worker) {
+  std::uint64_t seen = 0;
+  for (;;) {
+    {
+      std::unique_lock lock{work_mutex_};
+      work_cv_.wait(lock, [&] { return stopping_workers_ || generation_ != seen; });
+      if (stopping_workers_) {
+        break;
+      }
+      seen = generation_;
+    }
+
+    render_bands(histograms_[worker]);
+
+    {
+      std::lock_guard lock{work_mutex_};
+      if (--busy_workers_ == 0) {
+        done_cv_.notify_one();
+      }
+    }
+  }
+}
+
+void software_source::render_bands(fractal_histogram& histogram) {
+  thread_local std::vector<std::uint8_t> counts;
+  counts.resize(std::size_t{job_.width} * band_rows);
+
+  for (;;) {
+    const auto y = next_band_++ * band_rows;
+    if (y >= job_.height) {
+      break;
+    }
+    const auto rows = std::min(band_rows, job_.height - y);
+
+    render_iterations(job_.params, 0, y, job_.width, rows, counts.data(), job_.width, &histogram);
+
+    for (std::uint32_t j = 0; j < rows; ++j) {
+      const auto* src = counts.data() + std::size_t{j} * job_.width;
+      auto* dst = reinterpret_cast<std::uint32_t*>(job_.dst + std::size_t{y + j} * stride());
+      for (std::uint32_t i = 0; i < job_.width; ++i) {
+        dst[i] = job_.colors[src[i]];
+      }
+    }
+  }
+}
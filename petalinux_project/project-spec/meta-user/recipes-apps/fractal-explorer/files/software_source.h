@@ -0,0 +1,185 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "fractal.h"
+#include "fractal_engine.h"
+#include "iteration_governor.h"
+
+// Renders frames on the CPU in place of the generator.
+//
+// Frames are drawn into udmabuf-backed buffers, so they reach the display through the same dmabuf
+// import as captured ones. Like the generator, the source latches the view last passed to
+// set_view() when it starts a frame and keeps going while buffers are free, but it starts at most
+// one frame per target frame time. completed() returns the frames finished since the last call and
+// event_fd() becomes readable when there are some; their buffers are given back with release().
+//
+// Rows are shared out in bands between the threads. The iteration limit of each frame comes from
+// an iteration_governor fed with the frame's count histogram, which the engine gathers as it
+// renders; with `normalize` set the governor's histograms also spread the counts over the palette.
+//
+// Frames are rendered at a resolution chosen from how long the previous ones took, between
+// `min_scale` and 1 times the buffer size on each axis, so that they keep within the target frame
+// time. A smaller frame fills the top left of its buffer and covers the same view as a full size
+// one would; it is up to the display to scale it up. The iteration limit is only held down to
+// what fits the target at the smallest resolution, so resolution gives way first.
+//
+// To stand in for the generator when the CPU renders part of each frame, set_rows() makes the
+// source render only the top rows at full size, as the generator's height register does, and
+// start frames sooner in proportion.
+//
+// set_max_iterations() caps the governor's limits, as the generator's iteration limit register
+// does its own.
+class software_source {
+public:
+  struct buffer {
+    std::uint8_t* ptr;
+    std::uint32_t length;
+    int fd; // dmabuf
+  };
+
+  struct frame {
+    std::uint32_t index;
+    std::uint32_t sequence;
+    std::chrono::nanoseconds timestamp; // completion time, CLOCK_MONOTONIC
+    double x0, y0, dx, dy, cr, ci; // as if the frame were full size
+    std::uint32_t width;           // of the picture at the top left of the buffer
+    std::uint32_t height;
+    std::uint32_t max_iterations;
+    std::chrono::nanoseconds render_time;
+  };
+
+  // what the governors chose for the last frame
+  struct state {
+    iteration_governor::state iterations;
+    float scale; // of the next frame, per axis
+    std::uint32_t width;
+    std::uint32_t height;
+  };
+
+  struct stats {
+    std::uint64_t frames_rendered;
+    std::chrono::nanoseconds render_time;
+    std::uint64_t iterations_limit_sum; // of the limits of all frames
+    std::uint64_t pixels_sum;           // rendered in all frames
+  };
+
+  // `threads` is the number of rendering threads, 0 for one per core; the iteration limit stays
+  // within [min_iterations, max_iterations]; a `min_scale` of 1 keeps frames full size
+  software_source(std::uint32_t width, std::uint32_t height, std::size_t num_buffers,
+                  unsigned int threads, std::chrono::nanoseconds target_frame_time,
+                  std::uint32_t min_iterations, std::uint32_t max_iterations, bool normalize,
+                  double min_scale);
+  ~software_source();
+
+  software_source(const software_source&) = delete;
+  software_source& operator=(const software_source&) = delete;
+
+  std::uint32_t width() const {
+    return width_;
+  }
+
+  std::uint32_t height() const {
+    return height_;
+  }
+
+  // bytes per line of the buffers, which hold BGRX32 pixels
+  std::uint32_t stride() const {
+    return width_ * 4;
+  }
+
+  std::size_t num_buffers() const {
+    return buffers_.size();
+  }
+
+  const buffer& get_buffer(std::size_t index) const {
+    return buffers_.at(index);
+  }
+
+  int event_fd() const {
+    return event_fd_;
+  }
+
+  // the view and colour mode of the frames started from now on
+  void set_view(double x0, double y0, double dx, double dy, double cr, double ci, color_mode mode);
+
+  // rows of the frames started from now on, from the top; height() renders all of them
+  void set_rows(std::uint32_t rows);
+
+  // upper bound on the iteration limit of the frames started from now on
+  void set_max_iterations(std::uint32_t max_iterations);
+
+  // frames finished since the last call
+  std::vector<frame> completed();
+
+  // gives a buffer handed out by completed() back
+  void release(std::uint32_t index);
+
+  state get_state() const;
+
+  stats get_stats() const;
+
+private:
+  struct view {
+    double x0, y0, dx, dy, cr, ci;
+    color_mode mode;
+    std::uint32_t rows;
+    std::uint32_t max_iterations;
+  };
+
+  // what the threads share while rendering a frame
+  struct job {
+    fractal_params params;
+    std::array<std::uint32_t, 256> colors; // BGRX32 of each count
+    std::uint8_t* dst;
+    std::uint32_t width; // pixels rendered
+    std::uint32_t height;
+  };
+
+  void release_resources();
+  void run();
+  void work(std::size_t worker);
+  void render_bands(fractal_histogram& histogram);
+
+  std::uint32_t width_;
+  std::uint32_t height_;
+  bool normalize_;
+  double min_scale_;
+  double scale_; // used by the frame thread only
+
+  int udmabuf_fd_;
+  std::vector<buffer> buffers_;
+  int event_fd_;
+
+  iteration_governor governor_; // used by the frame thread only
+
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<std::uint32_t> free_;
+  std::vector<frame> completed_;
+  view view_;
+  state state_;
+  stats stats_;
+  bool stopping_;
+
+  // the frame being rendered; workers pick up each new generation
+  std::mutex work_mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  job job_;
+  std::uint64_t generation_;
+  std::size_t busy_workers_;
+  std::atomic<std::uint32_t> next_band_;
+  std::vector<fractal_histogram> histograms_; // one per thread
+  bool stopping_workers_;
+
+  std::vector<std::thread> workers_;
+  std::thread thread_;
+};
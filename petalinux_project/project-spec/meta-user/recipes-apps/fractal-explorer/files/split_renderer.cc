@@ -0,0 +1,255 @@
+#include "split_renderer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+extern "C" {
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/dma-buf.h>
+}
+
+using namespace std::string_literals;
+
+// rows a thread renders at a time; the counts of a band stay in cache until they are coloured
+static constexpr std::uint32_t band_rows = 8;
+
+// weight of the newest measurement in the smoothed costs per row
+static constexpr double cost_smoothing = 0.25;
+
+split_renderer::split_renderer(std::uint32_t width, std::uint32_t height, unsigned int threads,
+                               std::uint32_t min_rows)
+    : width_{width},
+      height_{height},
+      min_rows_{std::clamp(min_rows, 1u, height)},
+      event_fd_{-1},
+      // a guess until both sides have been measured
+      hardware_rows_{std::max(height - height / 4, min_rows_)},
+      hardware_row_ns_{0.0},
+      cpu_row_ns_{0.0},
+      stats_{},
+      stopping_{false},
+      job_{},
+      generation_{0},
+      busy_workers_{0},
+      next_band_{0},
+      stopping_workers_{false} {
+  if (threads == 0) {
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+
+  event_fd_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (event_fd_ < 0) {
+    throw std::runtime_error{"eventfd: "s + std::strerror(errno)};
+  }
+
+  // the frame thread renders too
+  for (unsigned int i = 1; i < threads; ++i) {
+    workers_.emplace_back(&split_renderer::work, this);
+  }
+  thread_ = std::thread{&split_renderer::run, this};
+}
+
+split_renderer::~split_renderer() {
+  {
+    std::lock_guard lock{mutex_};
+    stopping_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+
+  {
+    std::lock_guard lock{work_mutex_};
+    stopping_workers_ = true;
+  }
+  work_cv_.notify_all();
+  for (auto& w : workers_) {
+    w.join();
+  }
+
+  ::close(event_fd_);
+}
+
+std::uint32_t split_renderer::hardware_rows() const {
+  std::lock_guard lock{mutex_};
+  return hardware_rows_;
+}
+
+void split_renderer::hardware_frame(std::uint32_t rows, std::chrono::nanoseconds time) {
+  if (rows == 0) {
+    return;
+  }
+
+  std::lock_guard lock{mutex_};
+  const auto cost = static_cast<double>(time.count()) / rows;
+  hardware_row_ns_ =
+      hardware_row_ns_ == 0.0 ? cost : hardware_row_ns_ + (cost - hardware_row_ns_) * cost_smoothing;
+  rebalance();
+}
+
+void split_renderer::submit(const frame& f) {
+  {
+    std::lock_guard lock{mutex_};
+    pending_.push_back(f);
+  }
+  cv_.notify_one();
+}
+
+std::vector<split_renderer::result> split_renderer::completed() {
+  std::uint64_t count;
+  [[maybe_unused]] const auto ret = ::read(event_fd_, &count, sizeof count);
+
+  std::vector<result> results;
+  {
+    std::lock_guard lock{mutex_};
+    results.swap(completed_);
+  }
+  return results;
+}
+
+split_renderer::state split_renderer::get_state() const {
+  std::lock_guard lock{mutex_};
+  return {
+      hardware_rows_,
+      static_cast<float>(hardware_row_ns_ * hardware_rows_ / 1e6),
+      static_cast<float>(cpu_row_ns_ * (height_ - hardware_rows_) / 1e6),
+  };
+}
+
+split_renderer::stats split_renderer::get_stats() const {
+  std::lock_guard lock{mutex_};
+  return stats_;
+}
+
+// Both sides take the same time when the generator has h rows with h * hw = (height - h) * cpu.
+void split_renderer::rebalance() {
+  if (hardware_row_ns_ == 0.0 || cpu_row_ns_ == 0.0) {
+    return;
+  }
+
+  const auto rows = height_ * cpu_row_ns_ / (hardware_row_ns_ + cpu_row_ns_);
+  hardware_rows_ = std::clamp(static_cast<std::uint32_t>(std::lround(rows)), min_rows_, height_);
+}
+
+void split_renderer::run() {
+  for (;;) {
+    frame f{};
+    {
+      std::unique_lock lock{mutex_};
+      cv_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+      if (stopping_) {
+        break;
+      }
+      f = pending_.front();
+      pending_.pop_front();
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    const auto rows = height_ - std::min(f.first_row, height_);
+
+    job_.params = make_fractal_params(f.x0, f.y0, f.dx, f.dy, f.cr, f.ci);
+    job_.params.max_iterations = f.max_iterations;
+    {
+      const auto& palette = colorizer_palette(f.mode);
+      for (std::size_t n = 0; n < palette.size(); ++n) {
+        const auto& [r, g, b] = palette[n];
+        job_.colors[n] = 0xff000000u | std::uint32_t{r} << 16 | std::uint32_t{g} << 8 | b;
+      }
+    }
+    job_.dst = f.data;
+    job_.stride = f.stride;
+    job_.first_row = height_ - rows;
+
+    ::dma_buf_sync sync{};
+    sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE;
+    ::ioctl(f.dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync);
+
+    {
+      std::lock_guard lock{work_mutex_};
+      next_band_ = 0;
+      busy_workers_ = workers_.size();
+      ++generation_;
+    }
+    work_cv_.notify_all();
+
+    render_bands();
+    {
+      std::unique_lock lock{work_mutex_};
+      done_cv_.wait(lock, [this] { return busy_workers_ == 0; });
+    }
+
+    sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE;
+    ::ioctl(f.dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync);
+
+    const auto render_time = std::chrono::steady_clock::now() - start;
+
+    {
+      std::lock_guard lock{mutex_};
+      if (rows > 0) {
+        const auto cost = std::chrono::duration<double, std::nano>{render_time}.count() / rows;
+        cpu_row_ns_ = cpu_row_ns_ == 0.0 ? cost : cpu_row_ns_ + (cost - cpu_row_ns_) * cost_smoothing;
+        rebalance();
+      }
+
+      completed_.push_back({f.index, rows, render_time});
+      ++stats_.frames_rendered;
+      stats_.rows_rendered += rows;
+      stats_.render_time += render_time;
+    }
+
+    const std::uint64_t one = 1;
+    [[maybe_unused]] const auto ret = ::write(event_fd_, &one, sizeof one);
+  }
+}
+
+void split_renderer::work() {
+  std::uint64_t seen = 0;
+  for (;;) {
+    {
+      std::unique_lock lock{work_mutex_};
+      work_cv_.wait(lock, [&] { return stopping_workers_ || generation_ != seen; });
+      if (stopping_workers_) {
+        break;
+      }
+      seen = generation_;
+    }
+
+    render_bands();
+
+    {
+      std::lock_guard lock{work_mutex_};
+      if (--busy_workers_ == 0) {
+        done_cv_.notify_one();
+      }
+    }
+  }
+}
+
+void split_renderer::render_bands() {
+  thread_local std::vector<std::uint8_t> counts;
+  counts.resize(std::size_t{width_} * band_rows);
+
+  for (;;) {
+    const auto y = job_.first_row + next_band_++ * band_rows;
+    if (y >= height_) {
+      break;
+    }
+    const auto rows = std::min(band_rows, height_ - y);
+
+    render_iterations(job_.params, 0, y, width_, rows, counts.data(), width_);
+
+    for (std::uint32_t j = 0; j < rows; ++j) {
+      const auto* src = counts.data() + std::size_t{j} * width_;
+      auto* dst = reinterpret_cast<std::uint32_t*>(job_.dst + std::size_t{y + j} * job_.stride);
+      for (std::uint32_t i = 0; i < width_; ++i) {
+        dst[i] = job_.colors[src[i]];
+      }
+    }
+  }
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "fractal.h"
+#include "fractal_engine.h"
+
+// Renders the bottom of frames whose top the generator made, and decides where the split is.
+//
+// The generator's time per frame goes with the rows it makes, each pixel taking the passes its
+// iterations need, so it can be made to render only the top hardware_rows() rows. Once such a
+// frame has been captured, it is passed to submit() and the rows below are rendered into the same
+// buffer here, bit for bit as the generator would have, while the generator works on the next
+// frame.
+// Frames are finished in the order they were submitted; completed() returns them and event_fd()
+// becomes readable when there are some.
+//
+// After every frame the split moves to where both sides would take the same time, from their
+// smoothed costs per row: the generator's from the interval between its frames, given with
+// hardware_frame(), and the CPU's from its render times.
+class split_renderer {
+public:
+  struct frame {
+    std::uint32_t index;
+    std::uint8_t* data; // BGRX32, the whole frame
+    int dmabuf_fd;
+    std::uint32_t stride;
+    std::uint32_t first_row; // the generator made the rows above
+    double x0, y0, dx, dy, cr, ci;
+    std::uint32_t max_iterations; // the generator's iteration limit for the frame
+    color_mode mode;
+  };
+
+  struct result {
+    std::uint32_t index;
+    std::uint32_t rows; // rendered here
+    std::chrono::nanoseconds render_time;
+  };
+
+  struct state {
+    std::uint32_t hardware_rows; // of the frames started from now on
+    float hardware_time_ms;      // predicted for them, on each side
+    float cpu_time_ms;
+  };
+
+  struct stats {
+    std::uint64_t frames_rendered;
+    std::uint64_t rows_rendered;
+    std::chrono::nanoseconds render_time;
+  };
+
+  // `threads` is the number of rendering threads, 0 for one per core; the generator always makes
+  // at least `min_rows` rows
+  split_renderer(std::uint32_t width, std::uint32_t height, unsigned int threads,
+                 std::uint32_t min_rows);
+  ~split_renderer();
+
+  split_renderer(const split_renderer&) = delete;
+  split_renderer& operator=(const split_renderer&) = delete;
+
+  int event_fd() const {
+    return event_fd_;
+  }
+
+  // rows the generator should make of the frames it starts from now on
+  std::uint32_t hardware_rows() const;
+
+  // the generator took `time` for a frame of `rows` rows
+  void hardware_frame(std::uint32_t rows, std::chrono::nanoseconds time);
+
+  // renders the rows of `f` from first_row down; the buffer is leased until completed() returns it
+  void submit(const frame& f);
+
+  // frames finished since the last call
+  std::vector<result> completed();
+
+  state get_state() const;
+
+  stats get_stats() const;
+
+private:
+  // what the threads share while rendering a frame
+  struct job {
+    fractal_params params;
+    std::array<std::uint32_t, 256> colors; // BGRX32 of each count
+    std::uint8_t* dst;
+    std::uint32_t stride;
+    std::uint32_t first_row;
+  };
+
+  void rebalance();
+  void run();
+  void work();
+  void render_bands();
+
+  std::uint32_t width_;
+  std::uint32_t height_;
+  std::uint32_t min_rows_;
+  int event_fd_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<frame> pending_;
+  std::vector<result> completed_;
+  std::uint32_t hardware_rows_;
+  double hardware_row_ns_; // smoothed costs of a row, 0 until measured
+  double cpu_row_ns_;
+  stats stats_;
+  bool stopping_;
+
+  // the frame being rendered; workers pick up each new generation
+  std::mutex work_mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  job job_;
+  std::uint64_t generation_;
+  std::size_t busy_workers_;
+  std::atomic<std::uint32_t> next_band_;
+  bool stopping_workers_;
+
+  std::vector<std::thread> workers_;
+  std::thread thread_;
+};
@@ -0,0 +1,372 @@
+#include "tiled_tiff.h"
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+using namespace std::string_literals;
+
+static_assert(std::endian::native == std::endian::little, "TIFF fields are written as they are");
+
+namespace {
+
+constexpr char progress_magic[8] = {'F', 'R', 'A', 'C', 'P', 'R', 'G', '1'};
+
+struct progress_header {
+  char magic[8];
+  std::uint32_t width;
+  std::uint32_t height;
+  std::uint32_t tile_size;
+  std::uint32_t description_size;
+};
+
+// tiles written between two updates of the progress file
+constexpr std::size_t checkpoint_interval = 64;
+
+enum : std::uint16_t {
+  tiff_ascii = 2,
+  tiff_short = 3,
+  tiff_long = 4,
+  tiff_long8 = 16,
+};
+
+struct tiff_entry {
+  std::uint16_t tag;
+  std::uint16_t type;
+  std::uint64_t count;
+  std::vector<std::uint8_t> value;
+};
+
+template <typename T>
+void append(std::vector<std::uint8_t>& v, T value) {
+  const auto* p = reinterpret_cast<const std::uint8_t*>(&value);
+  v.insert(v.end(), p, p + sizeof value);
+}
+
+template <typename T>
+std::vector<std::uint8_t> values(std::initializer_list<T> list) {
+  std::vector<std::uint8_t> v;
+  for (const auto value : list) {
+    append(v, value);
+  }
+  return v;
+}
+
+bool pwrite_all(int fd, const void* data, std::size_t size, std::uint64_t offset) {
+  const auto* p = static_cast<const std::uint8_t*>(data);
+  while (size > 0) {
+    const auto n = ::pwrite(fd, p, size, static_cast<::off_t>(offset));
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    p += n;
+    size -= static_cast<std::size_t>(n);
+    offset += static_cast<std::uint64_t>(n);
+  }
+  return true;
+}
+
+bool pread_all(int fd, void* data, std::size_t size, std::uint64_t offset) {
+  auto* p = static_cast<std::uint8_t*>(data);
+  while (size > 0) {
+    const auto n = ::pread(fd, p, size, static_cast<::off_t>(offset));
+    if (n <= 0) {
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    p += n;
+    size -= static_cast<std::size_t>(n);
+    offset += static_cast<std::uint64_t>(n);
+  }
+  return true;
+}
+
+} // namespace
+
+tiled_tiff_writer::tiled_tiff_writer(const std::string& path, std::uint32_t width,
+                                     std::uint32_t height, std::uint32_t tile_size,
+                                     const std::string& description)
+    : path_{path},
+      progress_path_{path + ".progress"},
+      width_{width},
+      height_{height},
+      tile_size_{tile_size},
+      tiles_across_{0},
+      tile_bytes_{std::uint64_t{tile_size} * tile_size * 3},
+      data_offset_{0},
+      fd_{-1},
+      progress_fd_{-1},
+      progress_offset_{0},
+      tiles_done_{0} {
+  if (width == 0 || height == 0) {
+    throw std::runtime_error{"empty image"};
+  }
+  if (tile_size == 0 || tile_size % 16 != 0) {
+    throw std::runtime_error{"tile size must be a multiple of 16"};
+  }
+
+  tiles_across_ = (width + tile_size - 1) / tile_size;
+  const auto tiles_down = (height + tile_size - 1) / tile_size;
+  done_.assign(std::size_t{tiles_across_} * tiles_down, 0);
+
+  const auto header = make_header(description);
+  if (!resume(header, description)) {
+    create(header, description);
+  }
+  tiles_done_ = static_cast<std::size_t>(std::count(done_.begin(), done_.end(), 1));
+}
+
+tiled_tiff_writer::~tiled_tiff_writer() {
+  if (progress_fd_ >= 0) {
+    checkpoint();
+    ::close(progress_fd_);
+  }
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+std::vector<std::uint8_t> tiled_tiff_writer::make_header(const std::string& description) {
+  const auto tiles = done_.size();
+
+  // BigTIFF only once 32-bit offsets no longer reach every tile
+  const auto bound = 4096 + description.size() + tiles * 16 + tiles * tile_bytes_;
+  const bool big = bound > 0xffffffffu;
+  const std::size_t offset_size = big ? 8 : 4;
+
+  std::vector<std::uint8_t> ascii{description.begin(), description.end()};
+  ascii.push_back('\0');
+
+  std::vector<std::uint8_t> byte_counts;
+  for (std::size_t i = 0; i < tiles; ++i) {
+    append(byte_counts, static_cast<std::uint32_t>(tile_bytes_));
+  }
+
+  std::vector<tiff_entry> entries{
+      {256, tiff_long, 1, values<std::uint32_t>({width_})},
+      {257, tiff_long, 1, values<std::uint32_t>({height_})},
+      {258, tiff_short, 3, values<std::uint16_t>({8, 8, 8})}, // BitsPerSample
+      {259, tiff_short, 1, values<std::uint16_t>({1})},       // no compression
+      {262, tiff_short, 1, values<std::uint16_t>({2})},       // RGB
+      {270, tiff_ascii, ascii.size(), ascii},                 // ImageDescription
+      {277, tiff_short, 1, values<std::uint16_t>({3})},       // SamplesPerPixel
+      {284, tiff_short, 1, values<std::uint16_t>({1})},       // interleaved
+      {322, tiff_long, 1, values<std::uint32_t>({tile_size_})},
+      {323, tiff_long, 1, values<std::uint32_t>({tile_size_})},
+      {324, big ? tiff_long8 : tiff_long, tiles, std::vector<std::uint8_t>(tiles * offset_size)},
+      {325, tiff_long, tiles, byte_counts},
+  };
+
+  // values that do not fit in their entry follow the directory, on word boundaries
+  const std::size_t header_size = big ? 16 : 8;
+  auto pos = header_size + (big ? 8 : 2) + entries.size() * (big ? 20 : 12) + offset_size;
+  std::vector<std::uint64_t> value_offsets;
+  for (const auto& e : entries) {
+    value_offsets.push_back(pos);
+    if (e.value.size() > offset_size) {
+      pos += (e.value.size() + 1) & ~std::size_t{1};
+    }
+  }
+  data_offset_ = (pos + 4095) & ~std::uint64_t{4095};
+
+  auto& offsets = entries[10].value;
+  offsets.clear();
+  for (std::size_t i = 0; i < tiles; ++i) {
+    const auto offset = data_offset_ + i * tile_bytes_;
+    if (big) {
+      append(offsets, offset);
+    } else {
+      append(offsets, static_cast<std::uint32_t>(offset));
+    }
+  }
+
+  std::vector<std::uint8_t> header{'I', 'I'};
+  if (big) {
+    append(header, std::uint16_t{43});
+    append(header, std::uint16_t{8});
+    append(header, std::uint16_t{0});
+    append(header, std::uint64_t{header_size});
+    append(header, std::uint64_t{entries.size()});
+  } else {
+    append(header, std::uint16_t{42});
+    append(header, static_cast<std::uint32_t>(header_size));
+    append(header, static_cast<std::uint16_t>(entries.size()));
+  }
+
+  for (std::size_t i = 0; i < entries.size(); ++i) {
+    const auto& e = entries[i];
+    append(header, e.tag);
+    append(header, e.type);
+    if (big) {
+      append(header, e.count);
+    } else {
+      append(header, static_cast<std::uint32_t>(e.count));
+    }
+
+    if (e.value.size() > offset_size) {
+      if (big) {
+        append(header, value_offsets[i]);
+      } else {
+        append(header, static_cast<std::uint32_t>(value_offsets[i]));
+      }
+    } else {
+      auto field = e.value;
+      field.resize(offset_size);
+      header.insert(header.end(), field.begin(), field.end());
+    }
+  }
+  header.resize(header.size() + offset_size); // no next directory
+
+  for (const auto& e : entries) {
+    if (e.value.size() > offset_size) {
+      header.insert(header.end(), e.value.begin(), e.value.end());
+      header.resize((header.size() + 1) & ~std::size_t{1});
+    }
+  }
+
+  return header;
+}
+
+bool tiled_tiff_writer::resume(const std::vector<std::uint8_t>& header,
+                               const std::string& description) {
+  const auto progress_fd = ::open(progress_path_.c_str(), O_RDWR | O_CLOEXEC);
+  if (progress_fd < 0) {
+    return false;
+  }
+
+  const auto fail = [&](int fd) {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    ::close(progress_fd);
+    std::fill(done_.begin(), done_.end(), 0);
+    return false;
+  };
+
+  progress_header h;
+  std::string d(description.size(), '\0');
+  if (!pread_all(progress_fd, &h, sizeof h, 0) ||
+      std::memcmp(h.magic, progress_magic, sizeof h.magic) != 0 || h.width != width_ ||
+      h.height != height_ || h.tile_size != tile_size_ ||
+      h.description_size != description.size() ||
+      !pread_all(progress_fd, d.data(), d.size(), sizeof h) || d != description ||
+      !pread_all(progress_fd, done_.data(), done_.size(), sizeof h + d.size())) {
+    std::cerr << progress_path_ << " is for another image, starting over" << std::endl;
+    return fail(-1);
+  }
+
+  const auto fd = ::open(path_.c_str(), O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    return fail(-1);
+  }
+
+  struct ::stat st;
+  std::vector<std::uint8_t> existing(header.size());
+  if (::fstat(fd, &st) == -1 ||
+      static_cast<std::uint64_t>(st.st_size) != data_offset_ + done_.size() * tile_bytes_ ||
+      !pread_all(fd, existing.data(), existing.size(), 0) || existing != header) {
+    std::cerr << path_ << " does not match its progress file, starting over" << std::endl;
+    return fail(fd);
+  }
+
+  fd_ = fd;
+  progress_fd_ = progress_fd;
+  progress_offset_ = sizeof h + d.size();
+  return true;
+}
+
+void tiled_tiff_writer::create(const std::vector<std::uint8_t>& header,
+                               const std::string& description) {
+  try {
+    fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+      throw std::runtime_error{"failed to open "s + path_ + ": "s + std::strerror(errno)};
+    }
+    // the tiles stay holes until they are written
+    const auto size = data_offset_ + done_.size() * tile_bytes_;
+    if (!pwrite_all(fd_, header.data(), header.size(), 0) ||
+        ::ftruncate(fd_, static_cast<::off_t>(size)) == -1) {
+      throw std::runtime_error{path_ + ": "s + std::strerror(errno)};
+    }
+
+    progress_fd_ = ::open(progress_path_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (progress_fd_ < 0) {
+      throw std::runtime_error{"failed to open "s + progress_path_ + ": "s + std::strerror(errno)};
+    }
+    progress_header h{};
+    std::memcpy(h.magic, progress_magic, sizeof h.magic);
+    h.width = width_;
+    h.height = height_;
+    h.tile_size = tile_size_;
+    h.description_size = static_cast<std::uint32_t>(description.size());
+    progress_offset_ = sizeof h + description.size();
+    if (!pwrite_all(progress_fd_, &h, sizeof h, 0) ||
+        !pwrite_all(progress_fd_, description.data(), description.size(), sizeof h) ||
+        ::ftruncate(progress_fd_, static_cast<::off_t>(progress_offset_ + done_.size())) == -1) {
+      throw std::runtime_error{progress_path_ + ": "s + std::strerror(errno)};
+    }
+  } catch (...) {
+    if (progress_fd_ >= 0) {
+      ::close(progress_fd_);
+    }
+    if (fd_ >= 0) {
+      ::close(fd_);
+    }
+    throw;
+  }
+}
+
+void tiled_tiff_writer::write_tile(std::size_t tile, const std::uint8_t* rgb) {
+  if (!pwrite_all(fd_, rgb, tile_bytes_, data_offset_ + tile * tile_bytes_)) {
+    throw std::runtime_error{path_ + ": "s + std::strerror(errno)};
+  }
+
+  std::lock_guard lock{mutex_};
+  unrecorded_.push_back(tile);
+  if (unrecorded_.size() >= checkpoint_interval) {
+    checkpoint();
+  }
+}
+
+void tiled_tiff_writer::checkpoint() {
+  if (unrecorded_.empty()) {
+    return;
+  }
+
+  // a tile is only marked done once its pixels are on disk
+  if (::fdatasync(fd_) == -1) {
+    std::cerr << path_ << ": fdatasync: " << std::strerror(errno) << std::endl;
+    return;
+  }
+  const std::uint8_t one = 1;
+  for (const auto tile : unrecorded_) {
+    pwrite_all(progress_fd_, &one, 1, progress_offset_ + tile);
+  }
+  unrecorded_.clear();
+}
+
+void tiled_tiff_writer::finish() {
+  std::lock_guard lock{mutex_};
+  if (::fsync(fd_) == -1) {
+    throw std::runtime_error{path_ + ": fsync: "s + std::strerror(errno)};
+  }
+  unrecorded_.clear();
+  ::close(progress_fd_);
+  progress_fd_ = -1;
+  ::unlink(progress_path_.c_str());
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Writes an RGB TIFF of any size one tile at a time.
+//
+// The header and tile tables are laid out when the file is created, so every tile has a fixed
+// place in it and is written there with pwrite(); only the tile being rendered needs to be in
+// memory. Files past 4 GiB are written as BigTIFF. Finished tiles are recorded in a `.progress`
+// file next to the image, and opening an unfinished image again with the same size, tile size and
+// description picks up where it left off. write_tile() may be called from several threads.
+class tiled_tiff_writer {
+public:
+  tiled_tiff_writer(const std::string& path, std::uint32_t width, std::uint32_t height,
+                    std::uint32_t tile_size, const std::string& description);
+  ~tiled_tiff_writer();
+
+  tiled_tiff_writer(const tiled_tiff_writer&) = delete;
+  tiled_tiff_writer& operator=(const tiled_tiff_writer&) = delete;
+
+  std::uint32_t tile_size() const {
+    return tile_size_;
+  }
+
+  std::uint32_t tiles_across() const {
+    return tiles_across_;
+  }
+
+  std::size_t tile_count() const {
+    return done_.size();
+  }
+
+  // written by an earlier run
+  bool done(std::size_t tile) const {
+    return done_[tile] != 0;
+  }
+
+  std::size_t tiles_done() const {
+    return tiles_done_;
+  }
+
+  // `rgb` holds tile_size() x tile_size() pixels; tiles on the right and bottom edges are padded
+  void write_tile(std::size_t tile, const std::uint8_t* rgb);
+
+  // flushes the image and removes the progress file
+  void finish();
+
+private:
+  std::vector<std::uint8_t> make_header(const std::string& description);
+  void create(const std::vector<std::uint8_t>& header, const std::string& description);
+  bool resume(const std::vector<std::uint8_t>& header, const std::string& description);
+  void checkpoint();
+
+  std::string path_;
+  std::string progress_path_;
+  std::uint32_t width_;
+  std::uint32_t height_;
+  std::uint32_t tile_size_;
+  std::uint32_t tiles_across_;
+  std::uint64_t tile_bytes_;
+  std::uint64_t data_offset_;
+
+  int fd_;
+  int progress_fd_;
+  std::uint64_t progress_offset_; // of the first tile flag in the progress file
+  std::vector<std::uint8_t> done_;
+  std::size_t tiles_done_;
+
+  std::mutex mutex_;
+  std::vector<std::size_t> unrecorded_; // written, not yet in the progress file
+};
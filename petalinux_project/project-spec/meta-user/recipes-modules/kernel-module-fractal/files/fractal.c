@@ -9,6 +9,7 @@
 #include <linux/bitops.h>
 #include <linux/clk.h>
 #include <linux/device.h>
+#include <linux/kernel.h>
 #include <linux/module.h>
 #include <linux/of.h>
 #include <linux/platform_device.h>
@@ -25,13 +26,29 @@
 #define FRACTAL_REG_CTRL_IDLE		BIT(2)
 #define FRACTAL_REG_CTRL_READY		BIT(3)
 #define FRACTAL_REG_CTRL_AUTO_RESTART	BIT(7)
+#define FRACTAL_REG_MAX_ITER		0x04
+#define FRACTAL_REG_WIDTH		0x08
+#define FRACTAL_REG_HEIGHT		0x0c
 #define FRACTAL_REG_X0			0x10
+#define FRACTAL_REG_ROI_ORIGIN		0x14
 #define FRACTAL_REG_Y0			0x18
+#define FRACTAL_REG_ROI_SIZE		0x1c
 #define FRACTAL_REG_DX			0x20
+#define FRACTAL_REG_FRAME_REQUEST	0x24
 #define FRACTAL_REG_DY			0x28
 #define FRACTAL_REG_CR			0x30
 #define FRACTAL_REG_CI			0x38
 
+#define FRACTAL_MIN_WIDTH		64
+#define FRACTAL_MAX_WIDTH		1920
+#define FRACTAL_MIN_HEIGHT		64
+#define FRACTAL_MAX_HEIGHT		1080
+#define FRACTAL_DEFAULT_WIDTH		1920
+#define FRACTAL_DEFAULT_HEIGHT		1080
+
+/* 1.0 in the generator's 4.28 fixed point */
+#define FRACTAL_FIX_ONE			0x10000000u
+
 struct fractal_device {
 	struct device *dev;
 	void __iomem *iomem;
@@ -73,25 +90,40 @@ static inline struct fractal_device
 static int fractal_s_stream(struct v4l2_subdev *subdev, int enable)
 {
 	struct fractal_device *fractal = get_fractal_device(subdev);
+	u32 width = fractal->format.width;
+	u32 height = fractal->format.height;
+	u32 step = 2 * FRACTAL_FIX_ONE / width;
 
 	if (enable) {
-		fractal_write(fractal, FRACTAL_REG_X0, 0x10000000u);
-		fractal_write(fractal, FRACTAL_REG_Y0, 0x09000000u);
-		fractal_write(fractal, FRACTAL_REG_DX, 0x00044444u);
-		fractal_write(fractal, FRACTAL_REG_DY, 0x00044444u);
+		/* the size is latched at the start of each frame */
+		fractal_write(fractal, FRACTAL_REG_WIDTH, width);
+		fractal_write(fractal, FRACTAL_REG_HEIGHT, height);
+		fractal_write(fractal, FRACTAL_REG_MAX_ITER, 255);
+
+		/* [-1, 1] across, with square pixels */
+		fractal_write(fractal, FRACTAL_REG_X0, FRACTAL_FIX_ONE);
+		fractal_write(fractal, FRACTAL_REG_Y0, step * height / 2);
+		fractal_write(fractal, FRACTAL_REG_DX, step);
+		fractal_write(fractal, FRACTAL_REG_DY, step);
 		fractal_write(fractal, FRACTAL_REG_CR, 0xf9999999u);
 		fractal_write(fractal, FRACTAL_REG_CI, 0x09999999u);
 
 		fractal_clr(fractal, FRACTAL_REG_CTRL, 0xf00u);
 		fractal_set(fractal, FRACTAL_REG_CTRL, 0x700u);
 
-		fractal_set(fractal, FRACTAL_REG_CTRL,
-			    FRACTAL_REG_CTRL_AUTO_RESTART |
-			    FRACTAL_REG_CTRL_START);
+		/* the whole frame */
+		fractal_write(fractal, FRACTAL_REG_ROI_ORIGIN, 0);
+		fractal_write(fractal, FRACTAL_REG_ROI_SIZE, 0);
+
+		/*
+		 * AUTO_RESTART is left as it is, so that userspace can clear
+		 * it beforehand to have frames start only on request.
+		 */
+		fractal_set(fractal, FRACTAL_REG_CTRL, FRACTAL_REG_CTRL_START);
 	} else {
-		fractal_clr(fractal, FRACTAL_REG_CTRL,
-			    FRACTAL_REG_CTRL_AUTO_RESTART |
-			    FRACTAL_REG_CTRL_START);
+		fractal_clr(fractal, FRACTAL_REG_CTRL, FRACTAL_REG_CTRL_START);
+		fractal_set(fractal, FRACTAL_REG_CTRL,
+			    FRACTAL_REG_CTRL_AUTO_RESTART);
 	}
 
 	return 0;
@@ -127,10 +159,10 @@ static int fractal_enum_frame_size(struct v4l2_subdev *subdev,
 	if (fse->index || fse->code != format->code)
 		return -EINVAL;
 
-	fse->min_width = format->width;
-	fse->max_width = format->width;
-	fse->min_height = format->height;
-	fse->max_height = format->height;
+	fse->min_width = FRACTAL_MIN_WIDTH;
+	fse->max_width = FRACTAL_MAX_WIDTH;
+	fse->min_height = FRACTAL_MIN_HEIGHT;
+	fse->max_height = FRACTAL_MAX_HEIGHT;
 
 	return 0;
 }
@@ -139,20 +171,27 @@ static int fractal_set_format(struct v4l2_subdev *subdev,
 			      struct v4l2_subdev_state *sd_state,
 			      struct v4l2_subdev_format *fmt)
 {
-	/* Currently, Fractal IP cannot change pad formats */
+	/* Only the frame size can be changed, and it takes effect at the next stream start */
 	struct fractal_device *fractal = get_fractal_device(subdev);
+	struct v4l2_mbus_framefmt *format;
 
 	switch (fmt->which) {
 	case V4L2_SUBDEV_FORMAT_TRY:
-		fmt->format = *v4l2_subdev_get_try_format(subdev, sd_state, fmt->pad);
+		format = v4l2_subdev_get_try_format(subdev, sd_state, fmt->pad);
 		break;
 	case V4L2_SUBDEV_FORMAT_ACTIVE:
-		fmt->format = fractal->format;
+		format = &fractal->format;
 		break;
+	default:
+		return -EINVAL;
 	}
 
-	fmt->format.width = 1920;
-	fmt->format.height = 1080;
+	format->width = clamp_t(u32, fmt->format.width,
+				FRACTAL_MIN_WIDTH, FRACTAL_MAX_WIDTH);
+	format->height = clamp_t(u32, fmt->format.height,
+				 FRACTAL_MIN_HEIGHT, FRACTAL_MAX_HEIGHT);
+
+	fmt->format = *format;
 
 	return 0;
 }
@@ -244,6 +283,10 @@ static int fractal_probe(struct platform_device *dev)
 
 	clk_prepare_enable(fractal->clk);
 
+	/* frames follow each other unless userspace says otherwise */
+	fractal_write(fractal, FRACTAL_REG_CTRL,
+		      FRACTAL_REG_CTRL_AUTO_RESTART);
+
 	fractal->uio.name = "fractal";
 	fractal->uio.version = "1.0";
 	fractal->uio.mem[0].name = "fractal_ctl";
@@ -260,8 +303,8 @@ static int fractal_probe(struct platform_device *dev)
 	fractal->format.code = MEDIA_BUS_FMT_RBG888_1X24;
 	fractal->format.field = V4L2_FIELD_NONE;
 	fractal->format.colorspace = V4L2_COLORSPACE_SRGB;
-	fractal->format.width = 1920;
-	fractal->format.height = 1080;
+	fractal->format.width = FRACTAL_DEFAULT_WIDTH;
+	fractal->format.height = FRACTAL_DEFAULT_HEIGHT;
 
 	subdev = &fractal->subdev;
 	v4l2_subdev_init(subdev, &fractal_ops);
@@ -1,5 +1,6 @@
 module fractal #(
   parameter integer NUM_PARALLELS = 24,
+  // frame size while the width and height registers are 0; they are latched at each frame start
   parameter integer OUTPUT_WIDTH = 1920,
   parameter integer OUTPUT_HEIGHT = 1080,
 
@@ -70,6 +71,14 @@ fractal_axi #(
 
 wire  [7:0] generator_ctrl = registers[0+:8];
 wire  [3:0] colorizer_mode = registers[8+:4];
+wire  [7:0] max_iter = registers[('h04 * 8)+:8]; // 0 for 255
+wire [15:0] output_width = registers[('h08 * 8)+:16];
+wire [15:0] output_height = registers[('h0c * 8)+:16];
+wire [15:0] roi_x = registers[('h14 * 8)+:16];
+wire [15:0] roi_y = registers[('h16 * 8)+:16];
+wire [15:0] roi_width = registers[('h1c * 8)+:16];  // 0 for the whole frame
+wire [15:0] roi_height = registers[('h1e * 8)+:16];
+wire  [7:0] frame_request = registers[('h24 * 8)+:8];
 wire signed [31:0] generator_x0 = registers[('h10 * 8)+:32];
 wire signed [31:0] generator_y0 = registers[('h18 * 8)+:32];
 wire signed [31:0] generator_dx = registers[('h20 * 8)+:32];
@@ -78,31 +87,51 @@ wire signed [31:0] generator_cr = registers[('h30 * 8)+:32];
 wire signed [31:0] generator_ci = registers[('h38 * 8)+:32];
 
 wire generator_resetn = aresetn && generator_ctrl[0];
+// otherwise a frame starts each time frame_request is changed
+wire generator_auto_restart = generator_ctrl[7];
 
 wire [7:0] generator_data;
 wire       generator_frame_start;
 wire       generator_line_end;
 wire       generator_data_enable;
 
+// The generator can output a pixel every cycle, faster than the stream is taken, and the
+// colorizer cannot be held, so pixels are queued after it and the generator is held while the
+// queue is nearly full instead.
+wire output_fifo_prog_full;
+
 fractal_generator #(
   .NUM_PARALLELS(NUM_PARALLELS)
 ) generator(
   .clk(aclk),
   .resetn(generator_resetn),
-  .width_in(OUTPUT_WIDTH),
-  .height_in(OUTPUT_HEIGHT),
+  .auto_restart(generator_auto_restart),
+  .frame_request_in(frame_request),
+  .width_in(output_width == 0 ? OUTPUT_WIDTH : output_width),
+  .height_in(output_height == 0 ? OUTPUT_HEIGHT : output_height),
+  .roi_x_in(roi_x),
+  .roi_y_in(roi_y),
+  .roi_width_in(roi_width),
+  .roi_height_in(roi_height),
+  .max_iter_in(max_iter == 0 ? 8'd255 : max_iter),
   .cr_in(generator_cr),
   .ci_in(generator_ci),
   .dx_in(generator_dx),
   .dy_in(generator_dy),
   .x0_in(generator_x0),
   .y0_in(generator_y0),
+  .data_ready(~output_fifo_prog_full),
   .data(generator_data),
   .frame_start(generator_frame_start),
   .line_end(generator_line_end),
   .data_enable(generator_data_enable)
 );
 
+wire [23:0] colorizer_data;
+wire        colorizer_frame_start;
+wire        colorizer_line_end;
+wire        colorizer_data_enable;
+
 fractal_colorizer colorizer(
   .clk(aclk),
   .resetn(aresetn),
@@ -111,10 +140,66 @@ fractal_colorizer colorizer(
   .frame_start_in(generator_frame_start),
   .line_end_in(generator_line_end),
   .data_enable_in(generator_data_enable),
-  .data_out(m_axis_tdata),
-  .frame_start_out(m_axis_tuser),
-  .line_end_out(m_axis_tlast),
-  .data_enable_out(m_axis_tvalid)
+  .data_out(colorizer_data),
+  .frame_start_out(colorizer_frame_start),
+  .line_end_out(colorizer_line_end),
+  .data_enable_out(colorizer_data_enable)
+);
+
+xpm_fifo_axis #(
+  .CDC_SYNC_STAGES(2),
+  .CLOCKING_MODE("common_clock"),
+  .ECC_MODE("no_ecc"),
+  .FIFO_DEPTH(32),
+  .FIFO_MEMORY_TYPE("auto"),
+  .PACKET_FIFO("false"),
+  .PROG_EMPTY_THRESH(10),
+  .PROG_FULL_THRESH(24),      // leaves room for what the generator and colorizer hold
+  .RD_DATA_COUNT_WIDTH(1),
+  .RELATED_CLOCKS(0),
+  .SIM_ASSERT_CHK(0),
+  .TDATA_WIDTH(M_AXIS_TDATA_WIDTH),
+  .TDEST_WIDTH(1),
+  .TID_WIDTH(1),
+  .TUSER_WIDTH(1),
+  .USE_ADV_FEATURES("0002"),  // prog_full_axis
+  .WR_DATA_COUNT_WIDTH(1)
+) output_fifo(
+  .s_aclk(aclk),
+  .m_aclk(aclk),
+  .s_aresetn(aresetn),
+
+  .s_axis_tdata(colorizer_data),
+  .s_axis_tdest(1'b0),
+  .s_axis_tid(1'b0),
+  .s_axis_tkeep({(M_AXIS_TDATA_WIDTH / 8){1'b1}}),
+  .s_axis_tlast(colorizer_line_end),
+  .s_axis_tstrb({(M_AXIS_TDATA_WIDTH / 8){1'b1}}),
+  .s_axis_tuser(colorizer_frame_start),
+  .s_axis_tvalid(colorizer_data_enable),
+  .s_axis_tready(),
+
+  .m_axis_tdata(m_axis_tdata),
+  .m_axis_tdest(),
+  .m_axis_tid(),
+  .m_axis_tkeep(),
+  .m_axis_tlast(m_axis_tlast),
+  .m_axis_tstrb(),
+  .m_axis_tuser(m_axis_tuser),
+  .m_axis_tvalid(m_axis_tvalid),
+  .m_axis_tready(m_axis_tready),
+
+  .prog_full_axis(output_fifo_prog_full),
+
+  .almost_empty_axis(),
+  .almost_full_axis(),
+  .dbiterr_axis(),
+  .injectdbiterr_axis(1'b0),
+  .injectsbiterr_axis(1'b0),
+  .prog_empty_axis(),
+  .rd_data_count_axis(),
+  .sbiterr_axis(),
+  .wr_data_count_axis()
 );
 
 assign m_axis_tstrb = {(M_AXIS_TDATA_WIDTH / 8){1'b1}};
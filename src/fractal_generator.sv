@@ -1,100 +1,65 @@
 module fractal_generator #(
-  parameter integer NUM_PARALLELS = 24
+  parameter integer NUM_PARALLELS = 24,
+  // pixels that may be in flight past the oldest one not yet output; a power of 2
+  parameter integer REORDER_DEPTH = 4096
 ) (
   input         clk,
   input         resetn,
+  input         auto_restart, // start frames back to back instead of on request
+  input   [7:0] frame_request_in,
   input  [15:0] width_in,
   input  [15:0] height_in,
+  input  [15:0] roi_x_in,
+  input  [15:0] roi_y_in,
+  input  [15:0] roi_width_in,  // 0 for the whole frame
+  input  [15:0] roi_height_in,
+  input   [7:0] max_iter_in,   // 1 to MAX_ITER
   input  [31:0] cr_in,
   input  [31:0] ci_in,
   input  [31:0] dx_in,
   input  [31:0] dy_in,
   input  [31:0] x0_in,
   input  [31:0] y0_in,
+  input         data_ready,   // tready
   output  [7:0] data,         // tdata
   output        frame_start,  // tuser
   output        line_end,     // tlast
   output        data_enable   // tvalid
 );
 
+// The kernels form a ring of NUM_PARALLELS * NUM_STAGES slots, each holding one pixel, that turns
+// by a slot every cycle. Whenever the slot coming back to the first kernel is empty or holds a
+// finished pixel, the next pixel in raster order takes its place, so a pixel stays for the passes
+// its own iterations need instead of those of the deepest pixel there could be.
+//
+// Pixels therefore finish out of order. Each carries its sequence number, and finished ones are
+// written into a reorder buffer at it, from where they are output in order along with the frame
+// start and line end flags worked out when they were fed in. A pixel is only fed in while it would
+// fit in the buffer, so the ring stalls when the output does.
+//
+// A frame may cover only a region of the picture its size and view describe. Its pixels are then
+// output in lines of the frame's width regardless, one after another in raster order of the
+// region, and the last line is padded out, so that whatever takes the stream sees a frame of
+// fewer full lines. Frames follow each other while auto_restart is set; otherwise each starts
+// only once frame_request_in has changed from the value the previous one started with.
+
 localparam MAX_ITER = 255;
 localparam NUM_STAGES = 9;
-localparam NUM_LOOPS = (MAX_ITER + NUM_PARALLELS - 1) / NUM_PARALLELS;
-
-const bit [NUM_STAGES - 1:0] state0_begin = 'b1;
-const bit [NUM_STAGES - 1:0] state0_end = state0_begin << (NUM_STAGES - 1);
-bit       [NUM_STAGES - 1:0] state0 = state0_end;
-always_ff @(posedge clk) begin
-  if (~resetn)
-    state0 <= state0_end;
-  else begin
-    if (state0[NUM_STAGES - 1])
-      state0 <= state0_begin;
-    else
-      state0 <= state0 << 1;
-  end
-end
-
-const bit [NUM_PARALLELS - 1:0] state1_begin = 'b1;
-const bit [NUM_PARALLELS - 1:0] state1_end = state1_begin << (NUM_PARALLELS - 1);
-bit       [NUM_PARALLELS - 1:0] state1 = state1_end;
-always_ff @(posedge clk) begin
-  if (~resetn)
-    state1 <= state1_end;
-  else begin
-    if (state0[NUM_STAGES - 1]) begin
-      if (state1[NUM_PARALLELS - 1])
-        state1 <= state1_begin;
-      else
-        state1 <= state1 << 1;
-    end
-    else
-      state1 <= state1;
-  end
-end
 
-const bit [NUM_LOOPS - 1:0] state2_begin = 'b1;
-const bit [NUM_LOOPS - 1:0] state2_end = state2_begin << (NUM_LOOPS - 1);
-bit       [NUM_LOOPS - 1:0] state2 = state2_end;
-always_ff @(posedge clk) begin
-  if (~resetn)
-    state2 <= state2_end;
-  else begin
-    if (state1[NUM_PARALLELS - 1] && state0[NUM_STAGES - 1]) begin
-      if (state2[NUM_LOOPS - 1])
-        state2 <= state2_begin;
-      else
-        state2 <= state2 << 1;
-    end
-    else
-      state2 <= state2;
-  end
-end
-
-bit ready = 1'b0;
-assign data_enable = ready && state2[0];
-always_ff @(posedge clk) begin
-  if (~resetn)
-    ready <= 1'b0;
-  else begin
-    if (~ready &&
-        state2[0] &&
-        state1[NUM_PARALLELS - 1] &&
-        state0[NUM_STAGES - 1])
-      ready <= 1'b1;
-  end
-end
+localparam SEQ_WIDTH = $clog2(REORDER_DEPTH) + 1; // the top bit tells laps of the buffer apart
+localparam TAG_WIDTH = SEQ_WIDTH + 3;             // {valid, seq, frame_start, line_end}
 
+// The size, region and view are latched at the start of each frame.
 logic signed [15:0] width;
-logic signed [15:0] height;
-always_ff @(posedge clk) begin
-  // changing width or height needs to reset.
-  if (~resetn) begin
-    width <= width_in;
-    height <= height_in;
-  end
-end
 
+logic               auto_restart_next;
+logic         [7:0] frame_request_next;
+logic signed [15:0] width_next;
+logic        [15:0] roi_x_next;
+logic        [15:0] roi_y_next;
+logic        [15:0] roi_width_next;
+logic        [15:0] roi_height_next;
+logic         [7:0] max_iter_next;
 logic signed [31:0] cr_next;
 logic signed [31:0] ci_next;
 logic signed [31:0] dx_next;
@@ -103,102 +68,202 @@ logic signed [31:0] x0_next;
 logic signed [31:0] y0_next;
 
 always_ff @(posedge clk) begin
+  auto_restart_next <= auto_restart;
+  width_next <= width_in;
+  max_iter_next <= max_iter_in;
   cr_next <= cr_in;
   ci_next <= ci_in;
   dx_next <= dx_in;
   dy_next <= dy_in;
   x0_next <= x0_in;
   y0_next <= y0_in;
+
+  if (roi_width_in == 16'h0 || roi_height_in == 16'h0) begin
+    roi_x_next <= 16'h0;
+    roi_y_next <= 16'h0;
+    roi_width_next <= width_in;
+    roi_height_next <= height_in;
+  end
+  else begin
+    roi_x_next <= roi_x_in;
+    roi_y_next <= roi_y_in;
+    roi_width_next <= roi_width_in;
+    roi_height_next <= roi_height_in;
+  end
+end
+
+// The point of the region's top left corner takes two more cycles, one for the products so that
+// they can be pipelined in the DSPs. The request is delayed as much, so that a frame it starts
+// latches what was written before it.
+logic         [7:0] frame_request_delayed[1:0];
+logic signed [31:0] roi_dx_next;
+logic signed [31:0] roi_dy_next;
+logic signed [31:0] roi_z0_r_next;
+logic signed [31:0] roi_z0_i_next;
+logic        [15:0] roi_x_last_next;
+logic        [15:0] roi_y_last_next;
+
+always_ff @(posedge clk) begin
+  frame_request_delayed[0] <= frame_request_in;
+  frame_request_delayed[1] <= frame_request_delayed[0];
+  frame_request_next <= frame_request_delayed[1];
+
+  roi_dx_next <= roi_x_next * dx_next;
+  roi_dy_next <= roi_y_next * dy_next;
+  roi_z0_r_next <= roi_dx_next - x0_next;
+  roi_z0_i_next <= roi_dy_next - y0_next;
+  roi_x_last_next <= roi_x_next + roi_width_next - 16'h1;
+  roi_y_last_next <= roi_y_next + roi_height_next - 16'h1;
 end
 
-logic signed [15:0] x;
-logic signed [15:0] y;
+// sequence numbers of the next pixel to be fed in and of the next one to be output
+bit  [SEQ_WIDTH - 1:0] in_seq = 'b0;
+bit  [SEQ_WIDTH - 1:0] out_seq = 'b0;
+wire [SEQ_WIDTH - 1:0] in_flight = in_seq - out_seq;
+
+// After a reset the pixels still in the ring are let out, unseen, before new ones go in, so that
+// every sequence number is written before the buffer comes around to it again.
+bit  draining = 1'b0;
+wire discarding = draining || ~resetn;
+
+wire [TAG_WIDTH - 1:0] ring_tag[NUM_PARALLELS - 1:0];
+wire                   ring_valid = ring_tag[NUM_PARALLELS - 1][TAG_WIDTH - 1];
+wire [SEQ_WIDTH - 1:0] ring_seq = ring_tag[NUM_PARALLELS - 1][2+:SEQ_WIDTH];
+
+wire [7:0] iter[NUM_PARALLELS - 1:0];
+wire       finished[NUM_PARALLELS - 1:0];
+
+wire slot_free = !ring_valid || finished[NUM_PARALLELS - 1];
+wire retire = ring_valid && finished[NUM_PARALLELS - 1];
+
+// Between frames the input waits for the next one to start. The pixels of the region are fed in,
+// then as many empty ones, finished from the start, as fill the last line.
+typedef enum logic [1:0] {
+  IDLE,
+  PIXELS,
+  PADDING
+} input_state_t;
+
+input_state_t state;
+logic   [7:0] frame_request_seen;
+
+// the pixel to be fed in next, and its place in the lines that are output
+logic        [15:0] x;
+logic        [15:0] y;
 logic signed [31:0] z0_r;
 logic signed [31:0] z0_i;
+logic        [15:0] column;
+bit                 first;
 
+logic        [15:0] roi_x_current;
+logic        [15:0] roi_x_last;
+logic        [15:0] roi_y_last;
+logic signed [31:0] roi_z0_r;
+logic         [7:0] max_iter_current;
 logic signed [31:0] cr_current;
 logic signed [31:0] ci_current;
 logic signed [31:0] dx_current;
 logic signed [31:0] dy_current;
-logic signed [31:0] x0_current;
-logic signed [31:0] y0_current;
+
+wire start = state == IDLE && (auto_restart_next || frame_request_next != frame_request_seen);
+wire line_last = column == width - 1;
+
+wire inject = slot_free &&
+              !discarding &&
+              state != IDLE &&
+              !in_flight[SEQ_WIDTH - 1];
 
 always_ff @(posedge clk) begin
   if (~resetn) begin
-    x <= -16'h1;
-    y <= -16'h1;
-    z0_r <= 'h0;
-    z0_i <= 'h0;
-
-    cr_current <= cr_in;
-    ci_current <= ci_in;
-    dx_current <= dx_in;
-    dy_current <= dy_in;
-    x0_current <= x0_in;
-    y0_current <= y0_in;
+    state <= IDLE;
+    frame_request_seen <= frame_request_next;
   end
-  else begin
-    if ((state2[NUM_LOOPS - 1] &&
-         state1[NUM_PARALLELS - 1] &&
-         state0[NUM_STAGES - 1]) ||
-        (state2[0] &&
-         !(state1[NUM_PARALLELS - 1] &&
-           state0[NUM_STAGES - 1]))) begin
-      if (x == -16'h1 || x == width - 1) begin
-        if (y == -16'h1 || y == height - 1) begin
-          x <= 16'h00;
-          y <= 16'h00;
-          z0_r <= -x0_next;
-          z0_i <= -y0_next;
-
-          cr_current <= cr_next;
-          ci_current <= ci_next;
-          dx_current <= dx_next;
-          dy_current <= dy_next;
-          x0_current <= x0_next;
-          y0_current <= y0_next;
-        end
-        else begin
-          x <= 16'h00;
-          y <= y + 16'h01;
-          z0_r <= -x0_current;
-          z0_i <= z0_i + dy_current;
-        end
-      end
+  else if (start) begin
+    state <= PIXELS;
+    frame_request_seen <= frame_request_next;
+
+    x <= roi_x_next;
+    y <= roi_y_next;
+    z0_r <= roi_z0_r_next;
+    z0_i <= roi_z0_i_next;
+    column <= 16'h0;
+    first <= 1'b1;
+
+    width <= width_next;
+    roi_x_current <= roi_x_next;
+    roi_x_last <= roi_x_last_next;
+    roi_y_last <= roi_y_last_next;
+    roi_z0_r <= roi_z0_r_next;
+    max_iter_current <= max_iter_next;
+    cr_current <= cr_next;
+    ci_current <= ci_next;
+    dx_current <= dx_next;
+    dy_current <= dy_next;
+  end
+  else if (inject) begin
+    column <= line_last ? 16'h0 : column + 16'h1;
+    first <= 1'b0;
+
+    if (state == PADDING) begin
+      if (line_last)
+        state <= IDLE;
+    end
+    else if (x == roi_x_last) begin
+      if (y == roi_y_last)
+        state <= line_last ? IDLE : PADDING;
       else begin
-        x <= x + 16'h01;
-        z0_r <= z0_r + dx_current;
+        x <= roi_x_current;
+        y <= y + 16'h1;
+        z0_r <= roi_z0_r;
+        z0_i <= z0_i + dy_current;
       end
     end
+    else begin
+      x <= x + 16'h1;
+      z0_r <= z0_r + dx_current;
+    end
   end
 end
 
+always_ff @(posedge clk) begin
+  if (~resetn)
+    draining <= 1'b1;
+  else if (in_seq == out_seq)
+    draining <= 1'b0;
+
+  if (inject)
+    in_seq <= in_seq + 1'b1;
+end
+
 wire signed [31:0] zr[NUM_PARALLELS - 1:0];
 wire signed [31:0] zi[NUM_PARALLELS - 1:0];
 
 wire signed [31:0] cr[NUM_PARALLELS - 1:0];
 wire signed [31:0] ci[NUM_PARALLELS - 1:0];
 
-wire [7:0] iter[NUM_PARALLELS - 1:0];
-wire       finished[NUM_PARALLELS - 1:0];
+wire [7:0] max_iter[NUM_PARALLELS - 1:0];
 
 logic signed [31:0] zr_u_0;
 logic signed [31:0] zi_u_0;
 logic signed [31:0] cr_u_0;
 logic signed [31:0] ci_u_0;
 logic         [7:0] iter_u_0;
+logic         [7:0] max_iter_u_0;
 bit                 finished_u_0;
 bit                 inc_enabled_u_0;
+logic [TAG_WIDTH - 1:0] tag_u_0;
 
 always_comb begin
-  if (state2[0]) begin
+  if (inject) begin
     zr_u_0 = z0_r;
     zi_u_0 = z0_i;
     cr_u_0 = cr_current;
     ci_u_0 = ci_current;
     iter_u_0 = 'h0;
-    finished_u_0 = 'b0;
+    max_iter_u_0 = max_iter_current;
+    finished_u_0 = state == PADDING;
     inc_enabled_u_0 = 'b0;
+    tag_u_0 = {1'b1, in_seq, first, line_last};
   end
   else begin
     zr_u_0 = zr[NUM_PARALLELS - 1];
@@ -206,13 +271,17 @@ always_comb begin
     cr_u_0 = cr[NUM_PARALLELS - 1];
     ci_u_0 = ci[NUM_PARALLELS - 1];
     iter_u_0 = iter[NUM_PARALLELS - 1];
+    max_iter_u_0 = max_iter[NUM_PARALLELS - 1];
     finished_u_0 = finished[NUM_PARALLELS - 1];
     inc_enabled_u_0 = 'b1;
+    // a retired pixel leaves its slot empty
+    tag_u_0 = slot_free ? 'b0 : ring_tag[NUM_PARALLELS - 1];
   end
 end
 
 fractal_kernel #(
-  .PIPELINE_DEPTH(NUM_STAGES)
+  .PIPELINE_DEPTH(NUM_STAGES),
+  .TAG_WIDTH(TAG_WIDTH)
 ) u_0(
   .clk(clk),
   .inc_enabled(inc_enabled_u_0),
@@ -221,18 +290,23 @@ fractal_kernel #(
   .cr_in(cr_u_0),
   .ci_in(ci_u_0),
   .iter_in(iter_u_0),
+  .max_iter_in(max_iter_u_0),
   .finished_in(finished_u_0),
+  .tag_in(tag_u_0),
   .zr_out(zr[0]),
   .zi_out(zi[0]),
   .cr_out(cr[0]),
   .ci_out(ci[0]),
   .iter_out(iter[0]),
-  .finished_out(finished[0])
+  .max_iter_out(max_iter[0]),
+  .finished_out(finished[0]),
+  .tag_out(ring_tag[0])
 );
 
 for (genvar i = 1; i < NUM_PARALLELS; i++) begin
   fractal_kernel #(
-    .PIPELINE_DEPTH(NUM_STAGES)
+    .PIPELINE_DEPTH(NUM_STAGES),
+    .TAG_WIDTH(TAG_WIDTH)
   ) u_i(
     .clk(clk),
     .inc_enabled('b1),
@@ -241,41 +315,50 @@ for (genvar i = 1; i < NUM_PARALLELS; i++) begin
     .cr_in(cr[i - 1]),
     .ci_in(ci[i - 1]),
     .iter_in(iter[i - 1]),
+    .max_iter_in(max_iter[i - 1]),
     .finished_in(finished[i - 1]),
+    .tag_in(ring_tag[i - 1]),
     .zr_out(zr[i]),
     .zi_out(zi[i]),
     .cr_out(cr[i]),
     .ci_out(ci[i]),
     .iter_out(iter[i]),
-    .finished_out(finished[i])
+    .max_iter_out(max_iter[i]),
+    .finished_out(finished[i]),
+    .tag_out(ring_tag[i])
   );
 end
 
-assign data = iter[NUM_PARALLELS - 1];
+// Reorder buffer entries are {~lap, frame_start, line_end, data}. An entry holds pixel out_seq
+// once its lap bit differs from that of out_seq, so the zeros they start with are a lap behind.
+localparam ROB_ADDR_WIDTH = SEQ_WIDTH - 1;
+
+(* ram_style = "block" *) bit [10:0] rob[REORDER_DEPTH - 1:0];
+
+wire [ROB_ADDR_WIDTH - 1:0] rob_waddr = ring_seq[ROB_ADDR_WIDTH - 1:0];
 
-logic [15:0] out_x = 'b0;
-logic [15:0] out_y = 'b0;
 always_ff @(posedge clk) begin
-  if (~resetn) begin
-    out_x <= 'b0;
-    out_y <= 'b0;
-  end
-  else begin
-    if (data_enable) begin
-      if (out_x == width - 1) begin
-        out_x <= 'b0;
-        if (out_y == height - 1)
-          out_y <= 'b0;
-        else
-          out_y <= out_y + 1;
-      end
-      else
-        out_x <= out_x + 1;
-    end
-  end
+  if (retire)
+    rob[rob_waddr] <= {~ring_seq[ROB_ADDR_WIDTH],
+                       ring_tag[NUM_PARALLELS - 1][1:0],
+                       iter[NUM_PARALLELS - 1]};
+end
+
+bit  [10:0] rob_q = 'b0;
+bit         rob_q_stale = 1'b0; // read as it was written, so not to be trusted
+wire        rob_hit = !rob_q_stale && rob_q[10] != out_seq[ROB_ADDR_WIDTH];
+wire        pop = rob_hit && (data_ready || discarding);
+wire [SEQ_WIDTH - 1:0] out_seq_next = out_seq + pop;
+
+always_ff @(posedge clk) begin
+  rob_q <= rob[out_seq_next[ROB_ADDR_WIDTH - 1:0]];
+  rob_q_stale <= retire && rob_waddr == out_seq_next[ROB_ADDR_WIDTH - 1:0];
+  out_seq <= out_seq_next;
 end
 
-assign frame_start = data_enable && out_x == 'b0 && out_y == 'b0;
-assign line_end = data_enable && out_x == width - 1;
+assign data_enable = rob_hit && data_ready && !discarding;
+assign data = rob_q[7:0];
+assign frame_start = data_enable && rob_q[9];
+assign line_end = data_enable && rob_q[8];
 
 endmodule
@@ -1,6 +1,7 @@
 module fractal_kernel #(
   parameter integer PIPELINE_DEPTH = 9,
-  parameter integer INPUT_DATA_WIDTH = 32
+  parameter integer INPUT_DATA_WIDTH = 32,
+  parameter integer TAG_WIDTH = 1
 ) (
   input         clk,
 
@@ -11,21 +12,23 @@ module fractal_kernel #(
   input  signed [INPUT_DATA_WIDTH - 1:0] cr_in,
   input  signed [INPUT_DATA_WIDTH - 1:0] ci_in,
   input   [7:0] iter_in,
+  input   [7:0] max_iter_in,
   input         finished_in,
+  input   [TAG_WIDTH - 1:0] tag_in,
 
   output signed [INPUT_DATA_WIDTH - 1:0] zr_out,
   output signed [INPUT_DATA_WIDTH - 1:0] zi_out,
   output signed [INPUT_DATA_WIDTH - 1:0] cr_out,
   output signed [INPUT_DATA_WIDTH - 1:0] ci_out,
   output  [7:0] iter_out,
-  output        finished_out
+  output  [7:0] max_iter_out,
+  output        finished_out,
+  output  [TAG_WIDTH - 1:0] tag_out
 );
 
 localparam MUL_PIPELINE_DEPTH = PIPELINE_DEPTH - 2;
 localparam MUL_OUTPUT_DATA_WIDTH = INPUT_DATA_WIDTH * 2;
 
-localparam MAX_ITER = 255;
-
 logic signed [INPUT_DATA_WIDTH - 1:0] zr;  // Re(z)
 logic signed [INPUT_DATA_WIDTH - 1:0] zi;  // Im(z)
 
@@ -46,7 +49,9 @@ wire signed [INPUT_DATA_WIDTH - 1:0] zz_c_r = zz_r[28+:32] + cr[PIPELINE_DEPTH -
 wire signed [INPUT_DATA_WIDTH - 1:0] zz_c_i = zz_i[28+:32] + ci[PIPELINE_DEPTH - 1];
 
 logic [7:0] iter[PIPELINE_DEPTH - 1:0];
+logic [7:0] max_iter[PIPELINE_DEPTH - 1:0]; // each point carries its own iteration limit
 bit         finished[PIPELINE_DEPTH - 1:0];
+bit [TAG_WIDTH - 1:0] tag[PIPELINE_DEPTH - 1:0]; // passed through for the caller
 
 always_ff @(posedge clk) begin
   zr <= zr_in;
@@ -55,7 +60,9 @@ always_ff @(posedge clk) begin
   cr[0] <= cr_in;
   ci[0] <= ci_in;
 
+  max_iter[0] <= max_iter_in;
   finished[0] <= finished_in;
+  tag[0] <= tag_in;
   if (~inc_enabled || finished_in)
     iter[0] <= iter_in;
   else
@@ -80,7 +87,9 @@ always_ff @(posedge clk) begin
     ci[i] <= ci[i - 1];
 
     iter[i] <= iter[i - 1];
+    max_iter[i] <= max_iter[i - 1];
     finished[i] <= finished[i - 1];
+    tag[i] <= tag[i - 1];
   end
 end
 
@@ -97,9 +106,11 @@ assign cr_out = cr[PIPELINE_DEPTH - 1];
 assign ci_out = ci[PIPELINE_DEPTH - 1];
 
 assign iter_out = iter[PIPELINE_DEPTH - 1];
+assign max_iter_out = max_iter[PIPELINE_DEPTH - 1];
+assign tag_out = tag[PIPELINE_DEPTH - 1];
 
 assign finished_out = finished[PIPELINE_DEPTH - 1] ||
-                      iter[PIPELINE_DEPTH - 1] == MAX_ITER ||
+                      iter[PIPELINE_DEPTH - 1] == max_iter[PIPELINE_DEPTH - 1] ||
                       z_sq > {8'h4, 56'h0};
 
 endmodule
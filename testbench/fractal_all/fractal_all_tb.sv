@@ -5,11 +5,17 @@ import fractal_all_bd_axi_vip_0_0_pkg::*;
 
 module fractal_all_tb();
 
+// smaller than the 384x216 the block design is built for, set through the size registers
+localparam integer WIDTH = 192;
+localparam integer HEIGHT = 108;
+
 bit aclk = 0, aresetn = 0;
 
 bit tlast;
+bit tready = 1'b0;
 bit tvalid;
 bit tuser;
+bit frame_checked = 1'b0;
 
 logic [23:0] tdata;
 
@@ -19,12 +25,49 @@ fractal_all_bd_wrapper u0(
   .aresetn(aresetn),
   .m_axis_tdata(tdata),
   .m_axis_tlast(tlast),
+  .m_axis_tready(tready),
   .m_axis_tuser(tuser),
   .m_axis_tvalid(tvalid)
 );
 
 always #2500ps aclk = ~aclk;
 
+// The stream is taken with gaps, and now and then held off long enough for the queue after the
+// colorizer to fill and hold the generator through prog_full.
+integer stall = 0;
+always @(posedge aclk) begin
+  if (stall > 0) begin
+    stall = stall - 1;
+    tready <= 1'b0;
+  end
+  else if ($urandom_range(1999) == 0) begin
+    stall = $urandom_range(4000, 200);
+    tready <= 1'b0;
+  end
+  else
+    tready <= $urandom_range(9) < 6;
+end
+
+// The frame is checked against the iteration counts of fractal-render, made where the simulation
+// runs with
+//   fractal-render generator --size 192x108 \
+//     --registers 10000000,09000000,002aaaaa,002aaaaa,f9999999,09999999 --output expected.pgm
+// which the colorizer passes through as they are in gray.
+logic [7:0] expected[WIDTH * HEIGHT];
+
+initial begin
+  integer fd;
+  string line;
+
+  fd = $fopen("expected.pgm", "rb");
+  if (fd == 0)
+    $fatal(1, "expected.pgm is missing, see the top of the testbench");
+  repeat (3)
+    void'($fgets(line, fd)); // P5, the size and the maximum value
+  void'($fread(expected, fd));
+  $fclose(fd);
+end
+
 xil_axi_resp_t  resp;
 fractal_all_bd_axi_vip_0_0_mst_t agent;
 
@@ -36,23 +79,22 @@ initial begin
 
   #200ns;
 
+  agent.AXI4LITE_WRITE_BURST(32'h08, 0, WIDTH, resp);        // width
+  agent.AXI4LITE_WRITE_BURST(32'h0c, 0, HEIGHT, resp);       // height
   agent.AXI4LITE_WRITE_BURST(32'h10, 0, 32'h10000000, resp); // x0
   agent.AXI4LITE_WRITE_BURST(32'h18, 0, 32'h09000000, resp); // y0
-  agent.AXI4LITE_WRITE_BURST(32'h20, 0, 32'h00155555, resp); // dx
-  agent.AXI4LITE_WRITE_BURST(32'h28, 0, 32'h00155555, resp); // dy
+  agent.AXI4LITE_WRITE_BURST(32'h20, 0, 32'h002aaaaa, resp); // dx
+  agent.AXI4LITE_WRITE_BURST(32'h28, 0, 32'h002aaaaa, resp); // dy
   agent.AXI4LITE_WRITE_BURST(32'h30, 0, 32'hf9999999, resp); // cr
   agent.AXI4LITE_WRITE_BURST(32'h38, 0, 32'h09999999, resp); // ci
 
-  agent.AXI4LITE_WRITE_BURST(32'h00, 0, 32'h00000700, resp); // ctrl
+  agent.AXI4LITE_WRITE_BURST(32'h00, 0, 32'h00000000, resp); // ctrl, gray
 
   #200ns;
 
-  agent.AXI4LITE_WRITE_BURST(32'h00, 0, 32'h00000701, resp); // ctrl
+  agent.AXI4LITE_WRITE_BURST(32'h00, 0, 32'h00000081, resp); // ctrl, frames back to back
 
-  wait (tuser == 1'b1);
-  #100ns;
-
-  wait (tuser == 1'b1);
+  wait (frame_checked == 1'b1);
   #20ns aresetn = 0;
 
   #100ns $finish();
@@ -60,28 +102,43 @@ end
 
 integer file;
 integer img_writing = 1, img_start = 0;
+integer pixels = 0, mismatches = 0, tlast_errors = 0;
 initial begin
   file = $fopen("out.ppm", "w");
   $fwrite(file, "P6\n");
-  $fwrite(file, "%0d %0d\n", 384, 216);
+  $fwrite(file, "%0d %0d\n", WIDTH, HEIGHT);
   $fwrite(file, "%0d\n", 2**8-1);
 
   while (img_writing == 1) begin
     @(posedge aclk)
     #1ns;
+    if (tvalid == 1'b0 || tready == 1'b0)
+      continue;
+
     if (img_start == 1 && tuser == 1'b1)
       img_writing = 0;
     else begin
       if (tuser == 1'b1)
         img_start = 1;
 
-      if (img_start == 1 && tvalid == 1'b1)
+      if (img_start == 1) begin
         $fwrite(file, "%c%c%c", tdata[16+:8], tdata[0+:8], tdata[8+:8]);
+        if (pixels >= WIDTH * HEIGHT || tdata != {3{expected[pixels]}})
+          mismatches = mismatches + 1;
+        if (tlast != (pixels % WIDTH == WIDTH - 1))
+          tlast_errors = tlast_errors + 1;
+        pixels = pixels + 1;
+      end
     end
   end
 
   $fclose(file);
   $display("Image written");
+  $display("Frame: %0d pixels, %0d differing from fractal-render, %0d line ends out of place",
+           pixels, mismatches, tlast_errors);
+  if (pixels != WIDTH * HEIGHT || mismatches != 0 || tlast_errors != 0)
+    $error("The stream is not what fractal-render gives");
+  frame_checked = 1'b1;
 end
 
 endmodule
@@ -0,0 +1,335 @@
+#!/usr/bin/env python3
+"""Cycle model of fractal_generator, checked against fractal-render.
+
+Runs the ring of kernels, the reorder buffer with its lap bit, the drain after a reset and the
+input state machine with its regions and frame requests one clock at a time, as
+fractal_generator.sv does, with the kernels' fixed point arithmetic taken from fractal_kernel.sv.
+The output is taken with random back-pressure, in short gaps and in stalls long enough to fill
+the reorder buffer, as prog_full of the output queue gives it, and the generator is reset at
+random points. Every frame that comes out is compared with the iteration counts
+`fractal-render generator` renders for it.
+
+A frame cut short by a reset may end early; anything else out of place is an error. Exits with
+1 if there was one.
+
+    fractal_generator_model.py --render build/fractal-render
+"""
+
+import argparse
+import os
+import random
+import subprocess
+import sys
+import tempfile
+
+STAGES = 9  # NUM_STAGES, cycles a pixel spends in each kernel
+
+MASK_32 = (1 << 32) - 1
+MASK_64 = (1 << 64) - 1
+ESCAPE = 4 << 56  # {8'h4, 56'h0}, compared unsigned
+
+# the testbench's view
+REGISTERS = dict(x0=0x10000000, y0=0x09000000, dx=0x00155555, dy=0x00155555,
+                 cr=0xf9999999, ci=0x09999999)
+WIDTH = 384
+HEIGHT = 216
+
+MAX_ITERS = (255, 64, 7, 1)  # the iteration limits frames are run with
+
+
+def signed_32(v):
+    v &= MASK_32
+    return v - (1 << 32) if v >> 31 else v
+
+
+def kernel(p, inc_enabled):
+    """A pixel [zr, zi, cr, ci, iter, max_iter, finished] through one fractal_kernel."""
+    zr, zi, cr, ci, n, max_iter, finished = p
+    if inc_enabled and not finished:
+        n = (n + 1) & 0xff
+    zr2 = zr * zr
+    zi2 = zi * zi
+    zri = zr * zi
+    z_sq = (zr2 + zi2) & MASK_64
+    zz_r = (zr2 - zi2) & MASK_64
+    zz_i = (zri + zri) & MASK_64
+    finished = finished or n == max_iter or z_sq > ESCAPE
+    return [signed_32((zz_r >> 28) + cr), signed_32((zz_i >> 28) + ci), cr, ci, n, max_iter,
+            finished]
+
+
+def lap(p, injected, parallels):
+    """Once around the ring, from the input of the first kernel to the output of the last."""
+    for i in range(parallels):
+        if p[6]:
+            break  # a finished pixel is carried as it is
+        p = kernel(p, i > 0 or not injected)
+    return p
+
+
+class frame_job:
+    """The registers a frame starts with, and the pixels it should come out as. A requested
+    frame is started by a change of frame_request instead of auto_restart."""
+
+    def __init__(self, expected, max_iter=255, roi=None, requested=False):
+        self.max_iter = max_iter
+        self.requested = requested
+        self.roi = roi or (0, 0, WIDTH, HEIGHT)
+        x, y, w, h = self.roi
+        self.pixels = [expected[(y + i // w) * WIDTH + x + i % w] for i in range(w * h)]
+        self.pixels += [0] * (-len(self.pixels) % WIDTH)  # the last line padded out
+
+
+class generator:
+    def __init__(self, parallels, reorder_depth):
+        self.parallels = parallels
+        self.slots = [None] * (parallels * STAGES)  # (pixel, tag), or None for an empty slot
+        self.seq_width = reorder_depth.bit_length()  # $clog2(REORDER_DEPTH) + 1
+        self.seq_mask = (1 << self.seq_width) - 1
+        self.depth = reorder_depth
+        self.rob = [(0, False, False, 0, None)] * reorder_depth  # lap, fs, le, data, frame
+        self.rob_q = self.rob[0]
+        self.rob_q_stale = False
+        self.in_seq = 0
+        self.out_seq = 0
+        self.draining = False
+        self.state = 'IDLE'
+        self.frame_request_delayed = [0, 0, 0]  # frame_request_next last
+        self.frame_request_seen = 0
+        self.frames_started = 0
+        self.t = 0
+
+    def step(self, resetn, ready, auto_restart, frame_request, job):
+        """One clock. Returns whether a frame started and, when a pixel is output,
+        (data, frame_start, line_end, number of the frame it belongs to)."""
+        top = self.seq_width - 1
+        discarding = self.draining or not resetn
+
+        k = self.t % len(self.slots)
+        slot = self.slots[k]
+        slot_free = slot is None or slot[0][6]
+        retire = slot is not None and slot[0][6]
+        in_flight = (self.in_seq - self.out_seq) & self.seq_mask
+        frame_request_next = self.frame_request_delayed[-1]
+        start = self.state == 'IDLE' and (auto_restart or
+                                          frame_request_next != self.frame_request_seen)
+        inject = slot_free and not discarding and self.state != 'IDLE' and not in_flight >> top
+
+        if inject:
+            f = self.frame
+            line_last = self.column == WIDTH - 1
+            pixel = [self.z0_r, self.z0_i, f['cr'], f['ci'], 0, f['max_iter'],
+                     self.state == 'PADDING']
+            tag = (self.in_seq, self.first, line_last, f['number'])
+            self.slots[k] = (lap(pixel, True, self.parallels), tag)
+        elif slot_free:
+            self.slots[k] = None
+        else:
+            self.slots[k] = (lap(slot[0], False, self.parallels), slot[1])
+
+        # the reorder buffer, read a cycle ahead of the output
+        lap_bit = self.out_seq >> top
+        rob_hit = not self.rob_q_stale and self.rob_q[0] != lap_bit
+        pop = rob_hit and (ready or discarding)
+        out = None
+        if rob_hit and ready and not discarding:
+            out = self.rob_q[3], self.rob_q[1], self.rob_q[2], self.rob_q[4]
+        out_seq_next = (self.out_seq + pop) & self.seq_mask
+        addr_next = out_seq_next % self.depth
+        rob_q_next = self.rob[addr_next]
+        if retire:
+            seq, first, line_end, number = slot[1]
+            self.rob[seq % self.depth] = (1 - (seq >> top), first, line_end, slot[0][4], number)
+        self.rob_q_stale = retire and slot[1][0] % self.depth == addr_next
+
+        # the input side
+        if not resetn:
+            self.state = 'IDLE'
+            self.frame_request_seen = frame_request_next
+        elif start:
+            self.state = 'PIXELS'
+            self.frame_request_seen = frame_request_next
+            x, y, w, h = job.roi
+            self.frame = dict(REGISTERS, max_iter=job.max_iter, roi=job.roi,
+                              number=self.frames_started)
+            self.frames_started += 1
+            self.x, self.y = x, y
+            self.z0_r = signed_32(x * REGISTERS['dx'] - REGISTERS['x0'])
+            self.z0_i = signed_32(y * REGISTERS['dy'] - REGISTERS['y0'])
+            self.roi_z0_r = self.z0_r
+            self.column = 0
+            self.first = True
+            self.frame['cr'] = signed_32(REGISTERS['cr'])
+            self.frame['ci'] = signed_32(REGISTERS['ci'])
+        elif inject:
+            line_last = self.column == WIDTH - 1
+            self.column = 0 if line_last else self.column + 1
+            self.first = False
+            x0, y0, w, h = self.frame['roi']
+            if self.state == 'PADDING':
+                if line_last:
+                    self.state = 'IDLE'
+            elif self.x == x0 + w - 1:
+                if self.y == y0 + h - 1:
+                    self.state = 'IDLE' if line_last else 'PADDING'
+                else:
+                    self.x = x0
+                    self.y += 1
+                    self.z0_r = self.roi_z0_r
+                    self.z0_i = signed_32(self.z0_i + REGISTERS['dy'])
+            else:
+                self.x += 1
+                self.z0_r = signed_32(self.z0_r + REGISTERS['dx'])
+
+        if not resetn:
+            self.draining = True
+        elif self.in_seq == self.out_seq:
+            self.draining = False
+        if inject:
+            self.in_seq = (self.in_seq + 1) & self.seq_mask
+
+        self.frame_request_delayed = [frame_request] + self.frame_request_delayed[:-1]
+        self.rob_q = rob_q_next
+        self.out_seq = out_seq_next
+        self.t += 1
+        return start and resetn, out
+
+
+class back_pressure:
+    """tready as the output queue gives it: mostly taken, with gaps and now and then a stall."""
+
+    def __init__(self, rng):
+        self.rng = rng
+        self.stall = 0
+
+    def ready(self):
+        if self.stall > 0:
+            self.stall -= 1
+            return False
+        if self.rng.random() < 0.0002:
+            self.stall = self.rng.randrange(1000, 8000)
+            return False
+        return self.rng.random() < 0.7
+
+
+def render(path, max_iter):
+    """Iteration counts of the testbench's view from fractal-render."""
+    with tempfile.TemporaryDirectory() as d:
+        pgm = os.path.join(d, 'expected.pgm')
+        registers = ','.join('%08x' % REGISTERS[r] for r in ('x0', 'y0', 'dx', 'dy', 'cr', 'ci'))
+        subprocess.run([path, 'generator', '--size', '%dx%d' % (WIDTH, HEIGHT),
+                        '--registers', registers, '--max-iter', str(max_iter), '--output', pgm],
+                       check=True, stdout=subprocess.DEVNULL)
+        with open(pgm, 'rb') as f:
+            data = f.read()
+    return data[-WIDTH * HEIGHT:]
+
+
+def frame_jobs(expected):
+    """The frames run, in order, each started as soon as the one before has been: whole ones back
+    to back, with iteration limits changing from one to the next so that pixels of both are in the
+    ring at once, then regions on request, inside the picture and at its edges, and a whole frame
+    again."""
+    full = frame_job(expected[255])
+    regions = [(100, 40, 50, 30), (330, 200, 54, 16), (0, 215, WIDTH, 1), (WIDTH - 1, 0, 1, HEIGHT)]
+    return ([full] + [frame_job(expected[n], max_iter=n) for n in MAX_ITERS if n != 255] +
+            [full] * 2 +
+            [frame_job(expected[255], roi=r, requested=True) for r in regions] +
+            [frame_job(expected[255], requested=True)])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('--render', required=True, help='the fractal-render executable')
+    parser.add_argument('--parallels', type=int, default=24, help='kernels in the ring')
+    parser.add_argument('--reorder-depth', type=int, default=4096)
+    parser.add_argument('--resets', type=int, default=2, help='resets at random points')
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+    expected = {n: render(args.render, n) for n in MAX_ITERS}
+    jobs = frame_jobs(expected)
+    total = sum(len(j.pixels) for j in jobs)
+
+    g = generator(args.parallels, args.reorder_depth)
+    pressure = back_pressure(rng)
+    # reset somewhere in the frames, held for a few cycles
+    reset_at = sorted(rng.randrange(total // 2, total * 2) for _ in range(args.resets))
+    reset_cycles = 0
+
+    next_job = 0
+    frame_request = 0
+    requested = None  # the job last requested
+    started = []  # the job of each frame started
+    frames = []  # [job, number, pixels out, cut short] of each frame output
+    errors = 0
+    last_out = 0
+    # until every frame has started and the last of its pixels is out
+    while next_job < len(jobs) or g.state != 'IDLE' or g.in_seq != g.out_seq:
+        if g.t - last_out > 1000000:
+            print('cycle %d: nothing output for %d cycles' % (g.t, g.t - last_out))
+            errors += 1
+            break
+        if reset_at and g.t >= reset_at[0]:
+            reset_at.pop(0)
+            reset_cycles = rng.randrange(1, 20)
+            requested = None  # a request not yet taken is lost, and made again
+            if frames:
+                frames[-1][3] = True
+        resetn = reset_cycles == 0
+        reset_cycles = max(reset_cycles - 1, 0)
+
+        # the registers of the next frame are written once the one before has started, and
+        # a request made for it if it needs one
+        job = jobs[min(next_job, len(jobs) - 1)]
+        auto_restart = next_job < len(jobs) and not job.requested
+        if next_job < len(jobs) and job.requested and requested != next_job and resetn:
+            frame_request += 1
+            requested = next_job
+        started_now, out = g.step(resetn, pressure.ready(), auto_restart, frame_request & 0xff,
+                                  job)
+        if started_now:
+            if next_job == len(jobs):
+                print('cycle %d: frame started without a request' % g.t)
+                errors += 1
+                break
+            next_job += 1
+            started.append(job)
+
+        if out is None:
+            continue
+        last_out = g.t
+        data, frame_start, line_end, number = out
+        if frame_start:
+            frames.append([started[number], number, 0, False])
+        elif not frames:
+            print('cycle %d: pixel before the first frame start' % g.t)
+            errors += 1
+            continue
+        f = frames[-1]
+        i = f[2]
+        if number != f[1] or i >= len(f[0].pixels):
+            print('cycle %d: pixel %d out of frame %d' % (g.t, i, len(frames)))
+            errors += 1
+        elif data != f[0].pixels[i] or line_end != (i % WIDTH == WIDTH - 1):
+            if errors < 8:
+                print('cycle %d: frame %d pixel %d is %d%s, expected %d' %
+                      (g.t, len(frames), i, data, ' with line end' if line_end else '',
+                       f[0].pixels[i]))
+            errors += 1
+        f[2] += 1
+
+    for n, (job, number, count, cut) in enumerate(frames, 1):
+        if count != len(job.pixels) and not cut:
+            print('frame %d: %d of %d pixels' % (n, count, len(job.pixels)))
+            errors += 1
+
+    complete = sum(1 for job, number, count, cut in frames if count == len(job.pixels))
+    print('%d cycles, %d frames started, %d output, %d of them complete, %d errors' %
+          (g.t, len(started), len(frames), complete, errors))
+    return 1 if errors else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
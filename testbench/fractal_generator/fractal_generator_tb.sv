@@ -8,9 +8,23 @@ bit resetn = 0;
 bit frame_start;
 bit line_end;
 bit data_enable;
+bit data_ready = 1'b0;
+bit auto_restart = 1'b1;
 
+logic  [7:0] frame_request = 0;
 logic [15:0] width = 384;
 logic [15:0] height = 216;
+logic [15:0] roi_x = 0;
+logic [15:0] roi_y = 0;
+logic [15:0] roi_width = 0;
+logic [15:0] roi_height = 0;
+logic  [7:0] max_iter = 255;
+
+// the region of the third frame, checked against the whole picture
+localparam integer ROI_X = 100;
+localparam integer ROI_Y = 40;
+localparam integer ROI_WIDTH = 50;
+localparam integer ROI_HEIGHT = 30;
 
 logic signed [31:0] cr = 32'hf9999999; // 0.4
 logic signed [31:0] ci = 32'h09999999; // -0.6
@@ -24,14 +38,22 @@ logic [7:0] data;
 fractal_generator u_0(
   .clk(clk),
   .resetn(resetn),
+  .auto_restart(auto_restart),
+  .frame_request_in(frame_request),
   .width_in(width),
   .height_in(height),
+  .roi_x_in(roi_x),
+  .roi_y_in(roi_y),
+  .roi_width_in(roi_width),
+  .roi_height_in(roi_height),
+  .max_iter_in(max_iter),
   .cr_in(cr),
   .ci_in(ci),
   .dx_in(dx),
   .dy_in(dy),
   .x0_in(x0),
   .y0_in(y0),
+  .data_ready(data_ready),
   .data(data),
   .frame_start(frame_start),
   .line_end(line_end),
@@ -40,16 +62,145 @@ fractal_generator u_0(
 
 always #2500ps clk = ~clk;
 
+// The output is taken as the queue after the generator in fractal takes it: mostly, with a gap
+// now and then, and sometimes held off long enough for the reorder buffer to fill.
+integer stall = 0;
+always @(posedge clk) begin
+  if (stall > 0) begin
+    stall = stall - 1;
+    data_ready <= 1'b0;
+  end
+  else if ($urandom_range(4999) == 0) begin
+    stall = $urandom_range(8000, 1000);
+    data_ready <= 1'b0;
+  end
+  else
+    data_ready <= $urandom_range(9) < 7;
+end
+
+// Frames are checked against the iteration counts of fractal-render, made where the simulation
+// runs with
+//   fractal-render generator --output expected_255.pgm
+//   fractal-render generator --max-iter 64 --output expected_64.pgm
+// for the iteration limits the frames are run with.
+logic [7:0] expected_255[384 * 216];
+logic [7:0] expected_64[384 * 216];
+
+function automatic integer open_pgm(string path);
+  integer fd;
+  string line;
+
+  fd = $fopen(path, "rb");
+  if (fd == 0)
+    $fatal(1, "%s is missing, see the top of the testbench", path);
+  repeat (3)
+    void'($fgets(line, fd)); // P5, the size and the maximum value
+  return fd;
+endfunction
+
+initial begin
+  integer fd;
+
+  fd = open_pgm("expected_255.pgm");
+  void'($fread(expected_255, fd));
+  $fclose(fd);
+
+  fd = open_pgm("expected_64.pgm");
+  void'($fread(expected_64, fd));
+  $fclose(fd);
+end
+
+// The region's pixels come in lines of the frame's width, then padding, zeros, up to the end of
+// the last one.
+localparam integer REGION_LINES = (ROI_WIDTH * ROI_HEIGHT + 383) / 384;
+
+integer frame = 0;
+integer pixel = 0;
+integer frame_pixels[1:3] = '{0, 0, 0};
+integer frame_mismatches[1:3] = '{0, 0, 0};
+integer line_end_errors = 0;
+integer region_pixels = 0;
+integer region_lines = 0;
+integer region_mismatches = 0;
+always @(posedge clk) begin
+  if (resetn && data_enable == 1'b1) begin
+    if (frame_start == 1'b1) begin
+      frame = frame + 1;
+      pixel = 0;
+    end
+
+    if (frame == 1 && data != expected_255[pixel])
+      frame_mismatches[1] = frame_mismatches[1] + 1;
+    if (frame == 2 && data != expected_64[pixel])
+      frame_mismatches[2] = frame_mismatches[2] + 1;
+
+    if (frame >= 1 && frame <= 3) begin
+      if (line_end != (pixel % 384 == 383))
+        line_end_errors = line_end_errors + 1;
+      frame_pixels[frame] = frame_pixels[frame] + 1;
+    end
+
+    if (frame == 3) begin
+      if (pixel < ROI_WIDTH * ROI_HEIGHT ?
+          data != expected_255[(ROI_Y + pixel / ROI_WIDTH) * 384 + ROI_X + pixel % ROI_WIDTH] :
+          data != 8'h0)
+        region_mismatches = region_mismatches + 1;
+      if (line_end == 1'b1)
+        region_lines = region_lines + 1;
+      region_pixels = region_pixels + 1;
+    end
+
+    pixel = pixel + 1;
+  end
+end
+
 initial begin
   #150ns resetn = 1;
 
   wait (frame_start == 1'b1);
   #100ns;
 
+  // the second frame should take less, its points inside the set stopping at 64 iterations
+  max_iter = 64;
+
+  wait (frame_start == 1'b1);
+  #100ns;
+
+  // then only a region of the first, once asked for
+  max_iter = 255;
+  roi_x = ROI_X;
+  roi_y = ROI_Y;
+  roi_width = ROI_WIDTH;
+  roi_height = ROI_HEIGHT;
+  auto_restart = 1'b0;
+  frame_request = frame_request + 1;
+
+  wait (frame_start == 1'b1);
+  #200us;
+
+  $display("Region: %0d pixels in %0d lines, %0d differing from fractal-render",
+           region_pixels, region_lines, region_mismatches);
+  $display("Frames started without a request: %0d", frame - 3);
+  $display("First frame: %0d pixels, %0d differing from fractal-render",
+           frame_pixels[1], frame_mismatches[1]);
+  $display("Second frame, limited to 64 iterations: %0d pixels, %0d differing from fractal-render",
+           frame_pixels[2], frame_mismatches[2]);
+  $display("Line ends out of place: %0d", line_end_errors);
+
+  if (frame_pixels[1] != 384 * 216 || frame_mismatches[1] != 0 ||
+      frame_pixels[2] != 384 * 216 || frame_mismatches[2] != 0 || line_end_errors != 0)
+    $error("The generator's output is not what fractal-render gives");
+  if (region_pixels != REGION_LINES * 384 || region_lines != REGION_LINES ||
+      region_mismatches != 0 || frame != 3)
+    $error("The region is not what fractal-render gives, or not started as asked");
+
+  roi_width = 0;
+  roi_height = 0;
   width = width + width;
   height = height + height;
   x0 = x0 + dx * 20;
   y0 = y0 + dy * 20;
+  frame_request = frame_request + 1;
 
   wait (frame_start == 1'b1);
   #20ns resetn = 0;
@@ -57,6 +208,23 @@ initial begin
   #100ns $finish();
 end
 
+// cycles between frame starts, the time the generator took for each frame as the output was taken
+integer frames = 0;
+integer cycles = 0;
+always @(posedge clk) begin
+  if (~resetn)
+    cycles = 0;
+  else begin
+    cycles = cycles + 1;
+    if (frame_start == 1'b1) begin
+      if (frames > 0)
+        $display("Frame %0d: %0d cycles", frames, cycles);
+      frames = frames + 1;
+      cycles = 0;
+    end
+  end
+end
+
 integer file;
 integer img_writing = 1, img_start = 0;
 initial begin